@@ -177,10 +177,27 @@ gcm_test_night_light (void)
         g_assert (gsd_night_light_get_active (nlight));
         g_assert_cmpint (gsd_night_light_get_temperature (nlight), ==, GSD_COLOR_TEMPERATURE_DEFAULT);
 
+        /* The transition is described up front */
+        {
+                gdouble start_temperature, target_temperature;
+                gint64 start_time, duration;
+
+                g_assert_true (gsd_night_light_get_transition (nlight,
+                                                               &start_temperature,
+                                                               &target_temperature,
+                                                               &start_time,
+                                                               &duration));
+                g_assert_cmpint (start_temperature, ==, GSD_COLOR_TEMPERATURE_DEFAULT);
+                g_assert_cmpint (target_temperature, ==, 4000);
+                g_assert_cmpint (start_time, <=, g_get_monotonic_time ());
+                g_assert_cmpint (duration, ==, 5 * G_USEC_PER_SEC);
+        }
+
         /* Turn off immediately, before the first timeout event is fired. */
         g_settings_set_boolean (settings, "night-light-schedule-automatic", FALSE);
         g_settings_set_boolean (settings, "night-light-enabled", FALSE);
         g_assert (!gsd_night_light_get_active (nlight));
+        g_assert_false (gsd_night_light_get_transition (nlight, NULL, NULL, NULL, NULL));
 
         /* Now, sleep for a bit (the smooth transition time is 5 seconds) */
         g_timeout_add (5000, quit_mainloop, NULL);
@@ -318,6 +335,59 @@ gcm_test_sunset_sunrise_fractional_timezone (void)
         g_assert_cmpfloat (sunset, >, sunset_actual - 0.1);
 }
 
+static void
+gcm_test_sun_table (void)
+{
+        const gdouble latitude = 51.5;
+        const gdouble longitude = -0.1278;
+        g_autoptr(GsdNightLightSunTable) table = NULL;
+        g_autoptr(GDateTime) dt_start = g_date_time_new_utc (2007, 2, 1, 12, 0, 0);
+        g_autoptr(GTimeZone) tz = NULL;
+        guint i;
+
+        table = gsd_night_light_sun_table_new (latitude, longitude, dt_start);
+
+        /* the table is for rounded coordinates */
+        g_assert_true (gsd_night_light_sun_table_matches (table, latitude, longitude));
+        g_assert_true (gsd_night_light_sun_table_matches (table, latitude + 0.001, longitude));
+        g_assert_false (gsd_night_light_sun_table_matches (table, latitude + 0.1, longitude));
+
+        /* precomputed days, days after that and days before */
+        tz = g_time_zone_new_identifier ("+01:30");
+        g_assert_nonnull (tz);
+        for (i = 0; i < 10; i++) {
+                g_autoptr(GDateTime) dt_utc = g_date_time_add_hours (dt_start, 24 * i - 48);
+                g_autoptr(GDateTime) dt_local = g_date_time_to_timezone (dt_utc, tz);
+                GDateTime *dts[] = { dt_utc, dt_local };
+                guint j;
+
+                for (j = 0; j < G_N_ELEMENTS (dts); j++) {
+                        gdouble sunrise, sunset;
+                        gdouble sunrise_actual, sunset_actual;
+
+                        g_assert_true (gsd_night_light_sun_table_lookup (table, dts[j], &sunrise, &sunset));
+                        gsd_night_light_get_sunrise_sunset (dts[j], latitude, -0.13,
+                                                            &sunrise_actual, &sunset_actual);
+                        g_assert_cmpfloat (sunrise, ==, sunrise_actual);
+                        g_assert_cmpfloat (sunset, ==, sunset_actual);
+
+                        /* and against the exact coordinates, within a minute */
+                        gsd_night_light_get_sunrise_sunset (dts[j], latitude, longitude,
+                                                            &sunrise_actual, &sunset_actual);
+                        g_assert_cmpfloat (ABS (sunrise - sunrise_actual), <, 1.f / 60.f);
+                        g_assert_cmpfloat (ABS (sunset - sunset_actual), <, 1.f / 60.f);
+                }
+        }
+
+        /* the sun does not set near the pole in summer */
+        {
+                g_autoptr(GDateTime) dt_summer = g_date_time_new_utc (2007, 6, 21, 12, 0, 0);
+                g_autoptr(GsdNightLightSunTable) polar = gsd_night_light_sun_table_new (89, 0, dt_summer);
+
+                g_assert_false (gsd_night_light_sun_table_lookup (polar, dt_summer, NULL, NULL));
+        }
+}
+
 static void
 gcm_test_frac_day (void)
 {
@@ -346,6 +416,13 @@ gcm_test_frac_day (void)
         /* test equality */
         g_assert_true (gsd_night_light_frac_day_is_between (12, 0.5, 24.5));
         g_assert_true (gsd_night_light_frac_day_is_between (0.5, 0.5, 0.5));
+
+        /* test time until the next occurrence */
+        g_assert_cmpfloat (gsd_night_light_frac_day_until (12, 20), ==, 8);
+        g_assert_cmpfloat (gsd_night_light_frac_day_until (20, 6), ==, 10);
+        g_assert_cmpfloat (gsd_night_light_frac_day_until (0.5, -1), ==, 22.5);
+        g_assert_cmpfloat (gsd_night_light_frac_day_until (23, 25), ==, 2);
+        g_assert_cmpfloat (gsd_night_light_frac_day_until (6, 6), ==, 24);
 }
 
 int
@@ -359,6 +436,7 @@ main (int argc, char **argv)
 
         g_test_add_func ("/color/sunset-sunrise", gcm_test_sunset_sunrise);
         g_test_add_func ("/color/sunset-sunrise/fractional-timezone", gcm_test_sunset_sunrise_fractional_timezone);
+        g_test_add_func ("/color/sunset-sunrise/table", gcm_test_sun_table);
         g_test_add_func ("/color/fractional-day", gcm_test_frac_day);
         g_test_add_func ("/color/night-light", gcm_test_night_light);
 
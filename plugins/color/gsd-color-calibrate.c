@@ -37,6 +37,14 @@ struct _GsdColorCalibrate
         GsdColorManager *manager;
         CdClient        *client;
         GSettings       *settings;
+        GCancellable    *cancellable;
+
+        /* devices to connect to in the next batch */
+        GPtrArray       *pending_devices;
+        /* object path → GcmSessionProfileRequest, for profiles waiting for
+         * the next batch or being connected to */
+        GHashTable      *profiles;
+        guint            batch_id;
 };
 
 enum {
@@ -53,23 +61,19 @@ static void     gsd_color_calibrate_finalize    (GObject             *object);
 
 G_DEFINE_TYPE (GsdColorCalibrate, gsd_color_calibrate, G_TYPE_OBJECT)
 
+/* A profile and all the devices using it as default */
 typedef struct {
-        GsdColorCalibrate       *calibrate;
         CdProfile               *profile;
-        CdDevice                *device;
-        guint32                  output_id;
-} GcmSessionAsyncHelper;
+        GPtrArray               *devices;
+        gboolean                 connecting;
+} GcmSessionProfileRequest;
 
 static void
-gcm_session_async_helper_free (GcmSessionAsyncHelper *helper)
+gcm_session_profile_request_free (GcmSessionProfileRequest *request)
 {
-        if (helper->calibrate != NULL)
-                g_object_unref (helper->calibrate);
-        if (helper->profile != NULL)
-                g_object_unref (helper->profile);
-        if (helper->device != NULL)
-                g_object_unref (helper->device);
-        g_free (helper);
+        g_object_unref (request->profile);
+        g_ptr_array_unref (request->devices);
+        g_free (request);
 }
 
 static void
@@ -217,29 +221,13 @@ gcm_session_notify_device (GsdColorCalibrate *calibrate, CdDevice *device)
         g_free (message);
 }
 
-static void
-gcm_session_profile_connect_cb (GObject *object,
-                                GAsyncResult *res,
-                                gpointer user_data)
+/* whether the profile was created by a calibration */
+static gboolean
+gcm_session_profile_is_calibrated (CdProfile *profile)
 {
         const gchar *filename;
-        gboolean ret;
-        gchar *basename = NULL;
         const gchar *data_source;
-        GError *error = NULL;
-        CdProfile *profile = CD_PROFILE (object);
-        GcmSessionAsyncHelper *helper = (GcmSessionAsyncHelper *) user_data;
-        GsdColorCalibrate *calibrate = GSD_COLOR_CALIBRATE (helper->calibrate);
-
-        ret = cd_profile_connect_finish (profile,
-                                         res,
-                                         &error);
-        if (!ret) {
-                g_warning ("failed to connect to profile: %s",
-                           error->message);
-                g_error_free (error);
-                goto out;
-        }
+        g_autofree gchar *basename = NULL;
 
         /* ensure it's a profile generated by us */
         data_source = cd_profile_get_metadata_item (profile,
@@ -250,77 +238,203 @@ gcm_session_profile_connect_cb (GObject *object,
                  * won't have the extra metadata values added */
                 filename = cd_profile_get_filename (profile);
                 if (filename == NULL)
-                        goto out;
+                        return FALSE;
                 basename = g_path_get_basename (filename);
                 if (!g_str_has_prefix (basename, "GCM")) {
-                        g_debug ("not a GCM profile for %s: %s",
-                                 cd_device_get_id (helper->device), filename);
-                        goto out;
+                        g_debug ("not a GCM profile: %s", filename);
+                        return FALSE;
                 }
 
         /* ensure it's been created from a calibration, rather than from
          * auto-EDID */
         } else if (g_strcmp0 (data_source,
                    CD_PROFILE_METADATA_DATA_SOURCE_CALIB) != 0) {
-                g_debug ("not a calib profile for %s",
-                         cd_device_get_id (helper->device));
-                goto out;
+                g_debug ("not a calib profile: %s",
+                         cd_profile_get_id (profile));
+                return FALSE;
         }
 
-        /* handle device */
-        gcm_session_notify_device (calibrate, helper->device);
-out:
-        gcm_session_async_helper_free (helper);
-        g_free (basename);
+        return TRUE;
 }
 
 static void
-gcm_session_device_connect_cb (GObject *object,
-                               GAsyncResult *res,
-                               gpointer user_data)
+gcm_session_handle_profile (GsdColorCalibrate        *calibrate,
+                            GcmSessionProfileRequest *request)
 {
-        gboolean ret;
-        GError *error = NULL;
-        CdDeviceKind kind;
-        CdProfile *profile = NULL;
-        CdDevice *device = CD_DEVICE (object);
-        GsdColorCalibrate *calibrate = GSD_COLOR_CALIBRATE (user_data);
-        GcmSessionAsyncHelper *helper;
+        guint i;
 
-        ret = cd_device_connect_finish (device,
-                                        res,
-                                        &error);
-        if (!ret) {
-                g_warning ("failed to connect to device: %s",
+        if (!gcm_session_profile_is_calibrated (request->profile))
+                return;
+
+        /* handle devices */
+        for (i = 0; i < request->devices->len; i++)
+                gcm_session_notify_device (calibrate, g_ptr_array_index (request->devices, i));
+}
+
+static void
+gcm_session_profile_connect_cb (GObject *object,
+                                GAsyncResult *res,
+                                gpointer user_data)
+{
+        g_autoptr(GError) error = NULL;
+        CdProfile *profile = CD_PROFILE (object);
+        GsdColorCalibrate *calibrate;
+        GcmSessionProfileRequest *request;
+        const gchar *object_path;
+
+        if (!cd_profile_connect_finish (profile, res, &error)) {
+                if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        return;
+                g_warning ("failed to connect to profile: %s",
                            error->message);
-                g_error_free (error);
-                goto out;
         }
 
+        calibrate = GSD_COLOR_CALIBRATE (user_data);
+        object_path = cd_profile_get_object_path (profile);
+        request = g_hash_table_lookup (calibrate->profiles, object_path);
+        if (request == NULL)
+                return;
+
+        if (error == NULL)
+                gcm_session_handle_profile (calibrate, request);
+        g_hash_table_remove (calibrate->profiles, object_path);
+}
+
+static gboolean gcm_session_batch_cb (gpointer user_data);
+
+static void
+gcm_session_schedule_batch (GsdColorCalibrate *calibrate)
+{
+        /* idle, so that everything that arrives in one main loop
+         * iteration, such as a hotplug burst or the replies to the
+         * previous batch, is handled together */
+        if (calibrate->batch_id == 0)
+                calibrate->batch_id = g_idle_add (gcm_session_batch_cb, calibrate);
+}
+
+static void
+gcm_session_queue_profile (GsdColorCalibrate *calibrate,
+                           CdProfile         *profile,
+                           CdDevice          *device)
+{
+        GcmSessionProfileRequest *request;
+        const gchar *object_path;
+
+        /* profiles shared between devices are only connected to once */
+        object_path = cd_profile_get_object_path (profile);
+        request = g_hash_table_lookup (calibrate->profiles, object_path);
+        if (request == NULL) {
+                request = g_new0 (GcmSessionProfileRequest, 1);
+                request->profile = g_object_ref (profile);
+                request->devices = g_ptr_array_new_with_free_func (g_object_unref);
+                g_hash_table_insert (calibrate->profiles,
+                                     g_strdup (object_path),
+                                     request);
+                gcm_session_schedule_batch (calibrate);
+        }
+
+        if (!g_ptr_array_find (request->devices, device, NULL))
+                g_ptr_array_add (request->devices, g_object_ref (device));
+}
+
+static void
+gcm_session_handle_device (GsdColorCalibrate *calibrate,
+                           CdDevice          *device)
+{
+        CdDeviceKind kind;
+        g_autoptr(CdProfile) profile = NULL;
+
         /* check we care */
         kind = cd_device_get_kind (device);
         if (kind != CD_DEVICE_KIND_DISPLAY &&
             kind != CD_DEVICE_KIND_PRINTER)
-                goto out;
+                return;
 
         /* ensure we have a profile */
         profile = cd_device_get_default_profile (device);
         if (profile == NULL) {
                 g_debug ("no profile set for %s", cd_device_get_id (device));
-                goto out;
+                return;
         }
 
-        /* connect to the profile */
-        helper = g_new0 (GcmSessionAsyncHelper, 1);
-        helper->calibrate = g_object_ref (calibrate);
-        helper->device = g_object_ref (device);
-        cd_profile_connect (profile,
-                            NULL,
-                            gcm_session_profile_connect_cb,
-                            helper);
-out:
-        if (profile != NULL)
-                g_object_unref (profile);
+        /* connect to the profile in the next batch */
+        gcm_session_queue_profile (calibrate, profile, device);
+}
+
+static void
+gcm_session_device_connect_cb (GObject *object,
+                               GAsyncResult *res,
+                               gpointer user_data)
+{
+        g_autoptr(GError) error = NULL;
+        CdDevice *device = CD_DEVICE (object);
+
+        if (!cd_device_connect_finish (device, res, &error)) {
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        g_warning ("failed to connect to device: %s",
+                                   error->message);
+                return;
+        }
+
+        gcm_session_handle_device (GSD_COLOR_CALIBRATE (user_data), device);
+}
+
+static gboolean
+gcm_session_batch_cb (gpointer user_data)
+{
+        GsdColorCalibrate *calibrate = GSD_COLOR_CALIBRATE (user_data);
+        g_autoptr(GPtrArray) devices = NULL;
+        GHashTableIter iter;
+        gpointer value;
+        guint i, n_profiles = 0;
+
+        calibrate->batch_id = 0;
+
+        devices = g_steal_pointer (&calibrate->pending_devices);
+        calibrate->pending_devices = g_ptr_array_new_with_free_func (g_object_unref);
+
+        /* all requests are sent before any reply is waited for */
+        for (i = 0; i < devices->len; i++) {
+                CdDevice *device = g_ptr_array_index (devices, i);
+
+                if (cd_device_get_connected (device)) {
+                        gcm_session_handle_device (calibrate, device);
+                        continue;
+                }
+
+                cd_device_connect (device,
+                                   calibrate->cancellable,
+                                   gcm_session_device_connect_cb,
+                                   calibrate);
+        }
+
+        g_hash_table_iter_init (&iter, calibrate->profiles);
+        while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                GcmSessionProfileRequest *request = value;
+
+                if (request->connecting)
+                        continue;
+
+                request->connecting = TRUE;
+                n_profiles++;
+                cd_profile_connect (request->profile,
+                                    calibrate->cancellable,
+                                    gcm_session_profile_connect_cb,
+                                    calibrate);
+        }
+
+        g_debug ("connecting to %u devices and %u profiles",
+                 devices->len, n_profiles);
+
+        return G_SOURCE_REMOVE;
+}
+
+static gboolean
+gcm_session_device_equal (gconstpointer a,
+                          gconstpointer b)
+{
+        return g_strcmp0 (cd_device_get_object_path ((CdDevice *) a),
+                          cd_device_get_object_path ((CdDevice *) b)) == 0;
 }
 
 static void
@@ -328,11 +442,13 @@ gcm_session_device_added_notify_cb (CdClient *client,
                                     CdDevice *device,
                                     GsdColorCalibrate *calibrate)
 {
-        /* connect to the device to get properties */
-        cd_device_connect (device,
-                           NULL,
-                           gcm_session_device_connect_cb,
-                           calibrate);
+        /* connect to the device to get properties, in the next batch */
+        if (g_ptr_array_find_with_equal_func (calibrate->pending_devices, device,
+                                              gcm_session_device_equal, NULL))
+                return;
+
+        g_ptr_array_add (calibrate->pending_devices, g_object_ref (device));
+        gcm_session_schedule_batch (calibrate);
 }
 
 static void
@@ -414,6 +530,10 @@ static void
 gsd_color_calibrate_init (GsdColorCalibrate *calibrate)
 {
         calibrate->settings = g_settings_new ("org.gnome.settings-daemon.plugins.color");
+        calibrate->cancellable = g_cancellable_new ();
+        calibrate->pending_devices = g_ptr_array_new_with_free_func (g_object_unref);
+        calibrate->profiles = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                                     (GDestroyNotify) gcm_session_profile_request_free);
         calibrate->client = cd_client_new ();
         g_signal_connect (calibrate->client, "device-added",
                           G_CALLBACK (gcm_session_device_added_notify_cb),
@@ -436,6 +556,11 @@ gsd_color_calibrate_finalize (GObject *object)
 
         calibrate = GSD_COLOR_CALIBRATE (object);
 
+        g_cancellable_cancel (calibrate->cancellable);
+        g_clear_object (&calibrate->cancellable);
+        g_clear_handle_id (&calibrate->batch_id, g_source_remove);
+        g_clear_pointer (&calibrate->pending_devices, g_ptr_array_unref);
+        g_clear_pointer (&calibrate->profiles, g_hash_table_unref);
         g_clear_object (&calibrate->settings);
         g_clear_object (&calibrate->client);
 
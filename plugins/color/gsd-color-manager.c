@@ -48,6 +48,7 @@ static const gchar introspection_xml[] =
 "    <property name='DisabledUntilTomorrow' type='b' access='readwrite'/>"
 "    <property name='Sunrise' type='d' access='read'/>"
 "    <property name='Sunset' type='d' access='read'/>"
+"    <property name='TemperatureTransition' type='(uuxxs)' access='read'/>"
 "  </interface>"
 "</node>";
 
@@ -218,6 +219,46 @@ on_temperature_notify (GsdNightLight *nlight,
                                g_variant_new_uint32 (roundf (temperature)));
 }
 
+/* (start temperature, target temperature, start time, duration, curve),
+ * with times in CLOCK_MONOTONIC microseconds. Clients that interpolate on
+ * their own don't need to follow the Temperature property while a
+ * transition is running; without one, both temperatures are the current
+ * one and the duration is 0. */
+static GVariant *
+get_temperature_transition (GsdColorManager *manager)
+{
+        gdouble start_temperature;
+        gdouble target_temperature;
+        gint64 start_time = 0;
+        gint64 duration = 0;
+
+        if (!gsd_night_light_get_transition (manager->nlight,
+                                             &start_temperature,
+                                             &target_temperature,
+                                             &start_time,
+                                             &duration)) {
+                start_temperature = gsd_color_state_get_temperature (manager->state);
+                target_temperature = start_temperature;
+        }
+
+        return g_variant_new ("(uuxxs)",
+                              (guint32) roundf (start_temperature),
+                              (guint32) roundf (target_temperature),
+                              start_time,
+                              duration,
+                              "linear");
+}
+
+static void
+on_transition_notify (GsdNightLight *nlight,
+                      GParamSpec      *pspec,
+                      gpointer         user_data)
+{
+        GsdColorManager *manager = GSD_COLOR_MANAGER (user_data);
+        emit_property_changed (manager, "TemperatureTransition",
+                               get_temperature_transition (manager));
+}
+
 static void
 gsd_color_manager_init (GsdColorManager *manager)
 {
@@ -237,6 +278,8 @@ gsd_color_manager_init (GsdColorManager *manager)
                           G_CALLBACK (on_temperature_notify), manager);
         g_signal_connect (manager->nlight, "notify::disabled-until-tmw",
                           G_CALLBACK (on_disabled_until_tmw_notify), manager);
+        g_signal_connect (manager->nlight, "notify::transition",
+                          G_CALLBACK (on_transition_notify), manager);
 }
 
 static void
@@ -346,6 +389,9 @@ handle_get_property (GDBusConnection *connection,
         if (g_strcmp0 (property_name, "Sunset") == 0)
                 return g_variant_new_double (gsd_night_light_get_sunset (manager->nlight));
 
+        if (g_strcmp0 (property_name, "TemperatureTransition") == 0)
+                return get_temperature_transition (manager);
+
         g_set_error (error, G_DBUS_ERROR, G_DBUS_ERROR_FAILED,
                      "Failed to get property: %s", property_name);
         return NULL;
@@ -24,6 +24,24 @@
 
 #include "gsd-night-light-common.h"
 
+/* Days precomputed when a table is created */
+#define SUN_TABLE_DAYS          4
+/* Coordinates are rounded to 1/100 degree, about a kilometre */
+#define SUN_TABLE_SCALE         100
+
+typedef struct {
+        gint64          day;
+        GTimeSpan       utc_offset;
+        gdouble         sunrise;
+        gdouble         sunset;
+} SunTableEntry;
+
+struct _GsdNightLightSunTable {
+        gdouble         latitude;
+        gdouble         longitude;
+        GArray         *entries;
+};
+
 static gdouble
 deg2rad (gdouble degrees)
 {
@@ -135,3 +153,128 @@ gsd_night_light_frac_day_is_between (gdouble  value,
          */
         return value >= start && value < end;
 }
+
+static gdouble
+round_coordinate (gdouble value)
+{
+        return round (value * SUN_TABLE_SCALE) / SUN_TABLE_SCALE;
+}
+
+/* The result of gsd_night_light_get_sunrise_sunset() only depends on the
+ * UTC day @dt falls on and on its offset from UTC */
+static void
+sun_table_key (GDateTime *dt, gint64 *day, GTimeSpan *utc_offset)
+{
+        g_autoptr(GDateTime) dt_zero = g_date_time_new_utc (1900, 1, 1, 0, 0, 0);
+
+        *day = g_date_time_difference (dt, dt_zero) / G_USEC_PER_SEC / 24 / 60 / 60;
+        *utc_offset = g_date_time_get_utc_offset (dt);
+}
+
+static SunTableEntry *
+sun_table_add (GsdNightLightSunTable *table, GDateTime *dt)
+{
+        SunTableEntry entry;
+
+        sun_table_key (dt, &entry.day, &entry.utc_offset);
+        gsd_night_light_get_sunrise_sunset (dt, table->latitude, table->longitude,
+                                            &entry.sunrise, &entry.sunset);
+
+        /* keep the table small, older days are unlikely to be needed */
+        if (table->entries->len >= 2 * SUN_TABLE_DAYS)
+                g_array_remove_index (table->entries, 0);
+        g_array_append_val (table->entries, entry);
+
+        return &g_array_index (table->entries, SunTableEntry, table->entries->len - 1);
+}
+
+/*
+ * A table of sunrise and sunset times for one location, so that the
+ * position of the sun is not computed again for every lookup. The
+ * coordinates are rounded, and the days starting with @dt_start are
+ * computed up front.
+ */
+GsdNightLightSunTable *
+gsd_night_light_sun_table_new (gdouble pos_lat, gdouble pos_long, GDateTime *dt_start)
+{
+        GsdNightLightSunTable *table;
+        guint i;
+
+        g_return_val_if_fail (pos_lat <= 90.f && pos_lat >= -90.f, NULL);
+        g_return_val_if_fail (pos_long <= 180.f && pos_long >= -180.f, NULL);
+
+        table = g_new0 (GsdNightLightSunTable, 1);
+        table->latitude = CLAMP (round_coordinate (pos_lat), -90.f, 90.f);
+        table->longitude = CLAMP (round_coordinate (pos_long), -180.f, 180.f);
+        table->entries = g_array_sized_new (FALSE, FALSE, sizeof (SunTableEntry), 2 * SUN_TABLE_DAYS);
+
+        for (i = 0; i < SUN_TABLE_DAYS; i++) {
+                g_autoptr(GDateTime) dt = g_date_time_add_days (dt_start, i);
+                sun_table_add (table, dt);
+        }
+
+        return table;
+}
+
+void
+gsd_night_light_sun_table_free (GsdNightLightSunTable *table)
+{
+        if (table == NULL)
+                return;
+        g_array_unref (table->entries);
+        g_free (table);
+}
+
+/* whether @table is the one that would be created for these coordinates */
+gboolean
+gsd_night_light_sun_table_matches (GsdNightLightSunTable *table,
+                                   gdouble pos_lat, gdouble pos_long)
+{
+        return table->latitude == CLAMP (round_coordinate (pos_lat), -90.f, 90.f) &&
+               table->longitude == CLAMP (round_coordinate (pos_long), -180.f, 180.f);
+}
+
+gboolean
+gsd_night_light_sun_table_lookup (GsdNightLightSunTable *table,
+                                  GDateTime *dt,
+                                  gdouble *sunrise, gdouble *sunset)
+{
+        SunTableEntry *entry = NULL;
+        GTimeSpan utc_offset;
+        gint64 day;
+        guint i;
+
+        sun_table_key (dt, &day, &utc_offset);
+        for (i = 0; i < table->entries->len; i++) {
+                SunTableEntry *tmp = &g_array_index (table->entries, SunTableEntry, i);
+                if (tmp->day == day && tmp->utc_offset == utc_offset) {
+                        entry = tmp;
+                        break;
+                }
+        }
+        if (entry == NULL)
+                entry = sun_table_add (table, dt);
+
+        /* near the poles the sun may not rise or set at all that day */
+        if (isnan (entry->sunrise) || isnan (entry->sunset))
+                return FALSE;
+
+        if (sunrise != NULL)
+                *sunrise = entry->sunrise;
+        if (sunset != NULL)
+                *sunset = entry->sunset;
+        return TRUE;
+}
+
+/* The number of hours from @value until @target is next reached, in the
+ * range (0, 24]; both may lie outside of [0, 24). */
+gdouble
+gsd_night_light_frac_day_until (gdouble value,
+                                gdouble target)
+{
+        gdouble hours = fmod (target - value, 24);
+
+        if (hours <= 0)
+                hours += 24;
+        return hours;
+}
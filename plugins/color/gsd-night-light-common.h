@@ -24,6 +24,8 @@
 
 G_BEGIN_DECLS
 
+typedef struct _GsdNightLightSunTable GsdNightLightSunTable;
+
 gboolean gsd_night_light_get_sunrise_sunset     (GDateTime      *dt,
                                                  gdouble         pos_lat,
                                                  gdouble         pos_long,
@@ -33,6 +35,22 @@ gdouble  gsd_night_light_frac_day_from_dt       (GDateTime      *dt);
 gboolean gsd_night_light_frac_day_is_between    (gdouble         value,
                                                  gdouble         start,
                                                  gdouble         end);
+gdouble  gsd_night_light_frac_day_until         (gdouble         value,
+                                                 gdouble         target);
+
+GsdNightLightSunTable *gsd_night_light_sun_table_new     (gdouble                pos_lat,
+                                                          gdouble                pos_long,
+                                                          GDateTime             *dt_start);
+void                   gsd_night_light_sun_table_free    (GsdNightLightSunTable *table);
+gboolean               gsd_night_light_sun_table_matches (GsdNightLightSunTable *table,
+                                                          gdouble                pos_lat,
+                                                          gdouble                pos_long);
+gboolean               gsd_night_light_sun_table_lookup  (GsdNightLightSunTable *table,
+                                                          GDateTime             *dt,
+                                                          gdouble               *sunrise,
+                                                          gdouble               *sunset);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GsdNightLightSunTable, gsd_night_light_sun_table_free)
 
 G_END_DECLS
 
@@ -20,12 +20,11 @@
 
 #include "config.h"
 
+#include <math.h>
 #include <geoclue.h>
 
-#define GNOME_DESKTOP_USE_UNSTABLE_API
-#include "gnome-datetime-source.h"
-
 #include "gsd-color-state.h"
+#include "gsd-wall-clock.h"
 
 #include "gsd-night-light.h"
 #include "gsd-night-light-common.h"
@@ -37,11 +36,13 @@ struct _GsdNightLight {
         gboolean           disabled_until_tmw;
         GDateTime         *disabled_until_tmw_dt;
         gboolean           geoclue_enabled;
-        GSource           *source;
+        GsdWallClock      *wall_clock;
+        guint              wall_clock_id;
         guint              validate_id;
         GClueClient       *geoclue_client;
         GClueSimple       *geoclue_simple;
         GSettings         *location_settings;
+        GsdNightLightSunTable *sun_table;
         gdouble            cached_sunrise;
         gdouble            cached_sunset;
         gdouble            cached_temperature;
@@ -49,9 +50,15 @@ struct _GsdNightLight {
         gboolean           smooth_enabled;
         GTimer            *smooth_timer;
         guint              smooth_id;
+        gdouble            smooth_start_temperature;
         gdouble            smooth_target_temperature;
+        gint64             smooth_start_time;
         GCancellable      *cancellable;
         GDateTime         *datetime_override;
+        gboolean           schedule_valid;
+        gdouble            schedule_from;
+        gdouble            schedule_to;
+        gdouble            schedule_smear;
 };
 
 enum {
@@ -62,11 +69,12 @@ enum {
         PROP_TEMPERATURE,
         PROP_DISABLED_UNTIL_TMW,
         PROP_FORCED,
+        PROP_TRANSITION,
         PROP_LAST
 };
 
 #define GSD_NIGHT_LIGHT_SCHEDULE_TIMEOUT      5       /* seconds */
-#define GSD_NIGHT_LIGHT_POLL_TIMEOUT          60      /* seconds */
+#define GSD_NIGHT_LIGHT_POLL_TIMEOUT          60      /* seconds, while smearing */
 #define GSD_NIGHT_LIGHT_POLL_SMEAR            1       /* hours */
 #define GSD_NIGHT_LIGHT_SMOOTH_SMEAR          5.f     /* seconds */
 
@@ -75,6 +83,10 @@ enum {
 
 #define DESKTOP_ID "gnome-color-panel"
 
+/* the sunrise and sunset times are keyed on 0.01° */
+#define LOCATION_DISTANCE_THRESHOLD           1000            /* meters */
+#define LOCATION_TIME_THRESHOLD               (60 * 60)       /* 1 hour */
+
 static void poll_timeout_destroy (GsdNightLight *self);
 static void poll_timeout_create (GsdNightLight *self);
 static void night_light_recheck (GsdNightLight *self);
@@ -115,8 +127,10 @@ gsd_night_light_set_smooth_enabled (GsdNightLight *self,
                                     gboolean smooth_enabled)
 {
         /* ensure the timeout is stopped if called at runtime */
-        if (!smooth_enabled)
+        if (!smooth_enabled && self->smooth_id != 0) {
                 poll_smooth_destroy (self);
+                g_object_notify (G_OBJECT (self), "transition");
+        }
         self->smooth_enabled = smooth_enabled;
 }
 
@@ -128,28 +142,43 @@ linear_interpolate (gdouble val1, gdouble val2, gdouble factor)
         return ((val1 - val2) * factor) + val2;
 }
 
+/* the table is dropped when the coordinates change by more than the
+ * rounding it uses */
 static gboolean
-update_cached_sunrise_sunset (GsdNightLight *self)
+ensure_sun_table (GsdNightLight *self, GDateTime *dt_now)
 {
-        gboolean ret = FALSE;
         gdouble latitude;
         gdouble longitude;
-        gdouble sunrise;
-        gdouble sunset;
         g_autoptr(GVariant) tmp = NULL;
-        g_autoptr(GDateTime) dt_now = gsd_night_light_get_date_time_now (self);
 
-        /* calculate the sunrise/sunset for the location */
+        if (self->sun_table != NULL)
+                return TRUE;
+
         tmp = g_settings_get_value (self->settings, "night-light-last-coordinates");
         g_variant_get (tmp, "(dd)", &latitude, &longitude);
         if (latitude > 90.f || latitude < -90.f)
                 return FALSE;
         if (longitude > 180.f || longitude < -180.f)
                 return FALSE;
-        if (!gsd_night_light_get_sunrise_sunset (dt_now, latitude, longitude,
-                                                   &sunrise, &sunset)) {
-                g_warning ("failed to get sunset/sunrise for %.3f,%.3f",
-                           longitude, longitude);
+
+        self->sun_table = gsd_night_light_sun_table_new (latitude, longitude, dt_now);
+        return TRUE;
+}
+
+static gboolean
+update_cached_sunrise_sunset (GsdNightLight *self)
+{
+        gboolean ret = FALSE;
+        gdouble sunrise;
+        gdouble sunset;
+        g_autoptr(GDateTime) dt_now = gsd_night_light_get_date_time_now (self);
+
+        /* calculate the sunrise/sunset for the location */
+        if (!ensure_sun_table (self, dt_now))
+                return FALSE;
+        if (!gsd_night_light_sun_table_lookup (self->sun_table, dt_now,
+                                               &sunrise, &sunset)) {
+                g_warning ("failed to get sunset/sunrise");
                 return FALSE;
         }
 
@@ -192,13 +221,16 @@ gsd_night_light_smooth_cb (gpointer user_data)
                                                           self->smooth_target_temperature,
                                                           TRUE);
                 self->smooth_id = 0;
+                g_clear_pointer (&self->smooth_timer, g_timer_destroy);
+                g_object_notify (G_OBJECT (self), "transition");
                 return G_SOURCE_REMOVE;
         }
 
-        /* set new temperature step using log curve */
-        tmp = self->smooth_target_temperature - self->cached_temperature;
-        tmp *= frac;
-        tmp += self->cached_temperature;
+        /* set new temperature step; linear, so that clients following
+         * the published transition can compute the same values */
+        tmp = linear_interpolate (self->smooth_target_temperature,
+                                  self->smooth_start_temperature,
+                                  frac);
         gsd_night_light_set_temperature_internal (self, tmp, FALSE);
 
         return G_SOURCE_CONTINUE;
@@ -208,7 +240,9 @@ static void
 poll_smooth_create (GsdNightLight *self, gdouble temperature)
 {
         g_assert (self->smooth_id == 0);
+        self->smooth_start_temperature = self->cached_temperature;
         self->smooth_target_temperature = temperature;
+        self->smooth_start_time = g_get_monotonic_time ();
         self->smooth_timer = g_timer_new ();
         self->smooth_id = g_timeout_add (50, gsd_night_light_smooth_cb, self);
 }
@@ -216,6 +250,8 @@ poll_smooth_create (GsdNightLight *self, gdouble temperature)
 static void
 gsd_night_light_set_temperature (GsdNightLight *self, gdouble temperature)
 {
+        gboolean was_smoothing = self->smooth_id != 0;
+
         /* immediate */
         if (!self->smooth_enabled) {
                 gsd_night_light_set_temperature_internal (self, temperature, TRUE);
@@ -228,11 +264,14 @@ gsd_night_light_set_temperature (GsdNightLight *self, gdouble temperature)
         /* small jump */
         if (ABS (temperature - self->cached_temperature) < GSD_TEMPERATURE_MAX_DELTA) {
                 gsd_night_light_set_temperature_internal (self, temperature, TRUE);
+                if (was_smoothing)
+                        g_object_notify (G_OBJECT (self), "transition");
                 return;
         }
 
         /* smooth out the transition */
         poll_smooth_create (self, temperature);
+        g_object_notify (G_OBJECT (self), "transition");
 }
 
 static void
@@ -250,7 +289,7 @@ gsd_night_light_set_active (GsdNightLight *self, gboolean active)
 }
 
 static void
-night_light_recheck (GsdNightLight *self)
+night_light_update (GsdNightLight *self)
 {
         gdouble frac_day;
         gdouble schedule_from = -1.f;
@@ -260,6 +299,9 @@ night_light_recheck (GsdNightLight *self)
         guint temp_smeared;
         g_autoptr(GDateTime) dt_now = gsd_night_light_get_date_time_now (self);
 
+        /* Nothing to wake up for unless a schedule is followed */
+        self->schedule_valid = FALSE;
+
         /* Forced mode, just set the temperature to night light.
          * Proper rechecking will happen once forced mode is disabled again */
         if (self->forced) {
@@ -333,6 +375,11 @@ night_light_recheck (GsdNightLight *self)
                      MIN (     ABS (schedule_to - schedule_from),
                           24 - ABS (schedule_to - schedule_from)));
 
+        self->schedule_valid = TRUE;
+        self->schedule_from = schedule_from;
+        self->schedule_to = schedule_to;
+        self->schedule_smear = smear;
+
         if (!gsd_night_light_frac_day_is_between (frac_day,
                                                   schedule_from - smear,
                                                   schedule_to)) {
@@ -384,6 +431,15 @@ night_light_recheck (GsdNightLight *self)
         gsd_night_light_set_temperature (self, temp_smeared);
 }
 
+/* updates the state, then plans the next wakeup */
+static void
+night_light_recheck (GsdNightLight *self)
+{
+        night_light_update (self);
+        poll_timeout_destroy (self);
+        poll_timeout_create (self);
+}
+
 static gboolean
 night_light_recheck_schedule_cb (gpointer user_data)
 {
@@ -405,19 +461,61 @@ night_light_recheck_schedule (GsdNightLight *self)
                                        self);
 }
 
-/* called when the time may have changed */
-static gboolean
+/* called when the next state change is due */
+static void
 night_light_recheck_cb (gpointer user_data)
 {
         GsdNightLight *self = GSD_NIGHT_LIGHT (user_data);
 
-        /* recheck parameters, then reschedule a new timeout */
+        /* one-shot, so the ID is no longer valid */
+        self->wall_clock_id = 0;
+
+        /* recheck parameters, this also schedules the next wakeup */
         night_light_recheck (self);
-        poll_timeout_destroy (self);
-        poll_timeout_create (self);
+}
 
-        /* return value ignored for a one-time watch */
-        return G_SOURCE_REMOVE;
+/* the wall-clock time at which @frac_day is next reached */
+static GDateTime *
+frac_day_next_dt (GDateTime *dt_now, gdouble frac_day)
+{
+        g_autoptr(GDateTime) dt_day = NULL;
+        gdouble frac_now = gsd_night_light_frac_day_from_dt (dt_now);
+        gdouble hours;
+        gint seconds;
+
+        hours = frac_now + gsd_night_light_frac_day_until (frac_now, frac_day);
+        if (hours >= 24) {
+                dt_day = g_date_time_add_days (dt_now, 1);
+                hours -= 24;
+        } else {
+                dt_day = g_date_time_ref (dt_now);
+        }
+
+        /* build it from the local time of day so that DST changes
+         * in between are taken into account */
+        seconds = MIN ((gint) ceil (hours * 60 * 60), 24 * 60 * 60 - 1);
+        return g_date_time_new (g_date_time_get_timezone (dt_day),
+                                g_date_time_get_year (dt_day),
+                                g_date_time_get_month (dt_day),
+                                g_date_time_get_day_of_month (dt_day),
+                                seconds / 3600,
+                                (seconds / 60) % 60,
+                                seconds % 60);
+}
+
+static void
+update_expiry (GDateTime **dt_expiry, GDateTime *dt_now, GDateTime *dt)
+{
+        if (g_date_time_compare (dt, dt_now) <= 0) {
+                g_date_time_unref (dt);
+                return;
+        }
+        if (*dt_expiry != NULL && g_date_time_compare (dt, *dt_expiry) >= 0) {
+                g_date_time_unref (dt);
+                return;
+        }
+        g_clear_pointer (dt_expiry, g_date_time_unref);
+        *dt_expiry = dt;
 }
 
 static void
@@ -425,33 +523,66 @@ poll_timeout_create (GsdNightLight *self)
 {
         g_autoptr(GDateTime) dt_now = NULL;
         g_autoptr(GDateTime) dt_expiry = NULL;
+        g_autofree gchar *expiry_str = NULL;
+        gdouble frac_day;
+        gdouble from, to, smear;
+
+        if (self->wall_clock_id != 0)
+                return;
 
-        if (self->source != NULL)
+        /* settings changes cause a recheck anyway */
+        if (!self->schedule_valid)
                 return;
 
         /* It is not a good idea to make this overridable, it just creates
          * an infinite loop as a fixed date for testing just doesn't work. */
         dt_now = g_date_time_new_now_local ();
-        dt_expiry = g_date_time_add_seconds (dt_now, GSD_NIGHT_LIGHT_POLL_TIMEOUT);
-        self->source = _gnome_datetime_source_new (dt_now,
-                                                   dt_expiry,
-                                                   TRUE);
-        g_source_set_callback (self->source,
-                               night_light_recheck_cb,
-                               self, NULL);
-        g_source_attach (self->source, NULL);
+        frac_day = gsd_night_light_frac_day_from_dt (dt_now);
+
+        /* the state only changes at the edges of the smearing periods */
+        from = self->schedule_from;
+        to = self->schedule_to;
+        smear = self->schedule_smear;
+        update_expiry (&dt_expiry, dt_now, frac_day_next_dt (dt_now, from - smear));
+        update_expiry (&dt_expiry, dt_now, frac_day_next_dt (dt_now, from));
+        update_expiry (&dt_expiry, dt_now, frac_day_next_dt (dt_now, to - smear));
+        update_expiry (&dt_expiry, dt_now, frac_day_next_dt (dt_now, to));
+
+        /* ... and during them, where the temperature keeps moving */
+        if (smear >= 0.01 &&
+            (gsd_night_light_frac_day_is_between (frac_day, from - smear, from) ||
+             gsd_night_light_frac_day_is_between (frac_day, to - smear, to))) {
+                update_expiry (&dt_expiry, dt_now,
+                               g_date_time_add_seconds (dt_now, GSD_NIGHT_LIGHT_POLL_TIMEOUT));
+        }
+
+        /* disabled until tomorrow is reset after a day at the latest */
+        if (self->disabled_until_tmw) {
+                update_expiry (&dt_expiry, dt_now,
+                               g_date_time_add_seconds (self->disabled_until_tmw_dt, 24 * 60 * 60 + 1));
+        }
+
+        /* should not happen, but don't spin */
+        if (dt_expiry == NULL)
+                dt_expiry = g_date_time_add_seconds (dt_now, GSD_NIGHT_LIGHT_POLL_TIMEOUT);
+
+        expiry_str = g_date_time_format (dt_expiry, "%F %T");
+        g_debug ("next night light recheck at %s", expiry_str);
+
+        self->wall_clock_id = gsd_wall_clock_add_timeout (self->wall_clock,
+                                                          dt_expiry,
+                                                          night_light_recheck_cb,
+                                                          self);
 }
 
 static void
 poll_timeout_destroy (GsdNightLight *self)
 {
-
-        if (self->source == NULL)
+        if (self->wall_clock_id == 0)
                 return;
 
-        g_source_destroy (self->source);
-        g_source_unref (self->source);
-        self->source = NULL;
+        gsd_wall_clock_remove_timeout (self->wall_clock, self->wall_clock_id);
+        self->wall_clock_id = 0;
 }
 
 static void
@@ -459,6 +590,16 @@ settings_changed_cb (GSettings *settings, gchar *key, gpointer user_data)
 {
         GsdNightLight *self = GSD_NIGHT_LIGHT (user_data);
         g_debug ("settings changed");
+        if (g_strcmp0 (key, "night-light-last-coordinates") == 0 &&
+            self->sun_table != NULL) {
+                gdouble latitude;
+                gdouble longitude;
+
+                /* keep the table unless the rounded coordinates changed */
+                g_settings_get (settings, key, "(dd)", &latitude, &longitude);
+                if (!gsd_night_light_sun_table_matches (self->sun_table, latitude, longitude))
+                        g_clear_pointer (&self->sun_table, gsd_night_light_sun_table_free);
+        }
         night_light_recheck (self);
 }
 
@@ -475,6 +616,11 @@ on_location_notify (GClueSimple *simple,
         latitude = gclue_location_get_latitude (location);
         longitude = gclue_location_get_longitude (location);
 
+        /* the times only need to be computed again after moving */
+        if (self->sun_table != NULL &&
+            !gsd_night_light_sun_table_matches (self->sun_table, latitude, longitude))
+                g_clear_pointer (&self->sun_table, gsd_night_light_sun_table_free);
+
         g_settings_set_value (self->settings,
                               "night-light-last-coordinates",
                               g_variant_new ("(dd)", latitude, longitude));
@@ -504,8 +650,10 @@ on_geoclue_simple_ready (GObject      *source_object,
 
         self->geoclue_simple = geoclue_simple;
         self->geoclue_client = gclue_simple_get_client (self->geoclue_simple);
-        g_object_set (G_OBJECT (self->geoclue_client),
-                      "time-threshold", 60*60, NULL); /* 1 hour */
+        gclue_client_set_distance_threshold (self->geoclue_client,
+                                             LOCATION_DISTANCE_THRESHOLD);
+        gclue_client_set_time_threshold (self->geoclue_client,
+                                         LOCATION_TIME_THRESHOLD);
 
         g_signal_connect (self->geoclue_simple, "notify::location",
                           G_CALLBACK (on_location_notify), user_data);
@@ -616,6 +764,31 @@ gsd_night_light_get_temperature (GsdNightLight *self)
         return self->cached_temperature;
 }
 
+/* Describes the running smooth transition, which moves the temperature
+ * linearly from @start_temperature to @target_temperature over @duration
+ * microseconds, starting at @start_time in g_get_monotonic_time() units.
+ * Returns %FALSE when the temperature is not in transition. */
+gboolean
+gsd_night_light_get_transition (GsdNightLight *self,
+                                gdouble       *start_temperature,
+                                gdouble       *target_temperature,
+                                gint64        *start_time,
+                                gint64        *duration)
+{
+        if (self->smooth_id == 0)
+                return FALSE;
+
+        if (start_temperature != NULL)
+                *start_temperature = self->smooth_start_temperature;
+        if (target_temperature != NULL)
+                *target_temperature = self->smooth_target_temperature;
+        if (start_time != NULL)
+                *start_time = self->smooth_start_time;
+        if (duration != NULL)
+                *duration = GSD_NIGHT_LIGHT_SMOOTH_SMEAR * G_USEC_PER_SEC;
+        return TRUE;
+}
+
 void
 gsd_night_light_set_geoclue_enabled (GsdNightLight *self, gboolean enabled)
 {
@@ -626,11 +799,12 @@ gboolean
 gsd_night_light_start (GsdNightLight *self, GError **error)
 {
         night_light_recheck (self);
-        poll_timeout_create (self);
 
         /* care about changes */
         g_signal_connect (self->settings, "changed",
                           G_CALLBACK (settings_changed_cb), self);
+        g_signal_connect_swapped (self->wall_clock, "time-changed",
+                                  G_CALLBACK (night_light_recheck), self);
 
         g_signal_connect_swapped (self->location_settings, "changed::enabled",
                                   G_CALLBACK (check_location_settings), self);
@@ -648,10 +822,13 @@ gsd_night_light_finalize (GObject *object)
 
         poll_timeout_destroy (self);
         poll_smooth_destroy (self);
+        g_signal_handlers_disconnect_by_data (self->wall_clock, self);
+        g_clear_object (&self->wall_clock);
 
         g_clear_object (&self->settings);
         g_clear_pointer (&self->datetime_override, g_date_time_unref);
         g_clear_pointer (&self->disabled_until_tmw_dt, g_date_time_unref);
+        g_clear_pointer (&self->sun_table, gsd_night_light_sun_table_free);
 
         if (self->validate_id > 0) {
                 g_source_remove (self->validate_id);
@@ -718,6 +895,9 @@ gsd_night_light_get_property (GObject    *object,
         case PROP_FORCED:
                 g_value_set_boolean (value, gsd_night_light_get_forced (self));
                 break;
+        case PROP_TRANSITION:
+                g_value_set_boolean (value, self->smooth_id != 0);
+                break;
         default:
                 G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
         }
@@ -786,6 +966,14 @@ gsd_night_light_class_init (GsdNightLightClass *klass)
                                                                FALSE,
                                                                G_PARAM_READWRITE));
 
+        g_object_class_install_property (object_class,
+                                         PROP_TRANSITION,
+                                         g_param_spec_boolean ("transition",
+                                                               "Transition",
+                                                               "If the temperature is smoothly moving to a new value",
+                                                               FALSE,
+                                                               G_PARAM_READABLE));
+
 }
 
 static void
@@ -798,6 +986,7 @@ gsd_night_light_init (GsdNightLight *self)
         self->cached_temperature = GSD_COLOR_TEMPERATURE_DEFAULT;
         self->settings = g_settings_new ("org.gnome.settings-daemon.plugins.color");
         self->location_settings = g_settings_new ("org.gnome.system.location");
+        self->wall_clock = gsd_wall_clock_get_default ();
 }
 
 GsdNightLight *
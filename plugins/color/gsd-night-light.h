@@ -36,6 +36,11 @@ gboolean         gsd_night_light_get_active             (GsdNightLight *self);
 gdouble          gsd_night_light_get_sunrise            (GsdNightLight *self);
 gdouble          gsd_night_light_get_sunset             (GsdNightLight *self);
 gdouble          gsd_night_light_get_temperature        (GsdNightLight *self);
+gboolean         gsd_night_light_get_transition         (GsdNightLight *self,
+                                                         gdouble       *start_temperature,
+                                                         gdouble       *target_temperature,
+                                                         gint64        *start_time,
+                                                         gint64        *duration);
 
 gboolean         gsd_night_light_get_disabled_until_tmw (GsdNightLight *self);
 void             gsd_night_light_set_disabled_until_tmw (GsdNightLight *self,
@@ -0,0 +1,423 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Timeouts on the wall clock, as returned by g_get_real_time(), rather than
+ * the monotonic clock g_timeout_add() uses. All timeouts of a process share
+ * one CLOCK_REALTIME timerfd, armed for the earliest deadline with
+ * TFD_TIMER_CANCEL_ON_SET. The kernel cancels such timers when the clock is
+ * set and on resume from suspend, which is reported as ::time-changed.
+ *
+ * Without timerfd, a monotonic timeout is used and clock changes are
+ * detected by comparing both clocks, at least once a minute.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib-unix.h>
+
+#if HAVE_TIMERFD
+#include <sys/timerfd.h>
+
+/* http://article.gmane.org/gmane.linux.kernel/1132138 */
+#ifndef TFD_TIMER_CANCEL_ON_SET
+#define TFD_TIMER_CANCEL_ON_SET (1 << 1)
+#endif
+#endif
+
+#include "gsd-wall-clock.h"
+
+/* How far ahead the timer is armed with no timeouts, it still needs to
+ * be armed to notice clock changes */
+#define IDLE_EXPIRY             ((gint64) 365 * 24 * 60 * 60 * G_USEC_PER_SEC)
+/* Only used without timerfd */
+#define FALLBACK_INTERVAL       60      /* seconds */
+#define FALLBACK_MAX_DRIFT      (2 * G_USEC_PER_SEC)
+
+typedef struct {
+        gint64           expiry;
+        guint            id;
+        GsdWallClockFunc callback;
+        gpointer         user_data;
+} Deadline;
+
+struct _GsdWallClock {
+        GObject          parent;
+
+        /* min-heap of Deadline, ordered by expiry */
+        GArray          *heap;
+        guint            next_id;
+
+        int              fd;
+        GSource         *source;
+
+        /* for detecting clock changes without timerfd */
+        gint64           last_real;
+        gint64           last_monotonic;
+};
+
+enum {
+        TIME_CHANGED,
+        LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL] = { 0 };
+
+static GsdWallClock *default_clock = NULL;
+
+G_DEFINE_TYPE (GsdWallClock, gsd_wall_clock, G_TYPE_OBJECT)
+
+static void rearm (GsdWallClock *clock);
+
+static gboolean
+deadline_before (const Deadline *a,
+                 const Deadline *b)
+{
+        if (a->expiry != b->expiry)
+                return a->expiry < b->expiry;
+        return a->id < b->id;
+}
+
+static void
+heap_swap (GArray *heap,
+           guint   i,
+           guint   j)
+{
+        Deadline tmp = g_array_index (heap, Deadline, i);
+
+        g_array_index (heap, Deadline, i) = g_array_index (heap, Deadline, j);
+        g_array_index (heap, Deadline, j) = tmp;
+}
+
+static void
+heap_sift_up (GArray *heap,
+              guint   i)
+{
+        while (i > 0) {
+                guint parent = (i - 1) / 2;
+
+                if (!deadline_before (&g_array_index (heap, Deadline, i),
+                                      &g_array_index (heap, Deadline, parent)))
+                        break;
+                heap_swap (heap, i, parent);
+                i = parent;
+        }
+}
+
+static void
+heap_sift_down (GArray *heap,
+                guint   i)
+{
+        while (TRUE) {
+                guint smallest = i;
+                guint left = 2 * i + 1;
+                guint right = 2 * i + 2;
+
+                if (left < heap->len &&
+                    deadline_before (&g_array_index (heap, Deadline, left),
+                                     &g_array_index (heap, Deadline, smallest)))
+                        smallest = left;
+                if (right < heap->len &&
+                    deadline_before (&g_array_index (heap, Deadline, right),
+                                     &g_array_index (heap, Deadline, smallest)))
+                        smallest = right;
+                if (smallest == i)
+                        break;
+                heap_swap (heap, i, smallest);
+                i = smallest;
+        }
+}
+
+static Deadline
+heap_remove_index (GArray *heap,
+                   guint   i)
+{
+        Deadline removed = g_array_index (heap, Deadline, i);
+        guint last = heap->len - 1;
+
+        if (i != last) {
+                g_array_index (heap, Deadline, i) = g_array_index (heap, Deadline, last);
+                g_array_set_size (heap, last);
+                heap_sift_down (heap, i);
+                heap_sift_up (heap, i);
+        } else {
+                g_array_set_size (heap, last);
+        }
+
+        return removed;
+}
+
+static void
+dispatch (GsdWallClock *clock,
+          gboolean      changed)
+{
+        gint64 now;
+
+        g_object_ref (clock);
+
+        if (changed) {
+                g_debug ("Wall clock changed");
+                g_signal_emit (clock, signals[TIME_CHANGED], 0);
+        }
+
+        /* Callbacks may add and remove timeouts, so take them off the
+         * heap one by one */
+        now = g_get_real_time ();
+        while (clock->heap->len > 0 &&
+               g_array_index (clock->heap, Deadline, 0).expiry <= now) {
+                Deadline deadline = heap_remove_index (clock->heap, 0);
+                deadline.callback (deadline.user_data);
+        }
+
+        rearm (clock);
+
+        g_object_unref (clock);
+}
+
+#if HAVE_TIMERFD
+static gboolean
+timerfd_cb (gint         fd,
+            GIOCondition condition,
+            gpointer     user_data)
+{
+        GsdWallClock *clock = user_data;
+        guint64 expirations;
+        gboolean changed = FALSE;
+
+        if (read (fd, &expirations, sizeof (expirations)) < 0) {
+                if (errno == ECANCELED)
+                        changed = TRUE;
+                else if (errno != EAGAIN)
+                        g_warning ("Failed to read from timerfd: %s", g_strerror (errno));
+        }
+
+        dispatch (clock, changed);
+
+        return G_SOURCE_CONTINUE;
+}
+#endif
+
+static gboolean
+fallback_cb (gpointer user_data)
+{
+        GsdWallClock *clock = user_data;
+        gint64 expected;
+        gboolean changed;
+
+        expected = clock->last_real + (g_get_monotonic_time () - clock->last_monotonic);
+        changed = ABS (g_get_real_time () - expected) > FALLBACK_MAX_DRIFT;
+
+        g_clear_pointer (&clock->source, g_source_unref);
+        dispatch (clock, changed);
+
+        return G_SOURCE_REMOVE;
+}
+
+static void
+rearm (GsdWallClock *clock)
+{
+        gint64 now = g_get_real_time ();
+        gint64 expiry;
+
+        if (clock->heap->len > 0)
+                expiry = g_array_index (clock->heap, Deadline, 0).expiry;
+        else
+                expiry = now + IDLE_EXPIRY;
+
+#if HAVE_TIMERFD
+        if (clock->fd >= 0) {
+                struct itimerspec its;
+
+                memset (&its, 0, sizeof (its));
+                its.it_value.tv_sec = expiry / G_USEC_PER_SEC;
+                its.it_value.tv_nsec = (expiry % G_USEC_PER_SEC) * 1000;
+
+                /* A zero it_value would disarm the timer */
+                if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+                        its.it_value.tv_nsec = 1;
+
+                if (timerfd_settime (clock->fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &its, NULL) == 0)
+                        return;
+
+                g_warning ("Failed to arm timerfd: %s", g_strerror (errno));
+                g_source_destroy (clock->source);
+                g_clear_pointer (&clock->source, g_source_unref);
+                close (clock->fd);
+                clock->fd = -1;
+        }
+#endif
+
+        if (clock->source != NULL) {
+                g_source_destroy (clock->source);
+                g_clear_pointer (&clock->source, g_source_unref);
+        }
+
+        clock->last_real = now;
+        clock->last_monotonic = g_get_monotonic_time ();
+
+        clock->source = g_timeout_source_new_seconds (CLAMP ((expiry - now + G_USEC_PER_SEC - 1) / G_USEC_PER_SEC,
+                                                             0, FALLBACK_INTERVAL));
+        g_source_set_callback (clock->source, fallback_cb, clock, NULL);
+        g_source_set_name (clock->source, "[gnome-settings-daemon] wall clock");
+        g_source_attach (clock->source, NULL);
+}
+
+/**
+ * gsd_wall_clock_add_timeout:
+ * @clock: a #GsdWallClock
+ * @expiry: when to call @callback
+ * @callback: function to call once
+ * @user_data: data for @callback
+ *
+ * Calls @callback once the wall clock reaches @expiry, including when the
+ * clock is set past it. Unlike with g_timeout_add(), time spent suspended
+ * counts.
+ *
+ * Returns: an ID for gsd_wall_clock_remove_timeout(), which must not be
+ * used anymore after @callback was called
+ */
+guint
+gsd_wall_clock_add_timeout (GsdWallClock     *clock,
+                            GDateTime        *expiry,
+                            GsdWallClockFunc  callback,
+                            gpointer          user_data)
+{
+        Deadline deadline;
+        gboolean earliest;
+
+        g_return_val_if_fail (GSD_IS_WALL_CLOCK (clock), 0);
+        g_return_val_if_fail (expiry != NULL, 0);
+        g_return_val_if_fail (callback != NULL, 0);
+
+        deadline.expiry = g_date_time_to_unix (expiry) * G_USEC_PER_SEC +
+                          g_date_time_get_microsecond (expiry);
+        deadline.id = ++clock->next_id;
+        if (deadline.id == 0)
+                deadline.id = ++clock->next_id;
+        deadline.callback = callback;
+        deadline.user_data = user_data;
+
+        g_array_append_val (clock->heap, deadline);
+        heap_sift_up (clock->heap, clock->heap->len - 1);
+
+        earliest = g_array_index (clock->heap, Deadline, 0).id == deadline.id;
+        if (earliest)
+                rearm (clock);
+
+        return deadline.id;
+}
+
+void
+gsd_wall_clock_remove_timeout (GsdWallClock *clock,
+                               guint         id)
+{
+        guint i;
+
+        g_return_if_fail (GSD_IS_WALL_CLOCK (clock));
+
+        for (i = 0; i < clock->heap->len; i++) {
+                if (g_array_index (clock->heap, Deadline, i).id != id)
+                        continue;
+
+                heap_remove_index (clock->heap, i);
+
+                /* leaving the timer armed early is harmless */
+                return;
+        }
+}
+
+/**
+ * gsd_wall_clock_get_default:
+ *
+ * Returns: (transfer full): the #GsdWallClock shared by the process
+ */
+GsdWallClock *
+gsd_wall_clock_get_default (void)
+{
+        if (default_clock != NULL)
+                return g_object_ref (default_clock);
+
+        default_clock = g_object_new (GSD_TYPE_WALL_CLOCK, NULL);
+        g_object_add_weak_pointer (G_OBJECT (default_clock), (gpointer *) &default_clock);
+
+        return default_clock;
+}
+
+static void
+gsd_wall_clock_finalize (GObject *object)
+{
+        GsdWallClock *clock = GSD_WALL_CLOCK (object);
+
+        if (clock->source != NULL) {
+                g_source_destroy (clock->source);
+                g_clear_pointer (&clock->source, g_source_unref);
+        }
+        if (clock->fd >= 0)
+                close (clock->fd);
+        g_array_unref (clock->heap);
+
+        G_OBJECT_CLASS (gsd_wall_clock_parent_class)->finalize (object);
+}
+
+static void
+gsd_wall_clock_class_init (GsdWallClockClass *klass)
+{
+        GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+        object_class->finalize = gsd_wall_clock_finalize;
+
+        /**
+         * GsdWallClock::time-changed:
+         *
+         * Emitted when the wall clock was set, or after resuming from
+         * suspend, before any timeouts that expired because of it are
+         * called.
+         */
+        signals[TIME_CHANGED] =
+                g_signal_new ("time-changed",
+                              G_TYPE_FROM_CLASS (klass),
+                              G_SIGNAL_RUN_LAST,
+                              0,
+                              NULL, NULL, NULL,
+                              G_TYPE_NONE, 0);
+}
+
+static void
+gsd_wall_clock_init (GsdWallClock *clock)
+{
+        clock->heap = g_array_new (FALSE, FALSE, sizeof (Deadline));
+        clock->fd = -1;
+
+#if HAVE_TIMERFD
+        clock->fd = timerfd_create (CLOCK_REALTIME, TFD_CLOEXEC | TFD_NONBLOCK);
+        if (clock->fd >= 0) {
+                clock->source = g_unix_fd_source_new (clock->fd, G_IO_IN);
+                g_source_set_callback (clock->source, (GSourceFunc) timerfd_cb, clock, NULL);
+                g_source_set_name (clock->source, "[gnome-settings-daemon] wall clock");
+                g_source_attach (clock->source, NULL);
+        } else {
+                g_debug ("timerfd_create() failed, wall clock changes are only polled: %s",
+                         g_strerror (errno));
+        }
+#endif
+
+        rearm (clock);
+}
@@ -0,0 +1,40 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __GSD_WALL_CLOCK_H__
+#define __GSD_WALL_CLOCK_H__
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define GSD_TYPE_WALL_CLOCK (gsd_wall_clock_get_type ())
+G_DECLARE_FINAL_TYPE (GsdWallClock, gsd_wall_clock, GSD, WALL_CLOCK, GObject)
+
+typedef void (*GsdWallClockFunc) (gpointer user_data);
+
+GsdWallClock *gsd_wall_clock_get_default    (void);
+guint         gsd_wall_clock_add_timeout    (GsdWallClock     *clock,
+                                             GDateTime        *expiry,
+                                             GsdWallClockFunc  callback,
+                                             gpointer          user_data);
+void          gsd_wall_clock_remove_timeout (GsdWallClock     *clock,
+                                             guint             id);
+
+G_END_DECLS
+
+#endif /* __GSD_WALL_CLOCK_H__ */
@@ -24,6 +24,7 @@
 #include "timedated.h"
 #include "tz.h"
 #include "weather-tz.h"
+#include "gsd-timezone-throttle.h"
 
 #include <geoclue.h>
 #include <geocode-glib/geocode-glib.h>
@@ -32,6 +33,11 @@
 #define DESKTOP_ID "gnome-datetime-panel"
 #define SET_TIMEZONE_PERMISSION "org.freedesktop.timedate1.set-timezone"
 
+/* fixes closer than this to a known location of the current country,
+ * which has the current zone, are not geocoded again */
+#define REGION_RADIUS           30              /* km */
+#define MIN_GEOCODE_INTERVAL    (5 * 60 * 1000) /* ms */
+
 enum {
         TIMEZONE_CHANGED,
         LAST_SIGNAL
@@ -50,6 +56,12 @@ typedef struct {
 
         gdouble raw_latitude;
         gdouble raw_longitude;
+        GsdTimezoneThrottle *throttle;
+
+        /* the Olson locations of tz_index, and a tree of them */
+        TzIndex *tz_index;
+        TzLocation *olson_locations;
+        TzTree *olson_tree;
 
         gchar *current_timezone;
         GSettings *location_settings;
@@ -102,139 +114,145 @@ queue_set_timezone (GsdTimezoneMonitor *self,
         priv->current_timezone = g_strdup (new_timezone);
 }
 
-static gint
-compare_locations (gconstpointer a,
-                   gconstpointer b)
+static void
+update_olson_tree (GsdTimezoneMonitor *self)
 {
-        const TzLocation *loc_a = a;
-        const TzLocation *loc_b = b;
-
-        if (loc_a->dist > loc_b->dist)
-                return 1;
-
-        if (loc_a->dist < loc_b->dist)
-                return -1;
-
-        return 0;
-}
+        GsdTimezoneMonitorPrivate *priv = gsd_timezone_monitor_get_instance_private (self);
+        g_autoptr(TzIndex) index = NULL;
+        g_autofree TzLocation **pointers = NULL;
+        guint i, n_locations;
 
-static GList *
-sort_by_closest_to (GList           *locations,
-                    GeocodeLocation *location)
-{
-        GList *l;
+        /* keep the old tree if tzdata went missing */
+        index = tz_index_get_default ();
+        if (index == NULL || index == priv->tz_index)
+                return;
 
-        for (l = locations; l; l = l->next) {
-                GeocodeLocation *loc;
-                TzLocation *tz_location = l->data;
+        g_clear_pointer (&priv->olson_tree, tz_tree_free);
+        g_clear_pointer (&priv->olson_locations, g_free);
+        g_clear_pointer (&priv->tz_index, tz_index_unref);
 
-                loc = geocode_location_new (tz_location->latitude,
-                                            tz_location->longitude,
-                                            GEOCODE_LOCATION_ACCURACY_UNKNOWN);
-                tz_location->dist = geocode_location_get_distance_from (loc, location);
-                g_object_unref (loc);
+        n_locations = tz_index_get_n_locations (index);
+        priv->olson_locations = g_new (TzLocation, n_locations);
+        pointers = g_new (TzLocation *, n_locations);
+        for (i = 0; i < n_locations; i++) {
+                tz_index_get_location (index, i, &priv->olson_locations[i]);
+                pointers[i] = &priv->olson_locations[i];
         }
 
-        return g_list_sort (locations, compare_locations);
+        priv->olson_tree = tz_tree_new (pointers, n_locations);
+        priv->tz_index = g_steal_pointer (&index);
 }
 
-static GList *
-ptr_array_to_list (GPtrArray *array)
+/* the closest location in either tree, or %NULL */
+static TzLocation *
+find_nearest (TzTree      *olson_tree,
+              TzTree      *weather_tree,
+              gdouble      latitude,
+              gdouble      longitude,
+              const gchar *country_code,
+              gdouble     *distance)
 {
-        GList *l = NULL;
-        gint i;
-
-        for (i = 0; i < array->len; i++)
-                l = g_list_prepend (l, g_ptr_array_index (array, i));
-
-        return l;
-}
-
-static GList *
-find_by_country (GList       *locations,
-                 const gchar *country_code)
-{
-        GList *l, *found = NULL;
-        gchar *c1;
-        gchar *c2;
-
-        c1 = g_ascii_strdown (country_code, -1);
-
-        for (l = locations; l; l = l->next) {
-                TzLocation *loc = l->data;
-
-                c2 = g_ascii_strdown (loc->country, -1);
-                if (g_strcmp0 (c1, c2) == 0)
-                        found = g_list_prepend (found, loc);
-                g_free (c2);
+        TzLocation *olson, *weather;
+        gdouble olson_dist = G_MAXDOUBLE;
+        gdouble weather_dist = G_MAXDOUBLE;
+
+        olson = tz_tree_find_nearest (olson_tree, latitude, longitude,
+                                      country_code, &olson_dist);
+        weather = weather_tree ? tz_tree_find_nearest (weather_tree, latitude, longitude,
+                                                       country_code, &weather_dist) : NULL;
+
+        if (weather != NULL && weather_dist < olson_dist) {
+                *distance = weather_dist;
+                return weather;
         }
-        g_free (c1);
-
-        return found;
+        *distance = olson_dist;
+        return olson;
 }
 
 static gchar *
 find_timezone (GsdTimezoneMonitor *self,
-               GeocodeLocation    *location,
+               gdouble             latitude,
+               gdouble             longitude,
                const gchar        *country_code)
 {
-        TzDB *tzdb;
-        gchar *res;
-        GList *filtered;
-        GList *weather_locations;
-        GList *locations;
+        GsdTimezoneMonitorPrivate *priv = gsd_timezone_monitor_get_instance_private (self);
+        TzTree *weather_tree;
         TzLocation *closest_tz_location;
-
-        tzdb = tz_load_db ();
+        gdouble distance;
+        gchar *res;
 
         /* First load locations from Olson DB */
-        locations = ptr_array_to_list (tz_get_locations (tzdb));
-        g_return_val_if_fail (locations != NULL, NULL);
+        update_olson_tree (self);
+        g_return_val_if_fail (priv->olson_tree != NULL, NULL);
 
         /* ... and then add libgweather's locations as well */
-        weather_locations = weather_tz_db_get_locations (country_code);
-        locations = g_list_concat (locations,
-                                   g_list_copy (weather_locations));
-
-        /* Filter tz locations by country */
-        filtered = find_by_country (locations, country_code);
-        if (filtered != NULL) {
-                g_list_free (locations);
-                locations = filtered;
-        } else {
+        weather_tree = weather_tz_db_get_tree (country_code);
+
+        /* Find the closest tz location in the country */
+        closest_tz_location = find_nearest (priv->olson_tree, weather_tree,
+                                            latitude, longitude, country_code,
+                                            &distance);
+        if (closest_tz_location == NULL) {
                 g_debug ("No match for country code '%s' in tzdb", country_code);
+                closest_tz_location = find_nearest (priv->olson_tree, weather_tree,
+                                                    latitude, longitude, NULL,
+                                                    &distance);
         }
 
-        /* Find the closest tz location */
-        locations = sort_by_closest_to (locations, location);
-        closest_tz_location = (TzLocation *) locations->data;
-
-        res = g_strdup (closest_tz_location->zone);
-
-        g_list_free (locations);
-        g_list_free_full (weather_locations, (GDestroyNotify) tz_location_free);
-        tz_db_free (tzdb);
+        res = closest_tz_location ? g_strdup (closest_tz_location->zone) : NULL;
 
         return res;
 }
 
+/* the zone find_timezone() would find if the country did not change */
+static const gchar *
+lookup_zone (gdouble      latitude,
+             gdouble      longitude,
+             const gchar *country_code,
+             gpointer     user_data)
+{
+        GsdTimezoneMonitor *self = user_data;
+        GsdTimezoneMonitorPrivate *priv = gsd_timezone_monitor_get_instance_private (self);
+        TzLocation *closest_tz_location;
+        gdouble distance;
+
+        update_olson_tree (self);
+        if (priv->olson_tree == NULL)
+                return NULL;
+
+        /* close to a border, the fix may well be in the next country */
+        closest_tz_location = tz_tree_find_nearest (priv->olson_tree, latitude, longitude,
+                                                    NULL, &distance);
+        if (closest_tz_location == NULL ||
+            g_ascii_strcasecmp (closest_tz_location->country, country_code) != 0)
+                return NULL;
+
+        closest_tz_location = find_nearest (priv->olson_tree,
+                                            weather_tz_db_get_tree (country_code),
+                                            latitude, longitude, country_code,
+                                            &distance);
+        if (closest_tz_location == NULL || distance > REGION_RADIUS)
+                return NULL;
+
+        return closest_tz_location->zone;
+}
+
 static void
 process_location (GsdTimezoneMonitor *self,
                   GeocodePlace       *place)
 {
-        GeocodeLocation *location;
         GsdTimezoneMonitorPrivate *priv = gsd_timezone_monitor_get_instance_private (self);
         const gchar *country_code;
         g_autofree gchar *new_timezone = NULL;
 
         country_code = geocode_place_get_country_code (place);
-        location = geocode_location_new (priv->raw_latitude,
-                                         priv->raw_longitude,
-                                         GEOCODE_LOCATION_ACCURACY_CITY);
-
-        new_timezone = find_timezone (self, location, country_code);
-
-        g_object_unref (location);
+        new_timezone = find_timezone (self,
+                                      priv->raw_latitude,
+                                      priv->raw_longitude,
+                                      country_code);
+        gsd_timezone_throttle_geocoded (priv->throttle, country_code, new_timezone);
+        if (new_timezone == NULL)
+                return;
 
         if (g_strcmp0 (priv->current_timezone, new_timezone) != 0) {
                 g_debug ("Found updated timezone '%s' for country '%s'",
@@ -258,8 +276,12 @@ on_reverse_geocoding_ready (GObject      *source_object,
                                                 res,
                                                 &error);
         if (error != NULL) {
-                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                        GsdTimezoneMonitorPrivate *priv = gsd_timezone_monitor_get_instance_private (user_data);
+
                         g_debug ("Reverse geocoding failed: %s", error->message);
+                        gsd_timezone_throttle_geocoded (priv->throttle, NULL, NULL);
+                }
                 g_error_free (error);
                 return;
         }
@@ -271,14 +293,18 @@ on_reverse_geocoding_ready (GObject      *source_object,
 }
 
 static void
-start_reverse_geocoding (GsdTimezoneMonitor *self,
-                         gdouble             latitude,
-                         gdouble             longitude)
+start_reverse_geocoding (gdouble  latitude,
+                         gdouble  longitude,
+                         gpointer user_data)
 {
+        GsdTimezoneMonitor *self = user_data;
         GeocodeLocation *location;
         GeocodeReverse *reverse;
         GsdTimezoneMonitorPrivate *priv = gsd_timezone_monitor_get_instance_private (self);
 
+        priv->raw_latitude = latitude;
+        priv->raw_longitude = longitude;
+
         location = geocode_location_new (latitude,
                                          longitude,
                                          GEOCODE_LOCATION_ACCURACY_CITY);
@@ -302,18 +328,19 @@ on_location_notify (GClueSimple *simple,
         GsdTimezoneMonitorPrivate *priv = gsd_timezone_monitor_get_instance_private (self);
         GClueLocation *location;
         gdouble latitude, longitude;
+        guint processed, skipped;
 
         location = gclue_simple_get_location (simple);
 
         latitude = gclue_location_get_latitude (location);
         longitude = gclue_location_get_longitude (location);
 
-        priv->raw_latitude = latitude;
-        priv->raw_longitude = longitude;
-
         g_debug ("Got location %lf,%lf", latitude, longitude);
 
-        start_reverse_geocoding (self, latitude, longitude);
+        gsd_timezone_throttle_add_fix (priv->throttle, latitude, longitude);
+
+        gsd_timezone_throttle_get_counts (priv->throttle, &processed, &skipped);
+        g_debug ("%u location fixes geocoded, %u skipped", processed, skipped);
 }
 
 static void
@@ -372,6 +399,7 @@ stop_geoclue (GsdTimezoneMonitor *self)
 
         g_cancellable_cancel (priv->geoclue_cancellable);
         g_clear_object (&priv->geoclue_cancellable);
+        gsd_timezone_throttle_cancel (priv->throttle);
 
         if (priv->geoclue_client) {
                 gclue_client_call_stop (priv->geoclue_client, NULL, NULL, NULL);
@@ -381,10 +409,19 @@ stop_geoclue (GsdTimezoneMonitor *self)
         g_clear_object (&priv->geoclue_simple);
 }
 
-GsdTimezoneMonitor *
-gsd_timezone_monitor_new (void)
+/**
+ * gsd_timezone_monitor_get_fix_counts:
+ * @processed: (out) (optional): number of location fixes reverse geocoded
+ * @skipped: (out) (optional): number of fixes that were not
+ */
+void
+gsd_timezone_monitor_get_fix_counts (GsdTimezoneMonitor *monitor,
+                                     guint              *processed,
+                                     guint              *skipped)
 {
-        return g_object_new (GSD_TYPE_TIMEZONE_MONITOR, NULL);
+        GsdTimezoneMonitorPrivate *priv = gsd_timezone_monitor_get_instance_private (monitor);
+
+        gsd_timezone_throttle_get_counts (priv->throttle, processed, skipped);
 }
 
 static void
@@ -406,6 +443,11 @@ gsd_timezone_monitor_finalize (GObject *obj)
         g_clear_object (&priv->permission);
         g_clear_pointer (&priv->current_timezone, g_free);
 
+        g_clear_pointer (&priv->olson_tree, tz_tree_free);
+        g_clear_pointer (&priv->olson_locations, g_free);
+        g_clear_pointer (&priv->tz_index, tz_index_unref);
+        g_clear_pointer (&priv->throttle, gsd_timezone_throttle_free);
+
         g_clear_object (&priv->location_settings);
 
         G_OBJECT_CLASS (gsd_timezone_monitor_parent_class)->finalize (obj);
@@ -438,8 +480,10 @@ check_location_settings (GsdTimezoneMonitor *self)
                 stop_geoclue (self);
 }
 
+/* Kept out of init, so that the tests can create a monitor without
+ * polkit, timedated or geoclue */
 static void
-gsd_timezone_monitor_init (GsdTimezoneMonitor *self)
+start_monitor (GsdTimezoneMonitor *self)
 {
         GError *error = NULL;
         GsdTimezoneMonitorPrivate *priv = gsd_timezone_monitor_get_instance_private (self);
@@ -482,3 +526,25 @@ gsd_timezone_monitor_init (GsdTimezoneMonitor *self)
                                   G_CALLBACK (check_location_settings), self);
         check_location_settings (self);
 }
+
+static void
+gsd_timezone_monitor_init (GsdTimezoneMonitor *self)
+{
+        GsdTimezoneMonitorPrivate *priv = gsd_timezone_monitor_get_instance_private (self);
+
+        priv->throttle = gsd_timezone_throttle_new (MIN_GEOCODE_INTERVAL,
+                                                    start_reverse_geocoding,
+                                                    lookup_zone,
+                                                    self);
+}
+
+GsdTimezoneMonitor *
+gsd_timezone_monitor_new (void)
+{
+        GsdTimezoneMonitor *monitor;
+
+        monitor = g_object_new (GSD_TYPE_TIMEZONE_MONITOR, NULL);
+        start_monitor (monitor);
+
+        return monitor;
+}
@@ -49,6 +49,9 @@ struct _GsdTimezoneMonitorClass
 GType gsd_timezone_monitor_get_type (void) G_GNUC_CONST;
 
 GsdTimezoneMonitor *gsd_timezone_monitor_new (void);
+void gsd_timezone_monitor_get_fix_counts (GsdTimezoneMonitor *monitor,
+                                          guint              *processed,
+                                          guint              *skipped);
 
 G_END_DECLS
 
@@ -0,0 +1,251 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Decides which location fixes are worth a reverse geocoding round trip.
+ *
+ * A fix is skipped when the country found for the last geocoded fix would
+ * still give it the same zone, i.e. it is close to known locations of that
+ * country and the nearest of them is in the same zone. Other fixes are
+ * geocoded one at a time, and at most once per interval; a fix waiting
+ * for its turn is replaced by newer ones.
+ */
+
+#include "config.h"
+
+#include "gsd-timezone-throttle.h"
+
+struct _GsdTimezoneThrottle {
+        guint                           min_interval;   /* ms */
+        GsdTimezoneThrottleGeocodeFunc  geocode;
+        GsdTimezoneThrottleLookupFunc   lookup;
+        gpointer                        user_data;
+
+        /* result of the last geocoded fix */
+        gchar                          *country_code;
+        gchar                          *zone;
+
+        gboolean                        in_flight;
+        gint64                          last_geocode;   /* monotonic */
+
+        gboolean                        have_pending;
+        gdouble                         pending_latitude;
+        gdouble                         pending_longitude;
+        guint                           pending_id;
+
+        guint                           processed;
+        guint                           skipped;
+};
+
+static void maybe_start_pending (GsdTimezoneThrottle *throttle,
+                                 gboolean             check_region);
+
+static gboolean
+in_region (GsdTimezoneThrottle *throttle,
+           gdouble              latitude,
+           gdouble              longitude)
+{
+        const gchar *zone;
+
+        if (throttle->country_code == NULL || throttle->zone == NULL)
+                return FALSE;
+
+        zone = throttle->lookup (latitude, longitude,
+                                 throttle->country_code,
+                                 throttle->user_data);
+
+        return g_strcmp0 (zone, throttle->zone) == 0;
+}
+
+static void
+drop_pending (GsdTimezoneThrottle *throttle)
+{
+        if (!throttle->have_pending)
+                return;
+
+        throttle->have_pending = FALSE;
+        throttle->skipped++;
+        g_clear_handle_id (&throttle->pending_id, g_source_remove);
+}
+
+static gboolean
+pending_timeout_cb (gpointer user_data)
+{
+        GsdTimezoneThrottle *throttle = user_data;
+
+        throttle->pending_id = 0;
+        maybe_start_pending (throttle, TRUE);
+
+        return G_SOURCE_REMOVE;
+}
+
+static void
+maybe_start_pending (GsdTimezoneThrottle *throttle,
+                     gboolean             check_region)
+{
+        gint64 wait;
+
+        if (!throttle->have_pending ||
+            throttle->in_flight ||
+            throttle->pending_id != 0)
+                return;
+
+        /* the fix geocoded in the meantime may already cover it */
+        if (check_region &&
+            in_region (throttle, throttle->pending_latitude, throttle->pending_longitude)) {
+                g_debug ("Waiting location %f,%f is in %s, skipping",
+                         throttle->pending_latitude, throttle->pending_longitude,
+                         throttle->zone);
+                drop_pending (throttle);
+                return;
+        }
+
+        if (throttle->last_geocode != 0) {
+                wait = throttle->last_geocode +
+                       (gint64) throttle->min_interval * 1000 -
+                       g_get_monotonic_time ();
+                if (wait > 0) {
+                        g_debug ("Delaying reverse geocoding by %" G_GINT64_FORMAT " ms",
+                                 (wait + 999) / 1000);
+                        throttle->pending_id = g_timeout_add ((wait + 999) / 1000,
+                                                              pending_timeout_cb,
+                                                              throttle);
+                        return;
+                }
+        }
+
+        throttle->have_pending = FALSE;
+        throttle->in_flight = TRUE;
+        throttle->last_geocode = g_get_monotonic_time ();
+        throttle->processed++;
+
+        throttle->geocode (throttle->pending_latitude,
+                           throttle->pending_longitude,
+                           throttle->user_data);
+}
+
+/**
+ * gsd_timezone_throttle_add_fix:
+ *
+ * Passes on a new location fix, which calls the geocode function now,
+ * later or not at all.
+ */
+void
+gsd_timezone_throttle_add_fix (GsdTimezoneThrottle *throttle,
+                               gdouble              latitude,
+                               gdouble              longitude)
+{
+        if (in_region (throttle, latitude, longitude)) {
+                g_debug ("Location %f,%f is still in %s, skipping",
+                         latitude, longitude, throttle->zone);
+                throttle->skipped++;
+
+                /* back where we were */
+                drop_pending (throttle);
+                return;
+        }
+
+        if (throttle->have_pending)
+                throttle->skipped++;
+
+        throttle->have_pending = TRUE;
+        throttle->pending_latitude = latitude;
+        throttle->pending_longitude = longitude;
+
+        maybe_start_pending (throttle, FALSE);
+}
+
+/**
+ * gsd_timezone_throttle_geocoded:
+ * @country_code: (nullable): the country of the fix
+ * @zone: (nullable): the zone found for it
+ *
+ * Finishes the geocoding started last. A %NULL @zone is for failures,
+ * which keep the previous result.
+ */
+void
+gsd_timezone_throttle_geocoded (GsdTimezoneThrottle *throttle,
+                                const gchar         *country_code,
+                                const gchar         *zone)
+{
+        throttle->in_flight = FALSE;
+
+        if (zone != NULL) {
+                g_free (throttle->country_code);
+                throttle->country_code = g_strdup (country_code);
+                g_free (throttle->zone);
+                throttle->zone = g_strdup (zone);
+        }
+
+        maybe_start_pending (throttle, TRUE);
+}
+
+/* Forgets geocoding in progress or waiting, for when it is cancelled */
+void
+gsd_timezone_throttle_cancel (GsdTimezoneThrottle *throttle)
+{
+        throttle->in_flight = FALSE;
+        throttle->have_pending = FALSE;
+        g_clear_handle_id (&throttle->pending_id, g_source_remove);
+}
+
+void
+gsd_timezone_throttle_get_counts (GsdTimezoneThrottle *throttle,
+                                  guint               *processed,
+                                  guint               *skipped)
+{
+        if (processed != NULL)
+                *processed = throttle->processed;
+        if (skipped != NULL)
+                *skipped = throttle->skipped;
+}
+
+/**
+ * gsd_timezone_throttle_new:
+ * @min_interval: the minimum time between two geocodings, in ms
+ * @geocode: starts geocoding a fix
+ * @lookup: finds the zone of a point in a country
+ * @user_data: data for @geocode and @lookup
+ */
+GsdTimezoneThrottle *
+gsd_timezone_throttle_new (guint                           min_interval,
+                           GsdTimezoneThrottleGeocodeFunc  geocode,
+                           GsdTimezoneThrottleLookupFunc   lookup,
+                           gpointer                        user_data)
+{
+        GsdTimezoneThrottle *throttle;
+
+        throttle = g_new0 (GsdTimezoneThrottle, 1);
+        throttle->min_interval = min_interval;
+        throttle->geocode = geocode;
+        throttle->lookup = lookup;
+        throttle->user_data = user_data;
+
+        return throttle;
+}
+
+void
+gsd_timezone_throttle_free (GsdTimezoneThrottle *throttle)
+{
+        if (throttle == NULL)
+                return;
+
+        g_clear_handle_id (&throttle->pending_id, g_source_remove);
+        g_free (throttle->country_code);
+        g_free (throttle->zone);
+        g_free (throttle);
+}
@@ -0,0 +1,59 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __GSD_TIMEZONE_THROTTLE_H
+#define __GSD_TIMEZONE_THROTTLE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GsdTimezoneThrottle GsdTimezoneThrottle;
+
+/* Starts reverse geocoding a fix, the result is passed back with
+ * gsd_timezone_throttle_geocoded() */
+typedef void         (*GsdTimezoneThrottleGeocodeFunc) (gdouble      latitude,
+                                                        gdouble      longitude,
+                                                        gpointer     user_data);
+/* Returns the zone a point in @country_code would get, or %NULL if it is
+ * too far from any location known in the country */
+typedef const gchar *(*GsdTimezoneThrottleLookupFunc)  (gdouble      latitude,
+                                                        gdouble      longitude,
+                                                        const gchar *country_code,
+                                                        gpointer     user_data);
+
+GsdTimezoneThrottle *gsd_timezone_throttle_new        (guint                           min_interval,
+                                                       GsdTimezoneThrottleGeocodeFunc  geocode,
+                                                       GsdTimezoneThrottleLookupFunc   lookup,
+                                                       gpointer                        user_data);
+void                 gsd_timezone_throttle_free       (GsdTimezoneThrottle            *throttle);
+void                 gsd_timezone_throttle_add_fix    (GsdTimezoneThrottle            *throttle,
+                                                       gdouble                         latitude,
+                                                       gdouble                         longitude);
+void                 gsd_timezone_throttle_geocoded   (GsdTimezoneThrottle            *throttle,
+                                                       const gchar                    *country_code,
+                                                       const gchar                    *zone);
+void                 gsd_timezone_throttle_cancel     (GsdTimezoneThrottle            *throttle);
+void                 gsd_timezone_throttle_get_counts (GsdTimezoneThrottle            *throttle,
+                                                       guint                          *processed,
+                                                       guint                          *skipped);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GsdTimezoneThrottle, gsd_timezone_throttle_free)
+
+G_END_DECLS
+
+#endif /* __GSD_TIMEZONE_THROTTLE_H */
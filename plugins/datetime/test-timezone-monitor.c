@@ -0,0 +1,167 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Location fixes through the timezone monitor, from the throttle to the
+ * zone lookup in the system tzdata.
+ *
+ * The monitor is created without polkit, timedated or geoclue, and reverse
+ * geocoding is replaced by a mock that records the requests.
+ */
+
+#include <glib.h>
+
+/* the backward file of the source tree, rather than the installed one */
+#undef GNOMECC_DATA_DIR
+#define GNOMECC_DATA_DIR TEST_SRCDIR "/.."
+
+/* Include directly to test the static functions */
+#include "tz.c"
+#include "gsd-timezone-monitor.c"
+
+typedef struct {
+        GsdTimezoneMonitor *monitor;
+        guint               n_geocoded;
+} Fixture;
+
+static void
+mock_geocode (gdouble  latitude,
+              gdouble  longitude,
+              gpointer user_data)
+{
+        Fixture *fixture = user_data;
+        GsdTimezoneMonitorPrivate *priv = gsd_timezone_monitor_get_instance_private (fixture->monitor);
+
+        fixture->n_geocoded++;
+        priv->raw_latitude = latitude;
+        priv->raw_longitude = longitude;
+}
+
+static const gchar *
+fixture_lookup_zone (gdouble      latitude,
+                     gdouble      longitude,
+                     const gchar *country_code,
+                     gpointer     user_data)
+{
+        Fixture *fixture = user_data;
+
+        return lookup_zone (latitude, longitude, country_code, fixture->monitor);
+}
+
+static void
+fixture_set_up (Fixture       *fixture,
+                gconstpointer  user_data)
+{
+        GsdTimezoneMonitorPrivate *priv;
+
+        fixture->monitor = g_object_new (GSD_TYPE_TIMEZONE_MONITOR, NULL);
+        priv = gsd_timezone_monitor_get_instance_private (fixture->monitor);
+
+        gsd_timezone_throttle_free (priv->throttle);
+        priv->throttle = gsd_timezone_throttle_new (0,
+                                                    mock_geocode,
+                                                    fixture_lookup_zone,
+                                                    fixture);
+
+        /* so that nothing is set through timedated */
+        priv->current_timezone = g_strdup ("Europe/Paris");
+}
+
+static void
+fixture_tear_down (Fixture       *fixture,
+                   gconstpointer  user_data)
+{
+        g_clear_object (&fixture->monitor);
+}
+
+static void
+test_two_fixes (Fixture       *fixture,
+                gconstpointer  user_data)
+{
+        GsdTimezoneMonitorPrivate *priv = gsd_timezone_monitor_get_instance_private (fixture->monitor);
+        GeocodePlace *place;
+        guint processed, skipped;
+
+        if (!g_file_test (TZ_DATA_FILE, G_FILE_TEST_EXISTS)) {
+                g_test_skip ("No tzdata installed");
+                return;
+        }
+
+        place = geocode_place_new ("Paris", GEOCODE_PLACE_TYPE_TOWN);
+        g_object_set (place, "country-code", "FR", NULL);
+
+        /* the first fix is geocoded, which loads the tzdata */
+        gsd_timezone_throttle_add_fix (priv->throttle, 48.8566, 2.3522);
+        g_assert_cmpuint (fixture->n_geocoded, ==, 1);
+        process_location (fixture->monitor, place);
+        g_assert_nonnull (priv->olson_tree);
+
+        /* a few km away is still in the same zone */
+        gsd_timezone_throttle_add_fix (priv->throttle, 48.8700, 2.4000);
+        g_assert_cmpuint (fixture->n_geocoded, ==, 1);
+
+        gsd_timezone_monitor_get_fix_counts (fixture->monitor, &processed, &skipped);
+        g_assert_cmpuint (processed, ==, 1);
+        g_assert_cmpuint (skipped, ==, 1);
+        g_assert_cmpstr (priv->current_timezone, ==, "Europe/Paris");
+
+        g_object_unref (place);
+}
+
+static void
+test_border (Fixture       *fixture,
+             gconstpointer  user_data)
+{
+        GsdTimezoneMonitorPrivate *priv = gsd_timezone_monitor_get_instance_private (fixture->monitor);
+        g_autofree gchar *zone = NULL;
+        GeocodePlace *place;
+
+        if (!g_file_test (TZ_DATA_FILE, G_FILE_TEST_EXISTS)) {
+                g_test_skip ("No tzdata installed");
+                return;
+        }
+
+        g_free (priv->current_timezone);
+        priv->current_timezone = g_strdup ("Europe/Madrid");
+
+        place = geocode_place_new ("Badajoz", GEOCODE_PLACE_TYPE_TOWN);
+        g_object_set (place, "country-code", "ES", NULL);
+
+        gsd_timezone_throttle_add_fix (priv->throttle, 38.8794, -6.9707);
+        g_assert_cmpuint (fixture->n_geocoded, ==, 1);
+        process_location (fixture->monitor, place);
+
+        /* Elvas is close to Badajoz, but across the border */
+        gsd_timezone_throttle_add_fix (priv->throttle, 38.8809, -7.1632);
+        g_assert_cmpuint (fixture->n_geocoded, ==, 2);
+
+        zone = find_timezone (fixture->monitor, priv->raw_latitude, priv->raw_longitude, "PT");
+        g_assert_cmpstr (zone, ==, "Europe/Lisbon");
+
+        g_object_unref (place);
+}
+
+int
+main (int argc, char **argv)
+{
+        g_test_init (&argc, &argv, G_TEST_OPTION_ISOLATE_DIRS, NULL);
+
+        g_test_add ("/timezone-monitor/two-fixes", Fixture, NULL,
+                    fixture_set_up, test_two_fixes, fixture_tear_down);
+        g_test_add ("/timezone-monitor/border", Fixture, NULL,
+                    fixture_set_up, test_border, fixture_tear_down);
+
+        return g_test_run ();
+}
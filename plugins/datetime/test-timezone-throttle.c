@@ -0,0 +1,222 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Location fix throttling for the timezone monitor.
+ *
+ * Reverse geocoding is replaced by a mock that records the requests, and
+ * the zone lookup by one where France spans longitudes -5 to 8.
+ */
+
+#include <glib.h>
+
+#include "gsd-timezone-throttle.h"
+
+#define MIN_INTERVAL 100 /* ms */
+
+typedef struct {
+        GsdTimezoneThrottle *throttle;
+        guint                n_geocoded;
+        gdouble              latitude;
+        gdouble              longitude;
+} Fixture;
+
+static void
+mock_geocode (gdouble  latitude,
+              gdouble  longitude,
+              gpointer user_data)
+{
+        Fixture *fixture = user_data;
+
+        fixture->n_geocoded++;
+        fixture->latitude = latitude;
+        fixture->longitude = longitude;
+}
+
+static const gchar *
+mock_lookup (gdouble      latitude,
+             gdouble      longitude,
+             const gchar *country_code,
+             gpointer     user_data)
+{
+        if (g_strcmp0 (country_code, "FR") == 0 && longitude >= -5 && longitude <= 8)
+                return "Europe/Paris";
+
+        return NULL;
+}
+
+static void
+fixture_set_up (Fixture       *fixture,
+                gconstpointer  user_data)
+{
+        fixture->throttle = gsd_timezone_throttle_new (MIN_INTERVAL,
+                                                       mock_geocode,
+                                                       mock_lookup,
+                                                       fixture);
+}
+
+static void
+fixture_tear_down (Fixture       *fixture,
+                   gconstpointer  user_data)
+{
+        g_clear_pointer (&fixture->throttle, gsd_timezone_throttle_free);
+}
+
+static gboolean
+timeout_cb (gpointer user_data)
+{
+        gboolean *timed_out = user_data;
+
+        *timed_out = TRUE;
+
+        return G_SOURCE_REMOVE;
+}
+
+static void
+wait_for_geocode (Fixture *fixture,
+                  guint    n_geocoded)
+{
+        gboolean timed_out = FALSE;
+        guint id;
+
+        id = g_timeout_add (10 * MIN_INTERVAL, timeout_cb, &timed_out);
+        while (!timed_out && fixture->n_geocoded < n_geocoded)
+                g_main_context_iteration (NULL, TRUE);
+        g_assert_false (timed_out);
+        g_source_remove (id);
+}
+
+static void
+assert_counts (Fixture *fixture,
+               guint    expected_processed,
+               guint    expected_skipped)
+{
+        guint processed, skipped;
+
+        gsd_timezone_throttle_get_counts (fixture->throttle, &processed, &skipped);
+        g_assert_cmpuint (processed, ==, expected_processed);
+        g_assert_cmpuint (skipped, ==, expected_skipped);
+}
+
+static void
+test_region (Fixture       *fixture,
+             gconstpointer  user_data)
+{
+        /* nothing known yet */
+        gsd_timezone_throttle_add_fix (fixture->throttle, 48.85, 2.35);
+        g_assert_cmpuint (fixture->n_geocoded, ==, 1);
+        gsd_timezone_throttle_geocoded (fixture->throttle, "FR", "Europe/Paris");
+
+        /* Lyon and Brest get the same zone */
+        gsd_timezone_throttle_add_fix (fixture->throttle, 45.76, 4.84);
+        gsd_timezone_throttle_add_fix (fixture->throttle, 48.39, -4.49);
+        g_assert_cmpuint (fixture->n_geocoded, ==, 1);
+        assert_counts (fixture, 1, 2);
+
+        /* Berlin does not */
+        gsd_timezone_throttle_add_fix (fixture->throttle, 52.52, 13.40);
+        wait_for_geocode (fixture, 2);
+        g_assert_cmpfloat (fixture->longitude, ==, 13.40);
+        assert_counts (fixture, 2, 2);
+}
+
+static void
+test_failure (Fixture       *fixture,
+              gconstpointer  user_data)
+{
+        gsd_timezone_throttle_add_fix (fixture->throttle, 48.85, 2.35);
+        gsd_timezone_throttle_geocoded (fixture->throttle, NULL, NULL);
+
+        /* nothing was learnt, so it has to be tried again */
+        gsd_timezone_throttle_add_fix (fixture->throttle, 48.85, 2.35);
+        wait_for_geocode (fixture, 2);
+        assert_counts (fixture, 2, 0);
+}
+
+static void
+test_rate_limit (Fixture       *fixture,
+                 gconstpointer  user_data)
+{
+        gint64 start;
+
+        start = g_get_monotonic_time ();
+        gsd_timezone_throttle_add_fix (fixture->throttle, 52.52, 13.40);
+        g_assert_cmpuint (fixture->n_geocoded, ==, 1);
+
+        /* while in flight, the newest fix waits */
+        gsd_timezone_throttle_add_fix (fixture->throttle, 50.11, 8.68);
+        gsd_timezone_throttle_add_fix (fixture->throttle, 48.14, 11.58);
+        gsd_timezone_throttle_geocoded (fixture->throttle, "DE", "Europe/Berlin");
+        g_assert_cmpuint (fixture->n_geocoded, ==, 1);
+
+        wait_for_geocode (fixture, 2);
+        g_assert_cmpint (g_get_monotonic_time () - start, >=, MIN_INTERVAL * 1000);
+        g_assert_cmpfloat (fixture->longitude, ==, 11.58);
+        assert_counts (fixture, 2, 1);
+}
+
+static void
+test_back_in_region (Fixture       *fixture,
+                     gconstpointer  user_data)
+{
+        gboolean timed_out = FALSE;
+
+        gsd_timezone_throttle_add_fix (fixture->throttle, 48.85, 2.35);
+        gsd_timezone_throttle_geocoded (fixture->throttle, "FR", "Europe/Paris");
+
+        /* a waiting fix is dropped when the next one is back home */
+        gsd_timezone_throttle_add_fix (fixture->throttle, 52.52, 13.40);
+        gsd_timezone_throttle_add_fix (fixture->throttle, 48.85, 2.35);
+
+        g_timeout_add (2 * MIN_INTERVAL, timeout_cb, &timed_out);
+        while (!timed_out)
+                g_main_context_iteration (NULL, TRUE);
+
+        g_assert_cmpuint (fixture->n_geocoded, ==, 1);
+        assert_counts (fixture, 1, 2);
+}
+
+static void
+test_cancel (Fixture       *fixture,
+             gconstpointer  user_data)
+{
+        gsd_timezone_throttle_add_fix (fixture->throttle, 52.52, 13.40);
+        gsd_timezone_throttle_add_fix (fixture->throttle, 48.14, 11.58);
+        gsd_timezone_throttle_cancel (fixture->throttle);
+
+        /* the result of a cancelled geocoding never arrives */
+        gsd_timezone_throttle_add_fix (fixture->throttle, 50.11, 8.68);
+        wait_for_geocode (fixture, 2);
+        g_assert_cmpfloat (fixture->longitude, ==, 8.68);
+}
+
+int
+main (int argc, char **argv)
+{
+        g_test_init (&argc, &argv, NULL);
+
+        g_test_add ("/datetime/timezone-throttle/region", Fixture, NULL,
+                    fixture_set_up, test_region, fixture_tear_down);
+        g_test_add ("/datetime/timezone-throttle/failure", Fixture, NULL,
+                    fixture_set_up, test_failure, fixture_tear_down);
+        g_test_add ("/datetime/timezone-throttle/rate-limit", Fixture, NULL,
+                    fixture_set_up, test_rate_limit, fixture_tear_down);
+        g_test_add ("/datetime/timezone-throttle/back-in-region", Fixture, NULL,
+                    fixture_set_up, test_back_in_region, fixture_tear_down);
+        g_test_add ("/datetime/timezone-throttle/cancel", Fixture, NULL,
+                    fixture_set_up, test_cancel, fixture_tear_down);
+
+        return g_test_run ();
+}
@@ -1,6 +1,8 @@
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <locale.h>
 #include <math.h>
+#include <utime.h>
 
 /* Include directly to test static function 'convert_pos' */
 #include "tz.c"
@@ -46,6 +48,346 @@ test_convert_pos_safety (void)
 	g_assert_cmpfloat (convert_pos ("+123", 10), ==, 0.0);
 }
 
+#define N_ITERATIONS 100
+
+typedef struct {
+	gchar *dir;
+	gchar *data_file;
+	gchar *backward_file;
+	gchar *cache_file;
+} IndexFixture;
+
+static void
+index_fixture_set_up (IndexFixture  *fixture,
+		      gconstpointer  user_data)
+{
+	g_autofree gchar *contents = NULL;
+	gsize length;
+	g_autoptr(GError) error = NULL;
+
+	if (!g_file_get_contents (TZ_DATA_FILE, &contents, &length, NULL))
+		return;
+
+	fixture->dir = g_dir_make_tmp ("test-tz-XXXXXX", &error);
+	g_assert_no_error (error);
+
+	/* a copy, so that its modification time can be changed */
+	fixture->data_file = g_build_filename (fixture->dir, "zone.tab", NULL);
+	g_file_set_contents (fixture->data_file, contents, length, &error);
+	g_assert_no_error (error);
+
+	fixture->backward_file = g_build_filename (TEST_SRCDIR, "backward", NULL);
+	fixture->cache_file = g_build_filename (fixture->dir, "cache", "timezones.idx", NULL);
+}
+
+static void
+index_fixture_tear_down (IndexFixture  *fixture,
+			 gconstpointer  user_data)
+{
+	if (fixture->dir != NULL) {
+		g_autofree gchar *cache_dir = g_path_get_dirname (fixture->cache_file);
+
+		g_unlink (fixture->cache_file);
+		g_rmdir (cache_dir);
+		g_unlink (fixture->data_file);
+		g_rmdir (fixture->dir);
+	}
+
+	g_free (fixture->dir);
+	g_free (fixture->data_file);
+	g_free (fixture->backward_file);
+	g_free (fixture->cache_file);
+}
+
+static void
+test_index_matches_db (IndexFixture  *fixture,
+		       gconstpointer  user_data)
+{
+	TzDB *tz_db;
+	g_autoptr(TzIndex) index = NULL;
+	GHashTableIter iter;
+	gpointer alias, real;
+	guint i;
+
+	if (fixture->dir == NULL) {
+		g_test_skip ("No " TZ_DATA_FILE);
+		return;
+	}
+
+	tz_db = tz_load_db_from (fixture->data_file, fixture->backward_file);
+	index = tz_index_load_from (fixture->data_file, fixture->backward_file, fixture->cache_file);
+	g_assert_nonnull (index);
+
+	g_assert_cmpuint (tz_index_get_n_locations (index), ==, tz_db->locations->len);
+	for (i = 0; i < tz_db->locations->len; i++) {
+		TzLocation *expected = g_ptr_array_index (tz_db->locations, i);
+		TzLocation loc;
+
+		tz_index_get_location (index, i, &loc);
+		g_assert_cmpstr (loc.country, ==, expected->country);
+		g_assert_cmpstr (loc.zone, ==, expected->zone);
+		g_assert_cmpstr (loc.comment, ==, expected->comment);
+		g_assert_cmpfloat_with_epsilon (loc.latitude, expected->latitude, 1e-6);
+		g_assert_cmpfloat_with_epsilon (loc.longitude, expected->longitude, 1e-6);
+	}
+
+	g_hash_table_iter_init (&iter, tz_db->backward);
+	while (g_hash_table_iter_next (&iter, &alias, &real))
+		g_assert_cmpstr (tz_index_lookup_backward (index, alias), ==, real);
+	g_assert_null (tz_index_lookup_backward (index, "Not/A_Zone"));
+
+	tz_db_free (tz_db);
+}
+
+static void
+test_index_cache (IndexFixture  *fixture,
+		  gconstpointer  user_data)
+{
+	g_autoptr(TzIndex) index = NULL;
+	struct utimbuf times = { 0, 0 };
+
+	if (fixture->dir == NULL) {
+		g_test_skip ("No " TZ_DATA_FILE);
+		return;
+	}
+
+	index = tz_index_load_from (fixture->data_file, fixture->backward_file, fixture->cache_file);
+	g_assert_nonnull (index);
+	g_assert_true (g_file_test (fixture->cache_file, G_FILE_TEST_IS_REGULAR));
+	g_assert_true (tz_index_is_current (index, fixture->data_file, fixture->backward_file));
+	g_clear_pointer (&index, tz_index_unref);
+
+	/* loaded from the cache */
+	index = tz_index_load_from (fixture->data_file, fixture->backward_file, fixture->cache_file);
+	g_assert_nonnull (index);
+	g_assert_true (tz_index_is_current (index, fixture->data_file, fixture->backward_file));
+
+	/* tzdata updates invalidate it */
+	g_assert_cmpint (g_utime (fixture->data_file, &times), ==, 0);
+	g_assert_false (tz_index_is_current (index, fixture->data_file, fixture->backward_file));
+	g_clear_pointer (&index, tz_index_unref);
+
+	index = tz_index_load_from (fixture->data_file, fixture->backward_file, fixture->cache_file);
+	g_assert_nonnull (index);
+	g_assert_true (tz_index_is_current (index, fixture->data_file, fixture->backward_file));
+}
+
+static void
+test_index_corrupt (IndexFixture  *fixture,
+		    gconstpointer  user_data)
+{
+	g_autoptr(TzIndex) index = NULL;
+	g_autoptr(GError) error = NULL;
+
+	if (fixture->dir == NULL) {
+		g_test_skip ("No " TZ_DATA_FILE);
+		return;
+	}
+
+	index = tz_index_load_from (fixture->data_file, fixture->backward_file, fixture->cache_file);
+	g_assert_nonnull (index);
+	g_clear_pointer (&index, tz_index_unref);
+
+	g_file_set_contents (fixture->cache_file, TZ_INDEX_MAGIC "garbage", -1, &error);
+	g_assert_no_error (error);
+
+	index = tz_index_load_from (fixture->data_file, fixture->backward_file, fixture->cache_file);
+	g_assert_nonnull (index);
+	g_assert_cmpuint (tz_index_get_n_locations (index), >, 0);
+}
+
+static void
+test_index_benchmark (IndexFixture  *fixture,
+		      gconstpointer  user_data)
+{
+	gint64 start, parsed, indexed;
+	guint i;
+
+	if (fixture->dir == NULL) {
+		g_test_skip ("No " TZ_DATA_FILE);
+		return;
+	}
+
+	/* build the cache */
+	tz_index_unref (tz_index_load_from (fixture->data_file, fixture->backward_file, fixture->cache_file));
+
+	start = g_get_monotonic_time ();
+	for (i = 0; i < N_ITERATIONS; i++) {
+		TzDB *tz_db = tz_load_db_from (fixture->data_file, fixture->backward_file);
+
+		g_assert_nonnull (g_hash_table_lookup (tz_db->backward, "America/Buenos_Aires"));
+		tz_db_free (tz_db);
+	}
+	parsed = g_get_monotonic_time () - start;
+
+	start = g_get_monotonic_time ();
+	for (i = 0; i < N_ITERATIONS; i++) {
+		TzIndex *index = tz_index_load_from (fixture->data_file, fixture->backward_file, fixture->cache_file);
+
+		g_assert_nonnull (tz_index_lookup_backward (index, "America/Buenos_Aires"));
+		tz_index_unref (index);
+	}
+	indexed = g_get_monotonic_time () - start;
+
+	g_test_message ("%u loads: %" G_GINT64_FORMAT " us parsing zone.tab, "
+			"%" G_GINT64_FORMAT " us mapping the index",
+			N_ITERATIONS, parsed, indexed);
+}
+
+#define N_TREE_LOCATIONS 5000
+#define N_TREE_QUERIES   1000
+
+static const char *countries[] = { "FR", "BR", "US", "NZ", "JP" };
+
+static void
+random_position (GRand   *rand,
+		 gdouble *latitude,
+		 gdouble *longitude)
+{
+	/* uniform on the sphere */
+	*latitude = asin (g_rand_double_range (rand, -1, 1)) * 180.0 / G_PI;
+	*longitude = g_rand_double_range (rand, -180, 180);
+}
+
+static TzLocation *
+brute_force_nearest (TzLocation  *locations,
+		     guint        n_locations,
+		     gdouble      latitude,
+		     gdouble      longitude,
+		     const char  *country_code)
+{
+	TzLocation *best = NULL;
+	gdouble target[3], best_chord2 = G_MAXDOUBLE;
+	guint i;
+
+	lat_long_to_vector (latitude, longitude, target);
+
+	for (i = 0; i < n_locations; i++) {
+		gdouble pos[3];
+		gdouble d2;
+
+		if (country_code != NULL &&
+		    g_ascii_strcasecmp (locations[i].country, country_code) != 0)
+			continue;
+
+		lat_long_to_vector (locations[i].latitude, locations[i].longitude, pos);
+		d2 = chord2 (pos, target);
+		if (d2 < best_chord2) {
+			best = &locations[i];
+			best_chord2 = d2;
+		}
+	}
+
+	return best;
+}
+
+static TzLocation *
+random_locations (GRand *rand)
+{
+	TzLocation *locations;
+	guint i;
+
+	locations = g_new0 (TzLocation, N_TREE_LOCATIONS);
+	for (i = 0; i < N_TREE_LOCATIONS; i++) {
+		random_position (rand, &locations[i].latitude, &locations[i].longitude);
+		locations[i].country = (gchar *) countries[i % G_N_ELEMENTS (countries)];
+		locations[i].zone = (gchar *) "Test/Zone";
+	}
+
+	return locations;
+}
+
+static TzTree *
+tree_for_locations (TzLocation *locations,
+		    guint       n_locations)
+{
+	g_autofree TzLocation **pointers = NULL;
+	guint i;
+
+	pointers = g_new (TzLocation *, n_locations);
+	for (i = 0; i < n_locations; i++)
+		pointers[i] = &locations[i];
+
+	return tz_tree_new (pointers, n_locations);
+}
+
+static void
+test_tree_nearest (void)
+{
+	g_autoptr(GRand) rand = g_rand_new_with_seed (42);
+	g_autofree TzLocation *locations = NULL;
+	g_autoptr(TzTree) tree = NULL;
+	g_autoptr(TzTree) empty = NULL;
+	guint i;
+
+	locations = random_locations (rand);
+	tree = tree_for_locations (locations, N_TREE_LOCATIONS);
+
+	for (i = 0; i < N_TREE_QUERIES; i++) {
+		const char *country = (i % 2) ? countries[i % G_N_ELEMENTS (countries)] : NULL;
+		gdouble latitude, longitude;
+
+		random_position (rand, &latitude, &longitude);
+		g_assert_true (tz_tree_find_nearest (tree, latitude, longitude, country, NULL) ==
+			       brute_force_nearest (locations, N_TREE_LOCATIONS, latitude, longitude, country));
+	}
+
+	g_assert_null (tz_tree_find_nearest (tree, 0, 0, "XX", NULL));
+
+	empty = tree_for_locations (NULL, 0);
+	g_assert_null (tz_tree_find_nearest (empty, 0, 0, NULL, NULL));
+}
+
+static void
+test_tree_distance (void)
+{
+	TzLocation paris = { (gchar *) "FR", 48.8566, 2.3522, (gchar *) "Europe/Paris", NULL, 0 };
+	TzLocation *pointers[] = { &paris };
+	g_autoptr(TzTree) tree = NULL;
+	gdouble distance;
+
+	tree = tz_tree_new (pointers, G_N_ELEMENTS (pointers));
+
+	/* London */
+	g_assert_true (tz_tree_find_nearest (tree, 51.5074, -0.1278, "fr", &distance) == &paris);
+	g_assert_cmpfloat_with_epsilon (distance, 343.5, 1.0);
+}
+
+static void
+test_tree_benchmark (void)
+{
+	g_autoptr(GRand) rand = g_rand_new_with_seed (7);
+	g_autofree TzLocation *locations = NULL;
+	g_autoptr(TzTree) tree = NULL;
+	gint64 start, brute_force, lookups;
+	guint i;
+
+	locations = random_locations (rand);
+
+	start = g_get_monotonic_time ();
+	for (i = 0; i < N_TREE_QUERIES; i++) {
+		gdouble latitude, longitude;
+
+		random_position (rand, &latitude, &longitude);
+		brute_force_nearest (locations, N_TREE_LOCATIONS, latitude, longitude, "FR");
+	}
+	brute_force = g_get_monotonic_time () - start;
+
+	start = g_get_monotonic_time ();
+	tree = tree_for_locations (locations, N_TREE_LOCATIONS);
+	for (i = 0; i < N_TREE_QUERIES; i++) {
+		gdouble latitude, longitude;
+
+		random_position (rand, &latitude, &longitude);
+		tz_tree_find_nearest (tree, latitude, longitude, "FR", NULL);
+	}
+	lookups = g_get_monotonic_time () - start;
+
+	g_test_message ("%u lookups among %u locations: %" G_GINT64_FORMAT " us scanning, "
+			"%" G_GINT64_FORMAT " us building and searching a tree",
+			N_TREE_QUERIES, N_TREE_LOCATIONS, brute_force, lookups);
+}
+
 int
 main (int argc, char **argv)
 {
@@ -58,5 +400,20 @@ main (int argc, char **argv)
 	g_test_add_func ("/tz/parsing/contiguous_nyc", test_convert_pos_contiguous_nyc);
 	g_test_add_func ("/tz/parsing/safety", test_convert_pos_safety);
 
+	g_test_add_func ("/tz/tree/nearest", test_tree_nearest);
+	g_test_add_func ("/tz/tree/distance", test_tree_distance);
+	if (g_test_perf ())
+		g_test_add_func ("/tz/tree/benchmark", test_tree_benchmark);
+
+	g_test_add ("/tz/index/matches-db", IndexFixture, NULL,
+		    index_fixture_set_up, test_index_matches_db, index_fixture_tear_down);
+	g_test_add ("/tz/index/cache", IndexFixture, NULL,
+		    index_fixture_set_up, test_index_cache, index_fixture_tear_down);
+	g_test_add ("/tz/index/corrupt", IndexFixture, NULL,
+		    index_fixture_set_up, test_index_corrupt, index_fixture_tear_down);
+	if (g_test_perf ())
+		g_test_add ("/tz/index/benchmark", IndexFixture, NULL,
+			    index_fixture_set_up, test_index_benchmark, index_fixture_tear_down);
+
 	return g_test_run ();
 }
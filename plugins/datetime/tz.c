@@ -23,6 +23,7 @@
 
 
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -30,6 +31,7 @@
 #include <math.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
 #include "tz.h"
 
 
@@ -39,7 +41,8 @@ static gdouble convert_pos (const gchar *pos, gint digits);
 static int compare_country_names (const void *a, const void *b);
 static void sort_locations_by_country (GPtrArray *locations);
 static gchar * tz_data_file_get (void);
-static void load_backward_tz (TzDB *tz_db);
+static void load_backward_tz (TzDB *tz_db, const char *backward_file);
+static TzDB *tz_load_db_from (const char *tz_data_file, const char *backward_file);
 
 /* ---------------- *
  * Public interface *
@@ -49,18 +52,30 @@ tz_load_db (void)
 {
 	gchar *tz_data_file;
 	TzDB *tz_db;
-	FILE *tzfile;
-	char buf[4096];
 
 	tz_data_file = tz_data_file_get ();
 	if (!tz_data_file) {
 		g_warning ("Could not get the TimeZone data file name");
 		return NULL;
 	}
+
+	tz_db = tz_load_db_from (tz_data_file, TZ_BACKWARD_FILE);
+	g_free (tz_data_file);
+
+	return tz_db;
+}
+
+static TzDB *
+tz_load_db_from (const char *tz_data_file,
+		 const char *backward_file)
+{
+	TzDB *tz_db;
+	FILE *tzfile;
+	char buf[4096];
+
 	tzfile = fopen (tz_data_file, "r");
 	if (!tzfile) {
 		g_warning ("Could not open *%s*\n", tz_data_file);
-		g_free (tz_data_file);
 		return NULL;
 	}
 
@@ -122,11 +137,9 @@ tz_load_db (void)
 	
 	/* now sort by country */
 	sort_locations_by_country (tz_db->locations);
-	
-	g_free (tz_data_file);
 
 	/* Load up the hashtable of backward links */
-	load_backward_tz (tz_db);
+	load_backward_tz (tz_db, backward_file);
 
 	return tz_db;
 }
@@ -352,6 +365,595 @@ tz_info_get_clean_name (TzDB *tz_db,
 	return g_strdup (ret);
 }
 
+/* ------------- *
+ * Compact index *
+ * ------------- */
+
+#define TZ_INDEX_MAGIC "GSDTZIX"
+#define TZ_INDEX_VERSION 1
+#define TZ_INDEX_SCALE 1000000.0 /* coordinates are stored in micro-degrees */
+
+typedef struct {
+	gchar   magic[8];
+	guint32 version;
+	guint32 n_locations;
+	guint32 n_aliases;
+	guint32 strings_size;
+	/* of the files the index was built from */
+	gint64  data_file_mtime;
+	gint64  backward_file_mtime;
+} TzIndexHeader;
+
+/* Strings are offsets into the string pool, which starts with an empty
+ * string so that 0 can stand for none */
+typedef struct {
+	gint32  latitude;
+	gint32  longitude;
+	guint32 country;
+	guint32 zone;
+	guint32 comment;
+} TzIndexLocation;
+
+/* sorted by alias */
+typedef struct {
+	guint32 alias;
+	guint32 real;
+} TzIndexAlias;
+
+struct _TzIndex
+{
+	gatomicrefcount ref_count;
+
+	GBytes *bytes;
+	const TzIndexHeader *header;
+	const TzIndexLocation *locations;
+	const TzIndexAlias *aliases;
+	const gchar *strings;
+};
+
+static TzIndex *default_index = NULL;
+G_LOCK_DEFINE_STATIC (default_index);
+
+static gint64
+get_mtime (const char *path)
+{
+	GStatBuf buf;
+
+	if (g_stat (path, &buf) != 0)
+		return -1;
+
+	return buf.st_mtime;
+}
+
+static gboolean
+tz_index_is_current (TzIndex    *index,
+		     const char *data_file,
+		     const char *backward_file)
+{
+	return index->header->data_file_mtime == get_mtime (data_file) &&
+	       index->header->backward_file_mtime == get_mtime (backward_file);
+}
+
+static guint32
+add_string (GString    *strings,
+	    GHashTable *offsets,
+	    const char *str)
+{
+	gpointer offset;
+
+	if (str == NULL || *str == '\0')
+		return 0;
+
+	if (g_hash_table_lookup_extended (offsets, str, NULL, &offset))
+		return GPOINTER_TO_UINT (offset);
+
+	offset = GUINT_TO_POINTER (strings->len);
+	g_string_append_len (strings, str, strlen (str) + 1);
+	g_hash_table_insert (offsets, (gpointer) str, offset);
+
+	return GPOINTER_TO_UINT (offset);
+}
+
+static int
+compare_aliases (gconstpointer a,
+		 gconstpointer b,
+		 gpointer      user_data)
+{
+	const char *strings = user_data;
+	const TzIndexAlias *alias_a = a;
+	const TzIndexAlias *alias_b = b;
+
+	return strcmp (strings + alias_a->alias, strings + alias_b->alias);
+}
+
+static GBytes *
+tz_index_build (const char *data_file,
+		const char *backward_file)
+{
+	TzDB *tz_db;
+	TzIndexHeader header = { TZ_INDEX_MAGIC, TZ_INDEX_VERSION, };
+	g_autoptr(GHashTable) offsets = NULL;
+	g_autoptr(GArray) locations = NULL;
+	g_autoptr(GArray) aliases = NULL;
+	GString *strings;
+	GByteArray *data;
+	GHashTableIter iter;
+	gpointer alias, real;
+	guint i;
+
+	/* read the mtimes first, a change while reading must not be missed */
+	header.data_file_mtime = get_mtime (data_file);
+	header.backward_file_mtime = get_mtime (backward_file);
+
+	tz_db = tz_load_db_from (data_file, backward_file);
+	if (tz_db == NULL)
+		return NULL;
+
+	offsets = g_hash_table_new (g_str_hash, g_str_equal);
+	strings = g_string_new_len ("", 1);
+
+	locations = g_array_sized_new (FALSE, FALSE, sizeof (TzIndexLocation), tz_db->locations->len);
+	for (i = 0; i < tz_db->locations->len; i++) {
+		TzLocation *loc = g_ptr_array_index (tz_db->locations, i);
+		TzIndexLocation entry;
+
+		entry.latitude = (gint32) round (loc->latitude * TZ_INDEX_SCALE);
+		entry.longitude = (gint32) round (loc->longitude * TZ_INDEX_SCALE);
+		entry.country = add_string (strings, offsets, loc->country);
+		entry.zone = add_string (strings, offsets, loc->zone);
+		entry.comment = add_string (strings, offsets, loc->comment);
+		g_array_append_val (locations, entry);
+	}
+
+	aliases = g_array_sized_new (FALSE, FALSE, sizeof (TzIndexAlias), g_hash_table_size (tz_db->backward));
+	g_hash_table_iter_init (&iter, tz_db->backward);
+	while (g_hash_table_iter_next (&iter, &alias, &real)) {
+		TzIndexAlias entry;
+
+		entry.alias = add_string (strings, offsets, alias);
+		entry.real = add_string (strings, offsets, real);
+		g_array_append_val (aliases, entry);
+	}
+	g_array_sort_with_data (aliases, compare_aliases, strings->str);
+
+	header.n_locations = locations->len;
+	header.n_aliases = aliases->len;
+	header.strings_size = strings->len;
+
+	data = g_byte_array_sized_new (sizeof (header) +
+				       locations->len * sizeof (TzIndexLocation) +
+				       aliases->len * sizeof (TzIndexAlias) +
+				       strings->len);
+	g_byte_array_append (data, (const guint8 *) &header, sizeof (header));
+	g_byte_array_append (data, (const guint8 *) locations->data, locations->len * sizeof (TzIndexLocation));
+	g_byte_array_append (data, (const guint8 *) aliases->data, aliases->len * sizeof (TzIndexAlias));
+	g_byte_array_append (data, (const guint8 *) strings->str, strings->len);
+
+	/* the hash table keys point into the database */
+	g_clear_pointer (&offsets, g_hash_table_unref);
+	g_string_free (strings, TRUE);
+	tz_db_free (tz_db);
+
+	return g_byte_array_free_to_bytes (data);
+}
+
+static TzIndex *
+tz_index_new_for_bytes (GBytes *bytes)
+{
+	TzIndex *index;
+	const guint8 *data;
+	const TzIndexHeader *header;
+	gsize size, expected;
+	guint i;
+
+	data = g_bytes_get_data (bytes, &size);
+	if (size < sizeof (TzIndexHeader))
+		return NULL;
+
+	header = (const TzIndexHeader *) data;
+	if (memcmp (header->magic, TZ_INDEX_MAGIC, sizeof (header->magic)) != 0 ||
+	    header->version != TZ_INDEX_VERSION)
+		return NULL;
+
+	expected = sizeof (TzIndexHeader) +
+		   (gsize) header->n_locations * sizeof (TzIndexLocation) +
+		   (gsize) header->n_aliases * sizeof (TzIndexAlias) +
+		   header->strings_size;
+	if (size != expected || header->strings_size == 0)
+		return NULL;
+
+	index = g_new0 (TzIndex, 1);
+	g_atomic_ref_count_init (&index->ref_count);
+	index->bytes = g_bytes_ref (bytes);
+	index->header = header;
+	index->locations = (const TzIndexLocation *) (header + 1);
+	index->aliases = (const TzIndexAlias *) (index->locations + header->n_locations);
+	index->strings = (const gchar *) (index->aliases + header->n_aliases);
+
+	/* don't trust a file on disk to be sane */
+	if (index->strings[header->strings_size - 1] != '\0')
+		goto invalid;
+	for (i = 0; i < header->n_locations; i++) {
+		const TzIndexLocation *loc = &index->locations[i];
+
+		if (loc->country >= header->strings_size ||
+		    loc->zone >= header->strings_size ||
+		    loc->comment >= header->strings_size)
+			goto invalid;
+	}
+	for (i = 0; i < header->n_aliases; i++) {
+		if (index->aliases[i].alias >= header->strings_size ||
+		    index->aliases[i].real >= header->strings_size)
+			goto invalid;
+	}
+
+	return index;
+
+invalid:
+	tz_index_unref (index);
+	return NULL;
+}
+
+static TzIndex *
+tz_index_load_from (const char *data_file,
+		    const char *backward_file,
+		    const char *cache_file)
+{
+	g_autoptr(GMappedFile) mapped = NULL;
+	g_autoptr(GBytes) bytes = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autofree char *cache_dir = NULL;
+	TzIndex *index;
+
+	mapped = g_mapped_file_new (cache_file, FALSE, NULL);
+	if (mapped != NULL) {
+		bytes = g_mapped_file_get_bytes (mapped);
+		index = tz_index_new_for_bytes (bytes);
+		if (index != NULL && tz_index_is_current (index, data_file, backward_file))
+			return index;
+		g_clear_pointer (&index, tz_index_unref);
+		g_clear_pointer (&bytes, g_bytes_unref);
+	}
+
+	g_debug ("Building timezone index %s", cache_file);
+
+	bytes = tz_index_build (data_file, backward_file);
+	if (bytes == NULL)
+		return NULL;
+
+	/* not being able to cache the index is no reason to fail */
+	cache_dir = g_path_get_dirname (cache_file);
+	if (g_mkdir_with_parents (cache_dir, 0755) < 0 ||
+	    !g_file_set_contents (cache_file,
+				  g_bytes_get_data (bytes, NULL),
+				  g_bytes_get_size (bytes),
+				  &error)) {
+		g_debug ("Failed to save timezone index: %s",
+			 error ? error->message : g_strerror (errno));
+	}
+
+	return tz_index_new_for_bytes (bytes);
+}
+
+/**
+ * tz_index_get_default:
+ *
+ * Returns the index for the system tzdata, which is checked against the
+ * modification times of the tzdata files on every call, and only loaded
+ * again if they changed.
+ *
+ * Returns: (transfer full) (nullable): the index
+ */
+TzIndex *
+tz_index_get_default (void)
+{
+	g_autofree gchar *tz_data_file = NULL;
+	g_autofree gchar *cache_file = NULL;
+	TzIndex *index;
+
+	tz_data_file = tz_data_file_get ();
+
+	G_LOCK (default_index);
+
+	if (default_index != NULL &&
+	    !tz_index_is_current (default_index, tz_data_file, TZ_BACKWARD_FILE))
+		g_clear_pointer (&default_index, tz_index_unref);
+
+	if (default_index == NULL) {
+		cache_file = g_build_filename (g_get_user_cache_dir (),
+					       "gnome-settings-daemon",
+					       "timezones.idx",
+					       NULL);
+		default_index = tz_index_load_from (tz_data_file, TZ_BACKWARD_FILE, cache_file);
+	}
+
+	index = default_index ? tz_index_ref (default_index) : NULL;
+
+	G_UNLOCK (default_index);
+
+	return index;
+}
+
+TzIndex *
+tz_index_ref (TzIndex *index)
+{
+	g_atomic_ref_count_inc (&index->ref_count);
+	return index;
+}
+
+void
+tz_index_unref (TzIndex *index)
+{
+	if (!g_atomic_ref_count_dec (&index->ref_count))
+		return;
+
+	g_bytes_unref (index->bytes);
+	g_free (index);
+}
+
+guint
+tz_index_get_n_locations (TzIndex *index)
+{
+	return index->header->n_locations;
+}
+
+/**
+ * tz_index_get_location:
+ *
+ * Fills in @loc with the location at @i. The strings in it belong to
+ * @index, so it must not be passed to tz_location_free().
+ */
+void
+tz_index_get_location (TzIndex    *index,
+		       guint       i,
+		       TzLocation *loc)
+{
+	const TzIndexLocation *entry;
+
+	g_return_if_fail (i < index->header->n_locations);
+
+	entry = &index->locations[i];
+	loc->country = (gchar *) index->strings + entry->country;
+	loc->zone = (gchar *) index->strings + entry->zone;
+	loc->comment = entry->comment ? (gchar *) index->strings + entry->comment : NULL;
+	loc->latitude = entry->latitude / TZ_INDEX_SCALE;
+	loc->longitude = entry->longitude / TZ_INDEX_SCALE;
+	loc->dist = 0;
+}
+
+const char *
+tz_index_lookup_backward (TzIndex    *index,
+			  const char *alias)
+{
+	guint lo = 0, hi = index->header->n_aliases;
+
+	while (lo < hi) {
+		guint mid = lo + (hi - lo) / 2;
+		int cmp = strcmp (alias, index->strings + index->aliases[mid].alias);
+
+		if (cmp == 0)
+			return index->strings + index->aliases[mid].real;
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return NULL;
+}
+
+/* -------- *
+ * k-d tree *
+ * -------- */
+
+#define EARTH_RADIUS 6372.795 /* km */
+
+/* Points are kept as unit vectors, the chord between two of them grows
+ * with the distance on the surface, without any trigonometry in lookups */
+typedef struct {
+	gdouble     pos[3];
+	TzLocation *loc;
+} TzTreeNode;
+
+struct _TzTree
+{
+	TzTreeNode *nodes;
+	guint       n_nodes;
+};
+
+static void
+lat_long_to_vector (gdouble  latitude,
+		    gdouble  longitude,
+		    gdouble *pos)
+{
+	gdouble lat = latitude * G_PI / 180.0;
+	gdouble lon = longitude * G_PI / 180.0;
+
+	pos[0] = cos (lat) * cos (lon);
+	pos[1] = cos (lat) * sin (lon);
+	pos[2] = sin (lat);
+}
+
+static gdouble
+chord2 (const gdouble *a,
+	const gdouble *b)
+{
+	gdouble dx = a[0] - b[0];
+	gdouble dy = a[1] - b[1];
+	gdouble dz = a[2] - b[2];
+
+	return dx * dx + dy * dy + dz * dz;
+}
+
+static void
+swap_nodes (TzTreeNode *nodes,
+	    guint       a,
+	    guint       b)
+{
+	TzTreeNode tmp = nodes[a];
+
+	nodes[a] = nodes[b];
+	nodes[b] = tmp;
+}
+
+/* Partially sorts [lo, hi) along @axis so that @k is in its final place */
+static void
+select_node (TzTreeNode *nodes,
+	     guint       lo,
+	     guint       hi,
+	     guint       k,
+	     guint       axis)
+{
+	while (hi - lo > 1) {
+		gdouble pivot;
+		guint store, i;
+
+		swap_nodes (nodes, lo + (hi - lo) / 2, hi - 1);
+		pivot = nodes[hi - 1].pos[axis];
+
+		store = lo;
+		for (i = lo; i < hi - 1; i++) {
+			if (nodes[i].pos[axis] < pivot)
+				swap_nodes (nodes, i, store++);
+		}
+		swap_nodes (nodes, store, hi - 1);
+
+		if (k == store)
+			return;
+		if (k < store)
+			hi = store;
+		else
+			lo = store + 1;
+	}
+}
+
+/* The node of [lo, hi) is its middle, the halves are its subtrees */
+static void
+build_tree (TzTreeNode *nodes,
+	    guint       lo,
+	    guint       hi,
+	    guint       depth)
+{
+	guint mid;
+
+	if (hi - lo <= 1)
+		return;
+
+	mid = lo + (hi - lo) / 2;
+	select_node (nodes, lo, hi, mid, depth % 3);
+	build_tree (nodes, lo, mid, depth + 1);
+	build_tree (nodes, mid + 1, hi, depth + 1);
+}
+
+TzTree *
+tz_tree_new (TzLocation **locations,
+	     guint        n_locations)
+{
+	TzTree *tree;
+	guint i;
+
+	tree = g_new0 (TzTree, 1);
+	tree->nodes = g_new (TzTreeNode, n_locations);
+	tree->n_nodes = n_locations;
+
+	for (i = 0; i < n_locations; i++) {
+		lat_long_to_vector (locations[i]->latitude,
+				    locations[i]->longitude,
+				    tree->nodes[i].pos);
+		tree->nodes[i].loc = locations[i];
+	}
+
+	build_tree (tree->nodes, 0, n_locations, 0);
+
+	return tree;
+}
+
+void
+tz_tree_free (TzTree *tree)
+{
+	g_free (tree->nodes);
+	g_free (tree);
+}
+
+static void
+search_tree (TzTree         *tree,
+	     guint           lo,
+	     guint           hi,
+	     guint           depth,
+	     const gdouble  *target,
+	     const char     *country_code,
+	     TzTreeNode    **best,
+	     gdouble        *best_chord2)
+{
+	TzTreeNode *node;
+	guint mid, axis;
+	gdouble diff;
+
+	if (lo >= hi)
+		return;
+
+	mid = lo + (hi - lo) / 2;
+	node = &tree->nodes[mid];
+	axis = depth % 3;
+
+	if (country_code == NULL ||
+	    (node->loc->country != NULL &&
+	     g_ascii_strcasecmp (node->loc->country, country_code) == 0)) {
+		gdouble d2 = chord2 (node->pos, target);
+
+		if (d2 < *best_chord2) {
+			*best = node;
+			*best_chord2 = d2;
+		}
+	}
+
+	/* the side of the target first, the other one only if the
+	 * splitting plane is closer than the best match so far */
+	diff = target[axis] - node->pos[axis];
+	if (diff < 0) {
+		search_tree (tree, lo, mid, depth + 1, target, country_code, best, best_chord2);
+		if (diff * diff < *best_chord2)
+			search_tree (tree, mid + 1, hi, depth + 1, target, country_code, best, best_chord2);
+	} else {
+		search_tree (tree, mid + 1, hi, depth + 1, target, country_code, best, best_chord2);
+		if (diff * diff < *best_chord2)
+			search_tree (tree, lo, mid, depth + 1, target, country_code, best, best_chord2);
+	}
+}
+
+/**
+ * tz_tree_find_nearest:
+ * @tree: a #TzTree
+ * @latitude: latitude of the point
+ * @longitude: longitude of the point
+ * @country_code: (nullable): only consider locations in this country
+ * @distance: (out) (optional): the distance in km
+ *
+ * Returns: (nullable): the location closest to the point
+ */
+TzLocation *
+tz_tree_find_nearest (TzTree     *tree,
+		      gdouble     latitude,
+		      gdouble     longitude,
+		      const char *country_code,
+		      gdouble    *distance)
+{
+	TzTreeNode *best = NULL;
+	gdouble best_chord2 = G_MAXDOUBLE;
+	gdouble target[3];
+
+	lat_long_to_vector (latitude, longitude, target);
+	search_tree (tree, 0, tree->n_nodes, 0, target, country_code, &best, &best_chord2);
+
+	if (best == NULL)
+		return NULL;
+
+	if (distance != NULL)
+		*distance = 2 * EARTH_RADIUS * asin (MIN (sqrt (best_chord2) / 2, 1.0));
+
+	return best->loc;
+}
+
 /* ----------------- *
  * Private functions *
  * ----------------- */
@@ -461,7 +1063,7 @@ sort_locations_by_country (GPtrArray *locations)
 }
 
 static void
-load_backward_tz (TzDB *tz_db)
+load_backward_tz (TzDB *tz_db, const char *backward_file)
 {
   GError *error = NULL;
   char **lines, *contents;
@@ -469,7 +1071,7 @@ load_backward_tz (TzDB *tz_db)
 
   tz_db->backward = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
 
-  if (g_file_get_contents (GNOMECC_DATA_DIR "/datetime/backward", &contents, NULL, &error) == FALSE)
+  if (g_file_get_contents (backward_file, &contents, NULL, &error) == FALSE)
     {
       g_warning ("Failed to load 'backward' file: %s", error->message);
       return;
@@ -33,9 +33,13 @@
 #  define TZ_DATA_FILE "/usr/share/lib/zoneinfo/tab/zone_sun.tab"
 #endif
 
+#define TZ_BACKWARD_FILE GNOMECC_DATA_DIR "/datetime/backward"
+
 typedef struct _TzDB TzDB;
 typedef struct _TzLocation TzLocation;
 typedef struct _TzInfo TzInfo;
+typedef struct _TzIndex TzIndex;
+typedef struct _TzTree TzTree;
 
 
 struct _TzDB
@@ -86,4 +90,30 @@ gint       tz_location_set_locally    (TzLocation *loc);
 TzInfo    *tz_info_from_location      (TzLocation *loc);
 void       tz_info_free               (TzInfo *tz_info);
 
+/* The same data as a TzDB, cached in a compact binary file that is only
+ * rebuilt when the tzdata files change, and mapped into memory */
+TzIndex    *tz_index_get_default       (void);
+TzIndex    *tz_index_ref               (TzIndex *index);
+void        tz_index_unref             (TzIndex *index);
+guint       tz_index_get_n_locations   (TzIndex *index);
+void        tz_index_get_location      (TzIndex *index,
+					guint i,
+					TzLocation *loc);
+const char *tz_index_lookup_backward   (TzIndex *index,
+					const char *alias);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (TzIndex, tz_index_unref)
+
+/* A k-d tree for finding the location closest to a point */
+TzTree     *tz_tree_new                (TzLocation **locations,
+					guint n_locations);
+void        tz_tree_free               (TzTree *tree);
+TzLocation *tz_tree_find_nearest       (TzTree *tree,
+					gdouble latitude,
+					gdouble longitude,
+					const char *country_code,
+					gdouble *distance);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (TzTree, tz_tree_free)
+
 #endif
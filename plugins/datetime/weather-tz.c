@@ -24,22 +24,22 @@
 
 #include <libgweather/gweather.h>
 
-static GList *
-location_get_cities (GWeatherLocation *parent_location)
+/* The cities of a country with a known timezone, and a tree of them */
+typedef struct {
+        TzLocation *locations;
+        guint       n_locations;
+        TzTree     *tree;
+} CountryCities;
+
+/* upper-case country code → CountryCities */
+static GHashTable *countries = NULL;
+
+static void
+country_cities_free (CountryCities *cities)
 {
-        GList *cities = NULL;
-        GWeatherLocation *child = NULL;
-
-        while ((child = gweather_location_next_child (parent_location, child))) {
-                if (gweather_location_get_level (child) == GWEATHER_LOCATION_CITY) {
-                        cities = g_list_prepend (cities, g_object_ref (child));
-                } else {
-                        cities = g_list_concat (cities,
-                                                location_get_cities (child));
-                }
-        }
-
-        return cities;
+        tz_tree_free (cities->tree);
+        g_free (cities->locations);
+        g_free (cities);
 }
 
 static gboolean
@@ -48,71 +48,109 @@ weather_location_has_timezone (GWeatherLocation *loc)
         return gweather_location_get_timezone (loc) != NULL;
 }
 
-/**
- * load_timezones:
- * @cities: a list of #GWeatherLocation
- *
- * Returns: a list of #TzLocation
- */
-static GList *
-load_timezones (GList *cities)
+static void
+add_city (GArray           *locations,
+          GWeatherLocation *city)
 {
-        GList *l;
-        GList *tz_locations = NULL;
-
-        for (l = cities; l; l = l->next) {
-                TzLocation *loc;
-                const gchar *country;
-                const gchar *timezone_id;
-                GTimeZone *tz;
-                gdouble latitude;
-                gdouble longitude;
-
-                if (!gweather_location_has_coords (l->data) ||
-                    !weather_location_has_timezone (l->data)) {
-                        g_debug ("Incomplete GWeather location entry: (%s) %s",
-                                 gweather_location_get_country (l->data),
-                                 gweather_location_get_city_name (l->data));
-                        continue;
-                }
-
-                country = gweather_location_get_country (l->data);
-                tz = gweather_location_get_timezone (l->data);
-                timezone_id = g_time_zone_get_identifier (tz);
-                gweather_location_get_coords (l->data,
-                                              &latitude,
-                                              &longitude);
-
-                loc = g_new0 (TzLocation, 1);
-                loc->country = g_strdup (country);
-                loc->latitude = latitude;
-                loc->longitude = longitude;
-                loc->zone = g_strdup (timezone_id);
-                loc->comment = NULL;
-
-                tz_locations = g_list_prepend (tz_locations, loc);
+        TzLocation loc = { 0, };
+        GTimeZone *tz;
+
+        if (!gweather_location_has_coords (city) ||
+            !weather_location_has_timezone (city)) {
+                g_debug ("Incomplete GWeather location entry: (%s) %s",
+                         gweather_location_get_country (city),
+                         gweather_location_get_city_name (city));
+                return;
         }
 
-        return tz_locations;
+        tz = gweather_location_get_timezone (city);
+        gweather_location_get_coords (city,
+                                      &loc.latitude,
+                                      &loc.longitude);
+
+        /* there are few distinct zones and countries, so share the strings */
+        loc.country = (gchar *) g_intern_string (gweather_location_get_country (city));
+        loc.zone = (gchar *) g_intern_string (g_time_zone_get_identifier (tz));
+        loc.comment = NULL;
+
+        g_array_append_val (locations, loc);
+}
+
+/* appends the cities below @parent_location to @locations */
+static void
+collect_cities (GWeatherLocation *parent_location,
+                GArray           *locations)
+{
+        GWeatherLocation *child = NULL;
+
+        while ((child = gweather_location_next_child (parent_location, child))) {
+                if (gweather_location_get_level (child) == GWEATHER_LOCATION_CITY)
+                        add_city (locations, child);
+                else
+                        collect_cities (child, locations);
+        }
 }
 
-GList *
-weather_tz_db_get_locations (const gchar *country_code)
+static CountryCities *
+load_country (const gchar *country_code)
 {
         g_autoptr(GWeatherLocation) world = NULL;
         g_autoptr(GWeatherLocation) country = NULL;
-        g_autolist(GWeatherLocation) cities = NULL;
-        GList *tz_locations;
+        g_autoptr(GArray) locations = NULL;
+        g_autofree TzLocation **pointers = NULL;
+        CountryCities *cities;
+        guint i;
 
-        world = gweather_location_get_world ();
+        locations = g_array_new (FALSE, FALSE, sizeof (TzLocation));
 
+        world = gweather_location_get_world ();
         country = gweather_location_find_by_country_code (world, country_code);
+        if (country != NULL)
+                collect_cities (country, locations);
+
+        g_debug ("Loaded %u GWeather locations for country '%s'",
+                 locations->len, country_code);
+
+        cities = g_new0 (CountryCities, 1);
+        cities->n_locations = locations->len;
+        cities->locations = (TzLocation *) g_array_free (g_steal_pointer (&locations), FALSE);
+
+        pointers = g_new (TzLocation *, cities->n_locations);
+        for (i = 0; i < cities->n_locations; i++)
+                pointers[i] = &cities->locations[i];
+        cities->tree = tz_tree_new (pointers, cities->n_locations);
+
+        return cities;
+}
 
-        if (!country)
+/**
+ * weather_tz_db_get_tree:
+ * @country_code: the country code
+ *
+ * The cities of a country are only looked up once, and kept for the
+ * lifetime of the process.
+ *
+ * Returns: (transfer none) (nullable): a tree of the cities in the country
+ */
+TzTree *
+weather_tz_db_get_tree (const gchar *country_code)
+{
+        g_autofree gchar *key = NULL;
+        CountryCities *cities;
+
+        if (country_code == NULL)
                 return NULL;
 
-        cities = location_get_cities (country);
-        tz_locations = load_timezones (cities);
+        if (countries == NULL)
+                countries = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                   g_free, (GDestroyNotify) country_cities_free);
+
+        key = g_ascii_strup (country_code, -1);
+        cities = g_hash_table_lookup (countries, key);
+        if (cities == NULL) {
+                cities = load_country (country_code);
+                g_hash_table_insert (countries, g_steal_pointer (&key), cities);
+        }
 
-        return tz_locations;
+        return cities->tree;
 }
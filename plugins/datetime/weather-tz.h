@@ -22,6 +22,8 @@
 
 #include <glib.h>
 
-GList           *weather_tz_db_get_locations    (const char *country);
+#include "tz.h"
+
+TzTree          *weather_tz_db_get_tree         (const char *country_code);
 
 #endif /* __WEATHER_TZ_H */
@@ -26,6 +26,8 @@
 #include <glib/gi18n.h>
 #include <libnotify/notify.h>
 
+#include "gsd-wall-clock.h"
+
 #define DONATE_URL "https://donate.gnome.org"
 #define DONATE_SCHEMA "org.gnome.settings-daemon.plugins.housekeeping"
 #define DONATE_LAST_SHOWN_KEY "donation-reminder-last-shown"
@@ -35,8 +37,9 @@
 #define HALF_A_YEAR_IN_USEC ((int64_t) 365 * DAY_IN_SEC * G_USEC_PER_SEC)
 
 static NotifyNotification *notification = NULL;
+static GsdWallClock *wall_clock = NULL;
 static guint check_timeout_id = 0;
-static gboolean first_run = TRUE;
+static int64_t not_before = 0;
 
 static void
 closed_cb (NotifyNotification *n)
@@ -112,17 +115,40 @@ check_show_notification (GSettings *settings)
 	}
 }
 
-static gboolean
-show_notification_timeout_cb (void)
+static void schedule_check (GSettings *settings);
+
+static void
+show_notification_timeout_cb (gpointer user_data)
 {
 	g_autoptr (GSettings) settings = NULL;
 
+	check_timeout_id = 0;
+
 	settings = g_settings_new (DONATE_SCHEMA);
 
         check_show_notification (settings);
-        first_run = FALSE;
+        schedule_check (settings);
+}
 
-        return G_SOURCE_CONTINUE;
+/* Wakes up when the reminder is due on the wall clock, instead of polling
+ * daily, so that time spent suspended counts as well */
+static void
+schedule_check (GSettings *settings)
+{
+	g_autoptr (GDateTime) expiry = NULL;
+	int64_t due;
+
+	due = g_settings_get_int64 (settings, DONATE_LAST_SHOWN_KEY) + HALF_A_YEAR_IN_USEC;
+	due = MAX (due, not_before);
+
+	/* check_show_notification() wants the deadline strictly passed, so
+	 * wake up in the first whole second after it rather than at the
+	 * truncated second, which would fire again straight away */
+	expiry = g_date_time_new_from_unix_utc (due / G_USEC_PER_SEC + 1);
+	check_timeout_id = gsd_wall_clock_add_timeout (wall_clock,
+						       expiry,
+						       show_notification_timeout_cb,
+						       NULL);
 }
 
 void
@@ -135,17 +161,22 @@ gsd_donation_reminder_init (void)
         if (!g_settings_get_boolean (settings, DONATE_ENABLED_KEY))
                 return;
 
-	if (check_timeout_id == 0) {
-		check_timeout_id =
-			g_timeout_add_seconds (first_run ? INITIAL_DELAY : DAY_IN_SEC,
-					       (GSourceFunc) show_notification_timeout_cb,
-					       NULL);
-	}
+	if (wall_clock == NULL)
+		wall_clock = gsd_wall_clock_get_default ();
+	if (not_before == 0)
+		not_before = g_get_real_time () + (int64_t) INITIAL_DELAY * G_USEC_PER_SEC;
+
+	if (check_timeout_id == 0)
+		schedule_check (settings);
 }
 
 void
 gsd_donation_reminder_end (void)
 {
-	g_clear_handle_id (&check_timeout_id, g_source_remove);
+	if (check_timeout_id != 0) {
+		gsd_wall_clock_remove_timeout (wall_clock, check_timeout_id);
+		check_timeout_id = 0;
+	}
+	g_clear_object (&wall_clock);
 	g_clear_object (&notification);
 }
@@ -219,9 +219,14 @@ names_listed (GObject      *object,
       return;
     }
 
+  /* On busy buses nearly all of the listed names are unique names,
+   * which can never be part of a well-known namespace. */
   g_variant_get (reply, "(as)", &iter);
   while (g_variant_iter_next (iter, "&s", &name))
     {
+      if (name[0] == ':')
+        continue;
+
       if (dbus_name_has_namespace (name, watcher->name_space))
         {
           GetNameOwnerData *data = g_new (GetNameOwnerData, 1);
@@ -278,6 +283,10 @@ got_bus (GObject      *object,
   watcher->connection = connection;
   g_signal_connect (watcher->connection, "closed", G_CALLBACK (connection_closed), watcher);
 
+  /* The arg0namespace match rule makes the bus itself drop NameOwnerChanged
+   * signals for names outside of the namespace, so unrelated name churn on
+   * the bus doesn't wake us up at all. The subscription is set up before
+   * listing the names so that no owner change can be missed in between. */
   watcher->subscription_id =
     g_dbus_connection_signal_subscribe (watcher->connection, "org.freedesktop.DBus",
                                         "org.freedesktop.DBus", "NameOwnerChanged", "/org/freedesktop/DBus",
@@ -311,7 +320,7 @@ bus_watch_namespace (GBusType                  bus_type,
   watcher->vanished_handler = vanished_handler;
   watcher->user_data = user_data;
   watcher->user_data_destroy = user_data_destroy;
-  watcher->cancellable = g_cancellable_new ();;
+  watcher->cancellable = g_cancellable_new ();
   watcher->names = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 
   if (namespace_watcher_watchers == NULL)
@@ -18,6 +18,9 @@
  *
  */
 
+/* for posix_spawn_file_actions_addclosefrom_np() */
+#define _GNU_SOURCE
+
 #include "config.h"
 
 #include <sys/types.h>
@@ -28,6 +31,8 @@
 #include <string.h>
 #include <errno.h>
 #include <math.h>
+#include <signal.h>
+#include <spawn.h>
 
 #include <locale.h>
 
@@ -49,6 +54,7 @@
 #include "gsd-settings-migrate.h"
 
 #include "mpris-controller.h"
+#include "media-keys-latency.h"
 #include "gnome-settings-bus.h"
 #include "gnome-settings-profile.h"
 #include "gsd-marshal.h"
@@ -115,6 +121,18 @@
 
 #define GSD_MEDIA_KEYS_MANAGER_GET_PRIVATE(o) (gsd_media_keys_manager_get_instance_private (o))
 
+/* Latencies are reported in microseconds, measured from the moment
+ * the accelerator activation was received from the shell. */
+static const gchar introspection_xml[] =
+"<node>"
+"  <interface name='org.gnome.SettingsDaemon.MediaKeys.Debug'>"
+"    <method name='GetActionLatencies'>"
+"      <arg name='latencies' direction='out' type='a{sa{sv}}'/>"
+"    </method>"
+"    <method name='ResetActionLatencies'/>"
+"  </interface>"
+"</node>";
+
 typedef struct {
         char   *application;
         char   *dbus_name;
@@ -132,6 +150,7 @@ typedef struct {
         gboolean static_setting;
         char *custom_path;
         char *custom_command;
+        char **custom_argv; /* custom_command, parsed once */
         GArray *accel_ids;
 } MediaKey;
 
@@ -145,6 +164,20 @@ typedef struct {
         gboolean cancelled;
 } GrabUngrabData;
 
+/* logind's Can*() answers for the power actions the power button may trigger */
+typedef enum {
+        POWER_ACTION_SUPPORT_UNKNOWN,
+        POWER_ACTION_SUPPORT_YES,
+        POWER_ACTION_SUPPORT_NO,
+} PowerActionSupport;
+
+enum {
+        CACHED_POWER_ACTION_SUSPEND,
+        CACHED_POWER_ACTION_SHUTDOWN,
+        CACHED_POWER_ACTION_HIBERNATE,
+        N_CACHED_POWER_ACTIONS
+};
+
 typedef struct
 {
         /* Volume bits */
@@ -166,6 +199,10 @@ typedef struct
         GSettings       *settings;
         GHashTable      *custom_settings;
 
+        /* Launch environment */
+        guint            keyring_watch_id;
+        GStrv            keyring_environ;
+
         GPtrArray       *keys;
 
         /* HighContrast theme settings */
@@ -206,6 +243,9 @@ typedef struct
 
         /* systemd stuff */
         GDBusProxy      *logind_proxy;
+        GCancellable    *logind_cancellable;
+        PowerActionSupport power_action_support[N_CACHED_POWER_ACTIONS];
+        guint            power_action_support_serial;
         gint             inhibit_keys_fd;
         gint             inhibit_suspend_fd;
         gboolean         inhibit_suspend_taken;
@@ -216,6 +256,12 @@ typedef struct
 
         /* Multimedia keys */
         MprisController *mpris_controller;
+
+        /* Latency tracing */
+        MediaKeysLatency      *latency;
+        MediaKeysLatencyProbe *current_probe;
+        GDBusNodeInfo         *introspection_data;
+        guint                  debug_object_id;
 } GsdMediaKeysManagerPrivate;
 
 static void     gsd_media_keys_manager_class_init  (GsdMediaKeysManagerClass *klass);
@@ -249,6 +295,7 @@ media_key_unref (MediaKey *key)
         g_clear_pointer (&key->accel_ids, g_array_unref);
         g_free (key->custom_path);
         g_free (key->custom_command);
+        g_strfreev (key->custom_argv);
         g_free (key);
 }
 
@@ -292,52 +339,125 @@ grab_ungrab_data_free (GrabUngrabData *data)
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC (GrabUngrabData, grab_ungrab_data_free)
 
+/* Returns a new reference to the latency probe of the key press currently
+ * being dispatched, to be dropped once the asynchronous work started on
+ * its behalf has finished. */
+static MediaKeysLatencyProbe *
+hold_latency_probe (GsdMediaKeysManager *manager)
+{
+        GsdMediaKeysManagerPrivate *priv = GSD_MEDIA_KEYS_MANAGER_GET_PRIVATE (manager);
+
+        return media_keys_latency_probe_ref (priv->current_probe);
+}
+
+/* Built for every launch, so that changes to our own environment reach
+ * the commands too */
+static GStrv
+get_launch_environ (GsdMediaKeysManager *manager)
+{
+        GsdMediaKeysManagerPrivate *priv = GSD_MEDIA_KEYS_MANAGER_GET_PRIVATE (manager);
+        GStrv env;
+        guint i;
+
+        env = g_get_environ ();
+        for (i = 0; priv->keyring_environ && priv->keyring_environ[i]; i++)
+                env = g_environ_setenv (env,
+                                        priv->keyring_environ[i],
+                                        priv->keyring_environ[i] + strlen (priv->keyring_environ[i]) + 1,
+                                        TRUE);
+
+        return env;
+}
+
 static void
-set_launch_context_env (GsdMediaKeysManager *manager,
-			GAppLaunchContext   *launch_context)
+keyring_get_environment_cb (GObject      *source_object,
+                            GAsyncResult *res,
+                            gpointer      user_data)
 {
-        GDBusConnection *connection = g_application_get_dbus_connection (G_APPLICATION (manager));
-	GError *error = NULL;
-	GVariant *variant, *item;
-	GVariantIter *iter;
-
-	variant = g_dbus_connection_call_sync (connection,
-					       GNOME_KEYRING_DBUS_NAME,
-					       GNOME_KEYRING_DBUS_PATH,
-					       GNOME_KEYRING_DBUS_INTERFACE,
-					       "GetEnvironment",
-					       NULL,
-					       NULL,
-					       G_DBUS_CALL_FLAGS_NONE,
-					       -1,
-					       NULL,
-					       &error);
-	if (variant == NULL) {
-		g_warning ("Failed to call GetEnvironment on keyring daemon: %s", error->message);
-		g_error_free (error);
-		return;
-	}
+        GsdMediaKeysManager *manager;
+        GsdMediaKeysManagerPrivate *priv;
+        g_autoptr(GVariant) variant = NULL;
+        g_autoptr(GVariantIter) iter = NULL;
+        g_autoptr(GError) error = NULL;
+        g_autoptr(GPtrArray) pairs = NULL;
+        const char *key, *value;
+
+        variant = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object), res, &error);
+        if (variant == NULL) {
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        g_warning ("Failed to call GetEnvironment on keyring daemon: %s", error->message);
+                return;
+        }
+
+        manager = GSD_MEDIA_KEYS_MANAGER (user_data);
+        priv = GSD_MEDIA_KEYS_MANAGER_GET_PRIVATE (manager);
 
-	g_variant_get (variant, "(a{ss})", &iter);
+        /* Stored as consecutive "key\0value" strings */
+        pairs = g_ptr_array_new ();
+        g_variant_get (variant, "(a{ss})", &iter);
+        while (g_variant_iter_next (iter, "{&s&s}", &key, &value)) {
+                gsize key_len = strlen (key);
+                gsize value_len = strlen (value);
+                char *pair;
+
+                pair = g_malloc (key_len + value_len + 2);
+                memcpy (pair, key, key_len + 1);
+                memcpy (pair + key_len + 1, value, value_len + 1);
+                g_ptr_array_add (pairs, pair);
+        }
+        g_ptr_array_add (pairs, NULL);
 
-	while ((item = g_variant_iter_next_value (iter))) {
-		char *key;
-		char *value;
+        g_strfreev (priv->keyring_environ);
+        priv->keyring_environ = (GStrv) g_ptr_array_free (g_steal_pointer (&pairs), FALSE);
+}
 
-		g_variant_get (item,
-			       "{ss}",
-			       &key,
-			       &value);
+static void
+keyring_appeared_cb (GDBusConnection *connection,
+                     const gchar     *name,
+                     const gchar     *name_owner,
+                     gpointer         user_data)
+{
+        GsdMediaKeysManager *manager = GSD_MEDIA_KEYS_MANAGER (user_data);
+        GsdMediaKeysManagerPrivate *priv = GSD_MEDIA_KEYS_MANAGER_GET_PRIVATE (manager);
 
-		g_app_launch_context_setenv (launch_context, key, value);
+        g_dbus_connection_call (connection,
+                                GNOME_KEYRING_DBUS_NAME,
+                                GNOME_KEYRING_DBUS_PATH,
+                                GNOME_KEYRING_DBUS_INTERFACE,
+                                "GetEnvironment",
+                                NULL,
+                                G_VARIANT_TYPE ("(a{ss})"),
+                                G_DBUS_CALL_FLAGS_NONE,
+                                -1,
+                                priv->bus_cancellable,
+                                keyring_get_environment_cb,
+                                manager);
+}
 
-		g_variant_unref (item);
-		g_free (key);
-		g_free (value);
-	}
+static void
+keyring_vanished_cb (GDBusConnection *connection,
+                     const gchar     *name,
+                     gpointer         user_data)
+{
+        GsdMediaKeysManager *manager = GSD_MEDIA_KEYS_MANAGER (user_data);
+        GsdMediaKeysManagerPrivate *priv = GSD_MEDIA_KEYS_MANAGER_GET_PRIVATE (manager);
+
+        g_clear_pointer (&priv->keyring_environ, g_strfreev);
+}
+
+static void
+set_launch_context_env (GsdMediaKeysManager *manager,
+			GAppLaunchContext   *launch_context)
+{
+        GsdMediaKeysManagerPrivate *priv = GSD_MEDIA_KEYS_MANAGER_GET_PRIVATE (manager);
+        guint i;
 
-	g_variant_iter_free (iter);
-	g_variant_unref (variant);
+        /* The keyring environment is fetched whenever the keyring daemon
+         * appears on the bus, so launching never blocks on it. */
+        for (i = 0; priv->keyring_environ && priv->keyring_environ[i]; i++)
+                g_app_launch_context_setenv (launch_context,
+                                             priv->keyring_environ[i],
+                                             priv->keyring_environ[i] + strlen (priv->keyring_environ[i]) + 1);
 }
 
 static char *
@@ -758,6 +878,23 @@ gsettings_changed_cb (GSettings           *settings,
         }
 }
 
+static char **
+parse_custom_command (const char *command)
+{
+        g_autoptr(GError) error = NULL;
+        char **argv = NULL;
+
+        if (*command == '\0')
+                return NULL;
+
+        if (!g_shell_parse_argv (command, NULL, &argv, &error)) {
+                g_warning ("Could not parse custom command '%s': %s", command, error->message);
+                return NULL;
+        }
+
+        return argv;
+}
+
 static MediaKey *
 media_key_new_for_path (GsdMediaKeysManager *manager,
 			char                *path)
@@ -798,6 +935,7 @@ media_key_new_for_path (GsdMediaKeysManager *manager,
 		key->modes = GSD_ACTION_MODE_LAUNCHER;
         key->custom_path = g_strdup (path);
         key->custom_command = command;
+        key->custom_argv = parse_custom_command (command);
         key->grab_flags = META_KEY_BINDING_NONE;
 
         return key;
@@ -854,6 +992,8 @@ update_custom_binding_command (GsdMediaKeysManager *manager,
                 if (strcmp (key->custom_path, path) == 0) {
                         g_free (key->custom_command);
                         key->custom_command = g_settings_get_string (settings, "command");
+                        g_strfreev (key->custom_argv);
+                        key->custom_argv = parse_custom_command (key->custom_command);
                         break;
                 }
         }
@@ -1020,33 +1160,123 @@ launch_app (GsdMediaKeysManager *manager,
 	}
 }
 
+static void
+custom_scope_started_cb (GObject      *source_object,
+                         GAsyncResult *res,
+                         gpointer      user_data)
+{
+        g_autoptr(MediaKeysLatencyProbe) probe = user_data;
+        g_autoptr(GError) error = NULL;
+
+        if (!gnome_start_systemd_scope_finish (res, &error) &&
+            !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                g_debug ("Failed to move custom command into its own scope: %s", error->message);
+}
+
+static void
+custom_child_exited_cb (GPid     pid,
+                        gint     status,
+                        gpointer user_data)
+{
+        g_spawn_close_pid (pid);
+}
+
+#if HAVE_POSIX_SPAWN_CLOSEFROM
+static gboolean
+spawn_custom_command (MediaKey  *key,
+                      GStrv      env,
+                      GPid      *pid)
+{
+        posix_spawn_file_actions_t file_actions;
+        posix_spawnattr_t attr;
+        sigset_t mask;
+        int ret;
+
+        /* Only stdin, stdout and stderr are passed on */
+        posix_spawn_file_actions_init (&file_actions);
+        posix_spawn_file_actions_addclosefrom_np (&file_actions, STDERR_FILENO + 1);
+
+        /* Don't let the child inherit our signal mask, or SIGPIPE being ignored */
+        posix_spawnattr_init (&attr);
+        sigemptyset (&mask);
+        posix_spawnattr_setsigmask (&attr, &mask);
+        sigaddset (&mask, SIGPIPE);
+        posix_spawnattr_setsigdefault (&attr, &mask);
+        posix_spawnattr_setflags (&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+        ret = posix_spawnp (pid, key->custom_argv[0], &file_actions, &attr,
+                            key->custom_argv, env);
+        posix_spawnattr_destroy (&attr);
+        posix_spawn_file_actions_destroy (&file_actions);
+
+        if (ret != 0) {
+                g_warning ("Could not launch '%s': %s", key->custom_command, g_strerror (ret));
+                return FALSE;
+        }
+
+        return TRUE;
+}
+#else
+static gboolean
+spawn_custom_command (MediaKey  *key,
+                      GStrv      env,
+                      GPid      *pid)
+{
+        g_autoptr(GError) error = NULL;
+
+        if (!g_spawn_async (NULL, key->custom_argv, env,
+                            G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD,
+                            NULL, NULL, pid, &error)) {
+                g_warning ("Could not launch '%s': %s", key->custom_command, error->message);
+                return FALSE;
+        }
+
+        return TRUE;
+}
+#endif
+
+/* Custom commands are spawned directly from their pre-parsed argv, with
+ * posix_spawn() and its vfork semantics where it can close inherited
+ * descriptors, instead of going through a GAppInfo for every key press. */
 static void
 execute (GsdMediaKeysManager *manager,
-         char                *cmd,
-         gint64               timestamp)
-{
-	GAppInfo *app_info;
-	g_autofree gchar *escaped = NULL;
-	gchar *p;
-
-	/* Escape all % characters as g_app_info_create_from_commandline will
-	 * try to interpret them otherwise. */
-	escaped = g_malloc (strlen (cmd) * 2 + 1);
-	p = escaped;
-	while (*cmd) {
-		*p = *cmd;
-		p++;
-		if (*cmd == '%') {
-			*p = '%';
-			p++;
-		}
-		cmd++;
-	}
-	*p = '\0';
+         MediaKey            *key)
+{
+        GsdMediaKeysManagerPrivate *priv = GSD_MEDIA_KEYS_MANAGER_GET_PRIVATE (manager);
+        GDBusConnection *connection = g_application_get_dbus_connection (G_APPLICATION (manager));
+        g_autofree char *app_name = NULL;
+        g_auto(GStrv) env = NULL;
+        gint64 start;
+        GPid pid;
+
+        if (key->custom_argv == NULL) {
+                g_warning ("Could not launch '%s': invalid command", key->custom_command);
+                return;
+        }
+
+        env = get_launch_environ (manager);
+
+        start = g_get_monotonic_time ();
+
+        if (!spawn_custom_command (key, env, &pid))
+                return;
+
+        g_debug ("Launched '%s' as pid %d in %" G_GINT64_FORMAT " us",
+                 key->custom_command, pid, g_get_monotonic_time () - start);
 
-	app_info = g_app_info_create_from_commandline (escaped, NULL, G_APP_INFO_CREATE_NONE, NULL);
-	launch_app (manager, app_info, timestamp);
-	g_object_unref (app_info);
+        g_child_watch_add (pid, custom_child_exited_cb, NULL);
+
+        if (connection == NULL)
+                return;
+
+        app_name = g_path_get_basename (key->custom_argv[0]);
+        gnome_start_systemd_scope (app_name,
+                                   pid,
+                                   NULL,
+                                   connection,
+                                   priv->bus_cancellable,
+                                   custom_scope_started_cb,
+                                   hold_latency_probe (manager));
 }
 
 static void
@@ -1099,6 +1329,8 @@ gnome_session_logout_cb (GObject      *source_object,
         } else {
                 g_variant_unref (result);
         }
+
+        media_keys_latency_probe_unref (user_data);
 }
 
 static void
@@ -1117,7 +1349,7 @@ gnome_session_logout (GsdMediaKeysManager *manager,
                            -1,
                            priv->bus_cancellable,
                            gnome_session_logout_cb,
-                           NULL);
+                           hold_latency_probe (manager));
 
         g_object_unref (proxy);
 }
@@ -1141,6 +1373,8 @@ gnome_session_reboot_cb (GObject      *source_object,
         } else {
                 g_variant_unref (result);
         }
+
+        media_keys_latency_probe_unref (user_data);
 }
 
 static void
@@ -1158,7 +1392,7 @@ gnome_session_reboot (GsdMediaKeysManager *manager)
                            -1,
                            priv->bus_cancellable,
                            gnome_session_reboot_cb,
-                           NULL);
+                           hold_latency_probe (manager));
 
         g_object_unref (proxy);
 }
@@ -1182,6 +1416,8 @@ gnome_session_shutdown_cb (GObject *source_object,
         } else {
                 g_variant_unref (result);
         }
+
+        media_keys_latency_probe_unref (user_data);
 }
 
 static void
@@ -1199,7 +1435,7 @@ gnome_session_shutdown (GsdMediaKeysManager *manager)
                            -1,
                            priv->bus_cancellable,
                            gnome_session_shutdown_cb,
-                           NULL);
+                           hold_latency_probe (manager));
 
         g_object_unref (proxy);
 }
@@ -1770,18 +2006,28 @@ do_multimedia_player_action (GsdMediaKeysManager *manager,
 
         if (mpris_controller_get_has_active_player (priv->mpris_controller)) {
                 if (g_str_equal (key, "Rewind")) {
-                        if (mpris_controller_seek (priv->mpris_controller, REWIND_USEC))
+                        if (mpris_controller_seek (priv->mpris_controller, REWIND_USEC,
+                                                   hold_latency_probe (manager),
+                                                   (GDestroyNotify) media_keys_latency_probe_unref))
                                 return TRUE;
                 } else if (g_str_equal (key, "FastForward")) {
-                        if (mpris_controller_seek (priv->mpris_controller, FASTFORWARD_USEC))
+                        if (mpris_controller_seek (priv->mpris_controller, FASTFORWARD_USEC,
+                                                   hold_latency_probe (manager),
+                                                   (GDestroyNotify) media_keys_latency_probe_unref))
                                 return TRUE;
                 } else if (g_str_equal (key, "Repeat")) {
-                        if (mpris_controller_toggle (priv->mpris_controller, "LoopStatus"))
+                        if (mpris_controller_toggle (priv->mpris_controller, "LoopStatus",
+                                                     hold_latency_probe (manager),
+                                                     (GDestroyNotify) media_keys_latency_probe_unref))
                                 return TRUE;
                 } else if (g_str_equal (key, "Shuffle")) {
-                        if (mpris_controller_toggle (priv->mpris_controller, "Shuffle"))
+                        if (mpris_controller_toggle (priv->mpris_controller, "Shuffle",
+                                                     hold_latency_probe (manager),
+                                                     (GDestroyNotify) media_keys_latency_probe_unref))
                                 return TRUE;
-                } else if (mpris_controller_key (priv->mpris_controller, key)) {
+                } else if (mpris_controller_key (priv->mpris_controller, key,
+                                                 hold_latency_probe (manager),
+                                                 (GDestroyNotify) media_keys_latency_probe_unref)) {
                         return TRUE;
                 }
         }
@@ -1998,6 +2244,20 @@ do_toggle_contrast_action (GsdMediaKeysManager *manager)
 	}
 }
 
+static void
+logind_power_action_cb (GObject      *source_object,
+                        GAsyncResult *res,
+                        gpointer      user_data)
+{
+        g_autoptr(MediaKeysLatencyProbe) probe = user_data;
+        g_autoptr(GVariant) result = NULL;
+        g_autoptr(GError) error = NULL;
+
+        result = g_dbus_proxy_call_finish (G_DBUS_PROXY (source_object), res, &error);
+        if (result == NULL && !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                g_debug ("Failed to call power action on logind: %s", error->message);
+}
+
 static void
 logind_power_action (GsdMediaKeysManager *manager,
                      GsdPowerActionType   action,
@@ -2036,7 +2296,8 @@ logind_power_action (GsdMediaKeysManager *manager,
                            dbus_flags,
                            G_MAXINT,
                            priv->bus_cancellable,
-                           NULL, NULL);
+                           logind_power_action_cb,
+                           hold_latency_probe (manager));
 }
 
 static void
@@ -2063,9 +2324,41 @@ do_config_power_action (GsdMediaKeysManager *manager,
         }
 }
 
-static gboolean
-supports_power_action (GsdMediaKeysManager *manager,
-                       GsdPowerActionType   action_type)
+static const char *power_action_methods[N_CACHED_POWER_ACTIONS] = {
+        [CACHED_POWER_ACTION_SUSPEND] = "CanSuspend",
+        [CACHED_POWER_ACTION_SHUTDOWN] = "CanPowerOff",
+        [CACHED_POWER_ACTION_HIBERNATE] = "CanHibernate",
+};
+
+static const GsdPowerActionType cached_power_action_types[N_CACHED_POWER_ACTIONS] = {
+        [CACHED_POWER_ACTION_SUSPEND] = GSD_POWER_ACTION_SUSPEND,
+        [CACHED_POWER_ACTION_SHUTDOWN] = GSD_POWER_ACTION_SHUTDOWN,
+        [CACHED_POWER_ACTION_HIBERNATE] = GSD_POWER_ACTION_HIBERNATE,
+};
+
+static int
+get_cached_power_action (GsdPowerActionType action_type)
+{
+        switch (action_type) {
+        case GSD_POWER_ACTION_SUSPEND:
+                return CACHED_POWER_ACTION_SUSPEND;
+        case GSD_POWER_ACTION_SHUTDOWN:
+                return CACHED_POWER_ACTION_SHUTDOWN;
+        case GSD_POWER_ACTION_HIBERNATE:
+                return CACHED_POWER_ACTION_HIBERNATE;
+        case GSD_POWER_ACTION_INTERACTIVE:
+        case GSD_POWER_ACTION_BLANK:
+        case GSD_POWER_ACTION_LOGOUT:
+        case GSD_POWER_ACTION_NOTHING:
+                break;
+        }
+
+        return -1;
+}
+
+static PowerActionSupport
+parse_power_action_support (const char *method_name,
+                            GVariant   *variant)
 {
         static const char *supported_values[] = {
                 "yes", /* Supported, no questions asked */
@@ -2080,52 +2373,118 @@ supports_power_action (GsdMediaKeysManager *manager,
                 "na", /* Entirely unsupported */
                 NULL
         };
+        const char *reply;
 
-        GsdMediaKeysManagerPrivate *priv = GSD_MEDIA_KEYS_MANAGER_GET_PRIVATE (manager);
-        const char *method_name = NULL;
+        g_variant_get (variant, "(&s)", &reply);
+
+        if (g_strv_contains (supported_values, reply))
+                return POWER_ACTION_SUPPORT_YES;
+
+        if (!g_strv_contains (known_unsupported_values, reply))
+                g_warning ("%s() returned unknown value: %s", method_name, reply);
+
+        return POWER_ACTION_SUPPORT_NO;
+}
+
+typedef struct {
+        GsdMediaKeysManager   *manager;
+        int                    action;
+        guint                  serial;
+        /* Set when a power button press is waiting for the answer */
+        gboolean               pending_press;
+        gboolean               in_lock_screen;
+        MediaKeysLatencyProbe *probe;
+} PowerActionQuery;
+
+static void
+power_action_query_free (PowerActionQuery *query)
+{
+        media_keys_latency_probe_unref (query->probe);
+        g_free (query);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (PowerActionQuery, power_action_query_free)
+
+static void
+power_action_support_cb (GObject      *source_object,
+                         GAsyncResult *res,
+                         gpointer      user_data)
+{
+        g_autoptr(PowerActionQuery) query = user_data;
+        GsdMediaKeysManagerPrivate *priv;
         g_autoptr(GVariant) variant = NULL;
-        const char *reply;
+        g_autoptr(GError) error = NULL;
+        PowerActionSupport support = POWER_ACTION_SUPPORT_NO;
+        MediaKeysLatencyProbe *previous_probe;
 
-        switch (action_type) {
-        case GSD_POWER_ACTION_SUSPEND:
-                method_name = "CanSuspend";
-                break;
-        case GSD_POWER_ACTION_SHUTDOWN:
-                method_name = "CanPowerOff";
-                break;
-        case GSD_POWER_ACTION_HIBERNATE:
-                method_name = "CanHibernate";
-                break;
-        case GSD_POWER_ACTION_INTERACTIVE:
-        case GSD_POWER_ACTION_BLANK:
-        case GSD_POWER_ACTION_LOGOUT:
-        case GSD_POWER_ACTION_NOTHING:
-                break;
+        variant = g_dbus_proxy_call_finish (G_DBUS_PROXY (source_object), res, &error);
+        if (variant == NULL) {
+                if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        return;
+                g_debug ("Failed to call %s(): %s", power_action_methods[query->action], error->message);
+        } else {
+                support = parse_power_action_support (power_action_methods[query->action], variant);
         }
 
-        if (method_name == NULL)
-                return FALSE;
+        priv = GSD_MEDIA_KEYS_MANAGER_GET_PRIVATE (query->manager);
 
-        variant = g_dbus_proxy_call_sync (priv->logind_proxy,
-                                          method_name,
-                                          NULL,
-                                          G_DBUS_CALL_FLAGS_NONE,
-                                          -1,
-                                          priv->bus_cancellable,
-                                          NULL);
+        /* Don't cache answers to queries made before the last invalidation,
+         * or failures, which are retried on the next press */
+        if (variant != NULL && query->serial == priv->power_action_support_serial)
+                priv->power_action_support[query->action] = support;
 
-        if (variant == NULL)
-                return FALSE;
+        if (!query->pending_press)
+                return;
 
-        g_variant_get (variant, "(&s)", &reply);
+        previous_probe = priv->current_probe;
+        priv->current_probe = query->probe;
+        do_config_power_action (query->manager,
+                                support == POWER_ACTION_SUPPORT_YES ?
+                                cached_power_action_types[query->action] : GSD_POWER_ACTION_INTERACTIVE,
+                                query->in_lock_screen);
+        priv->current_probe = previous_probe;
+}
 
-        if (g_strv_contains (supported_values, reply))
-                return TRUE;
+static void
+query_power_action_support (GsdMediaKeysManager *manager,
+                            int                  action,
+                            PowerActionQuery    *query)
+{
+        GsdMediaKeysManagerPrivate *priv = GSD_MEDIA_KEYS_MANAGER_GET_PRIVATE (manager);
 
-        if (!g_strv_contains (known_unsupported_values, reply))
-                g_warning ("%s() returned unknown value: %s", method_name, reply);
+        if (query == NULL)
+                query = g_new0 (PowerActionQuery, 1);
+        query->manager = manager;
+        query->action = action;
+        query->serial = priv->power_action_support_serial;
 
-        return FALSE;
+        g_dbus_proxy_call (priv->logind_proxy,
+                           power_action_methods[action],
+                           NULL,
+                           G_DBUS_CALL_FLAGS_NONE,
+                           -1,
+                           priv->logind_cancellable,
+                           power_action_support_cb,
+                           query);
+}
+
+/* Drops all cached answers and asks logind again. Called at startup, when
+ * logind's properties change and after resuming, as any of those can
+ * change what is allowed. */
+static void
+refresh_power_action_support (GsdMediaKeysManager *manager)
+{
+        GsdMediaKeysManagerPrivate *priv = GSD_MEDIA_KEYS_MANAGER_GET_PRIVATE (manager);
+        int i;
+
+        if (priv->logind_proxy == NULL)
+                return;
+
+        priv->power_action_support_serial++;
+        for (i = 0; i < N_CACHED_POWER_ACTIONS; i++) {
+                priv->power_action_support[i] = POWER_ACTION_SUPPORT_UNKNOWN;
+                query_power_action_support (manager, i, NULL);
+        }
 }
 
 static void
@@ -2168,8 +2527,30 @@ do_config_power_button_action (GsdMediaKeysManager *manager,
                 return;
         }
 
-        if (action != GSD_POWER_ACTION_INTERACTIVE && !supports_power_action (manager, action))
+        if (action != GSD_POWER_ACTION_INTERACTIVE && priv->logind_proxy == NULL) {
                 action = GSD_POWER_ACTION_INTERACTIVE;
+        } else if (action != GSD_POWER_ACTION_INTERACTIVE) {
+                int cached = get_cached_power_action (action);
+
+                switch (priv->power_action_support[cached]) {
+                case POWER_ACTION_SUPPORT_YES:
+                        break;
+                case POWER_ACTION_SUPPORT_NO:
+                        action = GSD_POWER_ACTION_INTERACTIVE;
+                        break;
+                case POWER_ACTION_SUPPORT_UNKNOWN: {
+                        PowerActionQuery *query;
+
+                        /* Not known yet, decide once logind has answered */
+                        query = g_new0 (PowerActionQuery, 1);
+                        query->pending_press = TRUE;
+                        query->in_lock_screen = in_lock_screen;
+                        query->probe = hold_latency_probe (manager);
+                        query_power_action_support (manager, cached, query);
+                        return;
+                }
+                }
+        }
 
         do_config_power_action (manager, action, in_lock_screen);
 }
@@ -2409,12 +2790,11 @@ do_rfkill_action (GsdMediaKeysManager *manager,
 static void
 do_custom_action (GsdMediaKeysManager *manager,
                   const gchar         *device_node,
-                  MediaKey            *key,
-                  gint64               timestamp)
+                  MediaKey            *key)
 {
         g_debug ("Launching custom action for key (on device node %s)", device_node);
 
-	execute (manager, key->custom_command, timestamp);
+	execute (manager, key);
 }
 
 static gboolean
@@ -2584,6 +2964,7 @@ on_accelerator_activated (ShellKeyGrabber     *grabber,
                           GsdMediaKeysManager *manager)
 {
         GsdMediaKeysManagerPrivate *priv = GSD_MEDIA_KEYS_MANAGER_GET_PRIVATE (manager);
+        g_autoptr(MediaKeysLatencyProbe) probe = NULL;
         GVariantDict dict;
         guint i;
         guint deviceid;
@@ -2618,11 +2999,16 @@ on_accelerator_activated (ShellKeyGrabber     *grabber,
                 if (j >= key->accel_ids->len)
                         continue;
 
+                priv->current_probe = probe = media_keys_latency_probe_new (priv->latency, key->key_type);
+
                 if (key->key_type == CUSTOM_KEY)
-                        do_custom_action (manager, device_node, key, timestamp);
+                        do_custom_action (manager, device_node, key);
                 else
                         do_action (manager, device_node, mode, key->key_type, timestamp);
 
+                media_keys_latency_probe_dispatched (probe);
+                priv->current_probe = NULL;
+
                 g_free (device_node);
                 return;
         }
@@ -3343,9 +3729,19 @@ logind_proxy_signal_cb (GDBusProxy  *proxy,
                 inhibit_suspend (manager);
                 /* Re-enable power-button handling (after a small delay) */
                 setup_reenable_power_button_timer (manager);
+                refresh_power_action_support (manager);
         }
 }
 
+static void
+logind_proxy_properties_changed_cb (GDBusProxy *proxy,
+                                    GVariant   *changed_properties,
+                                    GStrv       invalidated_properties,
+                                    gpointer    user_data)
+{
+        refresh_power_action_support (GSD_MEDIA_KEYS_MANAGER (user_data));
+}
+
 static void
 gsd_media_keys_manager_class_init (GsdMediaKeysManagerClass *klass)
 {
@@ -3401,6 +3797,8 @@ gsd_media_keys_manager_init (GsdMediaKeysManager *manager)
         error = NULL;
         priv = GSD_MEDIA_KEYS_MANAGER_GET_PRIVATE (manager);
 
+        priv->latency = media_keys_latency_new ();
+
         bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
         if (bus == NULL) {
                 g_warning ("Failed to connect to system bus: %s",
@@ -3449,6 +3847,12 @@ gsd_media_keys_manager_init (GsdMediaKeysManager *manager)
                           G_CALLBACK (logind_proxy_signal_cb),
                           manager);
         inhibit_suspend (manager);
+
+        priv->logind_cancellable = g_cancellable_new ();
+        g_signal_connect (priv->logind_proxy, "g-properties-changed",
+                          G_CALLBACK (logind_proxy_properties_changed_cb),
+                          manager);
+        refresh_power_action_support (manager);
 }
 
 static void
@@ -3460,8 +3864,13 @@ gsd_media_keys_manager_finalize (GObject *object)
         if (priv->inhibit_keys_fd != -1)
                 close (priv->inhibit_keys_fd);
 
+        if (priv->logind_cancellable != NULL) {
+                g_cancellable_cancel (priv->logind_cancellable);
+                g_clear_object (&priv->logind_cancellable);
+        }
         g_clear_object (&priv->logind_proxy);
         g_clear_object (&priv->screen_saver_proxy);
+        g_clear_pointer (&priv->latency, media_keys_latency_unref);
 
         G_OBJECT_CLASS (gsd_media_keys_manager_parent_class)->finalize (object);
 }
@@ -3528,6 +3937,71 @@ power_keyboard_ready_cb (GObject             *source_object,
                           manager);
 }
 
+static void
+add_latency_stats (GVariantBuilder     *builder,
+                   GsdMediaKeysManager *manager,
+                   MediaKeyType         type,
+                   const char          *name)
+{
+        GsdMediaKeysManagerPrivate *priv = GSD_MEDIA_KEYS_MANAGER_GET_PRIVATE (manager);
+        MediaKeysLatencyStats stats;
+        GVariantBuilder dict;
+
+        if (!media_keys_latency_get_stats (priv->latency, type, &stats))
+                return;
+
+        g_variant_builder_init (&dict, G_VARIANT_TYPE_VARDICT);
+        g_variant_builder_add (&dict, "{sv}", "count", g_variant_new_uint32 (stats.count));
+        g_variant_builder_add (&dict, "{sv}", "dispatch-p50", g_variant_new_int64 (stats.dispatch_p50));
+        g_variant_builder_add (&dict, "{sv}", "dispatch-p90", g_variant_new_int64 (stats.dispatch_p90));
+        g_variant_builder_add (&dict, "{sv}", "dispatch-p99", g_variant_new_int64 (stats.dispatch_p99));
+        g_variant_builder_add (&dict, "{sv}", "complete-p50", g_variant_new_int64 (stats.complete_p50));
+        g_variant_builder_add (&dict, "{sv}", "complete-p90", g_variant_new_int64 (stats.complete_p90));
+        g_variant_builder_add (&dict, "{sv}", "complete-p99", g_variant_new_int64 (stats.complete_p99));
+        g_variant_builder_add (&dict, "{sv}", "complete-max", g_variant_new_int64 (stats.complete_max));
+
+        g_variant_builder_add (builder, "{sa{sv}}", name, &dict);
+}
+
+static void
+handle_method_call (GDBusConnection       *connection,
+                    const gchar           *sender,
+                    const gchar           *object_path,
+                    const gchar           *interface_name,
+                    const gchar           *method_name,
+                    GVariant              *parameters,
+                    GDBusMethodInvocation *invocation,
+                    gpointer               user_data)
+{
+        GsdMediaKeysManager *manager = GSD_MEDIA_KEYS_MANAGER (user_data);
+        GsdMediaKeysManagerPrivate *priv = GSD_MEDIA_KEYS_MANAGER_GET_PRIVATE (manager);
+
+        if (g_strcmp0 (method_name, "GetActionLatencies") == 0) {
+                GVariantBuilder builder;
+                guint i;
+
+                g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sa{sv}}"));
+                for (i = 0; i < G_N_ELEMENTS (media_keys); i++)
+                        add_latency_stats (&builder, manager,
+                                           media_keys[i].key_type,
+                                           media_keys[i].settings_key);
+                add_latency_stats (&builder, manager, CUSTOM_KEY, "custom");
+
+                g_dbus_method_invocation_return_value (invocation,
+                                                       g_variant_new ("(a{sa{sv}})", &builder));
+        } else if (g_strcmp0 (method_name, "ResetActionLatencies") == 0) {
+                media_keys_latency_reset (priv->latency);
+                g_dbus_method_invocation_return_value (invocation, NULL);
+        }
+}
+
+static const GDBusInterfaceVTable interface_vtable =
+{
+        handle_method_call,
+        NULL, /* Get Property */
+        NULL, /* Set Property */
+};
+
 static gboolean
 gsd_media_keys_manager_dbus_register (GApplication    *app,
                                       GDBusConnection *connection,
@@ -3546,6 +4020,29 @@ gsd_media_keys_manager_dbus_register (GApplication    *app,
 
         priv->bus_cancellable = g_cancellable_new ();
 
+        priv->introspection_data = g_dbus_node_info_new_for_xml (introspection_xml, NULL);
+        g_assert (priv->introspection_data != NULL);
+
+        priv->debug_object_id =
+                g_dbus_connection_register_object (connection,
+                                                   GSD_MEDIA_KEYS_DBUS_PATH,
+                                                   priv->introspection_data->interfaces[0],
+                                                   &interface_vtable,
+                                                   manager,
+                                                   NULL,
+                                                   error);
+        if (priv->debug_object_id == 0)
+                return FALSE;
+
+        priv->keyring_watch_id =
+                g_bus_watch_name_on_connection (connection,
+                                                GNOME_KEYRING_DBUS_NAME,
+                                                G_BUS_NAME_WATCHER_FLAGS_NONE,
+                                                keyring_appeared_cb,
+                                                keyring_vanished_cb,
+                                                manager,
+                                                NULL);
+
         g_dbus_proxy_new (connection,
                           G_DBUS_PROXY_FLAGS_NONE,
                           NULL,
@@ -3590,6 +4087,18 @@ gsd_media_keys_manager_dbus_unregister (GApplication    *app,
         g_clear_object (&priv->power_keyboard_proxy);
         g_clear_object (&priv->composite_device);
 
+        if (priv->debug_object_id != 0) {
+                g_dbus_connection_unregister_object (connection, priv->debug_object_id);
+                priv->debug_object_id = 0;
+        }
+
+        if (priv->keyring_watch_id != 0) {
+                g_bus_unwatch_name (priv->keyring_watch_id);
+                priv->keyring_watch_id = 0;
+        }
+        g_clear_pointer (&priv->keyring_environ, g_strfreev);
+        g_clear_pointer (&priv->introspection_data, g_dbus_node_info_unref);
+
         G_APPLICATION_CLASS (gsd_media_keys_manager_parent_class)->dbus_unregister (app,
                                                                                     connection,
                                                                                     object_path);
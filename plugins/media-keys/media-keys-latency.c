@@ -0,0 +1,226 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "media-keys-latency.h"
+
+/* Number of samples kept per key type; older samples are overwritten */
+#define LATENCY_HISTORY_SIZE 128
+
+typedef struct {
+        gint64 dispatch;
+        gint64 complete;
+} LatencySample;
+
+typedef struct {
+        LatencySample samples[LATENCY_HISTORY_SIZE];
+        guint         next;
+        guint         count;
+} LatencyHistory;
+
+struct _MediaKeysLatency {
+        gint ref_count;
+
+        LatencyHistory history[CUSTOM_KEY + 1];
+};
+
+/* A probe follows a single key press. The dispatcher holds one reference
+ * until do_action() returns, and every asynchronous operation started on
+ * behalf of the key press holds another until it finishes. The press is
+ * considered complete when the last reference is dropped. */
+struct _MediaKeysLatencyProbe {
+        gint ref_count;
+
+        MediaKeysLatency *latency;
+        MediaKeyType      type;
+        gint64            received;
+        gint64            dispatched;
+};
+
+MediaKeysLatency *
+media_keys_latency_new (void)
+{
+        MediaKeysLatency *latency;
+
+        latency = g_new0 (MediaKeysLatency, 1);
+        latency->ref_count = 1;
+
+        return latency;
+}
+
+MediaKeysLatency *
+media_keys_latency_ref (MediaKeysLatency *latency)
+{
+        g_atomic_int_inc (&latency->ref_count);
+        return latency;
+}
+
+void
+media_keys_latency_unref (MediaKeysLatency *latency)
+{
+        if (latency == NULL)
+                return;
+        if (!g_atomic_int_dec_and_test (&latency->ref_count))
+                return;
+        g_free (latency);
+}
+
+void
+media_keys_latency_reset (MediaKeysLatency *latency)
+{
+        memset (latency->history, 0, sizeof (latency->history));
+}
+
+static int
+compare_gint64 (const void *a,
+                const void *b)
+{
+        gint64 x = *(const gint64 *) a;
+        gint64 y = *(const gint64 *) b;
+
+        return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile over a sorted array */
+static gint64
+percentile (const gint64 *sorted,
+            guint         n,
+            guint         pct)
+{
+        guint rank;
+
+        rank = (pct * n + 99) / 100;
+        if (rank == 0)
+                rank = 1;
+
+        return sorted[rank - 1];
+}
+
+gboolean
+media_keys_latency_get_stats (MediaKeysLatency      *latency,
+                              MediaKeyType           type,
+                              MediaKeysLatencyStats *stats)
+{
+        LatencyHistory *history;
+        gint64 dispatch[LATENCY_HISTORY_SIZE];
+        gint64 complete[LATENCY_HISTORY_SIZE];
+        guint i;
+
+        g_return_val_if_fail (type <= CUSTOM_KEY, FALSE);
+
+        history = &latency->history[type];
+        memset (stats, 0, sizeof (*stats));
+
+        if (history->count == 0)
+                return FALSE;
+
+        for (i = 0; i < history->count; i++) {
+                dispatch[i] = history->samples[i].dispatch;
+                complete[i] = history->samples[i].complete;
+        }
+
+        qsort (dispatch, history->count, sizeof (gint64), compare_gint64);
+        qsort (complete, history->count, sizeof (gint64), compare_gint64);
+
+        stats->count = history->count;
+        stats->dispatch_p50 = percentile (dispatch, history->count, 50);
+        stats->dispatch_p90 = percentile (dispatch, history->count, 90);
+        stats->dispatch_p99 = percentile (dispatch, history->count, 99);
+        stats->complete_p50 = percentile (complete, history->count, 50);
+        stats->complete_p90 = percentile (complete, history->count, 90);
+        stats->complete_p99 = percentile (complete, history->count, 99);
+        stats->complete_max = complete[history->count - 1];
+
+        return TRUE;
+}
+
+MediaKeysLatencyProbe *
+media_keys_latency_probe_new (MediaKeysLatency *latency,
+                              MediaKeyType      type)
+{
+        MediaKeysLatencyProbe *probe;
+
+        g_return_val_if_fail (type <= CUSTOM_KEY, NULL);
+
+        probe = g_new0 (MediaKeysLatencyProbe, 1);
+        probe->ref_count = 1;
+        probe->latency = media_keys_latency_ref (latency);
+        probe->type = type;
+        probe->received = g_get_monotonic_time ();
+
+        return probe;
+}
+
+MediaKeysLatencyProbe *
+media_keys_latency_probe_ref (MediaKeysLatencyProbe *probe)
+{
+        if (probe == NULL)
+                return NULL;
+
+        g_atomic_int_inc (&probe->ref_count);
+        return probe;
+}
+
+void
+media_keys_latency_probe_dispatched (MediaKeysLatencyProbe *probe)
+{
+        if (probe == NULL)
+                return;
+
+        probe->dispatched = g_get_monotonic_time ();
+}
+
+static void
+media_keys_latency_probe_complete (MediaKeysLatencyProbe *probe)
+{
+        LatencyHistory *history;
+        LatencySample *sample;
+        gint64 now;
+
+        now = g_get_monotonic_time ();
+        if (probe->dispatched == 0)
+                probe->dispatched = now;
+
+        history = &probe->latency->history[probe->type];
+        sample = &history->samples[history->next];
+        sample->dispatch = probe->dispatched - probe->received;
+        sample->complete = now - probe->received;
+
+        history->next = (history->next + 1) % LATENCY_HISTORY_SIZE;
+        if (history->count < LATENCY_HISTORY_SIZE)
+                history->count++;
+
+        g_debug ("Key type %d: dispatched after %" G_GINT64_FORMAT " us, completed after %" G_GINT64_FORMAT " us",
+                 probe->type, sample->dispatch, sample->complete);
+}
+
+void
+media_keys_latency_probe_unref (MediaKeysLatencyProbe *probe)
+{
+        if (probe == NULL)
+                return;
+        if (!g_atomic_int_dec_and_test (&probe->ref_count))
+                return;
+
+        media_keys_latency_probe_complete (probe);
+        media_keys_latency_unref (probe->latency);
+        g_free (probe);
+}
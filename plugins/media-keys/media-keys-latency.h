@@ -0,0 +1,62 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __MEDIA_KEYS_LATENCY_H__
+#define __MEDIA_KEYS_LATENCY_H__
+
+#include <glib.h>
+
+#include "media-keys.h"
+
+G_BEGIN_DECLS
+
+typedef struct _MediaKeysLatency      MediaKeysLatency;
+typedef struct _MediaKeysLatencyProbe MediaKeysLatencyProbe;
+
+/* All times are in microseconds, measured from the moment the
+ * accelerator activation was received from the shell. */
+typedef struct {
+        guint   count;
+        gint64  dispatch_p50;
+        gint64  dispatch_p90;
+        gint64  dispatch_p99;
+        gint64  complete_p50;
+        gint64  complete_p90;
+        gint64  complete_p99;
+        gint64  complete_max;
+} MediaKeysLatencyStats;
+
+MediaKeysLatency      *media_keys_latency_new            (void);
+MediaKeysLatency      *media_keys_latency_ref            (MediaKeysLatency      *latency);
+void                   media_keys_latency_unref          (MediaKeysLatency      *latency);
+void                   media_keys_latency_reset          (MediaKeysLatency      *latency);
+gboolean               media_keys_latency_get_stats      (MediaKeysLatency      *latency,
+                                                          MediaKeyType           type,
+                                                          MediaKeysLatencyStats *stats);
+
+MediaKeysLatencyProbe *media_keys_latency_probe_new      (MediaKeysLatency      *latency,
+                                                          MediaKeyType           type);
+MediaKeysLatencyProbe *media_keys_latency_probe_ref      (MediaKeysLatencyProbe *probe);
+void                   media_keys_latency_probe_unref    (MediaKeysLatencyProbe *probe);
+void                   media_keys_latency_probe_dispatched (MediaKeysLatencyProbe *probe);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (MediaKeysLatency, media_keys_latency_unref)
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (MediaKeysLatencyProbe, media_keys_latency_probe_unref)
+
+G_END_DECLS
+
+#endif /* __MEDIA_KEYS_LATENCY_H__ */
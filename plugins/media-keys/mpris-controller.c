@@ -30,9 +30,12 @@ struct _MprisController
   GObject parent;
 
   GCancellable *cancellable;
-  GDBusProxy *mpris_client_proxy;
   guint namespace_watcher_id;
-  GSList *other_proxies;
+
+  /* org.mpris.MediaPlayer2.Player proxies for all known players,
+   * most recently active first. The head is the player that media
+   * keys are dispatched to. */
+  GQueue players;
 };
 
 G_DEFINE_TYPE (MprisController, mpris_controller, G_TYPE_OBJECT)
@@ -42,8 +45,8 @@ mpris_controller_dispose (GObject *object)
 {
   MprisController *self = MPRIS_CONTROLLER (object);
 
+  g_cancellable_cancel (self->cancellable);
   g_clear_object (&self->cancellable);
-  g_clear_object (&self->mpris_client_proxy);
 
   if (self->namespace_watcher_id)
     {
@@ -51,11 +54,47 @@ mpris_controller_dispose (GObject *object)
       self->namespace_watcher_id = 0;
     }
 
-  g_slist_free_full (g_steal_pointer (&self->other_proxies), g_object_unref);
+  g_queue_clear_full (&self->players, g_object_unref);
 
   G_OBJECT_CLASS (mpris_controller_parent_class)->dispose (object);
 }
 
+/* Data handed to the caller-supplied destroy notify once the
+ * D-Bus call made on its behalf has finished */
+typedef struct
+{
+  gpointer       user_data;
+  GDestroyNotify destroy;
+} MprisCallData;
+
+static MprisCallData *
+mpris_call_data_new (gpointer       user_data,
+                     GDestroyNotify destroy)
+{
+  MprisCallData *data;
+
+  if (destroy == NULL)
+    return NULL;
+
+  data = g_new0 (MprisCallData, 1);
+  data->user_data = user_data;
+  data->destroy = destroy;
+
+  return data;
+}
+
+static void
+mpris_call_data_free (MprisCallData *data)
+{
+  if (data == NULL)
+    return;
+
+  data->destroy (data->user_data);
+  g_free (data);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (MprisCallData, mpris_call_data_free)
+
 static void
 mpris_proxy_call_done (GObject      *object,
                        GAsyncResult *res,
@@ -69,92 +108,127 @@ mpris_proxy_call_done (GObject      *object,
       if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
         g_warning ("Error calling method %s", error->message);
       g_clear_error (&error);
-      return;
     }
-  g_variant_unref (ret);
+  else
+    {
+      g_variant_unref (ret);
+    }
+
+  mpris_call_data_free (user_data);
+}
+
+static GDBusProxy *
+get_active_player (MprisController *self)
+{
+  return g_queue_peek_head (&self->players);
 }
 
+/* The @destroy notify, if any, is called with @user_data once the call
+ * to the player has completed, or right away if no call was made. */
 gboolean
-mpris_controller_key (MprisController *self, const gchar *key)
+mpris_controller_key (MprisController *self,
+                      const gchar     *key,
+                      gpointer         user_data,
+                      GDestroyNotify   destroy)
 {
+  g_autoptr(MprisCallData) data = NULL;
+  GDBusProxy *player;
+
   g_return_val_if_fail (MPRIS_IS_CONTROLLER (self), FALSE);
   g_return_val_if_fail (key != NULL, FALSE);
 
-  if (!self->mpris_client_proxy)
+  data = mpris_call_data_new (user_data, destroy);
+
+  player = get_active_player (self);
+  if (!player)
     return FALSE;
 
   if (g_strcmp0 (key, "Play") == 0)
     key = "PlayPause";
 
   g_debug ("calling %s over dbus to mpris client %s",
-           key, g_dbus_proxy_get_name (self->mpris_client_proxy));
-  g_dbus_proxy_call (self->mpris_client_proxy,
+           key, g_dbus_proxy_get_name (player));
+  g_dbus_proxy_call (player,
                      key, NULL, 0, -1, self->cancellable,
                      mpris_proxy_call_done,
-                     NULL);
+                     g_steal_pointer (&data));
   return TRUE;
 }
 
 gboolean
-mpris_controller_seek (MprisController *self, gint64 offset)
+mpris_controller_seek (MprisController *self,
+                       gint64           offset,
+                       gpointer         user_data,
+                       GDestroyNotify   destroy)
 {
+  g_autoptr(MprisCallData) data = NULL;
+  GDBusProxy *player;
+
   g_return_val_if_fail (MPRIS_IS_CONTROLLER (self), FALSE);
 
-  if (!self->mpris_client_proxy)
+  data = mpris_call_data_new (user_data, destroy);
+
+  player = get_active_player (self);
+  if (!player)
     return FALSE;
 
   g_debug ("calling Seek over dbus to mpris client %s",
-           g_dbus_proxy_get_name (self->mpris_client_proxy));
-  g_dbus_proxy_call (self->mpris_client_proxy,
+           g_dbus_proxy_get_name (player));
+  g_dbus_proxy_call (player,
                      "Seek", g_variant_new ("(x)", offset, NULL),
                      G_DBUS_CALL_FLAGS_NONE, -1, self->cancellable,
                      mpris_proxy_call_done,
-                     NULL);
+                     g_steal_pointer (&data));
   return TRUE;
 }
 
-static GDBusProxy *
-get_props_proxy (GDBusProxy   *proxy,
-                 GCancellable *cancellable)
+/* Properties are set through the player proxy itself, using the fully
+ * qualified method name, so no extra proxy has to be set up on the bus
+ * when a toggle key is pressed. */
+static void
+set_player_property (MprisController *self,
+                     GDBusProxy      *player,
+                     const gchar     *property,
+                     GVariant        *value,
+                     MprisCallData   *data)
 {
-  GDBusProxy *props = NULL;
-  g_autoptr(GError) error = NULL;
-
-  g_return_val_if_fail (proxy != NULL, NULL);
-
-  props = g_dbus_proxy_new_sync (g_dbus_proxy_get_connection (proxy),
-                                 G_DBUS_PROXY_FLAGS_DO_NOT_AUTO_START | G_DBUS_PROXY_FLAGS_DO_NOT_CONNECT_SIGNALS | G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES,
-                                 NULL,
-                                 g_dbus_proxy_get_name (proxy),
-                                 g_dbus_proxy_get_object_path (proxy),
-                                 "org.freedesktop.DBus.Properties",
-                                 cancellable,
-                                 &error);
-  if (!props) {
-    g_debug ("Could not get properties proxy for %s: %s",
-             g_dbus_proxy_get_interface_name (proxy),
-             error->message);
-    return NULL;
-  }
-
-  return props;
+  g_debug ("setting %s over dbus on mpris client %s",
+           property, g_dbus_proxy_get_name (player));
+  g_dbus_proxy_call (player,
+                     "org.freedesktop.DBus.Properties.Set",
+                     g_variant_new ("(ssv)",
+                                    "org.mpris.MediaPlayer2.Player",
+                                    property,
+                                    value),
+                     G_DBUS_CALL_FLAGS_NONE,
+                     -1,
+                     self->cancellable,
+                     mpris_proxy_call_done, data);
 }
 
 gboolean
-mpris_controller_toggle (MprisController *self, const gchar *property)
+mpris_controller_toggle (MprisController *self,
+                         const gchar     *property,
+                         gpointer         user_data,
+                         GDestroyNotify   destroy)
 {
+  g_autoptr(MprisCallData) data = NULL;
+  GDBusProxy *player;
+
   g_return_val_if_fail (MPRIS_IS_CONTROLLER (self), FALSE);
   g_return_val_if_fail (property != NULL, FALSE);
 
-  if (!self->mpris_client_proxy)
+  data = mpris_call_data_new (user_data, destroy);
+
+  player = get_active_player (self);
+  if (!player)
     return FALSE;
 
   if (g_str_equal (property, "LoopStatus")) {
-    g_autoptr(GDBusProxy) props = NULL;
-    g_autoptr(GVariant) loop_status;
+    g_autoptr(GVariant) loop_status = NULL;
     const gchar *status_str, *new_status;
 
-    loop_status = g_dbus_proxy_get_cached_property (self->mpris_client_proxy, "LoopStatus");
+    loop_status = g_dbus_proxy_get_cached_property (player, "LoopStatus");
     if (!loop_status)
       return FALSE;
     if (!g_variant_is_of_type (loop_status, G_VARIANT_TYPE_STRING))
@@ -165,44 +239,27 @@ mpris_controller_toggle (MprisController *self, const gchar *property)
     else
       new_status = "Playlist";
 
-    props = get_props_proxy (self->mpris_client_proxy, self->cancellable);
-    if (!props)
-      return FALSE;
-    g_dbus_proxy_call (props,
-                       "Set",
-                       g_variant_new_parsed ("('org.mpris.MediaPlayer2.Player', 'LoopStatus', %v)",
-                                             g_variant_new_string (new_status)),
-                       G_DBUS_CALL_FLAGS_NONE,
-                       -1,
-                       self->cancellable,
-                       mpris_proxy_call_done, NULL);
+    set_player_property (self, player, "LoopStatus",
+                         g_variant_new_string (new_status),
+                         g_steal_pointer (&data));
   } else if (g_str_equal (property, "Shuffle")) {
-    g_autoptr(GDBusProxy) props = NULL;
-    g_autoptr(GVariant) shuffle_status;
+    g_autoptr(GVariant) shuffle_status = NULL;
     gboolean status;
 
-    shuffle_status = g_dbus_proxy_get_cached_property (self->mpris_client_proxy, "Shuffle");
+    shuffle_status = g_dbus_proxy_get_cached_property (player, "Shuffle");
     if (!shuffle_status)
       return FALSE;
     if (!g_variant_is_of_type (shuffle_status, G_VARIANT_TYPE_BOOLEAN))
       return FALSE;
     status = g_variant_get_boolean (shuffle_status);
 
-    props = get_props_proxy (self->mpris_client_proxy, self->cancellable);
-    if (!props)
-      return FALSE;
-    g_dbus_proxy_call (props,
-                       "Set",
-                       g_variant_new_parsed ("('org.mpris.MediaPlayer2.Player', 'Shuffle', %v)",
-                                             g_variant_new_boolean (!status)),
-                       G_DBUS_CALL_FLAGS_NONE,
-                       -1,
-                       self->cancellable,
-                       mpris_proxy_call_done, NULL);
+    set_player_property (self, player, "Shuffle",
+                         g_variant_new_boolean (!status),
+                         g_steal_pointer (&data));
+  } else {
+    g_debug ("Unhandled toggle property '%s'", property);
   }
 
-  g_debug ("Unhandled toggle property '%s'", property);
-
   return TRUE;
 }
 
@@ -223,44 +280,49 @@ mpris_client_is_playing (GDBusProxy *proxy)
   return g_strcmp0 (status_str, "Playing") == 0;
 }
 
+static GDBusProxy *
+find_player (MprisController *self,
+             const gchar     *name)
+{
+  GList *l;
+
+  for (l = self->players.head; l != NULL; l = l->next)
+    {
+      if (g_strcmp0 (g_dbus_proxy_get_name (l->data), name) == 0)
+        return l->data;
+    }
+
+  return NULL;
+}
+
 static void
 mpris_client_notify_name_owner_cb (GDBusProxy      *proxy,
                                    GParamSpec      *pspec,
                                    MprisController *self)
 {
   g_autofree gchar *name_owner = NULL;
-  GSList *first;
+  gboolean was_active;
 
   /* Owner changed, but the proxy is still valid. */
   name_owner = g_dbus_proxy_get_name_owner (proxy);
   if (name_owner)
     return;
 
-  if (proxy == self->mpris_client_proxy)
-    {
-      g_debug ("Clearing the current MPRIS client proxy");
-      g_clear_object (&self->mpris_client_proxy);
-
-      if ((first = self->other_proxies))
-        {
-          self->mpris_client_proxy = first->data;
-          self->other_proxies = first->next;
-          g_slist_free_1 (first);
-
-          g_debug ("Falling back to MPRIS client %s",
-                   g_dbus_proxy_get_name (self->mpris_client_proxy));
-        }
-      else
-        {
-          g_object_notify (G_OBJECT (self), "has-active-player");
-        }
-    }
+  was_active = (proxy == get_active_player (self));
+
+  g_debug ("Forgetting MPRIS client %s", g_dbus_proxy_get_name (proxy));
+  g_queue_remove (&self->players, proxy);
+  g_signal_handlers_disconnect_by_data (proxy, self);
+  g_object_unref (proxy);
+
+  if (!was_active)
+    return;
+
+  if (get_active_player (self))
+    g_debug ("Falling back to MPRIS client %s",
+             g_dbus_proxy_get_name (get_active_player (self)));
   else
-    {
-      g_debug ("Forgetting MPRIS client %s", g_dbus_proxy_get_name (proxy));
-      self->other_proxies = g_slist_remove (self->other_proxies, proxy);
-      g_object_unref (proxy);
-    }
+    g_object_notify (G_OBJECT (self), "has-active-player");
 }
 
 static void
@@ -272,28 +334,26 @@ mpris_client_properties_changed_cb (GDBusProxy *proxy,
   MprisController *self = MPRIS_CONTROLLER (user_data);
   GDBusProxy *current_proxy;
 
-  current_proxy = self->mpris_client_proxy;
+  current_proxy = get_active_player (self);
   if (current_proxy == proxy)
     return;
 
-  if (current_proxy && mpris_client_is_playing (current_proxy))
+  if (!mpris_client_is_playing (proxy))
     return;
 
-  if (mpris_client_is_playing (proxy))
-    {
-      g_debug ("Switching to MPRIS client %s because it is playing",
-               g_dbus_proxy_get_name (proxy));
-
-      self->other_proxies = g_slist_remove (self->other_proxies, proxy);
-
-      if (current_proxy)
-        self->other_proxies = g_slist_prepend (self->other_proxies, current_proxy);
+  g_queue_remove (&self->players, proxy);
 
-      self->mpris_client_proxy = proxy;
-
-      if (!current_proxy)
-        g_object_notify (user_data, "has-active-player");
+  /* Don't steal the keys from a playing client, but make this one
+   * the first to fall back to. */
+  if (mpris_client_is_playing (current_proxy))
+    {
+      g_queue_insert_after (&self->players, self->players.head, proxy);
+      return;
     }
+
+  g_debug ("Switching to MPRIS client %s because it is playing",
+           g_dbus_proxy_get_name (proxy));
+  g_queue_push_head (&self->players, proxy);
 }
 
 static void
@@ -301,9 +361,10 @@ mpris_proxy_ready_cb (GObject      *object,
                       GAsyncResult *res,
                       gpointer      user_data)
 {
-  MprisController *self = MPRIS_CONTROLLER (user_data);
+  MprisController *self;
   GError *error = NULL;
   GDBusProxy *proxy;
+  GDBusProxy *current_proxy;
   const gchar *name;
 
   proxy = g_dbus_proxy_new_for_bus_finish (res, &error);
@@ -316,34 +377,38 @@ mpris_proxy_ready_cb (GObject      *object,
       return;
     }
 
+  self = MPRIS_CONTROLLER (user_data);
+  name = g_dbus_proxy_get_name (proxy);
+
+  /* The player re-appeared while we were still setting up a proxy for it */
+  if (find_player (self, name))
+    {
+      g_object_unref (proxy);
+      return;
+    }
+
   g_signal_connect (proxy, "notify::g-name-owner",
                     G_CALLBACK (mpris_client_notify_name_owner_cb), user_data);
 
   g_signal_connect (proxy, "g-properties-changed",
                     G_CALLBACK (mpris_client_properties_changed_cb), user_data);
 
-  name = g_dbus_proxy_get_name (proxy);
+  current_proxy = get_active_player (self);
 
-  if (self->mpris_client_proxy)
+  if (current_proxy && mpris_client_is_playing (current_proxy))
     {
-      if (mpris_client_is_playing (self->mpris_client_proxy))
-        {
-          g_debug ("Remembering %s for later because the current MPRIS client is playing",
-                   name);
-          self->other_proxies = g_slist_prepend (self->other_proxies, proxy);
-          return;
-        }
-
-      g_debug ("Remembering the current MPRIS client for later");
-      self->other_proxies =
-        g_slist_prepend (self->other_proxies, self->mpris_client_proxy);
+      g_debug ("Remembering %s for later because the current MPRIS client is playing",
+               name);
+      g_queue_insert_after (&self->players, self->players.head, proxy);
+      return;
     }
 
   g_debug ("Switching to MPRIS client %s because it just appeared", name);
 
-  self->mpris_client_proxy = proxy;
+  g_queue_push_head (&self->players, proxy);
 
-  g_object_notify (user_data, "has-active-player");
+  if (!current_proxy)
+    g_object_notify (user_data, "has-active-player");
 }
 
 static void
@@ -367,7 +432,13 @@ mpris_player_appeared (GDBusConnection *connection,
                        const gchar     *name_owner,
                        gpointer         user_data)
 {
-  start_mpris_proxy (MPRIS_CONTROLLER (user_data), name);
+  MprisController *self = MPRIS_CONTROLLER (user_data);
+
+  /* Existing proxies follow owner changes of their well-known name */
+  if (find_player (self, name))
+    return;
+
+  start_mpris_proxy (self, name);
 }
 
 static void
@@ -375,6 +446,7 @@ mpris_controller_constructed (GObject *object)
 {
   MprisController *self = MPRIS_CONTROLLER (object);
 
+  self->cancellable = g_cancellable_new ();
   self->namespace_watcher_id = bus_watch_namespace (G_BUS_TYPE_SESSION,
                                                     "org.mpris.MediaPlayer2",
                                                     mpris_player_appeared,
@@ -423,6 +495,7 @@ mpris_controller_class_init (MprisControllerClass *klass)
 static void
 mpris_controller_init (MprisController *self)
 {
+  g_queue_init (&self->players);
 }
 
 gboolean
@@ -430,7 +503,7 @@ mpris_controller_get_has_active_player (MprisController *controller)
 {
   g_return_val_if_fail (MPRIS_IS_CONTROLLER (controller), FALSE);
 
-  return (controller->mpris_client_proxy != NULL);
+  return (get_active_player (controller) != NULL);
 }
 
 MprisController *
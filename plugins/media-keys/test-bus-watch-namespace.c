@@ -0,0 +1,246 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Name churn benchmark for bus_watch_namespace().
+ *
+ * A private bus is flooded with short-lived connections, each owning an
+ * unrelated well-known name, while a handful of MPRIS players come and go.
+ * The number of NameOwnerChanged signals reaching the watcher's connection
+ * is compared with what a plain NameOwnerChanged subscriber receives.
+ */
+
+#include <gio/gio.h>
+#include "bus-watch-namespace.h"
+
+#define MPRIS_NAMESPACE "org.mpris.MediaPlayer2"
+#define N_PLAYERS       5
+#define N_CHURN         500
+
+typedef struct
+{
+  guint appeared;
+  guint vanished;
+} WatchCounters;
+
+static GDBusMessage *
+count_name_owner_changed (GDBusConnection *connection,
+                          GDBusMessage    *message,
+                          gboolean         incoming,
+                          gpointer         user_data)
+{
+  guint *count = user_data;
+
+  if (incoming &&
+      g_dbus_message_get_message_type (message) == G_DBUS_MESSAGE_TYPE_SIGNAL &&
+      g_strcmp0 (g_dbus_message_get_member (message), "NameOwnerChanged") == 0)
+    g_atomic_int_inc (count);
+
+  return message;
+}
+
+static void
+noop_signal_cb (GDBusConnection *connection,
+                const gchar     *sender_name,
+                const gchar     *object_path,
+                const gchar     *interface_name,
+                const gchar     *signal_name,
+                GVariant        *parameters,
+                gpointer         user_data)
+{
+}
+
+static void
+name_appeared (GDBusConnection *connection,
+               const gchar     *name,
+               const gchar     *name_owner,
+               gpointer         user_data)
+{
+  WatchCounters *counters = user_data;
+
+  counters->appeared++;
+}
+
+static void
+name_vanished (GDBusConnection *connection,
+               const gchar     *name,
+               gpointer         user_data)
+{
+  WatchCounters *counters = user_data;
+
+  counters->vanished++;
+}
+
+/* Connects to the bus, owns @name and disconnects again */
+static void
+churn_name (const gchar *address,
+            const gchar *name)
+{
+  g_autoptr(GDBusConnection) connection = NULL;
+  g_autoptr(GVariant) reply = NULL;
+  g_autoptr(GError) error = NULL;
+
+  connection = g_dbus_connection_new_for_address_sync (address,
+                                                       G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+                                                       G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+                                                       NULL, NULL, &error);
+  g_assert_no_error (error);
+
+  reply = g_dbus_connection_call_sync (connection, "org.freedesktop.DBus", "/org/freedesktop/DBus",
+                                       "org.freedesktop.DBus", "RequestName",
+                                       g_variant_new ("(su)", name, 0), G_VARIANT_TYPE ("(u)"),
+                                       G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
+  g_assert_no_error (error);
+
+  g_dbus_connection_close_sync (connection, NULL, &error);
+  g_assert_no_error (error);
+}
+
+static void
+bus_round_trip (GDBusConnection *connection)
+{
+  g_autoptr(GVariant) reply = NULL;
+  g_autoptr(GError) error = NULL;
+
+  reply = g_dbus_connection_call_sync (connection, "org.freedesktop.DBus", "/org/freedesktop/DBus",
+                                       "org.freedesktop.DBus", "GetId", NULL, G_VARIANT_TYPE ("(s)"),
+                                       G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
+  g_assert_no_error (error);
+}
+
+static gboolean
+timeout_cb (gpointer user_data)
+{
+  gboolean *timed_out = user_data;
+
+  *timed_out = TRUE;
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+test_name_churn (void)
+{
+  g_autoptr(GTestDBus) bus = NULL;
+  g_autoptr(GDBusConnection) watcher_connection = NULL;
+  g_autoptr(GDBusConnection) baseline_connection = NULL;
+  g_autoptr(GError) error = NULL;
+  WatchCounters counters = { 0, };
+  const gchar *address;
+  guint watcher_signals = 0;
+  guint baseline_signals = 0;
+  guint watcher_filter, baseline_filter, baseline_subscription;
+  guint watch_id;
+  gboolean timed_out = FALSE;
+  gint64 start;
+  guint i;
+
+  bus = g_test_dbus_new (G_TEST_DBUS_NONE);
+  g_test_dbus_up (bus);
+  address = g_test_dbus_get_bus_address (bus);
+
+  /* bus_watch_namespace() uses the shared session bus connection */
+  watcher_connection = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, &error);
+  g_assert_no_error (error);
+  g_dbus_connection_set_exit_on_close (watcher_connection, FALSE);
+  watcher_filter = g_dbus_connection_add_filter (watcher_connection,
+                                                 count_name_owner_changed,
+                                                 &watcher_signals, NULL);
+
+  /* What a watcher without a namespace match rule would receive */
+  baseline_connection = g_dbus_connection_new_for_address_sync (address,
+                                                                G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+                                                                G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+                                                                NULL, NULL, &error);
+  g_assert_no_error (error);
+  baseline_filter = g_dbus_connection_add_filter (baseline_connection,
+                                                  count_name_owner_changed,
+                                                  &baseline_signals, NULL);
+  baseline_subscription =
+    g_dbus_connection_signal_subscribe (baseline_connection, "org.freedesktop.DBus",
+                                        "org.freedesktop.DBus", "NameOwnerChanged", "/org/freedesktop/DBus",
+                                        NULL, G_DBUS_SIGNAL_FLAGS_NONE,
+                                        noop_signal_cb, NULL, NULL);
+
+  watch_id = bus_watch_namespace (G_BUS_TYPE_SESSION, MPRIS_NAMESPACE,
+                                  name_appeared, name_vanished,
+                                  &counters, NULL);
+
+  /* Let the watcher subscribe, then make sure both match rules are
+   * in place on the bus before the churn starts */
+  while (g_main_context_iteration (NULL, FALSE));
+  bus_round_trip (baseline_connection);
+  bus_round_trip (watcher_connection);
+
+  start = g_get_monotonic_time ();
+
+  for (i = 0; i < N_CHURN; i++)
+    {
+      g_autofree gchar *name = NULL;
+
+      name = g_strdup_printf ("org.gnome.SettingsDaemon.Test.Churn%u", i);
+      churn_name (address, name);
+
+      if (i % (N_CHURN / N_PLAYERS) == 0)
+        {
+          g_autofree gchar *player = NULL;
+
+          player = g_strdup_printf (MPRIS_NAMESPACE ".test%u", i);
+          churn_name (address, player);
+        }
+    }
+
+  g_timeout_add_seconds (10, timeout_cb, &timed_out);
+  while (!timed_out && counters.vanished < N_PLAYERS)
+    g_main_context_iteration (NULL, TRUE);
+
+  /* Signals are ordered before the reply, so all of them have been
+   * seen by the filters once these calls return. */
+  bus_round_trip (baseline_connection);
+  bus_round_trip (watcher_connection);
+
+  g_test_message ("%u connections churned in %" G_GINT64_FORMAT " ms",
+                  N_CHURN + N_PLAYERS,
+                  (g_get_monotonic_time () - start) / 1000);
+  g_test_message ("NameOwnerChanged signals received: %u without match rule, %u with arg0namespace",
+                  g_atomic_int_get (&baseline_signals),
+                  g_atomic_int_get (&watcher_signals));
+
+  g_assert_cmpuint (counters.appeared, ==, N_PLAYERS);
+  g_assert_cmpuint (counters.vanished, ==, N_PLAYERS);
+
+  /* Each player's well-known name appears and vanishes once; all other
+   * owner changes must have been filtered out by the bus. */
+  g_assert_cmpuint (g_atomic_int_get (&watcher_signals), ==, 2 * N_PLAYERS);
+  g_assert_cmpuint (g_atomic_int_get (&baseline_signals), >=, 4 * (N_CHURN + N_PLAYERS));
+
+  bus_unwatch_namespace (watch_id);
+  g_dbus_connection_signal_unsubscribe (baseline_connection, baseline_subscription);
+  g_dbus_connection_remove_filter (baseline_connection, baseline_filter);
+  g_dbus_connection_remove_filter (watcher_connection, watcher_filter);
+
+  g_dbus_connection_close_sync (baseline_connection, NULL, NULL);
+  g_clear_object (&watcher_connection);
+  g_test_dbus_down (bus);
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/media-keys/bus-watch-namespace/name-churn", test_name_churn);
+
+  return g_test_run ();
+}
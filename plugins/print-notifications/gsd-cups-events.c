@@ -0,0 +1,517 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Events from the CUPS D-Bus notifier are handled as they arrive. The
+ * signals carry the same attributes as Get-Notifications would return,
+ * but no sequence number, so the tracker only counts them. Once in a
+ * while the caller asks the server for the sequence number of its
+ * subscription: if more events were sent than signals arrived before the
+ * request, the missing ones are fetched, and those which did arrive as signals are
+ * recognised by their attributes and skipped. Missed job events which
+ * are only fetched long after they happened are dropped as well.
+ *
+ * Every subscription with a dbus:// recipient gets its own notifier, and
+ * all of them broadcast on the system bus, so the same event usually
+ * arrives once per session. Identical events within a short window are
+ * only delivered once.
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+
+#include "gsd-cups-events.h"
+
+/* Identical events closer than this are considered copies */
+#define DUPLICATE_WINDOW (2 * G_USEC_PER_SEC)
+
+/* Fetched job events older than this are not worth a notification; well
+ * above the interval events are polled at without the D-Bus notifier */
+#define STALE_JOB_EVENT_AGE 120 /* secs */
+
+typedef struct {
+        const gchar *signal_name;
+        const gchar *subscribed_event;
+} SignalEvent;
+
+/* The events gsd subscribes to, named as cups-notifier-dbus does */
+static const SignalEvent signal_events[] = {
+        { "JobCreated",          "job-created" },
+        { "JobCompleted",        "job-completed" },
+        { "JobState",            "job-state-changed" },
+        { "PrinterAdded",        "printer-added" },
+        { "PrinterDeleted",      "printer-deleted" },
+        { "PrinterStateChanged", "printer-state-changed" },
+};
+
+GsdCupsEvent *
+gsd_cups_event_new (void)
+{
+        GsdCupsEvent *event;
+
+        event = g_new0 (GsdCupsEvent, 1);
+        event->sequence_number = -1;
+        event->printer_state = -1;
+        event->job_state = -1;
+        event->job_impressions_completed = -1;
+        event->age = -1;
+
+        return event;
+}
+
+void
+gsd_cups_event_free (GsdCupsEvent *event)
+{
+        if (event == NULL)
+                return;
+
+        g_free (event->subscribed_event);
+        g_free (event->text);
+        g_free (event->printer_uri);
+        g_free (event->printer_name);
+        g_free (event->printer_state_reasons);
+        g_free (event->job_state_reasons);
+        g_free (event->job_name);
+        g_free (event);
+}
+
+/* Returns %NULL without setting @error for signals of events gsd does
+ * not subscribe to, such as the Server* ones. */
+GsdCupsEvent *
+gsd_cups_event_new_from_signal (const gchar  *signal_name,
+                                GVariant     *parameters,
+                                GError      **error)
+{
+        g_autoptr(GsdCupsEvent) event = NULL;
+        const gchar *subscribed_event = NULL;
+        guint32 printer_state;
+        guint32 job_id;
+        guint32 job_state;
+        guint32 job_impressions_completed;
+        guint i;
+
+        for (i = 0; i < G_N_ELEMENTS (signal_events); i++) {
+                if (g_strcmp0 (signal_name, signal_events[i].signal_name) == 0) {
+                        subscribed_event = signal_events[i].subscribed_event;
+                        break;
+                }
+        }
+
+        if (subscribed_event == NULL)
+                return NULL;
+
+        event = gsd_cups_event_new ();
+        event->subscribed_event = g_strdup (subscribed_event);
+
+        if (g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(sssusbuussu)"))) {
+                g_variant_get (parameters, "(sssusbuussu)",
+                               &event->text,
+                               &event->printer_uri,
+                               &event->printer_name,
+                               &printer_state,
+                               &event->printer_state_reasons,
+                               &event->printer_is_accepting_jobs,
+                               &job_id,
+                               &job_state,
+                               &event->job_state_reasons,
+                               &event->job_name,
+                               &job_impressions_completed);
+                event->job_id = job_id;
+                event->job_state = job_state;
+                event->job_impressions_completed = job_impressions_completed;
+        } else if (g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(sssusb)"))) {
+                g_variant_get (parameters, "(sssusb)",
+                               &event->text,
+                               &event->printer_uri,
+                               &event->printer_name,
+                               &printer_state,
+                               &event->printer_state_reasons,
+                               &event->printer_is_accepting_jobs);
+        } else {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                             "Unexpected parameters %s for %s",
+                             g_variant_get_type_string (parameters), signal_name);
+                return NULL;
+        }
+
+        event->printer_state = printer_state;
+
+        return g_steal_pointer (&event);
+}
+
+typedef struct {
+        gchar    *fingerprint;
+        gint64    time;                 /* monotonic */
+        guint     mark;                 /* signals received up to this one */
+        gboolean  reconciled;
+} TrackedEvent;
+
+struct _GsdCupsEventTracker {
+        GsdCupsEventFunc  func;
+        gpointer          user_data;
+
+        /* sequence number of the last event known to be delivered */
+        gint              last;
+
+        /* delivered events, oldest first; reconciled ones are kept for
+         * the duplicate window, others until the next check */
+        GQueue            events;
+        guint             n_unreconciled;
+        guint             n_signals;
+
+        guint             delivered;
+        guint             duplicates;
+        guint             gaps;
+};
+
+static void
+tracked_event_free (TrackedEvent *tracked)
+{
+        g_free (tracked->fingerprint);
+        g_free (tracked);
+}
+
+static gchar *
+event_fingerprint (const GsdCupsEvent *event)
+{
+        return g_strdup_printf ("%s\x1f%s\x1f%d\x1f%s\x1f%u\x1f%d\x1f%s",
+                                event->subscribed_event ? event->subscribed_event : "",
+                                event->printer_name ? event->printer_name : "",
+                                event->printer_state,
+                                event->printer_state_reasons ? event->printer_state_reasons : "",
+                                event->job_id,
+                                event->job_state,
+                                event->job_state_reasons ? event->job_state_reasons : "");
+}
+
+static void
+prune (GsdCupsEventTracker *tracker,
+       gint64               now)
+{
+        GList *l, *next;
+
+        for (l = tracker->events.head; l != NULL; l = next) {
+                TrackedEvent *tracked = l->data;
+
+                next = l->next;
+                if (now - tracked->time < DUPLICATE_WINDOW)
+                        break;
+                if (!tracked->reconciled)
+                        continue;
+
+                tracked_event_free (tracked);
+                g_queue_delete_link (&tracker->events, l);
+        }
+}
+
+/* Signals received after @mark may be for events the server had not sent
+ * yet when it was asked, so they are left for the next check */
+static void
+mark_reconciled (GsdCupsEventTracker *tracker,
+                 guint                mark)
+{
+        GList *l;
+
+        for (l = tracker->events.head; l != NULL; l = l->next) {
+                TrackedEvent *tracked = l->data;
+
+                if (tracked->reconciled || tracked->mark > mark)
+                        continue;
+
+                tracked->reconciled = TRUE;
+                tracker->n_unreconciled--;
+        }
+}
+
+static guint
+count_unreconciled (GsdCupsEventTracker *tracker,
+                    guint                mark)
+{
+        GList *l;
+        guint n = 0;
+
+        for (l = tracker->events.head; l != NULL; l = l->next) {
+                TrackedEvent *tracked = l->data;
+
+                if (!tracked->reconciled && tracked->mark <= mark)
+                        n++;
+        }
+
+        return n;
+}
+
+static TrackedEvent *
+find_recent (GsdCupsEventTracker *tracker,
+             const gchar         *fingerprint,
+             gint64               now)
+{
+        GList *l;
+
+        for (l = tracker->events.tail; l != NULL; l = l->prev) {
+                TrackedEvent *tracked = l->data;
+
+                if (now - tracked->time >= DUPLICATE_WINDOW)
+                        break;
+                if (g_str_equal (tracked->fingerprint, fingerprint))
+                        return tracked;
+        }
+
+        return NULL;
+}
+
+static TrackedEvent *
+find_unreconciled (GsdCupsEventTracker *tracker,
+                   const gchar         *fingerprint)
+{
+        GList *l;
+
+        for (l = tracker->events.head; l != NULL; l = l->next) {
+                TrackedEvent *tracked = l->data;
+
+                if (!tracked->reconciled &&
+                    g_str_equal (tracked->fingerprint, fingerprint))
+                        return tracked;
+        }
+
+        return NULL;
+}
+
+static void
+deliver (GsdCupsEventTracker *tracker,
+         const GsdCupsEvent  *event,
+         gchar               *fingerprint,
+         gint64               now,
+         gboolean             reconciled)
+{
+        TrackedEvent *tracked;
+
+        tracked = g_new0 (TrackedEvent, 1);
+        tracked->fingerprint = fingerprint;
+        tracked->time = now;
+        tracked->reconciled = reconciled;
+        g_queue_push_tail (&tracker->events, tracked);
+
+        if (!reconciled) {
+                tracked->mark = ++tracker->n_signals;
+                tracker->n_unreconciled++;
+        }
+
+        tracker->delivered++;
+        tracker->func (event, tracker->user_data);
+}
+
+GsdCupsEventTracker *
+gsd_cups_event_tracker_new (GsdCupsEventFunc func,
+                            gpointer         user_data)
+{
+        GsdCupsEventTracker *tracker;
+
+        tracker = g_new0 (GsdCupsEventTracker, 1);
+        tracker->func = func;
+        tracker->user_data = user_data;
+        tracker->last = -1;
+        g_queue_init (&tracker->events);
+
+        return tracker;
+}
+
+void
+gsd_cups_event_tracker_free (GsdCupsEventTracker *tracker)
+{
+        if (tracker == NULL)
+                return;
+
+        g_queue_clear_full (&tracker->events, (GDestroyNotify) tracked_event_free);
+        g_free (tracker);
+}
+
+/* Forgets the sequence numbers, e.g. when the subscription was replaced.
+ * Recent events are still recognised as duplicates. */
+void
+gsd_cups_event_tracker_reset (GsdCupsEventTracker *tracker)
+{
+        mark_reconciled (tracker, G_MAXUINT);
+        tracker->last = -1;
+}
+
+/* Returns a mark of the signals received so far, to be taken when the
+ * sequence number is requested and passed to the check with it */
+guint
+gsd_cups_event_tracker_get_mark (GsdCupsEventTracker *tracker)
+{
+        return tracker->n_signals;
+}
+
+/* Handles an event received as a D-Bus signal */
+void
+gsd_cups_event_tracker_push (GsdCupsEventTracker *tracker,
+                             const GsdCupsEvent  *event)
+{
+        g_autofree gchar *fingerprint = NULL;
+        gint64 now;
+
+        now = g_get_monotonic_time ();
+        prune (tracker, now);
+
+        fingerprint = event_fingerprint (event);
+        if (find_recent (tracker, fingerprint, now) != NULL) {
+                tracker->duplicates++;
+                return;
+        }
+
+        deliver (tracker, event, g_steal_pointer (&fingerprint), now, FALSE);
+}
+
+/* Compares the signals received up to @mark with @sequence_number, the
+ * number of the last event the server sent when @mark was taken. Returns
+ * the first sequence number that has to be fetched, or -1 if nothing was
+ * missed.
+ *
+ * Signals from other subscriptions that do not look like ours can hide a
+ * gap until a later check. */
+gint
+gsd_cups_event_tracker_check (GsdCupsEventTracker *tracker,
+                              guint                mark,
+                              gint                 sequence_number)
+{
+        guint n_received;
+
+        n_received = count_unreconciled (tracker, mark);
+        if (tracker->last < 0 ||
+            sequence_number <= tracker->last + (gint) n_received) {
+                gsd_cups_event_tracker_reconciled (tracker, mark, sequence_number);
+                return -1;
+        }
+
+        g_debug ("Missed %d CUPS events after %d",
+                 sequence_number - tracker->last - (gint) n_received,
+                 tracker->last);
+
+        tracker->gaps++;
+
+        return tracker->last + 1;
+}
+
+/* Handles an event fetched with Get-Notifications */
+void
+gsd_cups_event_tracker_pull (GsdCupsEventTracker *tracker,
+                             const GsdCupsEvent  *event)
+{
+        g_autofree gchar *fingerprint = NULL;
+        TrackedEvent *tracked;
+        gint64 now;
+
+        if (event->sequence_number <= tracker->last)
+                return;
+
+        tracker->last = event->sequence_number;
+
+        now = g_get_monotonic_time ();
+        prune (tracker, now);
+
+        fingerprint = event_fingerprint (event);
+
+        /* already received as a signal */
+        tracked = find_unreconciled (tracker, fingerprint);
+        if (tracked != NULL) {
+                tracked->reconciled = TRUE;
+                tracker->n_unreconciled--;
+                return;
+        }
+
+        /* or as one reconciled by an earlier check */
+        if (find_recent (tracker, fingerprint, now) != NULL) {
+                tracker->duplicates++;
+                return;
+        }
+
+        /* printer events still tell the current state */
+        if (event->age > STALE_JOB_EVENT_AGE &&
+            event->subscribed_event != NULL &&
+            g_str_has_prefix (event->subscribed_event, "job-")) {
+                g_debug ("Dropping CUPS event %d from %d s ago",
+                         event->sequence_number, event->age);
+                return;
+        }
+
+        deliver (tracker, event, g_steal_pointer (&fingerprint), now, TRUE);
+}
+
+/* Called once every event up to @sequence_number, which was requested
+ * when @mark was taken, has been delivered */
+void
+gsd_cups_event_tracker_reconciled (GsdCupsEventTracker *tracker,
+                                   guint                mark,
+                                   gint                 sequence_number)
+{
+        mark_reconciled (tracker, mark);
+        tracker->last = MAX (tracker->last, sequence_number);
+}
+
+gint
+gsd_cups_event_tracker_get_last (GsdCupsEventTracker *tracker)
+{
+        return tracker->last;
+}
+
+void
+gsd_cups_event_tracker_get_counts (GsdCupsEventTracker *tracker,
+                                   guint               *delivered,
+                                   guint               *duplicates,
+                                   guint               *gaps)
+{
+        if (delivered != NULL)
+                *delivered = tracker->delivered;
+        if (duplicates != NULL)
+                *duplicates = tracker->duplicates;
+        if (gaps != NULL)
+                *gaps = tracker->gaps;
+}
+
+void
+gsd_cups_backoff_init (GsdCupsBackoff *backoff,
+                       guint           initial,
+                       guint           max)
+{
+        backoff->initial = initial;
+        backoff->max = MAX (initial, max);
+        backoff->current = initial;
+}
+
+/* Returns the next delay, between half and all of the current step, and
+ * doubles the step. The jitter keeps sessions that lost the same server
+ * from retrying in lockstep. */
+guint
+gsd_cups_backoff_next (GsdCupsBackoff *backoff)
+{
+        guint step;
+        guint delay;
+
+        step = backoff->current;
+        delay = step - step / 2 + (guint) g_random_int_range (0, step / 2 + 1);
+
+        backoff->current = step > backoff->max / 2 ? backoff->max : step * 2;
+
+        return delay;
+}
+
+void
+gsd_cups_backoff_reset (GsdCupsBackoff *backoff)
+{
+        backoff->current = backoff->initial;
+}
@@ -0,0 +1,100 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __GSD_CUPS_EVENTS_H
+#define __GSD_CUPS_EVENTS_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define CUPS_DBUS_NAME      "org.cups.cupsd.Notifier"
+#define CUPS_DBUS_PATH      "/org/cups/cupsd/Notifier"
+#define CUPS_DBUS_INTERFACE "org.cups.cupsd.Notifier"
+
+/* A printer or job event, either received from the CUPS D-Bus notifier
+ * or fetched with Get-Notifications. Fields which the event does not
+ * carry are %NULL or -1. */
+typedef struct {
+        gint      sequence_number;      /* -1 for D-Bus signals */
+        gchar    *subscribed_event;
+        gchar    *text;
+        gchar    *printer_uri;
+        gchar    *printer_name;
+        gint      printer_state;
+        gchar    *printer_state_reasons;
+        gboolean  printer_is_accepting_jobs;
+        guint     job_id;
+        gint      job_state;
+        gchar    *job_state_reasons;
+        gchar    *job_name;
+        gint      job_impressions_completed;
+        gint      age;                  /* secs before it was fetched, -1 if unknown */
+} GsdCupsEvent;
+
+GsdCupsEvent *gsd_cups_event_new              (void);
+void          gsd_cups_event_free             (GsdCupsEvent *event);
+GsdCupsEvent *gsd_cups_event_new_from_signal  (const gchar  *signal_name,
+                                               GVariant     *parameters,
+                                               GError      **error);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GsdCupsEvent, gsd_cups_event_free)
+
+typedef struct _GsdCupsEventTracker GsdCupsEventTracker;
+
+typedef void (*GsdCupsEventFunc) (const GsdCupsEvent *event,
+                                  gpointer            user_data);
+
+GsdCupsEventTracker *gsd_cups_event_tracker_new        (GsdCupsEventFunc     func,
+                                                        gpointer             user_data);
+void                 gsd_cups_event_tracker_free       (GsdCupsEventTracker *tracker);
+void                 gsd_cups_event_tracker_reset      (GsdCupsEventTracker *tracker);
+void                 gsd_cups_event_tracker_push       (GsdCupsEventTracker *tracker,
+                                                        const GsdCupsEvent  *event);
+guint                gsd_cups_event_tracker_get_mark   (GsdCupsEventTracker *tracker);
+gint                 gsd_cups_event_tracker_check      (GsdCupsEventTracker *tracker,
+                                                        guint                mark,
+                                                        gint                 sequence_number);
+void                 gsd_cups_event_tracker_pull       (GsdCupsEventTracker *tracker,
+                                                        const GsdCupsEvent  *event);
+void                 gsd_cups_event_tracker_reconciled (GsdCupsEventTracker *tracker,
+                                                        guint                mark,
+                                                        gint                 sequence_number);
+gint                 gsd_cups_event_tracker_get_last   (GsdCupsEventTracker *tracker);
+void                 gsd_cups_event_tracker_get_counts (GsdCupsEventTracker *tracker,
+                                                        guint               *delivered,
+                                                        guint               *duplicates,
+                                                        guint               *gaps);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GsdCupsEventTracker, gsd_cups_event_tracker_free)
+
+/* Exponential backoff with jitter, all times in milliseconds */
+typedef struct {
+        guint initial;
+        guint max;
+        guint current;
+} GsdCupsBackoff;
+
+void  gsd_cups_backoff_init  (GsdCupsBackoff *backoff,
+                              guint           initial,
+                              guint           max);
+guint gsd_cups_backoff_next  (GsdCupsBackoff *backoff);
+void  gsd_cups_backoff_reset (GsdCupsBackoff *backoff);
+
+G_END_DECLS
+
+#endif /* __GSD_CUPS_EVENTS_H */
@@ -38,20 +38,23 @@
 #include <libnotify/notify.h>
 
 #include "gnome-settings-profile.h"
+#include "gsd-cups-events.h"
 #include "gsd-print-notifications-manager.h"
 
-#define CUPS_DBUS_NAME      "org.cups.cupsd.Notifier"
-#define CUPS_DBUS_PATH      "/org/cups/cupsd/Notifier"
-#define CUPS_DBUS_INTERFACE "org.cups.cupsd.Notifier"
-
 #define RENEW_INTERVAL                   3500
 #define SUBSCRIPTION_DURATION            3600
 #define CONNECTING_TIMEOUT               60
 #define REASON_TIMEOUT                   15000
-#define CUPS_CONNECTION_TEST_INTERVAL    300
-#define CHECK_INTERVAL                   60 /* secs */
+#define CHECK_INTERVAL                   60 /* secs, without D-Bus notifier */
+#define SIGNAL_CHECK_DELAY               5  /* secs, after D-Bus signals */
 #define AUTHENTICATION_CHECK_TIMEOUT     3
 
+/* Retry delays after failed renewals and connection tests, in ms */
+#define RENEW_BACKOFF_INITIAL            (5 * 1000)
+#define RENEW_BACKOFF_MAX                (10 * 60 * 1000)
+#define CONNECTION_BACKOFF_INITIAL       (5 * 1000)
+#define CONNECTION_BACKOFF_MAX           (300 * 1000)
+
 #if (CUPS_VERSION_MAJOR > 1) || (CUPS_VERSION_MINOR > 5)
 #define HAVE_CUPS_1_6 1
 #endif
@@ -93,15 +96,31 @@ struct _GsdPrintNotificationsManager
         guint                         check_source_id;
         guint                         cups_dbus_subscription_id;
         guint                         renew_source_id;
-        gint                          last_notify_sequence_number;
+        guint                         signal_check_id;
         guint                         start_idle_id;
         GList                        *held_jobs;
+
+        GCancellable                 *cancellable;
+        GsdCupsEventTracker          *tracker;
+        GsdCupsBackoff                renew_backoff;
+        GsdCupsBackoff                connection_backoff;
+        gboolean                      renewing;
+        gboolean                      fetching;
+        gboolean                      checking;
+        /* whether events arrive as D-Bus signals, otherwise they are
+         * fetched every CHECK_INTERVAL */
+        gboolean                      push_events;
 };
 
 static void     gsd_print_notifications_manager_class_init  (GsdPrintNotificationsManagerClass *klass);
 static void     gsd_print_notifications_manager_init        (GsdPrintNotificationsManager      *print_notifications_manager);
 static gboolean cups_connection_test                        (gpointer                           user_data);
-static gboolean process_new_notifications                   (gpointer                           user_data);
+static void     renew_subscription                          (GsdPrintNotificationsManager      *manager);
+static void     check_sequence_number                       (GsdPrintNotificationsManager      *manager);
+static void     fetch_notifications                         (GsdPrintNotificationsManager      *manager,
+                                                             gint                               first,
+                                                             gint                               last,
+                                                             guint                              mark);
 
 G_DEFINE_TYPE (GsdPrintNotificationsManager, gsd_print_notifications_manager, GSD_TYPE_APPLICATION)
 
@@ -371,6 +390,21 @@ reason_is_blacklisted (const gchar *reason)
         return FALSE;
 }
 
+static gboolean
+signal_check_timeout (gpointer user_data)
+{
+        GsdPrintNotificationsManager *manager = user_data;
+
+        /* try again once the request in flight is done */
+        if (manager->renewing || manager->checking || manager->fetching)
+                return G_SOURCE_CONTINUE;
+
+        manager->signal_check_id = 0;
+        check_sequence_number (manager);
+
+        return G_SOURCE_REMOVE;
+}
+
 static void
 on_cups_notification (GDBusConnection *connection,
                       const char      *sender_name,
@@ -380,6 +414,10 @@ on_cups_notification (GDBusConnection *connection,
                       GVariant        *parameters,
                       gpointer         user_data)
 {
+        GsdPrintNotificationsManager *manager = user_data;
+        g_autoptr(GsdCupsEvent)       event = NULL;
+        g_autoptr(GError)             error = NULL;
+
         /* Ignore any signal starting with Server*. This has caused a message
          * storm through ServerAudit messages in the past, see
          *  https://gitlab.gnome.org/GNOME/gnome-settings-daemon/issues/62
@@ -387,7 +425,21 @@ on_cups_notification (GDBusConnection *connection,
         if (!signal_name || (strncmp (signal_name, "Server", 6) == 0))
                 return;
 
-        process_new_notifications (user_data);
+        event = gsd_cups_event_new_from_signal (signal_name, parameters, &error);
+        if (event != NULL) {
+                gsd_cups_event_tracker_push (manager->tracker, event);
+
+                /* signals lost around these are fetched once they settle,
+                 * rather than at the next renewal */
+                if (manager->signal_check_id == 0) {
+                        manager->signal_check_id = g_timeout_add_seconds (SIGNAL_CHECK_DELAY, signal_check_timeout, manager);
+                        g_source_set_name_by_id (manager->signal_check_id, "[gnome-settings-daemon] signal_check");
+                }
+        } else if (error != NULL) {
+                /* fetch it instead */
+                g_debug ("%s", error->message);
+                renew_subscription (manager);
+        }
 }
 
 static gchar *
@@ -1095,29 +1147,60 @@ process_cups_notification (GsdPrintNotificationsManager *manager,
         }
 }
 
-static gboolean
-process_new_notifications (gpointer user_data)
+static void
+deliver_cups_event (const GsdCupsEvent *event,
+                    gpointer            user_data)
+{
+        GsdPrintNotificationsManager *manager = user_data;
+
+        if (event->subscribed_event == NULL)
+                return;
+
+        process_cups_notification (manager,
+                                   event->subscribed_event,
+                                   event->text,
+                                   event->printer_uri,
+                                   event->printer_name,
+                                   event->printer_state,
+                                   event->printer_state_reasons,
+                                   event->printer_is_accepting_jobs,
+                                   event->job_id,
+                                   event->job_state,
+                                   event->job_state_reasons,
+                                   event->job_name,
+                                   event->job_impressions_completed);
+}
+
+static gchar *
+join_attribute_strings (ipp_attribute_t *attr)
+{
+        gchar **strings;
+        gchar  *joined;
+        gint    i;
+
+        strings = g_new0 (gchar *, ippGetCount (attr) + 1);
+        for (i = 0; i < ippGetCount (attr); i++)
+                strings[i] = g_strdup (ippGetString (attr, i, NULL));
+        joined = g_strjoinv (",", strings);
+        g_strfreev (strings);
+
+        return joined;
+}
+
+/* Runs in a worker thread */
+static GPtrArray *
+get_notifications (http_t *http,
+                   gint    subscription_id,
+                   gint    first,
+                   gint   *get_interval)
 {
-        GsdPrintNotificationsManager  *manager = (GsdPrintNotificationsManager *) user_data;
+        GPtrArray                     *events;
+        GsdCupsEvent                  *event = NULL;
         ipp_attribute_t               *attr;
-        const gchar                   *notify_subscribed_event = NULL;
-        const gchar                   *printer_name = NULL;
-        const gchar                   *notify_text = NULL;
-        const gchar                   *notify_printer_uri = NULL;
-        gchar                         *job_state_reasons = NULL;
-        const gchar                   *job_name = NULL;
         const char                    *attr_name;
-        gboolean                       printer_is_accepting_jobs = FALSE;
-        gchar                         *printer_state_reasons = NULL;
-        gchar                        **reasons;
-        guint                          notify_job_id = 0;
         ipp_t                         *request;
         ipp_t                         *response;
-        gint                           printer_state = -1;
-        gint                           job_state = -1;
-        gint                           job_impressions_completed = -1;
-        gint                           notify_sequence_number = -1;
-        gint                           i;
+        gint                           up_time = -1;
 
         request = ippNewRequest (IPP_GET_NOTIFICATIONS);
 
@@ -1125,7 +1208,7 @@ process_new_notifications (gpointer user_data)
                       "requesting-user-name", NULL, cupsUser ());
 
         ippAddInteger (request, IPP_TAG_OPERATION, IPP_TAG_INTEGER,
-                       "notify-subscription-ids", manager->subscription_id);
+                       "notify-subscription-ids", subscription_id);
 
         ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI, "printer-uri", NULL,
                       "/printers/");
@@ -1134,113 +1217,194 @@ process_new_notifications (gpointer user_data)
                       "/jobs/");
 
         ippAddInteger (request, IPP_TAG_OPERATION, IPP_TAG_INTEGER,
-                       "notify-sequence-numbers",
-                       manager->last_notify_sequence_number + 1);
+                       "notify-sequence-numbers", first);
+
+        response = cupsDoRequest (http, request, "/");
 
+        events = g_ptr_array_new_with_free_func ((GDestroyNotify) gsd_cups_event_free);
+        *get_interval = 0;
 
-        response = cupsDoRequest (CUPS_HTTP_DEFAULT, request, "/");
+        if (response == NULL)
+                return events;
 
+        attr = ippFindAttribute (response, "notify-get-interval", IPP_TAG_INTEGER);
+        if (attr != NULL)
+                *get_interval = ippGetInteger (attr, 0);
 
+        /* the time of the server, which event times are relative to */
+        attr = ippFindAttribute (response, "printer-up-time", IPP_TAG_INTEGER);
+        if (attr != NULL)
+                up_time = ippGetInteger (attr, 0);
+
+        /* the attributes following a sequence number belong to its event */
         for (attr = ippFindAttribute (response, "notify-sequence-number", IPP_TAG_INTEGER);
              attr != NULL;
              attr = ippNextAttribute (response)) {
 
                 attr_name = ippGetName (attr);
                 if (g_strcmp0 (attr_name, "notify-sequence-number") == 0) {
-                        notify_sequence_number = ippGetInteger (attr, 0);
-
-                        if (notify_sequence_number > manager->last_notify_sequence_number)
-                                manager->last_notify_sequence_number = notify_sequence_number;
-
-                        if (notify_subscribed_event != NULL) {
-                                process_cups_notification (manager,
-                                                           notify_subscribed_event,
-                                                           notify_text,
-                                                           notify_printer_uri,
-                                                           printer_name,
-                                                           printer_state,
-                                                           printer_state_reasons,
-                                                           printer_is_accepting_jobs,
-                                                           notify_job_id,
-                                                           job_state,
-                                                           job_state_reasons,
-                                                           job_name,
-                                                           job_impressions_completed);
-
-                                g_clear_pointer (&printer_state_reasons, g_free);
-                                g_clear_pointer (&job_state_reasons, g_free);
-                        }
-
-                        notify_subscribed_event = NULL;
-                        notify_text = NULL;
-                        notify_printer_uri = NULL;
-                        printer_name = NULL;
-                        printer_state = -1;
-                        printer_state_reasons = NULL;
-                        printer_is_accepting_jobs = FALSE;
-                        notify_job_id = 0;
-                        job_state = -1;
-                        job_state_reasons = NULL;
-                        job_name = NULL;
-                        job_impressions_completed = -1;
+                        event = gsd_cups_event_new ();
+                        event->sequence_number = ippGetInteger (attr, 0);
+                        g_ptr_array_add (events, event);
+                } else if (g_strcmp0 (attr_name, "notify-printer-up-time") == 0) {
+                        if (up_time >= 0)
+                                event->age = MAX (up_time - ippGetInteger (attr, 0), 0);
                 } else if (g_strcmp0 (attr_name, "notify-subscribed-event") == 0) {
-                        notify_subscribed_event = ippGetString (attr, 0, NULL);
+                        g_free (event->subscribed_event);
+                        event->subscribed_event = g_strdup (ippGetString (attr, 0, NULL));
                 } else if (g_strcmp0 (attr_name, "notify-text") == 0) {
-                        notify_text = ippGetString (attr, 0, NULL);
+                        g_free (event->text);
+                        event->text = g_strdup (ippGetString (attr, 0, NULL));
                 } else if (g_strcmp0 (attr_name, "notify-printer-uri") == 0) {
-                        notify_printer_uri = ippGetString (attr, 0, NULL);
+                        g_free (event->printer_uri);
+                        event->printer_uri = g_strdup (ippGetString (attr, 0, NULL));
                 } else if (g_strcmp0 (attr_name, "printer-name") == 0) {
-                        printer_name = ippGetString (attr, 0, NULL);
+                        g_free (event->printer_name);
+                        event->printer_name = g_strdup (ippGetString (attr, 0, NULL));
                 } else if (g_strcmp0 (attr_name, "printer-state") == 0) {
-                        printer_state = ippGetInteger (attr, 0);
+                        event->printer_state = ippGetInteger (attr, 0);
                 } else if (g_strcmp0 (attr_name, "printer-state-reasons") == 0) {
-                        reasons = g_new0 (gchar *, ippGetCount (attr) + 1);
-                        for (i = 0; i < ippGetCount (attr); i++)
-                                reasons[i] = g_strdup (ippGetString (attr, i, NULL));
-                        printer_state_reasons = g_strjoinv (",", reasons);
-                        g_strfreev (reasons);
+                        g_free (event->printer_state_reasons);
+                        event->printer_state_reasons = join_attribute_strings (attr);
                 } else if (g_strcmp0 (attr_name, "printer-is-accepting-jobs") == 0) {
-                        printer_is_accepting_jobs = ippGetBoolean (attr, 0);
+                        event->printer_is_accepting_jobs = ippGetBoolean (attr, 0);
                 } else if (g_strcmp0 (attr_name, "notify-job-id") == 0) {
-                        notify_job_id = ippGetInteger (attr, 0);
+                        event->job_id = ippGetInteger (attr, 0);
                 } else if (g_strcmp0 (attr_name, "job-state") == 0) {
-                        job_state = ippGetInteger (attr, 0);
+                        event->job_state = ippGetInteger (attr, 0);
                 } else if (g_strcmp0 (attr_name, "job-state-reasons") == 0) {
-                        reasons = g_new0 (gchar *, ippGetCount (attr) + 1);
-                        for (i = 0; i < ippGetCount (attr); i++)
-                                reasons[i] = g_strdup (ippGetString (attr, i, NULL));
-                        job_state_reasons = g_strjoinv (",", reasons);
-                        g_strfreev (reasons);
+                        g_free (event->job_state_reasons);
+                        event->job_state_reasons = join_attribute_strings (attr);
                 } else if (g_strcmp0 (attr_name, "job-name") == 0) {
-                        job_name = ippGetString (attr, 0, NULL);
+                        g_free (event->job_name);
+                        event->job_name = g_strdup (ippGetString (attr, 0, NULL));
                 } else if (g_strcmp0 (attr_name, "job-impressions-completed") == 0) {
-                        job_impressions_completed = ippGetInteger (attr, 0);
+                        event->job_impressions_completed = ippGetInteger (attr, 0);
                 }
         }
 
-        if (notify_subscribed_event != NULL) {
-                process_cups_notification (manager,
-                                           notify_subscribed_event,
-                                           notify_text,
-                                           notify_printer_uri,
-                                           printer_name,
-                                           printer_state,
-                                           printer_state_reasons,
-                                           printer_is_accepting_jobs,
-                                           notify_job_id,
-                                           job_state,
-                                           job_state_reasons,
-                                           job_name,
-                                           job_impressions_completed);
-
-                g_clear_pointer (&printer_state_reasons, g_free);
-                g_clear_pointer (&job_state_reasons, g_free);
+        ippDelete (response);
+
+        return events;
+}
+
+typedef struct {
+        gint       subscription_id;
+        gint       first;
+        /* sequence number the fetch reconciles up to, or -1 */
+        gint       last;
+        /* the signals @last was compared with */
+        guint      mark;
+        GPtrArray *events;
+        gint       get_interval;
+} FetchData;
+
+static void
+fetch_data_free (FetchData *data)
+{
+        g_clear_pointer (&data->events, g_ptr_array_unref);
+        g_free (data);
+}
+
+static void
+fetch_notifications_thread (GTask        *task,
+                            gpointer      source_object,
+                            gpointer      task_data,
+                            GCancellable *cancellable)
+{
+        FetchData *data = task_data;
+        http_t    *http;
+
+        /* the callback is per thread */
+        cupsSetPasswordCB2 (password_cb, NULL);
+
+        if ((http = httpConnectEncrypt (cupsServer (), ippPort (),
+                                        cupsEncryption ())) == NULL) {
+                g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED,
+                                         "Connection to CUPS server \'%s\' failed.",
+                                         cupsServer ());
+                return;
         }
 
-        if (response != NULL)
-                ippDelete (response);
+        data->events = get_notifications (http, data->subscription_id, data->first,
+                                          &data->get_interval);
+        httpClose (http);
 
-        return TRUE;
+        g_task_return_boolean (task, TRUE);
+}
+
+static gboolean
+fetch_notifications_timeout (gpointer user_data)
+{
+        GsdPrintNotificationsManager *manager = user_data;
+
+        manager->check_source_id = 0;
+        fetch_notifications (manager,
+                             gsd_cups_event_tracker_get_last (manager->tracker) + 1,
+                             -1, 0);
+
+        return G_SOURCE_REMOVE;
+}
+
+static void
+fetch_notifications_cb (GObject      *source_object,
+                        GAsyncResult *res,
+                        gpointer      user_data)
+{
+        GsdPrintNotificationsManager *manager = GSD_PRINT_NOTIFICATIONS_MANAGER (source_object);
+        FetchData                    *data = g_task_get_task_data (G_TASK (res));
+        g_autoptr(GError)             error = NULL;
+        guint                         interval = CHECK_INTERVAL;
+        guint                         i;
+
+        if (!g_task_propagate_boolean (G_TASK (res), &error)) {
+                if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        return;
+                g_debug ("%s", error->message);
+        } else {
+                for (i = 0; i < data->events->len; i++)
+                        gsd_cups_event_tracker_pull (manager->tracker,
+                                                     g_ptr_array_index (data->events, i));
+                if (data->last >= 0)
+                        gsd_cups_event_tracker_reconciled (manager->tracker, data->mark, data->last);
+                if (data->get_interval > 0)
+                        interval = data->get_interval;
+        }
+
+        manager->fetching = FALSE;
+
+        if (!manager->push_events && manager->check_source_id == 0) {
+                manager->check_source_id = g_timeout_add_seconds (interval, fetch_notifications_timeout, manager);
+                g_source_set_name_by_id (manager->check_source_id, "[gnome-settings-daemon] fetch_notifications");
+        }
+}
+
+static void
+fetch_notifications (GsdPrintNotificationsManager *manager,
+                     gint                          first,
+                     gint                          last,
+                     guint                         mark)
+{
+        g_autoptr(GTask)  task = NULL;
+        FetchData        *data;
+
+        if (manager->fetching || manager->subscription_id < 0)
+                return;
+
+        g_clear_handle_id (&manager->check_source_id, g_source_remove);
+
+        data = g_new0 (FetchData, 1);
+        data->subscription_id = manager->subscription_id;
+        data->first = first;
+        data->last = last;
+        data->mark = mark;
+
+        manager->fetching = TRUE;
+
+        task = g_task_new (manager, manager->cancellable, fetch_notifications_cb, NULL);
+        g_task_set_source_tag (task, fetch_notifications);
+        g_task_set_task_data (task, data, (GDestroyNotify) fetch_data_free);
+        g_task_run_in_thread (task, fetch_notifications_thread);
 }
 
 static void
@@ -1297,14 +1461,44 @@ cancel_subscription (gint id)
         }
 }
 
-static gboolean
-renew_subscription (gpointer data)
+/* Runs in a worker thread, returns the IPP status or -1 without response */
+static gint
+renew_subscription_request (http_t *http,
+                            gint    subscription_id)
+{
+        ipp_t *request;
+        ipp_t *response;
+        gint   status;
+
+        request = ippNewRequest (IPP_RENEW_SUBSCRIPTION);
+        ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI,
+                     "printer-uri", NULL, "/");
+        ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
+                     "requesting-user-name", NULL, cupsUser ());
+        ippAddInteger (request, IPP_TAG_OPERATION, IPP_TAG_INTEGER,
+                      "notify-subscription-id", subscription_id);
+        ippAddInteger (request, IPP_TAG_SUBSCRIPTION, IPP_TAG_INTEGER,
+                      "notify-lease-duration", SUBSCRIPTION_DURATION);
+        response = cupsDoRequest (http, request, "/");
+
+        if (response == NULL)
+                return -1;
+
+        status = ippGetStatusCode (response);
+        ippDelete (response);
+
+        return status;
+}
+
+/* Runs in a worker thread */
+static gint
+create_subscription_request (http_t   *http,
+                             gboolean  dbus_recipient)
 {
-        GsdPrintNotificationsManager *manager = (GsdPrintNotificationsManager *) data;
         ipp_attribute_t              *attr = NULL;
-        http_t                       *http;
         ipp_t                        *request;
         ipp_t                        *response;
+        gint                          subscription_id = -1;
         gint                          num_events = 7;
         static const char * const events[] = {
                 "job-created",
@@ -1315,139 +1509,312 @@ renew_subscription (gpointer data)
                 "printer-deleted",
                 "printer-state-changed"};
 
+        request = ippNewRequest (IPP_CREATE_PRINTER_SUBSCRIPTION);
+        ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI,
+                      "printer-uri", NULL,
+                      "/");
+        ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
+                      "requesting-user-name", NULL, cupsUser ());
+        ippAddStrings (request, IPP_TAG_SUBSCRIPTION, IPP_TAG_KEYWORD,
+                       "notify-events", num_events, NULL, events);
+        ippAddString (request, IPP_TAG_SUBSCRIPTION, IPP_TAG_KEYWORD,
+                      "notify-pull-method", NULL, "ippget");
+        if (dbus_recipient) {
+                ippAddString (request, IPP_TAG_SUBSCRIPTION, IPP_TAG_URI,
+                              "notify-recipient-uri", NULL, "dbus://");
+        }
+        ippAddInteger (request, IPP_TAG_SUBSCRIPTION, IPP_TAG_INTEGER,
+                       "notify-lease-duration", SUBSCRIPTION_DURATION);
+        response = cupsDoRequest (http, request, "/");
+
+        if (response != NULL && ippGetStatusCode (response) <= IPP_OK_CONFLICT) {
+                if ((attr = ippFindAttribute (response, "notify-subscription-id",
+                                              IPP_TAG_INTEGER)) == NULL)
+                        g_debug ("No notify-subscription-id in response!\n");
+                else
+                        subscription_id = ippGetInteger (attr, 0);
+        }
+
+        if (response)
+                ippDelete (response);
+
+        return subscription_id;
+}
+
+/* Runs in a worker thread, returns the sequence number of the last event
+ * sent for the subscription, or -1 if unknown */
+static gint
+get_sequence_number_request (http_t *http,
+                             gint    subscription_id)
+{
+        ipp_attribute_t *attr;
+        ipp_t           *request;
+        ipp_t           *response;
+        gint             sequence_number = -1;
+
+        request = ippNewRequest (IPP_GET_SUBSCRIPTION_ATTRIBUTES);
+        ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI,
+                      "printer-uri", NULL, "/");
+        ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
+                      "requesting-user-name", NULL, cupsUser ());
+        ippAddInteger (request, IPP_TAG_OPERATION, IPP_TAG_INTEGER,
+                       "notify-subscription-id", subscription_id);
+        ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD,
+                      "requested-attributes", NULL, "notify-sequence-number");
+        response = cupsDoRequest (http, request, "/");
+
+        if (response != NULL && ippGetStatusCode (response) <= IPP_OK_CONFLICT) {
+                attr = ippFindAttribute (response, "notify-sequence-number", IPP_TAG_INTEGER);
+                if (attr != NULL)
+                        sequence_number = ippGetInteger (attr, 0);
+        }
+
+        if (response)
+                ippDelete (response);
+
+        return sequence_number;
+}
+
+typedef struct {
+        gint     subscription_id;
+        gboolean dbus_recipient;
+        gboolean created;
+        guint    mark;
+        gint     sequence_number;
+} RenewData;
+
+static void
+renew_subscription_thread (GTask        *task,
+                           gpointer      source_object,
+                           gpointer      task_data,
+                           GCancellable *cancellable)
+{
+        RenewData *data = task_data;
+        http_t    *http;
+        gint       status;
+
+        /* the callback is per thread */
+        cupsSetPasswordCB2 (password_cb, NULL);
+
         if ((http = httpConnectEncrypt (cupsServer (), ippPort (),
                                         cupsEncryption ())) == NULL) {
-                g_debug ("Connection to CUPS server \'%s\' failed.", cupsServer ());
-        } else {
-                if (manager->subscription_id >= 0) {
-                        request = ippNewRequest (IPP_RENEW_SUBSCRIPTION);
-                        ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI,
-                                     "printer-uri", NULL, "/");
-                        ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
-                                     "requesting-user-name", NULL, cupsUser ());
-                        ippAddInteger (request, IPP_TAG_OPERATION, IPP_TAG_INTEGER,
-                                      "notify-subscription-id", manager->subscription_id);
-                        ippAddInteger (request, IPP_TAG_SUBSCRIPTION, IPP_TAG_INTEGER,
-                                      "notify-lease-duration", SUBSCRIPTION_DURATION);
-                        ippDelete (cupsDoRequest (http, request, "/"));
-                } else {
-                        request = ippNewRequest (IPP_CREATE_PRINTER_SUBSCRIPTION);
-                        ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI,
-                                      "printer-uri", NULL,
-                                      "/");
-                        ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
-                                      "requesting-user-name", NULL, cupsUser ());
-                        ippAddStrings (request, IPP_TAG_SUBSCRIPTION, IPP_TAG_KEYWORD,
-                                       "notify-events", num_events, NULL, events);
-                        ippAddString (request, IPP_TAG_SUBSCRIPTION, IPP_TAG_KEYWORD,
-                                      "notify-pull-method", NULL, "ippget");
-                        if (server_is_local (cupsServer ())) {
-                                ippAddString (request, IPP_TAG_SUBSCRIPTION, IPP_TAG_URI,
-                                              "notify-recipient-uri", NULL, "dbus://");
-                        }
-                        ippAddInteger (request, IPP_TAG_SUBSCRIPTION, IPP_TAG_INTEGER,
-                                       "notify-lease-duration", SUBSCRIPTION_DURATION);
-                        response = cupsDoRequest (http, request, "/");
-
-                        if (response != NULL && ippGetStatusCode (response) <= IPP_OK_CONFLICT) {
-                                if ((attr = ippFindAttribute (response, "notify-subscription-id",
-                                                              IPP_TAG_INTEGER)) == NULL)
-                                        g_debug ("No notify-subscription-id in response!\n");
-                                else
-                                        manager->subscription_id = ippGetInteger (attr, 0);
-                        }
+                g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED,
+                                         "Connection to CUPS server \'%s\' failed.",
+                                         cupsServer ());
+                return;
+        }
 
-                        if (response)
-                                ippDelete (response);
+        if (data->subscription_id >= 0) {
+                status = renew_subscription_request (http, data->subscription_id);
+                if (status == IPP_NOT_FOUND) {
+                        /* expired, or lost in a restart of cupsd */
+                        g_debug ("CUPS subscription %d is gone", data->subscription_id);
+                        data->subscription_id = -1;
+                } else if (status < 0 || status > IPP_OK_CONFLICT) {
+                        httpClose (http);
+                        g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED,
+                                                 "Renewing CUPS subscription %d failed.",
+                                                 data->subscription_id);
+                        return;
                 }
+        }
+
+        if (data->subscription_id < 0) {
+                data->subscription_id = create_subscription_request (http, data->dbus_recipient);
+                data->created = TRUE;
+        }
+
+        if (data->subscription_id < 0) {
                 httpClose (http);
+                g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED,
+                                         "Creating CUPS subscription failed.");
+                return;
         }
-        return TRUE;
+
+        data->sequence_number = get_sequence_number_request (http, data->subscription_id);
+        httpClose (http);
+
+        g_task_return_boolean (task, TRUE);
+}
+
+static gboolean
+renew_subscription_timeout (gpointer user_data)
+{
+        GsdPrintNotificationsManager *manager = user_data;
+
+        manager->renew_source_id = 0;
+        renew_subscription (manager);
+
+        return G_SOURCE_REMOVE;
 }
 
 static void
-renew_subscription_with_connection_test_cb (GObject      *source_object,
-                                            GAsyncResult *res,
-                                            gpointer      user_data)
+renew_subscription_schedule (GsdPrintNotificationsManager *manager,
+                             guint                         delay)
 {
-        GSocketConnection *connection;
-        GError            *error = NULL;
+        g_clear_handle_id (&manager->renew_source_id, g_source_remove);
+        manager->renew_source_id = g_timeout_add (delay, renew_subscription_timeout, manager);
+        g_source_set_name_by_id (manager->renew_source_id, "[gnome-settings-daemon] renew_subscription");
+}
 
-        connection = g_socket_client_connect_to_host_finish (G_SOCKET_CLIENT (source_object),
-                                                             res,
-                                                             &error);
+/* Fetches the events up to @sequence_number that did not arrive as
+ * signals before @mark */
+static void
+fetch_missed_events (GsdPrintNotificationsManager *manager,
+                     guint                         mark,
+                     gint                          sequence_number)
+{
+        gint first;
 
-        if (connection) {
-                g_debug ("Test connection to CUPS server \'%s:%d\' succeeded.", cupsServer (), ippPort ());
+        if (sequence_number < 0)
+                return;
 
-                g_io_stream_close (G_IO_STREAM (connection), NULL, NULL);
-                g_object_unref (connection);
+        first = gsd_cups_event_tracker_check (manager->tracker, mark, sequence_number);
+        if (first >= 0)
+                fetch_notifications (manager, first, sequence_number, mark);
+}
 
-                renew_subscription (user_data);
-        } else {
-                g_debug ("Test connection to CUPS server \'%s:%d\' failed.", cupsServer (), ippPort ());
+static void
+renew_subscription_cb (GObject      *source_object,
+                       GAsyncResult *res,
+                       gpointer      user_data)
+{
+        GsdPrintNotificationsManager *manager = GSD_PRINT_NOTIFICATIONS_MANAGER (source_object);
+        RenewData                    *data = g_task_get_task_data (G_TASK (res));
+        g_autoptr(GError)             error = NULL;
+        guint                         delay;
+
+        if (!g_task_propagate_boolean (G_TASK (res), &error)) {
+                if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        return;
+
+                manager->renewing = FALSE;
+                delay = gsd_cups_backoff_next (&manager->renew_backoff);
+                g_debug ("%s Retrying in %u ms.", error->message, delay);
+                renew_subscription_schedule (manager, delay);
+                return;
         }
+
+        manager->renewing = FALSE;
+        gsd_cups_backoff_reset (&manager->renew_backoff);
+        renew_subscription_schedule (manager, RENEW_INTERVAL * 1000);
+
+        manager->subscription_id = data->subscription_id;
+        if (data->created)
+                gsd_cups_event_tracker_reset (manager->tracker);
+
+        if (!manager->push_events) {
+                if (manager->check_source_id == 0)
+                        fetch_notifications (manager,
+                                             gsd_cups_event_tracker_get_last (manager->tracker) + 1,
+                                             -1, 0);
+                return;
+        }
+
+        fetch_missed_events (manager, data->mark, data->sequence_number);
 }
 
-static gboolean
-renew_subscription_with_connection_test (gpointer user_data)
+/* Renews or creates the subscription, and checks for missed events */
+static void
+renew_subscription (GsdPrintNotificationsManager *manager)
 {
-        GSocketClient *client;
-        gchar         *address;
-        int            port;
+        g_autoptr(GTask)  task = NULL;
+        RenewData        *data;
 
-        port = ippPort ();
+        if (manager->renewing)
+                return;
 
-        address = g_strdup_printf ("%s:%d", cupsServer (), port);
+        data = g_new0 (RenewData, 1);
+        data->subscription_id = manager->subscription_id;
+        data->dbus_recipient = server_is_local (cupsServer ());
+        data->mark = gsd_cups_event_tracker_get_mark (manager->tracker);
+        data->sequence_number = -1;
 
-        if (address && address[0] != '/') {
-                client = g_socket_client_new ();
+        manager->renewing = TRUE;
 
-                g_debug ("Initiating test connection to CUPS server \'%s:%d\'.", cupsServer (), port);
+        task = g_task_new (manager, manager->cancellable, renew_subscription_cb, NULL);
+        g_task_set_source_tag (task, renew_subscription);
+        g_task_set_task_data (task, data, g_free);
+        g_task_run_in_thread (task, renew_subscription_thread);
+}
 
-                g_socket_client_connect_to_host_async (client,
-                                                       address,
-                                                       port,
-                                                       NULL,
-                                                       renew_subscription_with_connection_test_cb,
-                                                       user_data);
+typedef struct {
+        gint  subscription_id;
+        guint mark;
+        gint  sequence_number;
+} CheckData;
 
-                g_object_unref (client);
-        } else {
-                renew_subscription (user_data);
+static void
+check_sequence_number_thread (GTask        *task,
+                              gpointer      source_object,
+                              gpointer      task_data,
+                              GCancellable *cancellable)
+{
+        CheckData *data = task_data;
+        http_t    *http;
+
+        /* the callback is per thread */
+        cupsSetPasswordCB2 (password_cb, NULL);
+
+        if ((http = httpConnectEncrypt (cupsServer (), ippPort (),
+                                        cupsEncryption ())) == NULL) {
+                g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED,
+                                         "Connection to CUPS server \'%s\' failed.",
+                                         cupsServer ());
+                return;
         }
 
-        g_free (address);
+        data->sequence_number = get_sequence_number_request (http, data->subscription_id);
+        httpClose (http);
 
-        return TRUE;
+        g_task_return_boolean (task, TRUE);
 }
 
 static void
-renew_subscription_timeout_enable (GsdPrintNotificationsManager *manager,
-                                   gboolean                      enable,
-                                   gboolean                      with_connection_test)
+check_sequence_number_cb (GObject      *source_object,
+                          GAsyncResult *res,
+                          gpointer      user_data)
 {
-        if (manager->renew_source_id > 0)
-                g_source_remove (manager->renew_source_id);
+        GsdPrintNotificationsManager *manager = GSD_PRINT_NOTIFICATIONS_MANAGER (source_object);
+        CheckData                    *data = g_task_get_task_data (G_TASK (res));
+        g_autoptr(GError)             error = NULL;
 
-        if (enable) {
-                renew_subscription (manager);
-                if (with_connection_test) {
-                        manager->renew_source_id =
-                                g_timeout_add_seconds (RENEW_INTERVAL,
-                                                       renew_subscription_with_connection_test,
-                                                       manager);
-                        g_source_set_name_by_id (manager->renew_source_id, "[gnome-settings-daemon] renew_subscription_with_connection_test");
-                } else {
-                        manager->renew_source_id =
-                                g_timeout_add_seconds (RENEW_INTERVAL,
-                                                       renew_subscription,
-                                                       manager);
-                        g_source_set_name_by_id (manager->renew_source_id, "[gnome-settings-daemon] renew_subscription");
-                }
-        } else {
-                manager->renew_source_id = 0;
+        if (!g_task_propagate_boolean (G_TASK (res), &error)) {
+                if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        return;
+                g_debug ("%s", error->message);
         }
+
+        manager->checking = FALSE;
+
+        /* the subscription was replaced in the meantime */
+        if (data->subscription_id != manager->subscription_id)
+                return;
+
+        fetch_missed_events (manager, data->mark, data->sequence_number);
+}
+
+/* Only checks for missed events, without renewing the subscription */
+static void
+check_sequence_number (GsdPrintNotificationsManager *manager)
+{
+        g_autoptr(GTask)  task = NULL;
+        CheckData        *data;
+
+        if (manager->checking || manager->subscription_id < 0)
+                return;
+
+        data = g_new0 (CheckData, 1);
+        data->subscription_id = manager->subscription_id;
+        data->mark = gsd_cups_event_tracker_get_mark (manager->tracker);
+        data->sequence_number = -1;
+
+        manager->checking = TRUE;
+
+        task = g_task_new (manager, manager->cancellable, check_sequence_number_cb, NULL);
+        g_task_set_source_tag (task, check_sequence_number);
+        g_task_set_task_data (task, data, g_free);
+        g_task_run_in_thread (task, check_sequence_number_thread);
 }
 
 static void
@@ -1458,6 +1825,7 @@ cups_connection_test_cb (GObject      *source_object,
         GsdPrintNotificationsManager *manager = (GsdPrintNotificationsManager *) user_data;
         GSocketConnection            *connection;
         GError                       *error = NULL;
+        guint                         delay;
 
         connection = g_socket_client_connect_to_host_finish (G_SOCKET_CLIENT (source_object),
                                                              res,
@@ -1472,14 +1840,19 @@ cups_connection_test_cb (GObject      *source_object,
                 manager->num_dests = cupsGetDests (&manager->dests);
                 g_debug ("Got dests from remote CUPS server.");
 
-                renew_subscription_timeout_enable (manager, TRUE, TRUE);
-                manager->check_source_id = g_timeout_add_seconds (CHECK_INTERVAL, process_new_notifications, manager);
-                g_source_set_name_by_id (manager->check_source_id, "[gnome-settings-daemon] process_new_notifications");
+                gsd_cups_backoff_reset (&manager->connection_backoff);
+                renew_subscription (manager);
+        } else if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                g_error_free (error);
         } else {
-                g_debug ("Test connection to CUPS server \'%s:%d\' failed.", cupsServer (), ippPort ());
+                delay = gsd_cups_backoff_next (&manager->connection_backoff);
+                g_debug ("Test connection to CUPS server \'%s:%d\' failed, retrying in %u ms.",
+                         cupsServer (), ippPort (), delay);
+                g_error_free (error);
+
                 if (manager->cups_connection_timeout_id == 0) {
                         manager->cups_connection_timeout_id =
-                                g_timeout_add_seconds (CUPS_CONNECTION_TEST_INTERVAL, cups_connection_test, manager);
+                                g_timeout_add (delay, cups_connection_test, manager);
                         g_source_set_name_by_id (manager->cups_connection_timeout_id, "[gnome-settings-daemon] cups_connection_test");
                 }
         }
@@ -1493,6 +1866,8 @@ cups_connection_test (gpointer user_data)
         gchar                        *address;
         int                           port = ippPort ();
 
+        manager->cups_connection_timeout_id = 0;
+
         if (!manager->dests) {
                 address = g_strdup_printf ("%s:%d", cupsServer (), port);
 
@@ -1503,7 +1878,7 @@ cups_connection_test (gpointer user_data)
                 g_socket_client_connect_to_host_async (client,
                                                        address,
                                                        port,
-                                                       NULL,
+                                                       manager->cancellable,
                                                        cups_connection_test_cb,
                                                        manager);
 
@@ -1511,13 +1886,7 @@ cups_connection_test (gpointer user_data)
                 g_free (address);
         }
 
-        if (manager->dests) {
-                manager->cups_connection_timeout_id = 0;
-
-                return FALSE;
-        } else {
-                return TRUE;
-        }
+        return G_SOURCE_REMOVE;
 }
 
 static void
@@ -1542,9 +1911,20 @@ gsd_print_notifications_manager_got_dbus_connection (GObject      *source_object
                                                             on_cups_notification,
                                                             manager,
                                                             NULL);
+
+                /* catch up with events sent before the subscription */
+                renew_subscription (manager);
+        } else if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                g_error_free (error);
         } else {
                 g_warning ("Connection to message bus failed: %s", error->message);
                 g_error_free (error);
+
+                /* no signals, fetch the events instead */
+                manager->push_events = FALSE;
+                fetch_notifications (manager,
+                                     gsd_cups_event_tracker_get_last (manager->tracker) + 1,
+                                     -1, 0);
         }
 }
 
@@ -1567,10 +1947,11 @@ gsd_print_notifications_manager_start_idle (gpointer data)
                 manager->num_dests = cupsGetDests (&manager->dests);
                 g_debug ("Got dests from local CUPS server.");
 
-                renew_subscription_timeout_enable (manager, TRUE, FALSE);
+                manager->push_events = TRUE;
+                renew_subscription (manager);
 
                 g_bus_get (G_BUS_TYPE_SYSTEM,
-                           NULL,
+                           manager->cancellable,
                            gsd_print_notifications_manager_got_dbus_connection,
                            data);
         } else {
@@ -1603,8 +1984,13 @@ gsd_print_notifications_manager_startup (GApplication *application)
         manager->active_notifications = NULL;
         manager->cups_bus_connection = NULL;
         manager->cups_connection_timeout_id = 0;
-        manager->last_notify_sequence_number = -1;
         manager->held_jobs = NULL;
+        manager->cancellable = g_cancellable_new ();
+        manager->tracker = gsd_cups_event_tracker_new (deliver_cups_event, manager);
+        gsd_cups_backoff_init (&manager->renew_backoff,
+                               RENEW_BACKOFF_INITIAL, RENEW_BACKOFF_MAX);
+        gsd_cups_backoff_init (&manager->connection_backoff,
+                               CONNECTION_BACKOFF_INITIAL, CONNECTION_BACKOFF_MAX);
 
         manager->start_idle_id = g_idle_add (gsd_print_notifications_manager_start_idle, manager);
         g_source_set_name_by_id (manager->start_idle_id, "[gnome-settings-daemon] gsd_print_notifications_manager_start_idle");
@@ -1636,18 +2022,20 @@ gsd_print_notifications_manager_shutdown (GApplication *application)
                 manager->cups_dbus_subscription_id = 0;
         }
 
-        renew_subscription_timeout_enable (manager, FALSE, FALSE);
+        g_cancellable_cancel (manager->cancellable);
+        g_clear_object (&manager->cancellable);
 
-        if (manager->check_source_id > 0) {
-                g_source_remove (manager->check_source_id);
-                manager->check_source_id = 0;
-        }
+        g_clear_handle_id (&manager->renew_source_id, g_source_remove);
+        g_clear_handle_id (&manager->signal_check_id, g_source_remove);
+        g_clear_handle_id (&manager->check_source_id, g_source_remove);
+        g_clear_handle_id (&manager->cups_connection_timeout_id, g_source_remove);
 
         if (manager->subscription_id >= 0) {
                 cancel_subscription (manager->subscription_id);
                 manager->subscription_id = -1;
         }
 
+        g_clear_pointer (&manager->tracker, gsd_cups_event_tracker_free);
         g_clear_pointer (&manager->printing_printers, g_hash_table_destroy);
 
         g_clear_object (&manager->cups_bus_connection);
@@ -0,0 +1,586 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Push-only handling of CUPS events.
+ *
+ * A mock notifier stands in for cupsd: it keeps the event log of a
+ * subscription, from which Get-Notifications would answer, and
+ * broadcasts the events on a private bus the way cups-notifier-dbus
+ * does, except for those a test chooses to lose.
+ */
+
+#include <gio/gio.h>
+
+#include "gsd-cups-events.h"
+
+#define JOB_COMPLETED 9 /* IPP_JOB_COMPLETED */
+
+typedef struct {
+        GDBusConnection *connection;
+        GPtrArray       *log;           /* GsdCupsEvent */
+} MockNotifier;
+
+typedef struct {
+        GTestDBus           *bus;
+        MockNotifier         notifier;
+        MockNotifier         other_session;
+        GDBusConnection     *connection;
+        guint                subscription_id;
+        guint                n_signals;
+        GsdCupsEventTracker *tracker;
+        GHashTable          *delivered; /* job id → count */
+} Fixture;
+
+static GDBusConnection *
+connect_to_bus (GTestDBus *bus)
+{
+        g_autoptr(GError) error = NULL;
+        GDBusConnection *connection;
+
+        connection = g_dbus_connection_new_for_address_sync (g_test_dbus_get_bus_address (bus),
+                                                             G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+                                                             G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+                                                             NULL, NULL, &error);
+        g_assert_no_error (error);
+
+        return connection;
+}
+
+static GsdCupsEvent *
+job_completed_event (guint job_id)
+{
+        GsdCupsEvent *event;
+
+        event = gsd_cups_event_new ();
+        event->subscribed_event = g_strdup ("job-completed");
+        event->text = g_strdup_printf ("Job %u completed.", job_id);
+        event->printer_uri = g_strdup ("ipp://localhost/printers/Office");
+        event->printer_name = g_strdup ("Office");
+        event->printer_state = 3;
+        event->printer_state_reasons = g_strdup ("none");
+        event->printer_is_accepting_jobs = TRUE;
+        event->job_id = job_id;
+        event->job_state = JOB_COMPLETED;
+        event->job_state_reasons = g_strdup ("job-completed-successfully");
+        event->job_name = g_strdup_printf ("Document %u", job_id);
+        event->job_impressions_completed = 1;
+
+        return event;
+}
+
+static void
+mock_notifier_emit (MockNotifier       *notifier,
+                    const GsdCupsEvent *event)
+{
+        g_autoptr(GError) error = NULL;
+
+        g_dbus_connection_emit_signal (notifier->connection,
+                                       NULL,
+                                       CUPS_DBUS_PATH,
+                                       CUPS_DBUS_INTERFACE,
+                                       "JobCompleted",
+                                       g_variant_new ("(sssusbuussu)",
+                                                      event->text,
+                                                      event->printer_uri,
+                                                      event->printer_name,
+                                                      event->printer_state,
+                                                      event->printer_state_reasons,
+                                                      event->printer_is_accepting_jobs,
+                                                      event->job_id,
+                                                      event->job_state,
+                                                      event->job_state_reasons,
+                                                      event->job_name,
+                                                      event->job_impressions_completed),
+                                       &error);
+        g_assert_no_error (error);
+}
+
+/* Adds a job-completed event to the log, and broadcasts it unless lost */
+static void
+mock_notifier_add_event (MockNotifier *notifier,
+                         guint         job_id,
+                         gboolean      lost)
+{
+        GsdCupsEvent *event;
+
+        event = job_completed_event (job_id);
+        event->sequence_number = notifier->log->len + 1;
+        g_ptr_array_add (notifier->log, event);
+
+        if (!lost)
+                mock_notifier_emit (notifier, event);
+}
+
+static gint
+mock_notifier_get_sequence_number (MockNotifier *notifier)
+{
+        return notifier->log->len;
+}
+
+/* What Get-Notifications returns */
+static void
+mock_notifier_pull (MockNotifier        *notifier,
+                    GsdCupsEventTracker *tracker,
+                    gint                 first)
+{
+        guint i;
+
+        for (i = MAX (first, 1) - 1; i < notifier->log->len; i++)
+                gsd_cups_event_tracker_pull (tracker, g_ptr_array_index (notifier->log, i));
+}
+
+static void
+on_signal (GDBusConnection *connection,
+           const gchar     *sender_name,
+           const gchar     *object_path,
+           const gchar     *interface_name,
+           const gchar     *signal_name,
+           GVariant        *parameters,
+           gpointer         user_data)
+{
+        Fixture *fixture = user_data;
+        g_autoptr(GsdCupsEvent) event = NULL;
+        g_autoptr(GError) error = NULL;
+
+        fixture->n_signals++;
+
+        event = gsd_cups_event_new_from_signal (signal_name, parameters, &error);
+        g_assert_no_error (error);
+        g_assert_nonnull (event);
+
+        gsd_cups_event_tracker_push (fixture->tracker, event);
+}
+
+static void
+deliver_cb (const GsdCupsEvent *event,
+            gpointer            user_data)
+{
+        Fixture *fixture = user_data;
+        guint count;
+
+        count = GPOINTER_TO_UINT (g_hash_table_lookup (fixture->delivered,
+                                                       GUINT_TO_POINTER (event->job_id)));
+        g_hash_table_insert (fixture->delivered,
+                             GUINT_TO_POINTER (event->job_id),
+                             GUINT_TO_POINTER (count + 1));
+}
+
+static gboolean
+timeout_cb (gpointer user_data)
+{
+        gboolean *timed_out = user_data;
+
+        *timed_out = TRUE;
+
+        return G_SOURCE_REMOVE;
+}
+
+static void
+wait_for_signals (Fixture *fixture,
+                  guint    n_signals)
+{
+        gboolean timed_out = FALSE;
+        guint id;
+
+        id = g_timeout_add_seconds (10, timeout_cb, &timed_out);
+        while (!timed_out && fixture->n_signals < n_signals)
+                g_main_context_iteration (NULL, TRUE);
+        g_assert_false (timed_out);
+        g_source_remove (id);
+}
+
+static void
+assert_delivered_once (Fixture *fixture,
+                       guint    n_jobs)
+{
+        guint job_id;
+
+        g_assert_cmpuint (g_hash_table_size (fixture->delivered), ==, n_jobs);
+        for (job_id = 1; job_id <= n_jobs; job_id++)
+                g_assert_cmpuint (GPOINTER_TO_UINT (g_hash_table_lookup (fixture->delivered,
+                                                                         GUINT_TO_POINTER (job_id))), ==, 1);
+}
+
+static void
+fixture_set_up (Fixture       *fixture,
+                gconstpointer  user_data)
+{
+        g_autoptr(GVariant) reply = NULL;
+        g_autoptr(GError) error = NULL;
+
+        fixture->bus = g_test_dbus_new (G_TEST_DBUS_NONE);
+        g_test_dbus_up (fixture->bus);
+
+        fixture->notifier.connection = connect_to_bus (fixture->bus);
+        fixture->notifier.log = g_ptr_array_new_with_free_func ((GDestroyNotify) gsd_cups_event_free);
+        fixture->other_session.connection = connect_to_bus (fixture->bus);
+        fixture->other_session.log = g_ptr_array_new_with_free_func ((GDestroyNotify) gsd_cups_event_free);
+
+        fixture->connection = connect_to_bus (fixture->bus);
+        fixture->subscription_id =
+                g_dbus_connection_signal_subscribe (fixture->connection,
+                                                    NULL,
+                                                    CUPS_DBUS_INTERFACE,
+                                                    NULL,
+                                                    CUPS_DBUS_PATH,
+                                                    NULL,
+                                                    G_DBUS_SIGNAL_FLAGS_NONE,
+                                                    on_signal,
+                                                    fixture,
+                                                    NULL);
+
+        /* make sure the match rule is in place before anything is sent */
+        reply = g_dbus_connection_call_sync (fixture->connection, "org.freedesktop.DBus", "/org/freedesktop/DBus",
+                                             "org.freedesktop.DBus", "GetId", NULL, G_VARIANT_TYPE ("(s)"),
+                                             G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
+        g_assert_no_error (error);
+
+        fixture->delivered = g_hash_table_new (NULL, NULL);
+        fixture->tracker = gsd_cups_event_tracker_new (deliver_cb, fixture);
+
+        /* the subscription was just created */
+        g_assert_cmpint (gsd_cups_event_tracker_check (fixture->tracker, 0, 0), ==, -1);
+}
+
+static void
+fixture_tear_down (Fixture       *fixture,
+                   gconstpointer  user_data)
+{
+        g_dbus_connection_signal_unsubscribe (fixture->connection, fixture->subscription_id);
+        g_dbus_connection_close_sync (fixture->connection, NULL, NULL);
+        g_dbus_connection_close_sync (fixture->notifier.connection, NULL, NULL);
+        g_dbus_connection_close_sync (fixture->other_session.connection, NULL, NULL);
+        g_clear_object (&fixture->connection);
+        g_clear_object (&fixture->notifier.connection);
+        g_clear_object (&fixture->other_session.connection);
+        g_clear_pointer (&fixture->notifier.log, g_ptr_array_unref);
+        g_clear_pointer (&fixture->other_session.log, g_ptr_array_unref);
+
+        g_clear_pointer (&fixture->tracker, gsd_cups_event_tracker_free);
+        g_clear_pointer (&fixture->delivered, g_hash_table_unref);
+
+        g_test_dbus_down (fixture->bus);
+        g_clear_object (&fixture->bus);
+}
+
+static void
+test_parse_signal (void)
+{
+        g_autoptr(GsdCupsEvent) expected = job_completed_event (7);
+        g_autoptr(GsdCupsEvent) event = NULL;
+        g_autoptr(GError) error = NULL;
+
+        event = gsd_cups_event_new_from_signal ("JobCompleted",
+                                                g_variant_new ("(sssusbuussu)",
+                                                               expected->text,
+                                                               expected->printer_uri,
+                                                               expected->printer_name,
+                                                               expected->printer_state,
+                                                               expected->printer_state_reasons,
+                                                               expected->printer_is_accepting_jobs,
+                                                               expected->job_id,
+                                                               expected->job_state,
+                                                               expected->job_state_reasons,
+                                                               expected->job_name,
+                                                               expected->job_impressions_completed),
+                                                &error);
+        g_assert_no_error (error);
+        g_assert_nonnull (event);
+        g_assert_cmpstr (event->subscribed_event, ==, "job-completed");
+        g_assert_cmpstr (event->printer_name, ==, "Office");
+        g_assert_cmpstr (event->job_name, ==, "Document 7");
+        g_assert_cmpuint (event->job_id, ==, 7);
+        g_assert_cmpint (event->job_state, ==, JOB_COMPLETED);
+        g_assert_cmpint (event->sequence_number, ==, -1);
+        g_clear_pointer (&event, gsd_cups_event_free);
+
+        event = gsd_cups_event_new_from_signal ("PrinterStateChanged",
+                                                g_variant_new ("(sssusb)",
+                                                               "Printer \"Office\" state changed.",
+                                                               "ipp://localhost/printers/Office",
+                                                               "Office",
+                                                               5,
+                                                               "media-empty-error",
+                                                               FALSE),
+                                                &error);
+        g_assert_no_error (error);
+        g_assert_cmpstr (event->subscribed_event, ==, "printer-state-changed");
+        g_assert_cmpint (event->printer_state, ==, 5);
+        g_assert_cmpstr (event->printer_state_reasons, ==, "media-empty-error");
+        g_assert_false (event->printer_is_accepting_jobs);
+        g_assert_cmpint (event->job_state, ==, -1);
+        g_clear_pointer (&event, gsd_cups_event_free);
+
+        /* not subscribed to */
+        event = gsd_cups_event_new_from_signal ("ServerAudit",
+                                                g_variant_new ("(s)", "audit"),
+                                                &error);
+        g_assert_no_error (error);
+        g_assert_null (event);
+
+        event = gsd_cups_event_new_from_signal ("JobCompleted",
+                                                g_variant_new ("(s)", "bogus"),
+                                                &error);
+        g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+        g_assert_null (event);
+}
+
+static void
+test_no_gap (Fixture       *fixture,
+             gconstpointer  user_data)
+{
+        guint delivered, duplicates, gaps;
+        guint i;
+
+        for (i = 1; i <= 20; i++)
+                mock_notifier_add_event (&fixture->notifier, i, FALSE);
+        wait_for_signals (fixture, 20);
+
+        g_assert_cmpint (gsd_cups_event_tracker_check (fixture->tracker,
+                                                       gsd_cups_event_tracker_get_mark (fixture->tracker),
+                                                       mock_notifier_get_sequence_number (&fixture->notifier)),
+                         ==, -1);
+        g_assert_cmpint (gsd_cups_event_tracker_get_last (fixture->tracker), ==, 20);
+
+        gsd_cups_event_tracker_get_counts (fixture->tracker, &delivered, &duplicates, &gaps);
+        g_assert_cmpuint (delivered, ==, 20);
+        g_assert_cmpuint (duplicates, ==, 0);
+        g_assert_cmpuint (gaps, ==, 0);
+        assert_delivered_once (fixture, 20);
+}
+
+static void
+test_gap (Fixture       *fixture,
+          gconstpointer  user_data)
+{
+        guint delivered, gaps;
+        guint mark;
+        gint first;
+        guint i;
+
+        /* signals for jobs 3, 4 and 7 are lost */
+        for (i = 1; i <= 10; i++)
+                mock_notifier_add_event (&fixture->notifier, i, i == 3 || i == 4 || i == 7);
+        wait_for_signals (fixture, 7);
+        g_assert_cmpuint (g_hash_table_size (fixture->delivered), ==, 7);
+
+        mark = gsd_cups_event_tracker_get_mark (fixture->tracker);
+        first = gsd_cups_event_tracker_check (fixture->tracker, mark,
+                                              mock_notifier_get_sequence_number (&fixture->notifier));
+        g_assert_cmpint (first, ==, 1);
+
+        mock_notifier_pull (&fixture->notifier, fixture->tracker, first);
+        gsd_cups_event_tracker_reconciled (fixture->tracker, mark,
+                                           mock_notifier_get_sequence_number (&fixture->notifier));
+        assert_delivered_once (fixture, 10);
+
+        /* back to signals only */
+        mock_notifier_add_event (&fixture->notifier, 11, FALSE);
+        wait_for_signals (fixture, 8);
+        g_assert_cmpint (gsd_cups_event_tracker_check (fixture->tracker,
+                                                       gsd_cups_event_tracker_get_mark (fixture->tracker),
+                                                       mock_notifier_get_sequence_number (&fixture->notifier)),
+                         ==, -1);
+        assert_delivered_once (fixture, 11);
+
+        gsd_cups_event_tracker_get_counts (fixture->tracker, &delivered, NULL, &gaps);
+        g_assert_cmpuint (delivered, ==, 11);
+        g_assert_cmpuint (gaps, ==, 1);
+}
+
+static void
+test_other_session (Fixture       *fixture,
+                    gconstpointer  user_data)
+{
+        guint duplicates;
+        guint i;
+
+        /* another session's subscription broadcasts the same events */
+        for (i = 1; i <= 5; i++) {
+                mock_notifier_add_event (&fixture->notifier, i, FALSE);
+                mock_notifier_add_event (&fixture->other_session, i, FALSE);
+        }
+        wait_for_signals (fixture, 10);
+
+        assert_delivered_once (fixture, 5);
+        gsd_cups_event_tracker_get_counts (fixture->tracker, NULL, &duplicates, NULL);
+        g_assert_cmpuint (duplicates, ==, 5);
+
+        g_assert_cmpint (gsd_cups_event_tracker_check (fixture->tracker,
+                                                       gsd_cups_event_tracker_get_mark (fixture->tracker),
+                                                       mock_notifier_get_sequence_number (&fixture->notifier)),
+                         ==, -1);
+}
+
+static void
+test_late_signal (Fixture       *fixture,
+                  gconstpointer  user_data)
+{
+        guint mark;
+        gint first;
+
+        /* the server already counts job 1 when its signal is still on
+         * the way, so it is fetched */
+        mock_notifier_add_event (&fixture->notifier, 1, TRUE);
+        mark = gsd_cups_event_tracker_get_mark (fixture->tracker);
+        first = gsd_cups_event_tracker_check (fixture->tracker, mark,
+                                              mock_notifier_get_sequence_number (&fixture->notifier));
+        g_assert_cmpint (first, ==, 1);
+        mock_notifier_pull (&fixture->notifier, fixture->tracker, first);
+        assert_delivered_once (fixture, 1);
+
+        mock_notifier_emit (&fixture->notifier, g_ptr_array_index (fixture->notifier.log, 0));
+        wait_for_signals (fixture, 1);
+        assert_delivered_once (fixture, 1);
+}
+
+static void
+test_signal_during_check (Fixture       *fixture,
+                          gconstpointer  user_data)
+{
+        guint gaps;
+        guint mark;
+        gint sequence_number;
+        gint first;
+        guint i;
+
+        for (i = 1; i <= 3; i++)
+                mock_notifier_add_event (&fixture->notifier, i, FALSE);
+        wait_for_signals (fixture, 3);
+
+        /* job 4 is signalled after the sequence number was read, and
+         * only counts for the next check */
+        mark = gsd_cups_event_tracker_get_mark (fixture->tracker);
+        sequence_number = mock_notifier_get_sequence_number (&fixture->notifier);
+        mock_notifier_add_event (&fixture->notifier, 4, FALSE);
+        wait_for_signals (fixture, 4);
+        g_assert_cmpint (gsd_cups_event_tracker_check (fixture->tracker, mark, sequence_number), ==, -1);
+        g_assert_cmpint (gsd_cups_event_tracker_check (fixture->tracker,
+                                                       gsd_cups_event_tracker_get_mark (fixture->tracker),
+                                                       mock_notifier_get_sequence_number (&fixture->notifier)),
+                         ==, -1);
+        assert_delivered_once (fixture, 4);
+
+        /* the signal for job 5 arrives while it is fetched */
+        mock_notifier_add_event (&fixture->notifier, 5, TRUE);
+        mark = gsd_cups_event_tracker_get_mark (fixture->tracker);
+        sequence_number = mock_notifier_get_sequence_number (&fixture->notifier);
+        first = gsd_cups_event_tracker_check (fixture->tracker, mark, sequence_number);
+        g_assert_cmpint (first, ==, 5);
+
+        mock_notifier_emit (&fixture->notifier, g_ptr_array_index (fixture->notifier.log, 4));
+        wait_for_signals (fixture, 5);
+        mock_notifier_pull (&fixture->notifier, fixture->tracker, first);
+        gsd_cups_event_tracker_reconciled (fixture->tracker, mark, sequence_number);
+        assert_delivered_once (fixture, 5);
+
+        g_assert_cmpint (gsd_cups_event_tracker_check (fixture->tracker,
+                                                       gsd_cups_event_tracker_get_mark (fixture->tracker),
+                                                       mock_notifier_get_sequence_number (&fixture->notifier)),
+                         ==, -1);
+        gsd_cups_event_tracker_get_counts (fixture->tracker, NULL, NULL, &gaps);
+        g_assert_cmpuint (gaps, ==, 1);
+}
+
+static void
+test_stale_gap (Fixture       *fixture,
+                gconstpointer  user_data)
+{
+        GsdCupsEvent *event;
+        guint mark;
+        gint first;
+
+        /* the signals for jobs 1 and 2 are lost, and only noticed once
+         * job 1 is long over */
+        mock_notifier_add_event (&fixture->notifier, 1, TRUE);
+        mock_notifier_add_event (&fixture->notifier, 2, TRUE);
+        event = g_ptr_array_index (fixture->notifier.log, 0);
+        event->age = 60 * 60;
+        event = g_ptr_array_index (fixture->notifier.log, 1);
+        event->age = 10;
+
+        mark = gsd_cups_event_tracker_get_mark (fixture->tracker);
+        first = gsd_cups_event_tracker_check (fixture->tracker, mark,
+                                              mock_notifier_get_sequence_number (&fixture->notifier));
+        g_assert_cmpint (first, ==, 1);
+        mock_notifier_pull (&fixture->notifier, fixture->tracker, first);
+        gsd_cups_event_tracker_reconciled (fixture->tracker, mark,
+                                           mock_notifier_get_sequence_number (&fixture->notifier));
+
+        g_assert_false (g_hash_table_contains (fixture->delivered, GUINT_TO_POINTER (1)));
+        g_assert_cmpuint (GPOINTER_TO_UINT (g_hash_table_lookup (fixture->delivered,
+                                                                 GUINT_TO_POINTER (2))), ==, 1);
+        g_assert_cmpint (gsd_cups_event_tracker_get_last (fixture->tracker), ==, 2);
+}
+
+static void
+test_backoff (void)
+{
+        GsdCupsBackoff backoff;
+        guint expected[] = { 100, 200, 400, 800, 1000, 1000 };
+        gboolean jittered = FALSE;
+        guint first = 0;
+        guint delay;
+        guint i;
+
+        gsd_cups_backoff_init (&backoff, 100, 1000);
+
+        for (i = 0; i < G_N_ELEMENTS (expected); i++) {
+                delay = gsd_cups_backoff_next (&backoff);
+                g_assert_cmpuint (delay, >=, expected[i] / 2);
+                g_assert_cmpuint (delay, <=, expected[i]);
+        }
+
+        for (i = 0; i < 100; i++) {
+                delay = gsd_cups_backoff_next (&backoff);
+                g_assert_cmpuint (delay, >=, 500);
+                g_assert_cmpuint (delay, <=, 1000);
+
+                if (i == 0)
+                        first = delay;
+                else if (delay != first)
+                        jittered = TRUE;
+        }
+        g_assert_true (jittered);
+
+        gsd_cups_backoff_reset (&backoff);
+        delay = gsd_cups_backoff_next (&backoff);
+        g_assert_cmpuint (delay, >=, 50);
+        g_assert_cmpuint (delay, <=, 100);
+}
+
+int
+main (int argc, char *argv[])
+{
+        g_test_init (&argc, &argv, NULL);
+
+        g_test_add_func ("/print-notifications/events/parse-signal", test_parse_signal);
+        g_test_add ("/print-notifications/events/no-gap", Fixture, NULL,
+                    fixture_set_up, test_no_gap, fixture_tear_down);
+        g_test_add ("/print-notifications/events/gap", Fixture, NULL,
+                    fixture_set_up, test_gap, fixture_tear_down);
+        g_test_add ("/print-notifications/events/other-session", Fixture, NULL,
+                    fixture_set_up, test_other_session, fixture_tear_down);
+        g_test_add ("/print-notifications/events/late-signal", Fixture, NULL,
+                    fixture_set_up, test_late_signal, fixture_tear_down);
+        g_test_add ("/print-notifications/events/signal-during-check", Fixture, NULL,
+                    fixture_set_up, test_signal_during_check, fixture_tear_down);
+        g_test_add ("/print-notifications/events/stale-gap", Fixture, NULL,
+                    fixture_set_up, test_stale_gap, fixture_tear_down);
+        g_test_add_func ("/print-notifications/backoff", test_backoff);
+
+        return g_test_run ();
+}
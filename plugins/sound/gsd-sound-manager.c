@@ -31,12 +31,22 @@
 #include <locale.h>
 
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
 #include <gio/gio.h>
 #include <pulse/pulseaudio.h>
+#include <pulse/glib-mainloop.h>
+#include <canberra.h>
 
 #include "gsd-sound-manager.h"
+#include "gsd-sound-theme.h"
 #include "gnome-settings-profile.h"
 
+typedef struct {
+        char    *path;
+        gint64   mtime;
+        goffset  size;
+} CachedSample;
+
 struct _GsdSoundManager
 {
         GsdApplication parent;
@@ -44,6 +54,35 @@ struct _GsdSoundManager
         GSettings *settings;
         GList     *monitors;
         guint      timeout;
+        GStrv      sound_dirs;
+
+        /* Kept around between flushes so that a flush doesn't have to
+         * wait for a new connection to the sound server */
+        pa_glib_mainloop *pa_mainloop;
+        pa_context       *pa_context;
+        gboolean          flush_running;
+        gboolean          flush_pending;
+
+        /* Theme samples kept by the last flush, by sample name */
+        GHashTable       *samples;
+        char             *flushed_theme_name;
+        gint64            last_flush;
+
+        /* State of the running flush */
+        GHashTable       *flush_samples;
+        char             *flush_theme_name;
+        gint64            flush_started;
+        GsdSoundTheme    *theme;
+        GsdSoundTheme    *previous_theme;
+        GHashTable       *flush_events;
+
+        /* Event sounds uploaded again after a flush, most recently
+         * found in the cache first */
+        GSettings        *plugin_settings;
+        GPtrArray        *hot_events;
+        GHashTable       *present_events;
+        gboolean          prewarm_pending;
+        GCancellable     *prewarm_cancellable;
 };
 
 static void gsd_sound_manager_class_init (GsdSoundManagerClass *klass);
@@ -51,20 +90,151 @@ static void gsd_sound_manager_init (GsdSoundManager *sound_manager);
 
 G_DEFINE_TYPE (GsdSoundManager, gsd_sound_manager, GSD_TYPE_APPLICATION)
 
+static void flush_cache (GsdSoundManager *manager);
+static void request_prewarm (GsdSoundManager *manager);
+static void learn_hot_events (GsdSoundManager *manager,
+                              GHashTable      *events);
+
+static void
+cached_sample_free (CachedSample *sample)
+{
+        g_free (sample->path);
+        g_free (sample);
+}
+
+static void
+end_flush (GsdSoundManager *manager,
+           gboolean         completed)
+{
+        if (completed) {
+                g_clear_pointer (&manager->samples, g_hash_table_unref);
+                manager->samples = g_steal_pointer (&manager->flush_samples);
+                g_free (manager->flushed_theme_name);
+                manager->flushed_theme_name = g_steal_pointer (&manager->flush_theme_name);
+                manager->last_flush = manager->flush_started;
+                learn_hot_events (manager, manager->flush_events);
+        }
+
+        g_clear_pointer (&manager->flush_samples, g_hash_table_unref);
+        g_clear_pointer (&manager->flush_events, g_hash_table_unref);
+        g_clear_pointer (&manager->flush_theme_name, g_free);
+        g_clear_pointer (&manager->theme, gsd_sound_theme_free);
+        g_clear_pointer (&manager->previous_theme, gsd_sound_theme_free);
+        manager->flush_running = FALSE;
+}
+
+static void
+keep_sample (GsdSoundManager *manager,
+             const char      *name,
+             const char      *path,
+             GStatBuf        *buf)
+{
+        CachedSample *sample;
+
+        sample = g_new0 (CachedSample, 1);
+        sample->path = g_strdup (path);
+        if (buf != NULL) {
+                sample->mtime = buf->st_mtime;
+                sample->size = buf->st_size;
+        }
+
+        g_hash_table_insert (manager->flush_samples, g_strdup (name), sample);
+}
+
+/* Whether the theme file backing a cached sample changed, or whether the
+ * sample's event now resolves to a different file */
+static gboolean
+sample_is_stale (GsdSoundManager *manager,
+                 const char      *name,
+                 const char      *event_id,
+                 const char      *filename)
+{
+        CachedSample *known = NULL;
+        const char *path;
+        GStatBuf buf;
+
+        path = gsd_sound_theme_lookup (manager->theme, event_id);
+
+        if (manager->samples != NULL)
+                known = g_hash_table_lookup (manager->samples, name);
+
+        if (known != NULL) {
+                if (g_strcmp0 (known->path, path) != 0)
+                        return TRUE;
+        } else {
+                GsdSoundTheme *loaded_theme;
+
+                /* The sample was uploaded after the last flush, so it
+                 * was resolved with the theme in effect back then */
+                loaded_theme = manager->previous_theme ? manager->previous_theme : manager->theme;
+                if (filename == NULL)
+                        filename = gsd_sound_theme_lookup (loaded_theme, event_id);
+                if (g_strcmp0 (filename, path) != 0)
+                        return TRUE;
+        }
+
+        if (path == NULL) {
+                /* Not from the theme, keep it */
+                keep_sample (manager, name, NULL, NULL);
+                return FALSE;
+        }
+
+        if (g_stat (path, &buf) < 0)
+                return TRUE;
+
+        /* Without a record of the file, anything modified since the last
+         * flush might postdate the sample. Before the first flush that is
+         * all of them. */
+        if (known != NULL) {
+                if (known->mtime != buf.st_mtime || known->size != buf.st_size)
+                        return TRUE;
+        } else if (manager->last_flush == 0 || buf.st_mtime >= manager->last_flush) {
+                return TRUE;
+        }
+
+        keep_sample (manager, name, path, &buf);
+
+        return FALSE;
+}
+
 static void
 sample_info_cb (pa_context *c, const pa_sample_info *i, int eol, void *userdata)
 {
+        GsdSoundManager *manager = userdata;
+        const char *event_id;
         pa_operation *o;
 
-        if (!i)
+        if (eol) {
+                if (eol < 0)
+                        g_debug ("pa_context_get_sample_info_list(): %s", pa_strerror (pa_context_errno (c)));
+                else
+                        g_debug ("Sample cache flushed");
+
+                end_flush (manager, eol > 0);
+
+                /* Changes that came in while we were listing samples
+                 * may have been missed, so go over the cache again */
+                if (manager->flush_pending)
+                        flush_cache (manager);
+                else
+                        request_prewarm (manager);
                 return;
+        }
 
         g_debug ("Found sample %s", i->name);
 
         /* We only flush those samples which have an XDG sound name
          * attached, because only those originate from themeing  */
-        if (!(pa_proplist_gets (i->proplist, PA_PROP_EVENT_ID)))
+        if (!(event_id = pa_proplist_gets (i->proplist, PA_PROP_EVENT_ID)))
+                return;
+
+        g_hash_table_add (manager->flush_events, g_strdup (event_id));
+
+        if (!sample_is_stale (manager, i->name, event_id,
+                              pa_proplist_gets (i->proplist, PA_PROP_MEDIA_FILENAME))) {
+                g_debug ("Keeping sample %s for %s", i->name, event_id);
                 return;
+        }
 
         g_debug ("Dropping sample %s from cache", i->name);
 
@@ -80,102 +250,435 @@ sample_info_cb (pa_context *c, const pa_sample_info *i, int eol, void *userdata)
 }
 
 static void
-flush_cache (void)
+start_flush (GsdSoundManager *manager)
 {
-        pa_mainloop *ml = NULL;
-        pa_context *c = NULL;
-        pa_proplist *pl = NULL;
-        pa_operation *o = NULL;
+        pa_operation *o;
 
         g_debug ("Flushing sample cache");
 
-        if (!(ml = pa_mainloop_new ())) {
-                g_debug ("Failed to allocate pa_mainloop");
-                goto fail;
-        }
+        manager->flush_pending = FALSE;
+        manager->flush_running = TRUE;
+        manager->flush_started = g_get_real_time () / G_USEC_PER_SEC;
+        manager->flush_samples = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                        g_free, (GDestroyNotify) cached_sample_free);
+        manager->flush_events = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 
-        if (!(pl = pa_proplist_new ())) {
-                g_debug ("Failed to allocate pa_proplist");
-                goto fail;
+        /* Whatever is being uploaded might be dropped again */
+        g_cancellable_cancel (manager->prewarm_cancellable);
+        g_clear_object (&manager->prewarm_cancellable);
+
+        manager->flush_theme_name = g_settings_get_string (manager->settings, "theme-name");
+        manager->theme = gsd_sound_theme_new (manager->flush_theme_name,
+                                              (const char * const *) manager->sound_dirs);
+        if (g_strcmp0 (manager->flush_theme_name, manager->flushed_theme_name) != 0)
+                manager->previous_theme = gsd_sound_theme_new (manager->flushed_theme_name,
+                                                               (const char * const *) manager->sound_dirs);
+
+        /* Enumerate all cached samples */
+        if (!(o = pa_context_get_sample_info_list (manager->pa_context, sample_info_cb, manager))) {
+                g_debug ("pa_context_get_sample_info_list(): %s", pa_strerror (pa_context_errno (manager->pa_context)));
+                end_flush (manager, FALSE);
+                return;
         }
 
-        pa_proplist_sets (pl, PA_PROP_APPLICATION_NAME, PACKAGE_NAME);
-        pa_proplist_sets (pl, PA_PROP_APPLICATION_VERSION, PACKAGE_VERSION);
-        pa_proplist_sets (pl, PA_PROP_APPLICATION_ID, "org.gnome.SettingsDaemon.Sound");
+        pa_operation_unref (o);
+}
 
-        if (!(c = pa_context_new_with_proplist (pa_mainloop_get_api (ml), PACKAGE_NAME, pl))) {
-                g_debug ("Failed to allocate pa_context");
-                goto fail;
+typedef struct {
+        char  *theme_name;
+        GStrv  event_ids;
+} PrewarmData;
+
+static void
+prewarm_data_free (PrewarmData *data)
+{
+        g_free (data->theme_name);
+        g_strfreev (data->event_ids);
+        g_free (data);
+}
+
+static char *
+get_hot_events_path (void)
+{
+        return g_build_filename (g_get_user_cache_dir (), "gnome-settings-daemon", "hot-sounds", NULL);
+}
+
+static void
+load_hot_events (GsdSoundManager *manager)
+{
+        g_autofree char *path = NULL;
+        g_autofree char *contents = NULL;
+        g_auto(GStrv) lines = NULL;
+        guint i;
+
+        manager->hot_events = g_ptr_array_new_with_free_func (g_free);
+
+        path = get_hot_events_path ();
+        if (!g_file_get_contents (path, &contents, NULL, NULL))
+                return;
+
+        lines = g_strsplit (contents, "\n", -1);
+        for (i = 0; lines[i] != NULL; i++) {
+                char *event_id = g_strstrip (lines[i]);
+
+                if (*event_id != '\0')
+                        g_ptr_array_add (manager->hot_events, g_strdup (event_id));
         }
+}
 
-        pa_proplist_free (pl);
-        pl = NULL;
+static void
+save_hot_events (GsdSoundManager *manager)
+{
+        g_autoptr(GString) contents = NULL;
+        g_autoptr(GError) error = NULL;
+        g_autofree char *path = NULL;
+        g_autofree char *dir = NULL;
+        guint i;
+
+        contents = g_string_new (NULL);
+        for (i = 0; i < manager->hot_events->len; i++)
+                g_string_append_printf (contents, "%s\n", (char *) g_ptr_array_index (manager->hot_events, i));
+
+        path = get_hot_events_path ();
+        dir = g_path_get_dirname (path);
+        if (g_mkdir_with_parents (dir, 0700) < 0 ||
+            !g_file_set_contents (path, contents->str, contents->len, &error))
+                g_debug ("Failed to save hot event sounds to %s: %s", path,
+                         error ? error->message : g_strerror (errno));
+}
 
-        if (pa_context_connect (c, NULL, PA_CONTEXT_NOAUTOSPAWN, NULL) < 0) {
-                g_debug ("pa_context_connect(): %s", pa_strerror (pa_context_errno (c)));
-                goto fail;
+static gboolean
+str_ptr_equal (gconstpointer a,
+               gconstpointer b)
+{
+        return g_str_equal (a, b);
+}
+
+/* Moves the event sounds found in the cache to the front of the hot list */
+static void
+learn_hot_events (GsdSoundManager *manager,
+                  GHashTable      *events)
+{
+        g_autoptr(GPtrArray) hot_events = NULL;
+        GHashTableIter iter;
+        gpointer event_id;
+        gboolean changed = FALSE;
+        guint max, i;
+
+        max = g_settings_get_uint (manager->plugin_settings, "prewarm-learned-max");
+
+        hot_events = g_ptr_array_new_with_free_func (g_free);
+        g_hash_table_iter_init (&iter, events);
+        while (g_hash_table_iter_next (&iter, &event_id, NULL) && hot_events->len < max)
+                g_ptr_array_add (hot_events, g_strdup (event_id));
+
+        for (i = 0; i < manager->hot_events->len && hot_events->len < max; i++) {
+                event_id = g_ptr_array_index (manager->hot_events, i);
+                if (!g_hash_table_contains (events, event_id))
+                        g_ptr_array_add (hot_events, g_strdup (event_id));
         }
 
-        /* Wait until the connection is established */
-        while (pa_context_get_state (c) != PA_CONTEXT_READY) {
+        if (hot_events->len != manager->hot_events->len) {
+                changed = TRUE;
+        } else {
+                for (i = 0; i < hot_events->len && !changed; i++)
+                        changed = !g_ptr_array_find_with_equal_func (manager->hot_events,
+                                                                     g_ptr_array_index (hot_events, i),
+                                                                     str_ptr_equal, NULL);
+        }
 
-                if (!PA_CONTEXT_IS_GOOD (pa_context_get_state (c))) {
-                        g_debug ("Connection failed: %s", pa_strerror (pa_context_errno (c)));
-                        goto fail;
-                }
+        g_ptr_array_unref (manager->hot_events);
+        manager->hot_events = g_steal_pointer (&hot_events);
+
+        if (changed)
+                save_hot_events (manager);
+}
 
-                if (pa_mainloop_iterate (ml, TRUE, NULL) < 0) {
-                        g_debug ("pa_mainloop_iterate() failed");
-                        goto fail;
+static void
+prewarm_thread (GTask        *task,
+                gpointer      source_object,
+                gpointer      task_data,
+                GCancellable *cancellable)
+{
+        PrewarmData *data = task_data;
+        ca_context *ca;
+        guint cached = 0;
+        guint i;
+        int res;
+
+        if ((res = ca_context_create (&ca)) < 0) {
+                g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED,
+                                         "ca_context_create(): %s", ca_strerror (res));
+                return;
+        }
+
+        ca_context_set_driver (ca, "pulse");
+        ca_context_change_props (ca,
+                                 CA_PROP_APPLICATION_ID, "org.gnome.SettingsDaemon.Sound",
+                                 CA_PROP_CANBERRA_XDG_THEME_NAME, data->theme_name,
+                                 NULL);
+
+        /* Decoding and uploading blocks, hence the thread; the samples
+         * are named the way later playback looks them up */
+        for (i = 0; data->event_ids[i] != NULL; i++) {
+                if (g_task_return_error_if_cancelled (task)) {
+                        ca_context_destroy (ca);
+                        return;
                 }
+
+                res = ca_context_cache (ca, CA_PROP_EVENT_ID, data->event_ids[i], NULL);
+                if (res < 0)
+                        g_debug ("Failed to upload sound %s: %s", data->event_ids[i], ca_strerror (res));
+                else
+                        cached++;
         }
 
-        /* Enumerate all cached samples */
-        if (!(o = pa_context_get_sample_info_list (c, sample_info_cb, NULL))) {
-                g_debug ("pa_context_get_sample_info_list(): %s", pa_strerror (pa_context_errno (c)));
-                goto fail;
+        ca_context_destroy (ca);
+
+        g_task_return_int (task, cached);
+}
+
+static void
+prewarm_done_cb (GObject      *source_object,
+                 GAsyncResult *res,
+                 gpointer      user_data)
+{
+        g_autoptr(GError) error = NULL;
+        gssize cached;
+
+        cached = g_task_propagate_int (G_TASK (res), &error);
+        if (cached < 0) {
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        g_debug ("Failed to upload event sounds: %s", error->message);
+                return;
         }
 
-        /* Wait until our operation is finished and there's nothing
-         * more queued to send to the server */
-        while (pa_operation_get_state (o) == PA_OPERATION_RUNNING || pa_context_is_pending (c)) {
+        g_debug ("Uploaded %" G_GSSIZE_FORMAT " event sounds", cached);
+}
 
-                if (!PA_CONTEXT_IS_GOOD (pa_context_get_state (c))) {
-                        g_debug ("Connection failed: %s", pa_strerror (pa_context_errno (c)));
-                        goto fail;
-                }
+static void
+add_prewarm_event (GPtrArray   *event_ids,
+                   GHashTable  *present,
+                   const char  *event_id)
+{
+        if (g_hash_table_contains (present, event_id) ||
+            g_ptr_array_find_with_equal_func (event_ids, event_id, str_ptr_equal, NULL))
+                return;
 
-                if (pa_mainloop_iterate (ml, TRUE, NULL) < 0) {
-                        g_debug ("pa_mainloop_iterate() failed");
-                        goto fail;
-                }
+        g_ptr_array_add (event_ids, g_strdup (event_id));
+}
+
+static void
+launch_prewarm (GsdSoundManager *manager,
+                GHashTable      *present)
+{
+        g_autoptr(GPtrArray) event_ids = NULL;
+        g_autoptr(GTask) task = NULL;
+        g_auto(GStrv) configured = NULL;
+        PrewarmData *data;
+        guint i;
+
+        event_ids = g_ptr_array_new_with_free_func (g_free);
+
+        configured = g_settings_get_strv (manager->plugin_settings, "prewarm-sounds");
+        for (i = 0; configured[i] != NULL; i++)
+                add_prewarm_event (event_ids, present, configured[i]);
+        for (i = 0; i < manager->hot_events->len; i++)
+                add_prewarm_event (event_ids, present, g_ptr_array_index (manager->hot_events, i));
+
+        if (event_ids->len == 0)
+                return;
+
+        g_debug ("Uploading %u event sounds", event_ids->len);
+
+        g_ptr_array_add (event_ids, NULL);
+
+        data = g_new0 (PrewarmData, 1);
+        data->theme_name = g_settings_get_string (manager->settings, "theme-name");
+        data->event_ids = (GStrv) g_ptr_array_free (g_steal_pointer (&event_ids), FALSE);
+
+        g_cancellable_cancel (manager->prewarm_cancellable);
+        g_clear_object (&manager->prewarm_cancellable);
+        manager->prewarm_cancellable = g_cancellable_new ();
+
+        task = g_task_new (manager, manager->prewarm_cancellable, prewarm_done_cb, NULL);
+        g_task_set_source_tag (task, launch_prewarm);
+        g_task_set_task_data (task, data, (GDestroyNotify) prewarm_data_free);
+        g_task_run_in_thread (task, prewarm_thread);
+}
+
+static void
+prewarm_info_cb (pa_context *c, const pa_sample_info *i, int eol, void *userdata)
+{
+        GsdSoundManager *manager = userdata;
+        const char *event_id;
+
+        if (eol) {
+                g_autoptr(GHashTable) present = g_steal_pointer (&manager->present_events);
+
+                if (eol < 0)
+                        g_debug ("pa_context_get_sample_info_list(): %s", pa_strerror (pa_context_errno (c)));
+                else if (!manager->flush_running && !manager->flush_pending)
+                        launch_prewarm (manager, present);
+                return;
         }
 
-        g_debug ("Sample cache flushed");
+        if ((event_id = pa_proplist_gets (i->proplist, PA_PROP_EVENT_ID)))
+                g_hash_table_add (manager->present_events, g_strdup (event_id));
+}
+
+static void
+start_prewarm (GsdSoundManager *manager)
+{
+        pa_operation *o;
+
+        manager->prewarm_pending = FALSE;
+
+        if (manager->present_events != NULL)
+                return;
+
+        /* Only upload what isn't in the cache already */
+        manager->present_events = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 
-fail:
-        if (o) {
-                pa_operation_cancel (o);
-                pa_operation_unref (o);
+        if (!(o = pa_context_get_sample_info_list (manager->pa_context, prewarm_info_cb, manager))) {
+                g_debug ("pa_context_get_sample_info_list(): %s", pa_strerror (pa_context_errno (manager->pa_context)));
+                g_clear_pointer (&manager->present_events, g_hash_table_unref);
+                return;
         }
 
-        if (c) {
-                pa_context_disconnect (c);
-                pa_context_unref (c);
+        pa_operation_unref (o);
+}
+
+static void
+context_state_cb (pa_context *c, void *userdata)
+{
+        GsdSoundManager *manager = userdata;
+
+        switch (pa_context_get_state (c)) {
+        case PA_CONTEXT_READY:
+                g_debug ("Connected to sound server");
+                if (manager->flush_pending)
+                        start_flush (manager);
+                else if (manager->prewarm_pending)
+                        start_prewarm (manager);
+                break;
+        case PA_CONTEXT_FAILED:
+        case PA_CONTEXT_TERMINATED:
+                /* The context is replaced on the next flush; a flush
+                 * that was running is moot as the server lost its
+                 * cache anyway. */
+                g_debug ("Connection failed: %s", pa_strerror (pa_context_errno (c)));
+                end_flush (manager, FALSE);
+                manager->flush_pending = FALSE;
+                manager->prewarm_pending = FALSE;
+                g_clear_pointer (&manager->present_events, g_hash_table_unref);
+
+                /* A new server starts with an empty cache */
+                g_clear_pointer (&manager->samples, g_hash_table_unref);
+                break;
+        default:
+                break;
         }
+}
 
-        if (pl)
-                pa_proplist_free (pl);
+static void
+clear_context (GsdSoundManager *manager)
+{
+        if (manager->pa_context == NULL)
+                return;
 
-        if (ml)
-                pa_mainloop_free (ml);
+        pa_context_set_state_callback (manager->pa_context, NULL, NULL);
+        pa_context_disconnect (manager->pa_context);
+        pa_context_unref (manager->pa_context);
+        manager->pa_context = NULL;
+        end_flush (manager, FALSE);
+}
+
+static gboolean
+ensure_context (GsdSoundManager *manager)
+{
+        pa_proplist *pl;
+
+        if (manager->pa_context != NULL &&
+            PA_CONTEXT_IS_GOOD (pa_context_get_state (manager->pa_context)))
+                return TRUE;
+
+        clear_context (manager);
+
+        if (manager->pa_mainloop == NULL &&
+            !(manager->pa_mainloop = pa_glib_mainloop_new (NULL))) {
+                g_debug ("Failed to allocate pa_glib_mainloop");
+                return FALSE;
+        }
+
+        if (!(pl = pa_proplist_new ())) {
+                g_debug ("Failed to allocate pa_proplist");
+                return FALSE;
+        }
+
+        pa_proplist_sets (pl, PA_PROP_APPLICATION_NAME, PACKAGE_NAME);
+        pa_proplist_sets (pl, PA_PROP_APPLICATION_VERSION, PACKAGE_VERSION);
+        pa_proplist_sets (pl, PA_PROP_APPLICATION_ID, "org.gnome.SettingsDaemon.Sound");
+
+        manager->pa_context = pa_context_new_with_proplist (pa_glib_mainloop_get_api (manager->pa_mainloop),
+                                                            PACKAGE_NAME, pl);
+        pa_proplist_free (pl);
+
+        if (manager->pa_context == NULL) {
+                g_debug ("Failed to allocate pa_context");
+                return FALSE;
+        }
+
+        pa_context_set_state_callback (manager->pa_context, context_state_cb, manager);
+
+        if (pa_context_connect (manager->pa_context, NULL, PA_CONTEXT_NOAUTOSPAWN, NULL) < 0) {
+                g_debug ("pa_context_connect(): %s", pa_strerror (pa_context_errno (manager->pa_context)));
+                clear_context (manager);
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+static void
+flush_cache (GsdSoundManager *manager)
+{
+        /* Requests made while a flush is running are merged into a
+         * single flush once the running one finishes */
+        manager->flush_pending = TRUE;
+
+        if (manager->flush_running)
+                return;
+
+        if (!ensure_context (manager)) {
+                manager->flush_pending = FALSE;
+                return;
+        }
+
+        /* Otherwise the flush starts once the connection is ready */
+        if (pa_context_get_state (manager->pa_context) == PA_CONTEXT_READY)
+                start_flush (manager);
+}
+
+static void
+request_prewarm (GsdSoundManager *manager)
+{
+        manager->prewarm_pending = TRUE;
+
+        if (!ensure_context (manager)) {
+                manager->prewarm_pending = FALSE;
+                return;
+        }
+
+        if (pa_context_get_state (manager->pa_context) == PA_CONTEXT_READY)
+                start_prewarm (manager);
 }
 
 static gboolean
 flush_cb (GsdSoundManager *manager)
 {
-        flush_cache ();
         manager->timeout = 0;
+        flush_cache (manager);
         return FALSE;
 }
 
@@ -251,6 +754,7 @@ static void
 gsd_sound_manager_startup (GApplication *app)
 {
         GsdSoundManager *manager = GSD_SOUND_MANAGER (app);
+        g_autoptr(GPtrArray) sound_dirs = NULL;
         guint i;
         const gchar * const * dirs;
         char *p;
@@ -260,13 +764,18 @@ gsd_sound_manager_startup (GApplication *app)
 
         /* We listen for change of the selected theme ... */
         register_config_callback (manager);
+        manager->flushed_theme_name = g_settings_get_string (manager->settings, "theme-name");
+        manager->plugin_settings = g_settings_new ("org.gnome.settings-daemon.plugins.sound");
+        load_hot_events (manager);
+
+        sound_dirs = g_ptr_array_new ();
 
         /* ... and we listen to changes of the theme base directories
          * in $HOME ...*/
         p = g_build_filename (g_get_user_data_dir (), "sounds", NULL);
         if (g_mkdir_with_parents(p, 0700) == 0)
                 register_directory_callback (manager, p, NULL);
-        g_free (p);
+        g_ptr_array_add (sound_dirs, p);
 
         /* ... and globally. */
         dirs = g_get_system_data_dirs ();
@@ -274,9 +783,15 @@ gsd_sound_manager_startup (GApplication *app)
                 p = g_build_filename (dirs[i], "sounds", NULL);
                 if (g_file_test (p, G_FILE_TEST_IS_DIR))
                         register_directory_callback (manager, p, NULL);
-                g_free (p);
+                g_ptr_array_add (sound_dirs, p);
         }
 
+        g_ptr_array_add (sound_dirs, NULL);
+        manager->sound_dirs = (GStrv) g_ptr_array_free (g_steal_pointer (&sound_dirs), FALSE);
+
+        /* Upload the sounds that are likely to be played soon */
+        request_prewarm (manager);
+
         G_APPLICATION_CLASS (gsd_sound_manager_parent_class)->startup (app);
 
         gnome_settings_profile_end (NULL);
@@ -305,6 +820,25 @@ gsd_sound_manager_shutdown (GApplication *app)
                 manager->monitors = g_list_delete_link (manager->monitors, manager->monitors);
         }
 
+        g_cancellable_cancel (manager->prewarm_cancellable);
+        g_clear_object (&manager->prewarm_cancellable);
+
+        clear_context (manager);
+        manager->flush_pending = FALSE;
+        manager->prewarm_pending = FALSE;
+        g_clear_pointer (&manager->present_events, g_hash_table_unref);
+        g_clear_pointer (&manager->hot_events, g_ptr_array_unref);
+        g_clear_object (&manager->plugin_settings);
+
+        g_clear_pointer (&manager->samples, g_hash_table_unref);
+        g_clear_pointer (&manager->flushed_theme_name, g_free);
+        g_clear_pointer (&manager->sound_dirs, g_strfreev);
+
+        if (manager->pa_mainloop != NULL) {
+                pa_glib_mainloop_free (manager->pa_mainloop);
+                manager->pa_mainloop = NULL;
+        }
+
         G_APPLICATION_CLASS (gsd_sound_manager_parent_class)->shutdown (app);
 }
 
@@ -0,0 +1,211 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "gsd-sound-theme.h"
+
+/* Resolves event sounds to files the way libcanberra does it, following
+ * the XDG sound theme specification for the stereo output profile.
+ * Localized sound directories are not taken into account. */
+
+#define FALLBACK_THEME  "freedesktop"
+#define OUTPUT_PROFILE  "stereo"
+
+static const char * const extensions[] = {
+        ".disabled", ".oga", ".ogg", ".wav", NULL
+};
+
+struct _GsdSoundTheme {
+        /* Directories searched for sound files, in lookup order */
+        GPtrArray  *dirs;
+        /* Event ID to resolved file, NULL if there is none */
+        GHashTable *resolved;
+};
+
+static GKeyFile *
+load_index (const char         *name,
+            const char * const *sound_dirs)
+{
+        guint i;
+
+        for (i = 0; sound_dirs[i] != NULL; i++) {
+                g_autoptr(GKeyFile) index = NULL;
+                g_autofree char *path = NULL;
+
+                path = g_build_filename (sound_dirs[i], name, "index.theme", NULL);
+                index = g_key_file_new ();
+                if (g_key_file_load_from_file (index, path, G_KEY_FILE_NONE, NULL))
+                        return g_steal_pointer (&index);
+        }
+
+        return NULL;
+}
+
+static void
+add_theme (GsdSoundTheme      *theme,
+           GHashTable         *visited,
+           const char         *name,
+           const char * const *sound_dirs)
+{
+        g_autoptr(GKeyFile) index = NULL;
+        g_autofree char *directories = NULL;
+        g_autofree char *inherits = NULL;
+        g_auto(GStrv) subdirs = NULL;
+        g_auto(GStrv) parents = NULL;
+        guint i, j;
+
+        if (!g_hash_table_add (visited, g_strdup (name)))
+                return;
+
+        index = load_index (name, sound_dirs);
+        if (index == NULL) {
+                g_debug ("Sound theme %s not found", name);
+                return;
+        }
+
+        directories = g_key_file_get_string (index, "Sound Theme", "Directories", NULL);
+        if (directories != NULL)
+                subdirs = g_strsplit (directories, ",", -1);
+
+        for (i = 0; subdirs != NULL && subdirs[i] != NULL; i++) {
+                g_autofree char *profile = NULL;
+                char *subdir = g_strstrip (subdirs[i]);
+
+                if (*subdir == '\0')
+                        continue;
+
+                profile = g_key_file_get_string (index, subdir, "OutputProfile", NULL);
+                if (profile != NULL && strcmp (profile, OUTPUT_PROFILE) != 0)
+                        continue;
+
+                /* A theme may be spread over several data directories */
+                for (j = 0; sound_dirs[j] != NULL; j++)
+                        g_ptr_array_add (theme->dirs, g_build_filename (sound_dirs[j], name, subdir, NULL));
+        }
+
+        inherits = g_key_file_get_string (index, "Sound Theme", "Inherits", NULL);
+        if (inherits != NULL)
+                parents = g_strsplit (inherits, ",", -1);
+
+        for (i = 0; parents != NULL && parents[i] != NULL; i++) {
+                char *parent = g_strstrip (parents[i]);
+
+                if (*parent != '\0')
+                        add_theme (theme, visited, parent, sound_dirs);
+        }
+}
+
+/**
+ * gsd_sound_theme_new:
+ * @name: the sound theme name
+ * @sound_dirs: the "sounds" data directories, most important first
+ *
+ * Loads the directory layout of @name and the themes it inherits from.
+ * The file system is only looked at again for events that haven't been
+ * looked up yet, so a #GsdSoundTheme should not be kept around across
+ * changes to the theme directories.
+ */
+GsdSoundTheme *
+gsd_sound_theme_new (const char         *name,
+                     const char * const *sound_dirs)
+{
+        g_autoptr(GHashTable) visited = NULL;
+        GsdSoundTheme *theme;
+
+        theme = g_new0 (GsdSoundTheme, 1);
+        theme->dirs = g_ptr_array_new_with_free_func (g_free);
+        theme->resolved = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+        visited = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+        if (name != NULL && *name != '\0')
+                add_theme (theme, visited, name, sound_dirs);
+        add_theme (theme, visited, FALLBACK_THEME, sound_dirs);
+
+        return theme;
+}
+
+void
+gsd_sound_theme_free (GsdSoundTheme *theme)
+{
+        if (theme == NULL)
+                return;
+
+        g_ptr_array_unref (theme->dirs);
+        g_hash_table_unref (theme->resolved);
+        g_free (theme);
+}
+
+static char *
+find_file (GsdSoundTheme *theme,
+           const char    *name)
+{
+        guint i, j;
+
+        for (i = 0; i < theme->dirs->len; i++) {
+                for (j = 0; extensions[j] != NULL; j++) {
+                        g_autofree char *basename = NULL;
+                        g_autofree char *path = NULL;
+
+                        basename = g_strconcat (name, extensions[j], NULL);
+                        path = g_build_filename (g_ptr_array_index (theme->dirs, i), basename, NULL);
+                        if (g_file_test (path, G_FILE_TEST_EXISTS))
+                                return g_steal_pointer (&path);
+                }
+        }
+
+        return NULL;
+}
+
+/**
+ * gsd_sound_theme_lookup:
+ * @theme: a #GsdSoundTheme
+ * @event_id: an XDG sound name
+ *
+ * Returns: the file @event_id resolves to, which ends in ".disabled" if
+ * the theme disables the sound, or %NULL if no file was found.
+ */
+const char *
+gsd_sound_theme_lookup (GsdSoundTheme *theme,
+                        const char    *event_id)
+{
+        g_autofree char *name = NULL;
+        char *path = NULL;
+        char *dash;
+
+        if (g_hash_table_lookup_extended (theme->resolved, event_id, NULL, (gpointer *) &path))
+                return path;
+
+        /* "message-new-instant" falls back to "message-new" and "message" */
+        name = g_strdup (event_id);
+        while (TRUE) {
+                path = find_file (theme, name);
+                if (path != NULL)
+                        break;
+
+                dash = strrchr (name, '-');
+                if (dash == NULL)
+                        break;
+                *dash = '\0';
+        }
+
+        g_hash_table_insert (theme->resolved, g_strdup (event_id), path);
+
+        return path;
+}
@@ -0,0 +1,37 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __GSD_SOUND_THEME_H
+#define __GSD_SOUND_THEME_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GsdSoundTheme GsdSoundTheme;
+
+GsdSoundTheme *gsd_sound_theme_new    (const char         *name,
+                                       const char * const *sound_dirs);
+void           gsd_sound_theme_free   (GsdSoundTheme      *theme);
+const char    *gsd_sound_theme_lookup (GsdSoundTheme      *theme,
+                                       const char         *event_id);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GsdSoundTheme, gsd_sound_theme_free)
+
+G_END_DECLS
+
+#endif /* __GSD_SOUND_THEME_H */
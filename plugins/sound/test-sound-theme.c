@@ -0,0 +1,175 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "gsd-sound-theme.h"
+
+typedef struct {
+        char *user_dir;
+        char *system_dir;
+} Fixture;
+
+static void
+write_file (const char *dir,
+            const char *relative,
+            const char *contents)
+{
+        g_autofree char *path = NULL;
+        g_autofree char *parent = NULL;
+        g_autoptr(GError) error = NULL;
+
+        path = g_build_filename (dir, relative, NULL);
+        parent = g_path_get_dirname (path);
+        g_assert_cmpint (g_mkdir_with_parents (parent, 0700), ==, 0);
+        g_file_set_contents (path, contents, -1, &error);
+        g_assert_no_error (error);
+}
+
+static void
+fixture_setup (Fixture       *fixture,
+               gconstpointer  user_data)
+{
+        g_autoptr(GError) error = NULL;
+
+        fixture->user_dir = g_dir_make_tmp ("gsd-sound-theme-XXXXXX", &error);
+        g_assert_no_error (error);
+        fixture->system_dir = g_dir_make_tmp ("gsd-sound-theme-XXXXXX", &error);
+        g_assert_no_error (error);
+
+        write_file (fixture->system_dir, "freedesktop/index.theme",
+                    "[Sound Theme]\n"
+                    "Name=Default\n"
+                    "Directories=stereo\n"
+                    "\n"
+                    "[stereo]\n"
+                    "OutputProfile=stereo\n");
+        write_file (fixture->system_dir, "freedesktop/stereo/bell.oga", "");
+        write_file (fixture->system_dir, "freedesktop/stereo/message.oga", "");
+        write_file (fixture->system_dir, "freedesktop/stereo/dialog-warning.oga", "");
+
+        write_file (fixture->system_dir, "custom/index.theme",
+                    "[Sound Theme]\n"
+                    "Name=Custom\n"
+                    "Inherits=freedesktop\n"
+                    "Directories=stereo, 5.1\n"
+                    "\n"
+                    "[stereo]\n"
+                    "OutputProfile=stereo\n"
+                    "\n"
+                    "[5.1]\n"
+                    "OutputProfile=5.1\n");
+        write_file (fixture->system_dir, "custom/stereo/message-new-instant.wav", "");
+        write_file (fixture->system_dir, "custom/5.1/bell.oga", "");
+        write_file (fixture->system_dir, "custom/stereo/dialog-warning.disabled", "");
+
+        /* Overrides the system copy of the same theme */
+        write_file (fixture->user_dir, "custom/stereo/message-new-instant.oga", "");
+}
+
+static void
+remove_tree (const char *path)
+{
+        GDir *dir;
+        const char *name;
+
+        dir = g_dir_open (path, 0, NULL);
+        if (dir != NULL) {
+                while ((name = g_dir_read_name (dir)) != NULL) {
+                        g_autofree char *child = g_build_filename (path, name, NULL);
+                        remove_tree (child);
+                }
+                g_dir_close (dir);
+        }
+
+        g_remove (path);
+}
+
+static void
+fixture_teardown (Fixture       *fixture,
+                  gconstpointer  user_data)
+{
+        remove_tree (fixture->user_dir);
+        remove_tree (fixture->system_dir);
+        g_free (fixture->user_dir);
+        g_free (fixture->system_dir);
+}
+
+static void
+assert_lookup (GsdSoundTheme *theme,
+               const char    *event_id,
+               const char    *dir,
+               const char    *expected)
+{
+        g_autofree char *path = NULL;
+
+        if (expected != NULL)
+                path = g_build_filename (dir, expected, NULL);
+
+        g_assert_cmpstr (gsd_sound_theme_lookup (theme, event_id), ==, path);
+}
+
+static void
+test_lookup (Fixture       *fixture,
+             gconstpointer  user_data)
+{
+        const char *dirs[] = { fixture->user_dir, fixture->system_dir, NULL };
+        g_autoptr(GsdSoundTheme) theme = NULL;
+
+        theme = gsd_sound_theme_new ("custom", dirs);
+
+        assert_lookup (theme, "message-new-instant", fixture->user_dir, "custom/stereo/message-new-instant.oga");
+        /* Falls back to a less specific name in the parent theme */
+        assert_lookup (theme, "message-new-email", fixture->system_dir, "freedesktop/stereo/message.oga");
+        /* Other output profiles are ignored */
+        assert_lookup (theme, "bell", fixture->system_dir, "freedesktop/stereo/bell.oga");
+        assert_lookup (theme, "dialog-warning", fixture->system_dir, "custom/stereo/dialog-warning.disabled");
+        assert_lookup (theme, "camera-shutter", NULL, NULL);
+}
+
+static void
+test_theme_change (Fixture       *fixture,
+                   gconstpointer  user_data)
+{
+        const char *dirs[] = { fixture->user_dir, fixture->system_dir, NULL };
+        g_autoptr(GsdSoundTheme) custom = NULL;
+        g_autoptr(GsdSoundTheme) fallback = NULL;
+        g_autoptr(GsdSoundTheme) missing = NULL;
+
+        custom = gsd_sound_theme_new ("custom", dirs);
+        fallback = gsd_sound_theme_new ("freedesktop", dirs);
+        missing = gsd_sound_theme_new ("does-not-exist", dirs);
+
+        g_assert_cmpstr (gsd_sound_theme_lookup (custom, "bell"), ==,
+                         gsd_sound_theme_lookup (fallback, "bell"));
+        g_assert_cmpstr (gsd_sound_theme_lookup (custom, "message-new-instant"), !=,
+                         gsd_sound_theme_lookup (fallback, "message-new-instant"));
+        g_assert_cmpstr (gsd_sound_theme_lookup (missing, "message-new-instant"), ==,
+                         gsd_sound_theme_lookup (fallback, "message-new-instant"));
+}
+
+int
+main (int argc, char **argv)
+{
+        g_test_init (&argc, &argv, NULL);
+
+        g_test_add ("/sound/theme/lookup", Fixture, NULL,
+                    fixture_setup, test_lookup, fixture_teardown);
+        g_test_add ("/sound/theme/theme-change", Fixture, NULL,
+                    fixture_setup, test_theme_change, fixture_teardown);
+
+        return g_test_run ();
+}
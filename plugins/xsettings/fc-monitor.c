@@ -26,12 +26,41 @@
 
 #define TIMEOUT_MILLISECONDS 1000
 
+/* Set on each GFileMonitor: the path it watches, and whether that is
+ * a configuration file rather than a font directory */
+#define MONITOR_PATH_KEY   "fc-monitor-path"
+#define MONITOR_CONFIG_KEY "fc-monitor-config"
+
 static void
 fontconfig_cache_update_thread (GTask *task,
                                 gpointer source_object G_GNUC_UNUSED,
-                                gpointer task_data G_GNUC_UNUSED,
+                                gpointer task_data,
                                 GCancellable *cancellable G_GNUC_UNUSED)
 {
+        const char * const *dirs = task_data;
+
+        /* Only font directories changed: rescan just those, so that the
+         * reinitialization below finds every other cache up to date and
+         * doesn't have to scan anything. A configuration change
+         * (dirs == NULL) needs the full rebuild. */
+        if (dirs != NULL) {
+                guint i;
+
+                for (i = 0; dirs[i] != NULL; i++) {
+                        FcCache *cache;
+
+                        g_debug ("Rescanning fontconfig cache for %s", dirs[i]);
+                        cache = FcDirCacheRescan ((const FcChar8 *) dirs[i], NULL);
+                        if (cache == NULL) {
+                                g_debug ("Could not rescan %s", dirs[i]);
+                                continue;
+                        }
+
+                        /* only the file written to disk is of interest */
+                        FcDirCacheUnload (cache);
+                }
+        }
+
         if (FcConfigUptoDate (NULL)) {
                 g_task_return_boolean (task, FALSE);
                 return;
@@ -47,10 +76,12 @@ fontconfig_cache_update_thread (GTask *task,
 }
 
 static void
-fontconfig_cache_update_async (GAsyncReadyCallback callback,
+fontconfig_cache_update_async (GStrv               dirs,
+                               GAsyncReadyCallback callback,
                                gpointer user_data)
 {
         GTask *task = g_task_new (NULL, NULL, callback, user_data);
+        g_task_set_task_data (task, dirs, (GDestroyNotify) g_strfreev);
         g_task_run_in_thread (task, fontconfig_cache_update_thread);
         g_object_unref (task);
 }
@@ -72,7 +103,18 @@ typedef enum {
 struct _FcMonitor {
         GObject parent_instance;
 
-        GPtrArray *monitors;
+        /* path -> GFileMonitor */
+        GHashTable *monitors;
+
+        /* Changes since the last update was started */
+        GHashTable *changed_dirs;
+        gboolean config_changed;
+
+        /* What the running update is refreshing, and what has been
+         * refreshed since "updated" was last emitted */
+        GStrv updating_dirs;
+        GHashTable *updated_dirs;
+        gboolean updated_config;
 
         guint timeout;
         UpdateState state;
@@ -88,7 +130,8 @@ enum {
 static guint signals[N_SIGNALS] = { 0, };
 
 static void fc_monitor_finalize (GObject *object);
-static void monitor_files (FcMonitor *self, FcStrList *list);
+static void monitor_files (FcMonitor *self, FcStrList *list, gboolean config,
+                           GHashTable *old_monitors);
 static void stuff_changed (GFileMonitor *monitor, GFile *file, GFile *other_file,
                            GFileMonitorEvent event_type, gpointer data);
 static void start_timeout (FcMonitor *self);
@@ -112,7 +155,8 @@ fc_monitor_class_init (FcMonitorClass *klass)
                                                 NULL,
                                                 NULL,
                                                 G_TYPE_NONE,
-                                                0);
+                                                1,
+                                                G_TYPE_STRV);
 }
 
 FcMonitor *
@@ -122,9 +166,12 @@ fc_monitor_new (void)
 }
 
 static void
-fc_monitor_init (FcMonitor *self G_GNUC_UNUSED)
+fc_monitor_init (FcMonitor *self)
 {
         FcInit ();
+
+        self->changed_dirs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+        self->updated_dirs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 }
 
 static void
@@ -136,39 +183,74 @@ fc_monitor_finalize (GObject *object)
                 g_source_remove (self->timeout);
         self->timeout = 0;
 
-        g_clear_pointer (&self->monitors, g_ptr_array_unref);
+        g_clear_pointer (&self->monitors, g_hash_table_unref);
+        g_clear_pointer (&self->changed_dirs, g_hash_table_unref);
+        g_clear_pointer (&self->updated_dirs, g_hash_table_unref);
+        g_clear_pointer (&self->updating_dirs, g_strfreev);
 
         G_OBJECT_CLASS (fc_monitor_parent_class)->finalize (object);
 }
 
+static void
+update_monitors (FcMonitor *self)
+{
+        GHashTable *old_monitors = self->monitors;
+
+        self->monitors = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+
+        monitor_files (self, FcConfigGetConfigFiles (NULL), TRUE, old_monitors);
+        monitor_files (self, FcConfigGetFontDirs (NULL), FALSE, old_monitors);
+
+        if (old_monitors != NULL) {
+                g_debug ("Watching %u font paths, %u were dropped",
+                         g_hash_table_size (self->monitors),
+                         g_hash_table_size (old_monitors));
+                g_hash_table_unref (old_monitors);
+        }
+}
+
 void
 fc_monitor_start (FcMonitor *self)
 {
         g_return_if_fail (FC_IS_MONITOR (self));
         g_return_if_fail (self->monitors == NULL);
 
-        self->monitors = g_ptr_array_new_with_free_func (g_object_unref);
-
-        monitor_files (self, FcConfigGetConfigFiles (NULL));
-        monitor_files (self, FcConfigGetFontDirs (NULL));
+        update_monitors (self);
 }
 
 void
 fc_monitor_stop (FcMonitor *self)
 {
         g_return_if_fail (FC_IS_MONITOR (self));
-        g_clear_pointer (&self->monitors, g_ptr_array_unref);
+        g_clear_pointer (&self->monitors, g_hash_table_unref);
 }
 
+/* Recursive fanotify marks would need CAP_SYS_ADMIN, which the session
+ * doesn't have, so each path keeps its own inotify-backed monitor. The
+ * lists from fontconfig contain duplicates though, and monitors for paths
+ * that are still in use are kept across updates rather than recreated.
+ */
 static void
 monitor_files (FcMonitor *self,
-               FcStrList *list)
+               FcStrList *list,
+               gboolean config,
+               GHashTable *old_monitors)
 {
         const char *str;
 
         while ((str = (const char *) FcStrListNext (list))) {
                 GFile *file;
                 GFileMonitor *monitor;
+                gpointer old_path;
+
+                if (g_hash_table_contains (self->monitors, str))
+                        continue;
+
+                if (old_monitors != NULL &&
+                    g_hash_table_steal_extended (old_monitors, str, &old_path, (gpointer *) &monitor)) {
+                        g_hash_table_insert (self->monitors, old_path, monitor);
+                        continue;
+                }
 
                 file = g_file_new_for_path (str);
 
@@ -179,16 +261,18 @@ monitor_files (FcMonitor *self,
                 if (!monitor)
                         continue;
 
+                g_object_set_data_full (G_OBJECT (monitor), MONITOR_PATH_KEY, g_strdup (str), g_free);
+                g_object_set_data (G_OBJECT (monitor), MONITOR_CONFIG_KEY, GINT_TO_POINTER (config));
                 g_signal_connect (monitor, "changed", G_CALLBACK (stuff_changed), self);
 
-                g_ptr_array_add (self->monitors, monitor);
+                g_hash_table_insert (self->monitors, g_strdup (str), monitor);
         }
 
         FcStrListDone (list);
 }
 
 static void
-stuff_changed (GFileMonitor *monitor G_GNUC_UNUSED,
+stuff_changed (GFileMonitor *monitor,
                GFile *file G_GNUC_UNUSED,
                GFile *other_file G_GNUC_UNUSED,
                GFileMonitorEvent event_type,
@@ -197,6 +281,12 @@ stuff_changed (GFileMonitor *monitor G_GNUC_UNUSED,
         FcMonitor *self = FC_MONITOR (data);
         const gchar *event_name = g_enum_to_string (G_TYPE_FILE_MONITOR_EVENT, event_type);
 
+        if (g_object_get_data (G_OBJECT (monitor), MONITOR_CONFIG_KEY))
+                self->config_changed = TRUE;
+        else
+                g_hash_table_add (self->changed_dirs,
+                                  g_strdup (g_object_get_data (G_OBJECT (monitor), MONITOR_PATH_KEY)));
+
         switch (self->state) {
         case UPDATE_IDLE:
                 g_debug ("Got %-38s: starting fontconfig update timeout", event_name);
@@ -229,16 +319,36 @@ start_timeout (FcMonitor *self)
         g_source_set_name_by_id (self->timeout, "[gnome-settings-daemon] update");
 }
 
+static GStrv
+dirs_to_strv (GHashTable *dirs)
+{
+        g_autofree gchar **keys = NULL;
+
+        keys = (gchar **) g_hash_table_get_keys_as_array (dirs, NULL);
+
+        return g_strdupv (keys);
+}
+
 static gboolean
 start_update (gpointer data)
 {
         FcMonitor *self = FC_MONITOR (data);
+        GStrv dirs = NULL;
 
         self->state = UPDATE_RUNNING;
         self->timeout = 0;
 
+        g_clear_pointer (&self->updating_dirs, g_strfreev);
+        if (!self->config_changed) {
+                self->updating_dirs = dirs_to_strv (self->changed_dirs);
+                dirs = g_strdupv (self->updating_dirs);
+        }
+        self->updated_config |= self->config_changed;
+        self->config_changed = FALSE;
+        g_hash_table_remove_all (self->changed_dirs);
+
         g_debug ("Timeout completed: starting fontconfig update");
-        fontconfig_cache_update_async (update_done, g_object_ref (self));
+        fontconfig_cache_update_async (dirs, update_done, g_object_ref (self));
 
         return G_SOURCE_REMOVE;
 }
@@ -255,9 +365,13 @@ update_done (GObject *source_object G_GNUC_UNUSED,
         self->state = UPDATE_IDLE;
 
         if (fontconfig_cache_update_finish (result, &error)) {
+                guint i;
+
                 g_debug ("Fontconfig update successful");
                 /* Remember we had a successful update even if we have to restart it */
                 self->notify = TRUE;
+                for (i = 0; self->updating_dirs && self->updating_dirs[i]; i++)
+                        g_hash_table_add (self->updated_dirs, g_strdup (self->updating_dirs[i]));
         } else if (error) {
                 g_warning ("Fontconfig update failed: %s", error->message);
                 g_error_free (error);
@@ -268,16 +382,23 @@ update_done (GObject *source_object G_GNUC_UNUSED,
                 g_debug ("Concurrent change: restarting fontconfig update timeout");
                 start_timeout (self);
         } else if (self->notify) {
+                g_auto(GStrv) changed_dirs = NULL;
+
                 self->notify = FALSE;
 
-                if (self->monitors) {
-                        fc_monitor_stop (self);
-                        fc_monitor_start (self);
-                }
+                /* NULL tells the listener that the configuration itself
+                 * changed and anything may be different */
+                if (!self->updated_config)
+                        changed_dirs = dirs_to_strv (self->updated_dirs);
+                self->updated_config = FALSE;
+                g_hash_table_remove_all (self->updated_dirs);
+
+                if (self->monitors)
+                        update_monitors (self);
 
                 /* we finish modifying self before emitting the signal,
                  * allowing the callback to stop us if it decides to. */
-                g_signal_emit (self, signals[SIGNAL_UPDATED], 0);
+                g_signal_emit (self, signals[SIGNAL_UPDATED], 0, changed_dirs);
         }
 
         /* release ref taken in start_update */
@@ -286,8 +407,13 @@ update_done (GObject *source_object G_GNUC_UNUSED,
 
 #ifdef FONTCONFIG_MONITOR_TEST
 static void
-yay (void)
+yay (FcMonitor *monitor,
+     GStrv      changed_dirs)
 {
+        guint i;
+
+        for (i = 0; changed_dirs && changed_dirs[i]; i++)
+                g_message ("changed: %s", changed_dirs[i]);
         g_message ("yay");
 }
 
@@ -44,168 +44,205 @@ struct _GsdXSettingsGtk {
 
         GSettings         *settings;
 
-        guint64            dir_mtime;
+        /* file name -> ModuleInfo, for every file in the modules directory */
+        GHashTable        *module_infos;
+        /* schema id -> GSettings, shared by all modules enabled by a key in it */
+        GHashTable        *cond_settings;
         GFileMonitor      *monitor;
-        GList             *cond_settings;
 };
 
+/* What a .desktop or .gtk-module file says, as of its last modification.
+ * module_name is NULL for files that don't describe a GTK module. */
+typedef struct {
+        gint64  mtime;
+        char   *module_name;
+        char   *schema;
+        char   *key;
+} ModuleInfo;
+
 G_DEFINE_TYPE(GsdXSettingsGtk, gsd_xsettings_gtk, G_TYPE_OBJECT)
 
 static void update_gtk_modules (GsdXSettingsGtk *gtk);
 
 static void
-empty_cond_settings_list (GsdXSettingsGtk *gtk)
+module_info_free (ModuleInfo *info)
 {
-        if (gtk->cond_settings == NULL)
-                return;
+        g_free (info->module_name);
+        g_free (info->schema);
+        g_free (info->key);
+        g_free (info);
+}
+
+static ModuleInfo *
+process_desktop_file (const char *path,
+                      gint64      mtime)
+{
+        GKeyFile *keyfile;
+        ModuleInfo *info;
+
+        info = g_new0 (ModuleInfo, 1);
+        info->mtime = mtime;
+
+        keyfile = g_key_file_new ();
+        if (g_key_file_load_from_file (keyfile, path, G_KEY_FILE_NONE, NULL) == FALSE)
+                goto bail;
+
+        if (g_key_file_has_group (keyfile, "GTK Module") == FALSE)
+                goto bail;
+
+        info->module_name = g_key_file_get_string (keyfile, "GTK Module", "X-GTK-Module-Name", NULL);
+        if (info->module_name == NULL)
+                goto bail;
+
+        if (g_key_file_has_key (keyfile, "GTK Module", "X-GTK-Module-Enabled-Schema", NULL) != FALSE) {
+                info->schema = g_key_file_get_string (keyfile, "GTK Module", "X-GTK-Module-Enabled-Schema", NULL);
+                info->key = g_key_file_get_string (keyfile, "GTK Module", "X-GTK-Module-Enabled-Key", NULL);
+        }
 
-        /* Empty the list of settings */
-        g_list_foreach (gtk->cond_settings, (GFunc) g_object_unref, NULL);
-        g_list_free (gtk->cond_settings);
-        gtk->cond_settings = NULL;
+bail:
+        g_key_file_free (keyfile);
+        return info;
 }
 
+static void update_dir_modules (GsdXSettingsGtk *gtk);
+
 static void
 cond_setting_changed (GSettings       *settings,
                       const char      *key,
                       GsdXSettingsGtk *gtk)
 {
-        gboolean enabled;
-        const char *module_name;
-
-        module_name = g_object_get_data (G_OBJECT (settings), "module-name");
-
-        enabled = g_settings_get_boolean (settings, key);
-        if (enabled != FALSE) {
-                if (gtk->dir_modules == NULL)
-                        gtk->dir_modules = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
-                g_hash_table_insert (gtk->dir_modules, g_strdup (module_name), NULL);
-        } else if (gtk->dir_modules != NULL) {
-                g_hash_table_remove (gtk->dir_modules, module_name);
-        }
-
+        update_dir_modules (gtk);
         update_gtk_modules (gtk);
 }
 
-static char *
-process_desktop_file (const char      *path,
-                      GsdXSettingsGtk *gtk)
+static GSettings *
+get_cond_settings (GsdXSettingsGtk *gtk,
+                   const char      *schema)
 {
-        GKeyFile *keyfile;
-        char *retval;
-        char *module_name;
+        GSettings *settings;
 
-        retval = NULL;
+        settings = g_hash_table_lookup (gtk->cond_settings, schema);
+        if (settings == NULL) {
+                settings = g_settings_new (schema);
+                g_signal_connect_object (G_OBJECT (settings), "changed",
+                                         G_CALLBACK (cond_setting_changed), gtk, 0);
+                g_hash_table_insert (gtk->cond_settings, g_strdup (schema), settings);
+        }
 
-        if (g_str_has_suffix (path, ".desktop") == FALSE &&
-            g_str_has_suffix (path, ".gtk-module") == FALSE)
-                return retval;
+        return settings;
+}
 
-        keyfile = g_key_file_new ();
-        if (g_key_file_load_from_file (keyfile, path, G_KEY_FILE_NONE, NULL) == FALSE)
-                goto bail;
+/* Rebuilds dir_modules from the cached module infos, without any I/O,
+ * and drops the GSettings of schemas no module refers to anymore. */
+static void
+update_dir_modules (GsdXSettingsGtk *gtk)
+{
+        g_autoptr(GHashTable) used_schemas = NULL;
+        GHashTableIter iter;
+        gpointer value;
 
-        if (g_key_file_has_group (keyfile, "GTK Module") == FALSE)
-                goto bail;
+        if (gtk->dir_modules != NULL)
+                g_hash_table_remove_all (gtk->dir_modules);
+        else
+                gtk->dir_modules = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 
-        module_name = g_key_file_get_string (keyfile, "GTK Module", "X-GTK-Module-Name", NULL);
-        if (module_name == NULL)
-                goto bail;
+        used_schemas = g_hash_table_new (g_str_hash, g_str_equal);
 
-        if (g_key_file_has_key (keyfile, "GTK Module", "X-GTK-Module-Enabled-Schema", NULL) != FALSE) {
-                char *schema;
-                char *key;
-                gboolean enabled;
-                GSettings *settings;
-                char *signal;
+        g_hash_table_iter_init (&iter, gtk->module_infos);
+        while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                ModuleInfo *info = value;
 
-                schema = g_key_file_get_string (keyfile, "GTK Module", "X-GTK-Module-Enabled-Schema", NULL);
-                key = g_key_file_get_string (keyfile, "GTK Module", "X-GTK-Module-Enabled-Key", NULL);
+                if (info->module_name == NULL)
+                        continue;
 
-                settings = g_settings_new (schema);
+                if (info->schema != NULL) {
+                        GSettings *settings;
 
-                gtk->cond_settings = g_list_prepend (gtk->cond_settings, settings);
+                        settings = get_cond_settings (gtk, info->schema);
+                        g_hash_table_add (used_schemas, info->schema);
 
-                g_object_set_data_full (G_OBJECT (settings), "module-name", g_strdup (module_name), (GDestroyNotify) g_free);
+                        if (g_settings_get_boolean (settings, info->key) == FALSE)
+                                continue;
+                }
 
-                signal = g_strdup_printf ("changed::%s", key);
-                g_signal_connect_object (G_OBJECT (settings), signal, G_CALLBACK (cond_setting_changed), gtk, 0);
-                enabled = g_settings_get_boolean (settings, key);
-                g_free (signal);
-                g_free (schema);
-                g_free (key);
+                g_hash_table_add (gtk->dir_modules, g_strdup (info->module_name));
+        }
 
-                if (enabled != FALSE)
-                        retval = g_strdup (module_name);
-        } else {
-                retval = g_strdup (module_name);
+        g_hash_table_iter_init (&iter, gtk->cond_settings);
+        while (g_hash_table_iter_next (&iter, &value, NULL)) {
+                if (!g_hash_table_contains (used_schemas, value))
+                        g_hash_table_iter_remove (&iter);
+        }
+}
+
+/* Updates the cached info for @name, re-parsing it only if it changed
+ * since it was last read. */
+static void
+update_module_info (GsdXSettingsGtk *gtk,
+                    const char      *name)
+{
+        g_autofree char *path = NULL;
+        g_autoptr(GFile) file = NULL;
+        g_autoptr(GFileInfo) file_info = NULL;
+        ModuleInfo *info;
+        gint64 mtime;
+
+        if (g_str_has_suffix (name, ".desktop") == FALSE &&
+            g_str_has_suffix (name, ".gtk-module") == FALSE)
+                return;
+
+        path = g_build_filename (modules_path, name, NULL);
+        file = g_file_new_for_path (path);
+        file_info = g_file_query_info (file,
+                                       G_FILE_ATTRIBUTE_TIME_MODIFIED ","
+                                       G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC,
+                                       G_FILE_QUERY_INFO_NONE,
+                                       NULL,
+                                       NULL);
+        if (file_info == NULL) {
+                g_hash_table_remove (gtk->module_infos, name);
+                return;
         }
 
-	g_free (module_name);
+        mtime = g_file_info_get_attribute_uint64 (file_info, G_FILE_ATTRIBUTE_TIME_MODIFIED) * G_USEC_PER_SEC +
+                g_file_info_get_attribute_uint32 (file_info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
 
-bail:
-        g_key_file_free (keyfile);
-        return retval;
+        info = g_hash_table_lookup (gtk->module_infos, name);
+        if (info != NULL && info->mtime == mtime)
+                return;
+
+        g_debug ("Reading GTK module file %s", path);
+        g_hash_table_insert (gtk->module_infos, g_strdup (name), process_desktop_file (path, mtime));
 }
 
 static void
 get_gtk_modules_from_dir (GsdXSettingsGtk *gtk)
 {
-        GFile *file;
-        GFileInfo *info;
-        GHashTable *ht;
+        g_autoptr(GHashTable) seen = NULL;
+        GHashTableIter iter;
+        gpointer name;
+        GDir *dir;
 
-        file = g_file_new_for_path (modules_path);
-        info = g_file_query_info (file,
-                                  G_FILE_ATTRIBUTE_TIME_MODIFIED,
-                                  G_FILE_QUERY_INFO_NONE,
-                                  NULL,
-                                  NULL);
-        if (info != NULL) {
-                guint64 dir_mtime;
-
-                dir_mtime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
-                if (gtk->dir_mtime == 0 ||
-                    dir_mtime > gtk->dir_mtime) {
-                        GDir *dir;
-                        const char *name;
-
-                        empty_cond_settings_list (gtk);
-
-                        gtk->dir_mtime = dir_mtime;
-
-                        if (gtk->dir_modules != NULL) {
-                                g_hash_table_destroy (gtk->dir_modules);
-                                gtk->dir_modules = NULL;
-                        }
-
-                        dir = g_dir_open (modules_path, 0, NULL);
-                        if (dir == NULL)
-                                goto bail;
-
-                        ht = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
-
-                        while ((name = g_dir_read_name (dir)) != NULL) {
-                                char *path;
-                                char *module;
-
-                                path = g_build_filename (modules_path, name, NULL);
-                                module = process_desktop_file (path, gtk);
-                                if (module != NULL)
-                                        g_hash_table_insert (ht, module, NULL);
-                                g_free (path);
-                        }
-                        g_dir_close (dir);
-
-                        gtk->dir_modules = ht;
+        seen = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+        dir = g_dir_open (modules_path, 0, NULL);
+        if (dir != NULL) {
+                const char *entry;
+
+                while ((entry = g_dir_read_name (dir)) != NULL) {
+                        update_module_info (gtk, entry);
+                        g_hash_table_add (seen, g_strdup (entry));
                 }
-                g_object_unref (info);
-        } else {
-                empty_cond_settings_list (gtk);
+                g_dir_close (dir);
         }
 
-bail:
-        g_object_unref (file);
+        g_hash_table_iter_init (&iter, gtk->module_infos);
+        while (g_hash_table_iter_next (&iter, &name, NULL)) {
+                if (!g_hash_table_contains (seen, name))
+                        g_hash_table_iter_remove (&iter);
+        }
+
+        update_dir_modules (gtk);
 }
 
 static void
@@ -275,7 +312,25 @@ gtk_modules_dir_changed_cb (GFileMonitor     *monitor,
                             GFileMonitorEvent event_type,
                             GsdXSettingsGtk  *gtk)
 {
-        get_gtk_modules_from_dir (gtk);
+        g_autoptr(GFile) dir = NULL;
+
+        dir = g_file_new_for_path (modules_path);
+
+        /* Most events are about a single file in the directory, and only
+         * that file needs to be looked at again */
+        if (file != NULL && g_file_has_parent (file, dir)) {
+                g_autofree char *name = g_file_get_basename (file);
+
+                update_module_info (gtk, name);
+                if (other_file != NULL) {
+                        g_autofree char *other_name = g_file_get_basename (other_file);
+                        update_module_info (gtk, other_name);
+                }
+                update_dir_modules (gtk);
+        } else {
+                get_gtk_modules_from_dir (gtk);
+        }
+
         update_gtk_modules (gtk);
 }
 
@@ -287,6 +342,10 @@ gsd_xsettings_gtk_init (GsdXSettingsGtk *gtk)
         g_debug ("GsdXSettingsGtk initializing");
 
         gtk->settings = g_settings_new (XSETTINGS_PLUGIN_SCHEMA);
+        gtk->module_infos = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                   g_free, (GDestroyNotify) module_info_free);
+        gtk->cond_settings = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                    g_free, g_object_unref);
 
         modules_path = g_getenv ("GSD_gtk_modules_dir");
         if (modules_path == NULL)
@@ -333,7 +392,8 @@ gsd_xsettings_gtk_finalize (GObject *object)
         if (gtk->monitor != NULL)
                 g_object_unref (gtk->monitor);
 
-        empty_cond_settings_list (gtk);
+        g_clear_pointer (&gtk->module_infos, g_hash_table_unref);
+        g_clear_pointer (&gtk->cond_settings, g_hash_table_unref);
 
         G_OBJECT_CLASS (gsd_xsettings_gtk_parent_class)->finalize (object);
 }
@@ -83,6 +83,7 @@ static const gchar introspection_xml[] =
 "<node name='/org/gtk/Settings'>"
 "  <interface name='org.gtk.Settings'>"
 "    <property name='FontconfigTimestamp' type='x' access='read'/>"
+"    <property name='FontconfigChangedDirectories' type='as' access='read'/>"
 "    <property name='Modules' type='s' access='read'/>"
 "    <property name='EnableAnimations' type='b' access='read'/>"
 "  </interface>"
@@ -242,7 +243,11 @@ static const gchar introspection_xml[] =
  */
 #define DPI_FALLBACK 96
 
+/* How long the first settings snapshot may wait for the UI scaling factor */
+#define WINDOW_SCALE_TIMEOUT_MS 1000
+
 typedef struct _TranslationEntry TranslationEntry;
+typedef struct _XwaylandScripts XwaylandScripts;
 typedef void (* TranslationFunc) (GsdXSettingsManager *manager,
                                   TranslationEntry    *trans,
                                   GVariant            *value);
@@ -282,6 +287,7 @@ struct _GsdXSettingsManager
         GSettings         *plugin_settings;
         FcMonitor         *fontconfig_monitor;
         gint64             fontconfig_timestamp;
+        GStrv              fontconfig_changed_dirs;
 
         GSettings         *interface_settings;
 
@@ -299,6 +305,16 @@ struct _GsdXSettingsManager
 
         guint              notify_idle_id;
 
+        XwaylandScripts   *xwayland_scripts;
+
+        /* Startup */
+        GCancellable      *cancellable;
+        gint64             startup_time;
+        GHashTable        *startup_phases;
+        gboolean           have_window_scale;
+        guint              window_scale_timeout_id;
+        int                window_scale;
+
         GDBusNodeInfo     *introspection_data;
         guint              gtk_settings_name_id;
 };
@@ -409,35 +425,55 @@ fixed_true_int (GsdXSettingsManager *manager,
         xsettings_manager_set_int (manager->manager, fixed->xsetting_name, TRUE);
 }
 
+static void queue_notify (GsdXSettingsManager *manager);
+static void log_startup_phase (GsdXSettingsManager *manager,
+                               const char          *phase);
+
 static void
-fixed_bus_id (GsdXSettingsManager *manager,
-              FixedEntry          *fixed)
+got_bus_id (GObject      *source_object,
+            GAsyncResult *res,
+            gpointer      user_data)
 {
+        GsdXSettingsManager *manager;
+        g_autoptr(GVariant) variant = NULL;
+        g_autoptr(GError) error = NULL;
         const gchar *id;
-        GDBusConnection *bus;
-        GVariant *res;
-
-        bus = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, NULL);
-        res = g_dbus_connection_call_sync (bus,
-                                           "org.freedesktop.DBus",
-                                           "/org/freedesktop/DBus",
-                                           "org.freedesktop.DBus",
-                                           "GetId",
-                                           NULL,
-                                           NULL,
-                                           G_DBUS_CALL_FLAGS_NONE,
-                                           -1,
-                                           NULL,
-                                           NULL);
-
-        if (res) {
-                g_variant_get (res, "(&s)", &id);
 
-                xsettings_manager_set_string (manager->manager, fixed->xsetting_name, id);
-                g_variant_unref (res);
+        variant = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object), res, &error);
+        if (variant == NULL) {
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        g_warning ("Failed to get session bus id: %s", error->message);
+                return;
         }
 
-        g_object_unref (bus);
+        manager = GSD_XSETTINGS_MANAGER (user_data);
+        log_startup_phase (manager, "session bus id");
+
+        g_variant_get (variant, "(&s)", &id);
+        xsettings_manager_set_string (manager->manager, "Gtk/SessionBusId", id);
+        queue_notify (manager);
+}
+
+/* Nothing depends on the bus id, so it is filled in once known rather
+ * than holding back the first snapshot */
+static void
+fixed_bus_id (GsdXSettingsManager *manager,
+              FixedEntry          *fixed)
+{
+        GDBusConnection *connection = g_application_get_dbus_connection (G_APPLICATION (manager));
+
+        g_dbus_connection_call (connection,
+                                "org.freedesktop.DBus",
+                                "/org/freedesktop/DBus",
+                                "org.freedesktop.DBus",
+                                "GetId",
+                                NULL,
+                                G_VARIANT_TYPE ("(s)"),
+                                G_DBUS_CALL_FLAGS_NONE,
+                                -1,
+                                manager->cancellable,
+                                got_bus_id,
+                                manager);
 }
 
 static void
@@ -514,6 +550,22 @@ static TranslationEntry translations [] = {
         { "org.gnome.desktop.a11y.interface", "show-status-shapes",       "Gtk/ShowStatusShapes", translate_bool_int }
 };
 
+/* Only the first occurrence of each phase is logged, later calls are
+ * for changes after startup */
+static void
+log_startup_phase (GsdXSettingsManager *manager,
+                   const char          *phase)
+{
+        if (manager->startup_phases == NULL)
+                return;
+
+        if (!g_hash_table_add (manager->startup_phases, (gpointer) phase))
+                return;
+
+        g_debug ("Startup: %s after %" G_GINT64_FORMAT " ms", phase,
+                 (g_get_monotonic_time () - manager->startup_time) / 1000);
+}
+
 static gboolean
 notify_idle (gpointer data)
 {
@@ -521,6 +573,8 @@ notify_idle (gpointer data)
 
         xsettings_manager_notify (manager->manager);
 
+        log_startup_phase (manager, "first settings published");
+
         manager->notify_idle_id = 0;
         return G_SOURCE_REMOVE;
 }
@@ -531,6 +585,11 @@ queue_notify (GsdXSettingsManager *manager)
         if (manager->notify_idle_id != 0)
                 return;
 
+        /* The window scale affects the DPI and cursor size, so don't
+         * publish values that would change right away */
+        if (!manager->have_window_scale)
+                return;
+
         manager->notify_idle_id = g_idle_add (notify_idle, manager);
         g_source_set_name_by_id (manager->notify_idle_id, "[gnome-settings-daemon] notify_idle");
 }
@@ -541,6 +600,17 @@ typedef enum {
         GTK_SETTINGS_ENABLE_ANIMATIONS    = 1 << 2
 } GtkSettingsMask;
 
+/* Empty when the fontconfig configuration changed, so that clients
+ * can't limit what they reload */
+static GVariant *
+get_fontconfig_changed_dirs (GsdXSettingsManager *manager)
+{
+        if (manager->fontconfig_changed_dirs == NULL)
+                return g_variant_new_strv (NULL, 0);
+
+        return g_variant_new_strv ((const gchar * const *) manager->fontconfig_changed_dirs, -1);
+}
+
 static void
 send_dbus_event (GsdXSettingsManager *manager,
                  GtkSettingsMask      mask)
@@ -554,6 +624,8 @@ send_dbus_event (GsdXSettingsManager *manager,
         if (mask & GTK_SETTINGS_FONTCONFIG_TIMESTAMP) {
                 g_variant_builder_add (&props_builder, "{sv}", "FontconfigTimestamp",
                                        g_variant_new_int64 (manager->fontconfig_timestamp));
+                g_variant_builder_add (&props_builder, "{sv}", "FontconfigChangedDirectories",
+                                       get_fontconfig_changed_dirs (manager));
         }
 
         if (mask & GTK_SETTINGS_MODULES) {
@@ -597,36 +669,89 @@ get_dpi_from_gsettings (GsdXSettingsManager *manager)
 static int
 get_window_scale (GsdXSettingsManager *manager)
 {
-        GDBusConnection *connection = g_application_get_dbus_connection (G_APPLICATION (manager));
+        return manager->window_scale;
+}
+
+static void update_xft_settings (GsdXSettingsManager *manager);
+
+static void
+set_window_scale (GsdXSettingsManager *manager,
+                  int                  window_scale)
+{
+        gboolean first = !manager->have_window_scale;
+
+        g_clear_handle_id (&manager->window_scale_timeout_id, g_source_remove);
+        manager->have_window_scale = TRUE;
+
+        if (window_scale == manager->window_scale && !first)
+                return;
+
+        manager->window_scale = window_scale;
+        update_xft_settings (manager);
+        queue_notify (manager);
+}
+
+static void
+got_window_scale (GObject      *source_object,
+                  GAsyncResult *res,
+                  gpointer      user_data)
+{
+        GsdXSettingsManager *manager;
         g_autoptr(GError) error = NULL;
-        g_autoptr(GVariant) res = NULL;
+        g_autoptr(GVariant) variant = NULL;
         g_autoptr(GVariant) ui_scaling_factor_variant = NULL;
-        g_autoptr(GVariantIter) properties = NULL;
         int ui_scaling_factor = 1;
 
-        res = g_dbus_connection_call_sync (connection,
-                                           "org.gnome.Mutter.X11",
-                                           "/org/gnome/Mutter/X11",
-                                           "org.freedesktop.DBus.Properties",
-                                           "Get",
-                                           g_variant_new ("(ss)",
-                                                          "org.gnome.Mutter.X11",
-                                                          "UiScalingFactor"),
-                                           NULL,
-                                           G_DBUS_CALL_FLAGS_NO_AUTO_START,
-                                           -1,
-                                           NULL,
-                                           &error);
-        if (!res) {
+        variant = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object), res, &error);
+        if (variant == NULL && g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                return;
+
+        manager = GSD_XSETTINGS_MANAGER (user_data);
+        log_startup_phase (manager, "window scale");
+
+        if (variant == NULL) {
                 g_warning ("Failed to get current UI scaling factor: %s",
                            error->message);
-                return 1;
+        } else {
+                g_variant_get (variant, "(v)", &ui_scaling_factor_variant);
+                g_variant_get (ui_scaling_factor_variant, "i", &ui_scaling_factor);
         }
 
-        g_variant_get (res, "(v)", &ui_scaling_factor_variant);
-        g_variant_get (ui_scaling_factor_variant, "i", &ui_scaling_factor);
+        set_window_scale (manager, ui_scaling_factor);
+}
+
+static void
+query_window_scale (GsdXSettingsManager *manager)
+{
+        GDBusConnection *connection = g_application_get_dbus_connection (G_APPLICATION (manager));
+
+        g_dbus_connection_call (connection,
+                                "org.gnome.Mutter.X11",
+                                "/org/gnome/Mutter/X11",
+                                "org.freedesktop.DBus.Properties",
+                                "Get",
+                                g_variant_new ("(ss)",
+                                               "org.gnome.Mutter.X11",
+                                               "UiScalingFactor"),
+                                G_VARIANT_TYPE ("(v)"),
+                                G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                                -1,
+                                manager->cancellable,
+                                got_window_scale,
+                                manager);
+}
+
+static gboolean
+window_scale_timeout_cb (gpointer user_data)
+{
+        GsdXSettingsManager *manager = user_data;
 
-        return ui_scaling_factor;
+        manager->window_scale_timeout_id = 0;
+
+        g_warning ("Timed out waiting for the UI scaling factor, publishing settings without it");
+        set_window_scale (manager, manager->window_scale);
+
+        return G_SOURCE_REMOVE;
 }
 
 typedef struct {
@@ -898,6 +1023,7 @@ gtk_modules_callback (GsdXSettingsGtk     *gtk,
 
 static void
 fontconfig_callback (FcMonitor            *monitor,
+                     GStrv                 changed_dirs,
                      GsdXSettingsManager  *manager)
 {
         gint64 timestamp = g_get_real_time ();
@@ -908,6 +1034,8 @@ fontconfig_callback (FcMonitor            *monitor,
         xsettings_manager_set_int (manager->manager, "Fontconfig/Timestamp", timestamp_sec);
 
         manager->fontconfig_timestamp = timestamp;
+        g_strfreev (manager->fontconfig_changed_dirs);
+        manager->fontconfig_changed_dirs = g_strdupv (changed_dirs);
 
         queue_notify (manager);
         send_dbus_event (manager, GTK_SETTINGS_FONTCONFIG_TIMESTAMP);
@@ -950,51 +1078,95 @@ process_value (GsdXSettingsManager *manager,
         (* trans->translate) (manager, trans, value);
 }
 
+/* Keys whose changes are not a plain translation; only compared by address */
+static TranslationEntry xft_entry;
+static TranslationEntry high_contrast_entry;
+
+static const char *xft_keys[] = {
+        TEXT_SCALING_FACTOR_KEY,
+        FONT_ANTIALIASING_KEY,
+        FONT_HINTING_KEY,
+        FONT_RGBA_ORDER_KEY,
+        CURSOR_SIZE_KEY,
+        CURSOR_THEME_KEY,
+        NULL
+};
+
+G_DEFINE_QUARK (gsd-xsettings-translation-index, translation_index)
+
 static TranslationEntry *
-find_translation_entry (GSettings *settings, const char *key)
+find_translation_entry (const char *schema, const char *key)
 {
         guint i;
-        char *schema;
 
-        g_object_get (settings, "schema-id", &schema, NULL);
+        if (g_str_equal (key, HIGH_CONTRAST_KEY))
+                return &high_contrast_entry;
 
-        if (g_str_equal (schema, CLASSIC_WM_SETTINGS_SCHEMA)) {
-              g_free (schema);
-              schema = g_strdup (WM_SETTINGS_SCHEMA);
-        }
+        if (g_strv_contains (xft_keys, key))
+                return &xft_entry;
+
+        if (g_str_equal (schema, CLASSIC_WM_SETTINGS_SCHEMA))
+                schema = WM_SETTINGS_SCHEMA;
 
         for (i = 0; i < G_N_ELEMENTS (translations); i++) {
                 if (g_str_equal (schema, translations[i].gsettings_schema) &&
-                    g_str_equal (key, translations[i].gsettings_key)) {
-                            g_free (schema);
+                    g_str_equal (key, translations[i].gsettings_key))
                         return &translations[i];
-                }
         }
 
-        g_free (schema);
-
         return NULL;
 }
 
+/* Resolves every key of @settings' schema to its entry once, so that
+ * change notifications are a single hash lookup on the key, without
+ * querying the schema id or scanning the translation table. */
+static void
+index_translations (GSettings *settings)
+{
+        g_autoptr(GSettingsSchema) schema = NULL;
+        g_auto(GStrv) keys = NULL;
+        GHashTable *index;
+        const char *schema_id;
+        guint i;
+
+        g_object_get (settings, "settings-schema", &schema, NULL);
+        schema_id = g_settings_schema_get_id (schema);
+        keys = g_settings_schema_list_keys (schema);
+
+        index = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+        for (i = 0; keys[i] != NULL; i++) {
+                TranslationEntry *trans;
+
+                trans = find_translation_entry (schema_id, keys[i]);
+                if (trans != NULL)
+                        g_hash_table_insert (index, g_steal_pointer (&keys[i]), trans);
+        }
+
+        g_object_set_qdata_full (G_OBJECT (settings), translation_index_quark (),
+                                 index, (GDestroyNotify) g_hash_table_unref);
+}
+
 static void
 xsettings_callback (GSettings           *settings,
                     const char          *key,
                     GsdXSettingsManager *manager)
 {
         TranslationEntry *trans;
+        GHashTable       *index;
         GVariant         *value;
 
-        if (g_str_equal (key, TEXT_SCALING_FACTOR_KEY) ||
-            g_str_equal (key, FONT_ANTIALIASING_KEY) ||
-            g_str_equal (key, FONT_HINTING_KEY) ||
-            g_str_equal (key, FONT_RGBA_ORDER_KEY) ||
-            g_str_equal (key, CURSOR_SIZE_KEY) ||
-            g_str_equal (key, CURSOR_THEME_KEY)) {
+        index = g_object_get_qdata (G_OBJECT (settings), translation_index_quark ());
+        trans = g_hash_table_lookup (index, key);
+        if (trans == NULL) {
+                return;
+        }
+
+        if (trans == &xft_entry) {
         	xft_callback (NULL, key, manager);
         	return;
 	}
 
-        if (g_str_equal (key, HIGH_CONTRAST_KEY)) {
+        if (trans == &high_contrast_entry) {
                 GSettings *iface_settings;
 
                 iface_settings = g_hash_table_lookup (manager->settings,
@@ -1003,11 +1175,6 @@ xsettings_callback (GSettings           *settings,
                 return;
         }
 
-        trans = find_translation_entry (settings, key);
-        if (trans == NULL) {
-                return;
-        }
-
         value = g_settings_get_value (settings, key);
 
         process_value (manager, trans, value);
@@ -1051,13 +1218,6 @@ setup_xsettings_managers (GsdXSettingsManager *manager)
         return TRUE;
 }
 
-static void
-ui_scaling_factor_changed (GsdXSettingsManager *manager)
-{
-        update_xft_settings (manager);
-        queue_notify (manager);
-}
-
 static void
 on_mutter_x11_properties_changed (GDBusConnection *connection,
                                   const gchar     *sender_name,
@@ -1068,8 +1228,14 @@ on_mutter_x11_properties_changed (GDBusConnection *connection,
                                   gpointer         data)
 {
         GsdXSettingsManager *manager = data;
+        g_autoptr(GVariant) changed = NULL;
+        int ui_scaling_factor;
 
-        ui_scaling_factor_changed (manager);
+        g_variant_get (parameters, "(s@a{sv}as)", NULL, &changed, NULL);
+        if (g_variant_lookup (changed, "UiScalingFactor", "i", &ui_scaling_factor))
+                set_window_scale (manager, ui_scaling_factor);
+        else
+                query_window_scale (manager);
 }
 
 static void
@@ -1080,38 +1246,46 @@ on_mutter_x11_name_appeared_handler (GDBusConnection *connection,
 {
         GsdXSettingsManager *manager = data;
 
-        ui_scaling_factor_changed (manager);
+        query_window_scale (manager);
 }
 
 static void
-animations_enabled_changed (GsdXSettingsManager *manager)
+on_mutter_x11_name_vanished_handler (GDBusConnection *connection,
+                                     const gchar     *name,
+                                     gpointer         data)
 {
-        GDBusConnection *connection = g_application_get_dbus_connection (G_APPLICATION (manager));
+        GsdXSettingsManager *manager = data;
+
+        /* Nothing to wait for */
+        if (!manager->have_window_scale) {
+                log_startup_phase (manager, "no window scale provider");
+                set_window_scale (manager, manager->window_scale);
+        }
+}
+
+static void
+got_animations_enabled (GObject      *source_object,
+                        GAsyncResult *res,
+                        gpointer      user_data)
+{
+        GsdXSettingsManager *manager;
         g_autoptr(GError) error = NULL;
-        g_autoptr(GVariant) res = NULL;
+        g_autoptr(GVariant) variant = NULL;
         g_autoptr(GVariant) animations_enabled_variant = NULL;
         gboolean animations_enabled;
 
-        res = g_dbus_connection_call_sync (connection,
-                                           "org.gnome.Shell.Introspect",
-                                           "/org/gnome/Shell/Introspect",
-                                           "org.freedesktop.DBus.Properties",
-                                           "Get",
-                                           g_variant_new ("(ss)",
-                                                          "org.gnome.Shell.Introspect",
-                                                          "AnimationsEnabled"),
-                                           NULL,
-                                           G_DBUS_CALL_FLAGS_NONE,
-                                           -1,
-                                           NULL,
-                                           &error);
-        if (!res) {
-                g_warning ("Failed to get animations-enabled state: %s",
-                           error->message);
+        variant = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object), res, &error);
+        if (variant == NULL) {
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        g_warning ("Failed to get animations-enabled state: %s",
+                                   error->message);
                 return;
         }
 
-        g_variant_get (res, "(v)", &animations_enabled_variant);
+        manager = GSD_XSETTINGS_MANAGER (user_data);
+        log_startup_phase (manager, "animations state");
+
+        g_variant_get (variant, "(v)", &animations_enabled_variant);
         g_variant_get (animations_enabled_variant, "b", &animations_enabled);
 
         if (manager->enable_animations == animations_enabled)
@@ -1124,6 +1298,27 @@ animations_enabled_changed (GsdXSettingsManager *manager)
         send_dbus_event (manager, GTK_SETTINGS_ENABLE_ANIMATIONS);
 }
 
+static void
+animations_enabled_changed (GsdXSettingsManager *manager)
+{
+        GDBusConnection *connection = g_application_get_dbus_connection (G_APPLICATION (manager));
+
+        g_dbus_connection_call (connection,
+                                "org.gnome.Shell.Introspect",
+                                "/org/gnome/Shell/Introspect",
+                                "org.freedesktop.DBus.Properties",
+                                "Get",
+                                g_variant_new ("(ss)",
+                                               "org.gnome.Shell.Introspect",
+                                               "AnimationsEnabled"),
+                                G_VARIANT_TYPE ("(v)"),
+                                G_DBUS_CALL_FLAGS_NONE,
+                                -1,
+                                manager->cancellable,
+                                got_animations_enabled,
+                                manager);
+}
+
 static void
 on_introspect_properties_changed (GDBusConnection *connection,
                                   const gchar     *sender_name,
@@ -1147,15 +1342,201 @@ on_shell_introspect_name_appeared_handler (GDBusConnection *connection,
         animations_enabled_changed (manager);
 }
 
+/* Xwayland startup scripts run concurrently, except that a script only
+ * starts once all scripts before it in the same directory with a smaller
+ * numeric prefix have finished. "10-foo" and "10-bar" run in parallel,
+ * "20-baz" waits for both; scripts without a prefix form one last batch.
+ */
+#define XWAYLAND_SCRIPT_TIMEOUT_MS 5000
+#define XWAYLAND_SCRIPTS_BUDGET_MS 15000
+
+typedef struct {
+        GsdXSettingsManager *manager;
+        char                *path;
+        GSubprocess         *subprocess;
+        gint64               start_time;
+        guint                timeout_id;
+} XwaylandScript;
+
+struct _XwaylandScripts {
+        GCancellable *cancellable;
+        /* Batches of XwaylandScript, in the order they have to run */
+        GQueue        batches;
+        GPtrArray    *running;
+        gint64        start_time;
+        guint         budget_timeout_id;
+};
+
+static void run_next_xwayland_batch (XwaylandScripts *scripts);
+
+static void
+xwayland_script_free (XwaylandScript *script)
+{
+        g_clear_handle_id (&script->timeout_id, g_source_remove);
+        g_clear_object (&script->subprocess);
+        g_free (script->path);
+        g_free (script);
+}
+
+static void
+xwayland_scripts_free (XwaylandScripts *scripts)
+{
+        guint i;
+
+        g_cancellable_cancel (scripts->cancellable);
+        g_clear_object (&scripts->cancellable);
+        g_clear_handle_id (&scripts->budget_timeout_id, g_source_remove);
+
+        for (i = 0; i < scripts->running->len; i++) {
+                XwaylandScript *script = g_ptr_array_index (scripts->running, i);
+
+                g_subprocess_force_exit (script->subprocess);
+        }
+        g_ptr_array_unref (scripts->running);
+
+        g_queue_clear_full (&scripts->batches, (GDestroyNotify) g_ptr_array_unref);
+        g_free (scripts);
+}
+
+static gboolean
+xwayland_script_timeout_cb (gpointer user_data)
+{
+        XwaylandScript *script = user_data;
+
+        script->timeout_id = 0;
+
+        g_warning ("Xwayland startup script '%s' did not finish within %d ms, killing it",
+                   script->path, XWAYLAND_SCRIPT_TIMEOUT_MS);
+        g_subprocess_force_exit (script->subprocess);
+
+        return G_SOURCE_REMOVE;
+}
+
+static gboolean
+xwayland_scripts_budget_cb (gpointer user_data)
+{
+        XwaylandScripts *scripts = user_data;
+        guint i;
+
+        scripts->budget_timeout_id = 0;
+
+        g_warning ("Xwayland startup scripts did not finish within %d ms, skipping %u remaining batches",
+                   XWAYLAND_SCRIPTS_BUDGET_MS, g_queue_get_length (&scripts->batches));
+
+        g_queue_clear_full (&scripts->batches, (GDestroyNotify) g_ptr_array_unref);
+        for (i = 0; i < scripts->running->len; i++) {
+                XwaylandScript *script = g_ptr_array_index (scripts->running, i);
+
+                g_subprocess_force_exit (script->subprocess);
+        }
+
+        return G_SOURCE_REMOVE;
+}
+
+static void
+xwayland_script_done (GObject      *source_object,
+                      GAsyncResult *res,
+                      gpointer      user_data)
+{
+        XwaylandScript *script = user_data;
+        XwaylandScripts *scripts;
+        g_autoptr(GError) error = NULL;
+
+        if (!g_subprocess_wait_finish (G_SUBPROCESS (source_object), res, &error)) {
+                /* Shutting down, the scripts have been freed */
+                if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        return;
+                g_warning ("Failed to wait for '%s': %s", script->path, error->message);
+        }
+
+        scripts = script->manager->xwayland_scripts;
+
+        g_debug ("Xwayland startup script '%s' finished after %" G_GINT64_FORMAT " ms",
+                 script->path, (g_get_monotonic_time () - script->start_time) / 1000);
+
+        g_ptr_array_remove (scripts->running, script);
+        if (scripts->running->len == 0)
+                run_next_xwayland_batch (scripts);
+}
+
+static void
+run_next_xwayland_batch (XwaylandScripts *scripts)
+{
+        while (scripts->running->len == 0 && !g_queue_is_empty (&scripts->batches)) {
+                g_autoptr(GPtrArray) batch = g_queue_pop_head (&scripts->batches);
+
+                while (batch->len > 0) {
+                        XwaylandScript *script = g_ptr_array_steal_index (batch, 0);
+                        g_autoptr(GError) error = NULL;
+
+                        g_debug ("Spawning Xwayland startup script '%s'", script->path);
+                        script->start_time = g_get_monotonic_time ();
+                        script->subprocess = g_subprocess_new (G_SUBPROCESS_FLAGS_NONE, &error,
+                                                               script->path, NULL);
+                        if (script->subprocess == NULL) {
+                                g_warning ("Error when spawning '%s': %s",
+                                           script->path, error->message);
+                                xwayland_script_free (script);
+                                continue;
+                        }
+
+                        script->timeout_id = g_timeout_add (XWAYLAND_SCRIPT_TIMEOUT_MS,
+                                                            xwayland_script_timeout_cb, script);
+                        g_source_set_name_by_id (script->timeout_id,
+                                                 "[gnome-settings-daemon] xwayland_script_timeout_cb");
+
+                        g_ptr_array_add (scripts->running, script);
+                        g_subprocess_wait_async (script->subprocess, scripts->cancellable,
+                                                 xwayland_script_done, script);
+                }
+        }
+
+        if (scripts->running->len == 0 && g_queue_is_empty (&scripts->batches)) {
+                g_debug ("Xwayland startup scripts finished after %" G_GINT64_FORMAT " ms",
+                         (g_get_monotonic_time () - scripts->start_time) / 1000);
+                g_clear_handle_id (&scripts->budget_timeout_id, g_source_remove);
+        }
+}
+
+static int
+get_script_order (const char *path)
+{
+        g_autofree char *name = g_path_get_basename (path);
+
+        if (!g_ascii_isdigit (name[0]))
+                return G_MAXINT;
+
+        return atoi (name);
+}
+
+/* Orders by the numeric prefix, so that "9-foo" comes before "10-bar",
+ * then by name within a batch */
+static gint
+compare_script_paths (gconstpointer a,
+                      gconstpointer b)
+{
+        int order_a = get_script_order (a);
+        int order_b = get_script_order (b);
+
+        if (order_a != order_b)
+                return order_a < order_b ? -1 : 1;
+
+        return strcmp (a, b);
+}
+
 static void
-launch_xwayland_services_on_dir (const gchar *path)
+queue_xwayland_services_on_dir (XwaylandScripts     *scripts,
+                                GsdXSettingsManager *manager,
+                                const gchar         *path)
 {
         GFileEnumerator *enumerator;
         GError *error = NULL;
-        GList *l, *scripts = NULL;
+        GList *l, *paths = NULL;
+        GPtrArray *batch = NULL;
+        int batch_order = 0;
         GFile *dir;
 
-        g_debug ("launch_xwayland_services_on_dir: %s", path);
+        g_debug ("queue_xwayland_services_on_dir: %s", path);
 
         dir = g_file_new_for_path (path);
         enumerator = g_file_enumerate_children (dir,
@@ -1198,36 +1579,44 @@ launch_xwayland_services_on_dir (const gchar *path)
                     !g_file_info_get_attribute_boolean (info, G_FILE_ATTRIBUTE_ACCESS_CAN_EXECUTE))
                         continue;
 
-                scripts = g_list_prepend (scripts, g_file_get_path (child));
+                paths = g_list_prepend (paths, g_file_get_path (child));
         }
 
-        scripts = g_list_sort (scripts, (GCompareFunc) strcmp);
+        paths = g_list_sort (paths, compare_script_paths);
 
-        for (l = scripts; l; l = l->next) {
-                gchar *args[2] = { l->data, NULL };
+        for (l = paths; l; l = l->next) {
+                XwaylandScript *script;
+                int order = get_script_order (l->data);
 
-                g_debug ("launch_xwayland_services_on_dir: Spawning '%s'", args[0]);
-                if (!g_spawn_sync (NULL, args, NULL,
-                                   G_SPAWN_DEFAULT,
-                                   NULL, NULL,
-                                   NULL, NULL, NULL,
-                                   &error)) {
-                        g_warning ("Error when spawning '%s': %s",
-                                   args[0], error->message);
-                        g_clear_error (&error);
+                if (batch == NULL || order != batch_order) {
+                        batch = g_ptr_array_new_with_free_func ((GDestroyNotify) xwayland_script_free);
+                        batch_order = order;
+                        g_queue_push_tail (&scripts->batches, batch);
                 }
+
+                script = g_new0 (XwaylandScript, 1);
+                script->manager = manager;
+                script->path = g_steal_pointer (&l->data);
+                g_ptr_array_add (batch, script);
         }
 
         g_object_unref (enumerator);
-        g_list_free_full (scripts, g_free);
+        g_list_free (paths);
 }
 
 static void
-launch_xwayland_services (void)
+launch_xwayland_services (GsdXSettingsManager *manager)
 {
         const gchar * const * config_dirs;
+        XwaylandScripts *scripts;
         gint i;
 
+        scripts = g_new0 (XwaylandScripts, 1);
+        scripts->cancellable = g_cancellable_new ();
+        scripts->running = g_ptr_array_new_with_free_func ((GDestroyNotify) xwayland_script_free);
+        scripts->start_time = g_get_monotonic_time ();
+        g_queue_init (&scripts->batches);
+
         config_dirs = g_get_system_config_dirs ();
 
         for (i = 0; config_dirs[i] != NULL; i++) {
@@ -1237,9 +1626,17 @@ launch_xwayland_services (void)
                                                "Xwayland-session.d",
                                                NULL);
 
-                launch_xwayland_services_on_dir (config_dir);
+                queue_xwayland_services_on_dir (scripts, manager, config_dir);
                 g_free (config_dir);
         }
+
+        scripts->budget_timeout_id = g_timeout_add (XWAYLAND_SCRIPTS_BUDGET_MS,
+                                                    xwayland_scripts_budget_cb, scripts);
+        g_source_set_name_by_id (scripts->budget_timeout_id,
+                                 "[gnome-settings-daemon] xwayland_scripts_budget_cb");
+
+        manager->xwayland_scripts = scripts;
+        run_next_xwayland_batch (scripts);
 }
 
 static void
@@ -1309,6 +1706,11 @@ gsd_xsettings_manager_startup (GApplication *app)
         g_debug ("Starting xsettings manager");
         gnome_settings_profile_start (NULL);
 
+        manager->startup_time = g_get_monotonic_time ();
+        manager->startup_phases = g_hash_table_new (g_str_hash, g_str_equal);
+        manager->cancellable = g_cancellable_new ();
+        manager->window_scale = 1;
+
         migrate_settings ();
 
         if (!setup_xsettings_managers (manager)) {
@@ -1316,6 +1718,14 @@ gsd_xsettings_manager_startup (GApplication *app)
                 g_application_release (app);
                 return;
         }
+        log_startup_phase (manager, "X connection");
+
+        /* The window scale query is started by the name watch below, and
+         * the first snapshot waits for it, but not forever */
+        manager->window_scale_timeout_id =
+                g_timeout_add (WINDOW_SCALE_TIMEOUT_MS, window_scale_timeout_cb, manager);
+        g_source_set_name_by_id (manager->window_scale_timeout_id,
+                                 "[gnome-settings-daemon] window_scale_timeout_cb");
 
         manager->interface_settings = g_settings_new (INTERFACE_SETTINGS_SCHEMA);
         g_signal_connect_swapped (manager->interface_settings,
@@ -1339,7 +1749,7 @@ gsd_xsettings_manager_startup (GApplication *app)
                                                 "org.gnome.Mutter.X11",
                                                 G_BUS_NAME_WATCHER_FLAGS_NONE,
                                                 on_mutter_x11_name_appeared_handler,
-                                                NULL,
+                                                on_mutter_x11_name_vanished_handler,
                                                 manager,
                                                 NULL);
 
@@ -1404,6 +1814,7 @@ gsd_xsettings_manager_startup (GApplication *app)
 
         list = g_hash_table_get_values (manager->settings);
         for (l = list; l != NULL; l = l->next) {
+                index_translations (l->data);
                 g_signal_connect_object (G_OBJECT (l->data), "changed", G_CALLBACK (xsettings_callback), manager, 0);
         }
         g_list_free (list);
@@ -1436,10 +1847,11 @@ gsd_xsettings_manager_startup (GApplication *app)
 
         /* Xft settings */
         update_xft_settings (manager);
+        log_startup_phase (manager, "GSettings values");
 
         /* Launch Xwayland services */
         if (is_xwayland (manager))
-                launch_xwayland_services ();
+                launch_xwayland_services (manager);
 
         start_fontconfig_monitor (manager);
 
@@ -1466,6 +1878,14 @@ gsd_xsettings_manager_shutdown (GApplication *app)
                 manager->notify_idle_id = 0;
         }
 
+        if (manager->cancellable != NULL) {
+                g_cancellable_cancel (manager->cancellable);
+                g_clear_object (&manager->cancellable);
+        }
+        g_clear_handle_id (&manager->window_scale_timeout_id, g_source_remove);
+        g_clear_pointer (&manager->startup_phases, g_hash_table_unref);
+        g_clear_pointer (&manager->xwayland_scripts, xwayland_scripts_free);
+
         if (manager->introspect_properties_changed_id) {
                 g_dbus_connection_signal_unsubscribe (connection,
                                                       manager->introspect_properties_changed_id);
@@ -1509,6 +1929,7 @@ gsd_xsettings_manager_shutdown (GApplication *app)
                 fc_monitor_stop (manager->fontconfig_monitor);
                 g_object_unref (manager->fontconfig_monitor);
                 manager->fontconfig_monitor = NULL;
+                g_clear_pointer (&manager->fontconfig_changed_dirs, g_strfreev);
         }
 
         if (manager->settings != NULL) {
@@ -1560,6 +1981,8 @@ handle_get_property (GDBusConnection *connection,
 
         if (g_strcmp0 (property_name, "FontconfigTimestamp") == 0) {
                 return g_variant_new_int64 (manager->fontconfig_timestamp);
+        } else if (g_strcmp0 (property_name, "FontconfigChangedDirectories") == 0) {
+                return get_fontconfig_changed_dirs (manager);
         } else if (g_strcmp0 (property_name, "Modules") == 0) {
                 const char *modules = gsd_xsettings_gtk_get_modules (manager->gtk);
                 return g_variant_new_string (modules ? modules : "");
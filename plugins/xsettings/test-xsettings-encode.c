@@ -0,0 +1,198 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Serialisation benchmark for the _XSETTINGS_SETTINGS property.
+ *
+ * A few hundred settings, roughly what a GNOME session publishes once
+ * overrides are included, are encoded repeatedly the way notify does it,
+ * once with every setting changed in between and once with a single one,
+ * so that the others reuse their cached encoding.
+ */
+
+#include <string.h>
+#include <glib.h>
+
+#include "xsettings-common.h"
+
+#define N_SETTINGS   300
+#define N_ITERATIONS 1000
+
+static GHashTable *
+new_settings (void)
+{
+  return g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify) xsettings_setting_free);
+}
+
+static void
+add_setting (GHashTable  *settings,
+             const gchar *name,
+             GVariant    *value,
+             guint32      serial)
+{
+  XSettingsSetting *setting;
+
+  setting = g_hash_table_lookup (settings, name);
+  if (setting == NULL)
+    {
+      setting = xsettings_setting_new (name);
+      g_hash_table_insert (settings, setting->name, setting);
+    }
+
+  xsettings_setting_set (setting, 0, value, serial);
+}
+
+static GVariant *
+value_for_index (guint i)
+{
+  switch (i % 3)
+    {
+    case 0:
+      return g_variant_new_int32 (i);
+    case 1:
+      return g_variant_new_take_string (g_strdup_printf ("value-%u", i));
+    default:
+      return g_variant_new ("(qqqq)", i, i + 1, i + 2, 0xffff);
+    }
+}
+
+static GHashTable *
+populate (gboolean reverse)
+{
+  GHashTable *settings;
+  guint i;
+
+  settings = new_settings ();
+
+  for (i = 0; i < N_SETTINGS; i++)
+    {
+      g_autofree gchar *name = NULL;
+      guint n = reverse ? N_SETTINGS - 1 - i : i;
+
+      name = g_strdup_printf ("Gnome/Test/Setting%03u", n);
+      add_setting (settings, name, value_for_index (n), 0);
+    }
+
+  return settings;
+}
+
+/* Gives every setting a new value of the same type */
+static void
+change_all (GHashTable *settings,
+            guint32     serial)
+{
+  guint i;
+
+  for (i = 0; i < N_SETTINGS; i++)
+    {
+      g_autofree gchar *name = NULL;
+
+      name = g_strdup_printf ("Gnome/Test/Setting%03u", i);
+      add_setting (settings, name, value_for_index (i + 3 * serial), serial);
+    }
+}
+
+static gboolean
+byte_arrays_equal (GByteArray *a,
+                   GByteArray *b)
+{
+  return a->len == b->len && memcmp (a->data, b->data, a->len) == 0;
+}
+
+static void
+test_stable_order (void)
+{
+  g_autoptr(GHashTable) forward = populate (FALSE);
+  g_autoptr(GHashTable) reverse = populate (TRUE);
+  g_autoptr(GByteArray) a = NULL;
+  g_autoptr(GByteArray) b = NULL;
+
+  a = xsettings_encode_settings (forward);
+  b = xsettings_encode_settings (reverse);
+
+  g_assert_true (byte_arrays_equal (a, b));
+}
+
+static void
+test_change_detection (void)
+{
+  g_autoptr(GHashTable) settings = populate (FALSE);
+  g_autoptr(GHashTable) fresh = populate (FALSE);
+  g_autoptr(GByteArray) before = NULL;
+  g_autoptr(GByteArray) same = NULL;
+  g_autoptr(GByteArray) changed = NULL;
+  g_autoptr(GByteArray) uncached = NULL;
+
+  before = xsettings_encode_settings (settings);
+
+  /* Setting an equal value keeps the encoding */
+  add_setting (settings, "Gnome/Test/Setting000", g_variant_new_int32 (0), 1);
+  same = xsettings_encode_settings (settings);
+  g_assert_true (byte_arrays_equal (before, same));
+
+  add_setting (settings, "Gnome/Test/Setting000", g_variant_new_int32 (42), 1);
+  changed = xsettings_encode_settings (settings);
+  g_assert_false (byte_arrays_equal (before, changed));
+
+  /* The cache must match the encoding of settings never encoded before */
+  add_setting (fresh, "Gnome/Test/Setting000", g_variant_new_int32 (42), 1);
+  uncached = xsettings_encode_settings (fresh);
+  g_assert_true (byte_arrays_equal (changed, uncached));
+}
+
+static void
+test_benchmark (void)
+{
+  g_autoptr(GHashTable) settings = populate (FALSE);
+  gint64 start, full, cached;
+  guint i;
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < N_ITERATIONS; i++)
+    {
+      change_all (settings, i + 1);
+      g_byte_array_unref (xsettings_encode_settings (settings));
+    }
+  full = g_get_monotonic_time () - start;
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < N_ITERATIONS; i++)
+    {
+      g_autofree gchar *name = NULL;
+
+      /* One setting changes between notifications */
+      name = g_strdup_printf ("Gnome/Test/Setting%03u", i % N_SETTINGS);
+      add_setting (settings, name, g_variant_new_int32 (i), i + 1);
+      g_byte_array_unref (xsettings_encode_settings (settings));
+    }
+  cached = g_get_monotonic_time () - start;
+
+  g_test_message ("%u settings, %u notifications: %" G_GINT64_FORMAT " us re-encoding everything, "
+                  "%" G_GINT64_FORMAT " us with cached encodings",
+                  N_SETTINGS, N_ITERATIONS, full, cached);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/xsettings/encode/stable-order", test_stable_order);
+  g_test_add_func ("/xsettings/encode/change-detection", test_change_detection);
+  if (g_test_perf ())
+    g_test_add_func ("/xsettings/encode/benchmark", test_benchmark);
+
+  return g_test_run ();
+}
@@ -84,7 +84,10 @@ xsettings_setting_set (XSettingsSetting *setting,
   setting->value[tier] = value ? g_variant_ref_sink (value) : NULL;
 
   if (!xsettings_variant_equal0 (old_value, xsettings_setting_get (setting)))
-    setting->last_change_serial = serial;
+    {
+      setting->last_change_serial = serial;
+      g_clear_pointer (&setting->encoded, g_bytes_unref);
+    }
 
   if (old_value)
     g_variant_unref (old_value);
@@ -99,10 +102,151 @@ xsettings_setting_free (XSettingsSetting *setting)
     if (setting->value[i])
       g_variant_unref (setting->value[i]);
 
+  g_clear_pointer (&setting->encoded, g_bytes_unref);
   g_free (setting->name);
   g_free (setting);
 }
 
+static gchar
+xsettings_get_typecode (GVariant *value)
+{
+  switch (g_variant_classify (value))
+    {
+    case G_VARIANT_CLASS_INT32:
+      return XSETTINGS_TYPE_INT;
+    case G_VARIANT_CLASS_STRING:
+      return XSETTINGS_TYPE_STRING;
+    case G_VARIANT_CLASS_TUPLE:
+      return XSETTINGS_TYPE_COLOR;
+    default:
+      g_assert_not_reached ();
+    }
+}
+
+static void
+align_string (GString *string,
+              gint     alignment)
+{
+  /* Adds nul-bytes to the string until its length is an even multiple
+   * of the specified alignment requirement.
+   */
+  while ((string->len % alignment) != 0)
+    g_string_append_c (string, '\0');
+}
+
+static void
+setting_store (XSettingsSetting *setting,
+               GString          *buffer)
+{
+  XSettingsType type;
+  GVariant *value;
+  guint16 len16;
+
+  value = xsettings_setting_get (setting);
+
+  type = xsettings_get_typecode (value);
+
+  g_string_append_c (buffer, type);
+  g_string_append_c (buffer, 0);
+
+  len16 = strlen (setting->name);
+  g_string_append_len (buffer, (gchar *) &len16, 2);
+  g_string_append (buffer, setting->name);
+  align_string (buffer, 4);
+
+  g_string_append_len (buffer, (gchar *) &setting->last_change_serial, 4);
+
+  if (type == XSETTINGS_TYPE_STRING)
+    {
+      const gchar *string;
+      gsize stringlen;
+      guint32 len32;
+
+      string = g_variant_get_string (value, &stringlen);
+      len32 = stringlen;
+      g_string_append_len (buffer, (gchar *) &len32, 4);
+      g_string_append (buffer, string);
+      align_string (buffer, 4);
+    }
+  else
+    /* GVariant format is the same as XSETTINGS format for the non-string types */
+    g_string_append_len (buffer, g_variant_get_data (value), g_variant_get_size (value));
+}
+
+/* Returns the wire format of @setting. The encoding only depends on the
+ * name, the current value and the serial of the last change, so it is
+ * kept until xsettings_setting_set() changes the value.
+ */
+GBytes *
+xsettings_setting_get_encoded (XSettingsSetting *setting)
+{
+  if (setting->encoded == NULL)
+    {
+      GString *buffer;
+
+      buffer = g_string_new (NULL);
+      setting_store (setting, buffer);
+      setting->encoded = g_string_free_to_bytes (buffer);
+    }
+
+  return setting->encoded;
+}
+
+static gint
+compare_settings (gconstpointer a,
+                  gconstpointer b)
+{
+  const XSettingsSetting *setting_a = *(const XSettingsSetting **) a;
+  const XSettingsSetting *setting_b = *(const XSettingsSetting **) b;
+
+  return strcmp (setting_a->name, setting_b->name);
+}
+
+/* Encodes the number of settings followed by all settings in @settings,
+ * sorted by name so that the result only changes when a setting does.
+ * This is everything in the _XSETTINGS_SETTINGS property but the header.
+ */
+GByteArray *
+xsettings_encode_settings (GHashTable *settings)
+{
+  GByteArray *result;
+  GPtrArray *sorted;
+  GHashTableIter iter;
+  gpointer value;
+  guint32 n_settings;
+  gsize len;
+  guint i;
+
+  n_settings = g_hash_table_size (settings);
+  sorted = g_ptr_array_sized_new (n_settings);
+  len = 4;
+
+  g_hash_table_iter_init (&iter, settings);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      g_ptr_array_add (sorted, value);
+      len += g_bytes_get_size (xsettings_setting_get_encoded (value));
+    }
+  g_ptr_array_sort (sorted, compare_settings);
+
+  result = g_byte_array_sized_new (len);
+  g_byte_array_append (result, (guint8 *) &n_settings, 4);
+
+  for (i = 0; i < sorted->len; i++)
+    {
+      GBytes *encoded;
+
+      encoded = xsettings_setting_get_encoded (g_ptr_array_index (sorted, i));
+      g_byte_array_append (result,
+                           g_bytes_get_data (encoded, NULL),
+                           g_bytes_get_size (encoded));
+    }
+
+  g_ptr_array_unref (sorted);
+
+  return result;
+}
+
 char
 xsettings_byte_order (void)
 {
@@ -50,6 +50,7 @@ struct _XSettingsSetting
   char *name;
   GVariant *value[XSETTINGS_N_TIERS];
   unsigned long last_change_serial;
+  GBytes *encoded;
 };
 
 XSettingsSetting *xsettings_setting_new   (const gchar      *name);
@@ -59,6 +60,9 @@ void              xsettings_setting_set   (XSettingsSetting *setting,
                                            GVariant         *value,
                                            guint32           serial);
 void              xsettings_setting_free  (XSettingsSetting *setting);
+GBytes *          xsettings_setting_get_encoded (XSettingsSetting *setting);
+
+GByteArray *      xsettings_encode_settings (GHashTable *settings);
 
 char xsettings_byte_order (void);
 
@@ -46,6 +46,8 @@ struct _XSettingsManager
 
   GHashTable *settings;
   unsigned long serial;
+  /* Settings as last written to _XSETTINGS_SETTINGS, without the header */
+  GByteArray *published;
 
   GVariant *overrides;
 };
@@ -149,6 +151,7 @@ xsettings_manager_new (Display                *display,
 
   manager->settings = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify) xsettings_setting_free);
   manager->serial = 0;
+  manager->published = NULL;
   manager->overrides = NULL;
 
   manager->window = XCreateSimpleWindow (display,
@@ -197,6 +200,7 @@ xsettings_manager_destroy (XSettingsManager *manager)
   XDestroyWindow (manager->display, manager->window);
 
   g_hash_table_unref (manager->settings);
+  g_clear_pointer (&manager->published, g_byte_array_unref);
 
   g_free (manager);
 }
@@ -259,94 +263,32 @@ xsettings_manager_delete_setting (XSettingsManager *manager,
   xsettings_manager_set_setting (manager, name, 0, NULL);
 }
 
-static gchar
-xsettings_get_typecode (GVariant *value)
-{
-  switch (g_variant_classify (value))
-    {
-    case G_VARIANT_CLASS_INT32:
-      return XSETTINGS_TYPE_INT;
-    case G_VARIANT_CLASS_STRING:
-      return XSETTINGS_TYPE_STRING;
-    case G_VARIANT_CLASS_TUPLE:
-      return XSETTINGS_TYPE_COLOR;
-    default:
-      g_assert_not_reached ();
-    }
-}
-
-static void
-align_string (GString *string,
-              gint     alignment)
-{
-  /* Adds nul-bytes to the string until its length is an even multiple
-   * of the specified alignment requirement.
-   */
-  while ((string->len % alignment) != 0)
-    g_string_append_c (string, '\0');
-}
-
-static void
-setting_store (XSettingsSetting *setting,
-               GString          *buffer)
-{
-  XSettingsType type;
-  GVariant *value;
-  guint16 len16;
-
-  value = xsettings_setting_get (setting);
-
-  type = xsettings_get_typecode (value);
-
-  g_string_append_c (buffer, type);
-  g_string_append_c (buffer, 0);
-
-  len16 = strlen (setting->name);
-  g_string_append_len (buffer, (gchar *) &len16, 2);
-  g_string_append (buffer, setting->name);
-  align_string (buffer, 4);
-
-  g_string_append_len (buffer, (gchar *) &setting->last_change_serial, 4);
-
-  if (type == XSETTINGS_TYPE_STRING)
-    {
-      const gchar *string;
-      gsize stringlen;
-      guint32 len32;
-
-      string = g_variant_get_string (value, &stringlen);
-      len32 = stringlen;
-      g_string_append_len (buffer, (gchar *) &len32, 4);
-      g_string_append (buffer, string);
-      align_string (buffer, 4);
-    }
-  else
-    /* GVariant format is the same as XSETTINGS format for the non-string types */
-    g_string_append_len (buffer, g_variant_get_data (value), g_variant_get_size (value));
-}
-
 void
 xsettings_manager_notify (XSettingsManager *manager)
 {
   GString *buffer;
-  GHashTableIter iter;
-  int n_settings;
-  gpointer value;
+  GByteArray *settings;
 
-  n_settings = g_hash_table_size (manager->settings);
+  settings = xsettings_encode_settings (manager->settings);
 
-  buffer = g_string_new (NULL);
+  /* Nothing changed since the property was last published; don't make
+   * every client re-read and re-parse it. */
+  if (manager->published != NULL &&
+      manager->published->len == settings->len &&
+      memcmp (manager->published->data, settings->data, settings->len) == 0)
+    {
+      g_byte_array_unref (settings);
+      return;
+    }
+
+  buffer = g_string_sized_new (8 + settings->len);
   g_string_append_c (buffer, xsettings_byte_order ());
   g_string_append_c (buffer, '\0');
   g_string_append_c (buffer, '\0');
   g_string_append_c (buffer, '\0');
 
   g_string_append_len (buffer, (gchar *) &manager->serial, 4);
-  g_string_append_len (buffer, (gchar *) &n_settings, 4);
-
-  g_hash_table_iter_init (&iter, manager->settings);
-  while (g_hash_table_iter_next (&iter, NULL, &value))
-    setting_store (value, buffer);
+  g_string_append_len (buffer, (gchar *) settings->data, settings->len);
 
   XChangeProperty (manager->display, manager->window,
                    manager->xsettings_atom, manager->xsettings_atom,
@@ -354,6 +296,8 @@ xsettings_manager_notify (XSettingsManager *manager)
   XFlush (manager->display);
 
   g_string_free (buffer, TRUE);
+  g_clear_pointer (&manager->published, g_byte_array_unref);
+  manager->published = settings;
   manager->serial++;
 }
 